@@ -0,0 +1,8804 @@
+#include "core.h"
+
+/*** filetypes ***/
+char *C_HL_EXTENSIONS[] = {".c", ".h", ".cpp", ".hpp", NULL};
+char *C_HL_keywords[] = {
+	"switch", "if", "while", "for", "break", "continue", "return", "else",
+	"struct", "union", "typedef", "static", "enum", "class", "case", "#define", "#include",
+	"int|",
+	"long|", "double|", "float|", "char|", "unsigned|", "signed|",
+	"void|", NULL};
+
+// store all HL catagories
+struct EditorSyntax HLDB[] = {
+	{"c",
+	 C_HL_EXTENSIONS,
+	 C_HL_keywords,
+	 "//", "/*", "*/", "\"'", HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS | HL_FOLD_BRACES, NULL},
+};
+
+#define HLDB_ENTRIES (int)(sizeof(HLDB) / sizeof(HLDB[0]))
+
+/*** function prototypes ***/
+void editorSearchRowsAppended(int oldNumRows);
+void lexRunsFree(struct LexRuns *runs);
+void editorFreeRow(EditorRow *row);
+void editorFreeSyntax(struct EditorSyntax *syntax);
+void syntaxFreeLexer(struct SyntaxLexer *lexer);
+void editorInsertRow(int at, char *s, size_t len);
+void editorDelRow(int at);
+void editorRowInsertChar(EditorRow *row, int at, int c);
+void editorRowDelChar(EditorRow *row, int at);
+void editorRowAppendString(EditorRow *row, const char *s, size_t len);
+void editorRowTruncate(EditorRow *row, int size);
+void editorInsertText(int at, int x, const char *text, size_t len, int *endY, int *endX);
+void editorDeleteText(int startY, int startX, int endY, int endX);
+void editorIndentRows(int first, int last, int dedent);
+int editorToggleComment(int first, int last);
+void editorChangeCase(int startY, int startX, int endY, int endX, int upper);
+void editorReplaceRows(int at, int count, const char *text, size_t len);
+int editorSortRows(int first, int last, int unique);
+int editorUniqRows(int first, int last);
+int editorFilterRows(int first, int last, const char *pattern, int keep);
+void editorDiffTouch(int first, int last);
+void editorFoldTouch(int first, int last);
+void editorBracketTouch(int first, int last);
+void editorWordsTouch(int first, int last);
+void editorWordsRowsAppended(int oldNumRows);
+int wordChar(unsigned char c);
+void editorJournalFlush();
+void editorJournalClose();
+off_t editorJournalMark();
+void editorJournalRebase(off_t mark);
+int editorJournalRebaseAppend(const struct stat *st, int dropLen, int openLine);
+int journalEncodeVarint(unsigned char *p, uint64_t value);
+void editorSaveFinish();
+char *cachePathFor(const char *filename);
+int editorCacheOpen(struct EditorLoader *ld);
+void editorCacheStore(const uint64_t *offsets);
+void editorWatchStart();
+
+/*** context ***/
+_Thread_local struct EditorContext *editorContext;
+
+void releaseMemory()
+{
+	free(EC.filename);
+	for (int i = 0; i < KILL_RING_SIZE; i++)
+	{
+		free(EC.killRing.entries[i]);
+	}
+	if (EC.row)
+	{
+		for (int i = 0; i < EC.numRows; i++)
+		{
+			editorFreeRow(&EC.row[i]);
+		}
+		free(EC.row);
+	}
+	for (int i = 0; i < EC.syntaxDBSize; i++)
+	{
+		editorFreeSyntax(&EC.syntaxDB[i]);
+	}
+	free(EC.syntaxDB);
+	free(EC.save.orphans);
+	free(EC.disk.cachePath);
+	free(EC.search.rows);
+	free(EC.search.pattern);
+	regexFree(EC.search.regex);
+	free(EC.diff.lineHashes);
+	free(EC.diff.rowHashes);
+	free(EC.diff.hunks);
+	free(EC.folds.folds);
+	free(EC.brackets.blocks);
+	free(EC.brackets.valid);
+	for (int i = 0; i < 2; i++)
+	{
+		free(EC.brackets.lines[i].cols);
+		free(EC.brackets.lines[i].depths);
+		free(EC.brackets.lines[i].kinds);
+		free(EC.brackets.lines[i].chunks);
+	}
+	free(EC.words.arena);
+	free(EC.words.words);
+	free(EC.words.slots);
+	free(EC.words.sorted);
+	for (int i = 0; i < EC.completion.count; i++)
+	{
+		free(EC.completion.candidates[i]);
+	}
+	free(EC.hex.patches);
+	if (EC.hex.map)
+	{
+		munmap((void *)EC.hex.map, EC.hex.mapSize);
+	}
+	if (EC.hex.active)
+	{
+		close(EC.hex.fd);
+	}
+	lexRunsFree(&EC.lexRuns);
+}
+
+void terminate(const char *s)
+{
+	int error = errno;
+	if (editorContext && EC.hooks.fatal)
+	{
+		EC.hooks.fatal();
+	}
+	errno = error;
+	perror(s);
+	if (editorContext)
+	{
+		editorJournalFlush();
+		releaseMemory();
+	}
+	exit(1);
+}
+
+// variadic function
+void editorSetStatusMessage(const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	vsnprintf(EC.statusMsg, sizeof(EC.statusMsg), fmt, ap);
+	va_end(ap);
+	EC.statusMsgTime = time(NULL);
+}
+
+/*** Syntax highlight***/
+int isSeparator(int c)
+{
+	return isspace(c) || strchr(SEPARATORS, c) != NULL;
+}
+
+/*
+ * Each EditorSyntax is compiled into a DFA over bytes. A lexer state is a
+ * lexical mode (code, word, number, string, comment...) plus, for code, the
+ * keyword trie node reached so far and any bytes that may still turn out to
+ * be a comment delimiter. Keywords and multi-byte delimiters are recognised
+ * once complete and recoloured backwards through the backfill fields of the
+ * transition, so highlighting costs one table lookup per byte.
+ */
+enum LexMode
+{
+	LEX_CODE = 0,
+	LEX_WORD,
+	LEX_NUMBER,
+	LEX_STRING,
+	LEX_STRING_ESCAPE,
+	LEX_COMMENT,
+	LEX_MLCOMMENT,
+};
+
+struct LexKey
+{
+	int mode;
+	int aux; // trie node for LEX_CODE, quote char for strings
+	int pendingLen;
+	unsigned char pending[SYNTAX_MAX_DELIMITER + 1]; // +1 keeps the struct free of padding for memcmp
+};
+
+struct LexStep
+{
+	int mode, aux;
+	int hl, back, backHl;
+};
+
+struct LexDelimiter
+{
+	const char *str;
+	int len;
+	int hl;
+	int mode;
+};
+
+struct LexBuilder
+{
+	const struct EditorSyntax *syntax;
+	int (*trie)[256];
+	int *trieFinal;
+	int *trieDepth;
+	int trieSize, trieCap;
+	struct LexKey *keys;
+	int numKeys, capKeys;
+	int *hash;
+	int hashCap;
+	struct LexDelimiter codeDelimiters[2];
+	int numCodeDelimiters;
+	struct LexDelimiter commentEnd;
+	int hasCommentEnd;
+};
+
+int lexTrieNewNode(struct LexBuilder *lb, int depth)
+{
+	if (lb->trieSize == lb->trieCap)
+	{
+		lb->trieCap = lb->trieCap ? lb->trieCap * 2 : 64;
+		lb->trie = realloc(lb->trie, sizeof(*lb->trie) * lb->trieCap);
+		lb->trieFinal = realloc(lb->trieFinal, sizeof(int) * lb->trieCap);
+		lb->trieDepth = realloc(lb->trieDepth, sizeof(int) * lb->trieCap);
+		if (!lb->trie || !lb->trieFinal || !lb->trieDepth)
+		{
+			terminate("[error]@lexTrieNewNode | realloc");
+		}
+	}
+	memset(lb->trie[lb->trieSize], 0, sizeof(*lb->trie));
+	lb->trieFinal[lb->trieSize] = HL_NORMAL;
+	lb->trieDepth[lb->trieSize] = depth;
+	return lb->trieSize++;
+}
+
+void lexTrieAddKeyword(struct LexBuilder *lb, const char *keyword)
+{
+	int len = strlen(keyword);
+	int hl = HL_KEYWORD_MAIN;
+	if (len && keyword[len - 1] == '|')
+	{
+		hl = HL_KEYWORD_SUB;
+		len--;
+	}
+	if (!len || len > SYNTAX_MAX_KEYWORD)
+	{
+		return;
+	}
+
+	int node = 0;
+	for (int i = 0; i < len; i++)
+	{
+		unsigned char c = keyword[i];
+		if (!lb->trie[node][c])
+		{
+			int child = lexTrieNewNode(lb, i + 1);
+			lb->trie[node][c] = child;
+		}
+		node = lb->trie[node][c];
+	}
+	// the first definition of a keyword wins, as with the old linear scan
+	if (lb->trieFinal[node] == HL_NORMAL)
+	{
+		lb->trieFinal[node] = hl;
+	}
+}
+
+// lexing of one byte ignoring comment delimiters
+struct LexStep lexOrdinaryStep(const struct LexBuilder *lb, int mode, int aux, unsigned char c)
+{
+	const struct EditorSyntax *syntax = lb->syntax;
+	struct LexStep step = {LEX_CODE, 0, HL_NORMAL, 0, HL_NORMAL};
+
+	switch (mode)
+	{
+	case LEX_STRING:
+		step.hl = HL_STRING;
+		if (c == '\\')
+		{
+			step.mode = LEX_STRING_ESCAPE;
+			step.aux = aux;
+		}
+		else if (c != aux)
+		{
+			step.mode = LEX_STRING;
+			step.aux = aux;
+		}
+		return step;
+	case LEX_STRING_ESCAPE:
+		step.mode = LEX_STRING;
+		step.aux = aux;
+		step.hl = HL_STRING;
+		return step;
+	case LEX_COMMENT:
+		step.mode = LEX_COMMENT;
+		step.hl = HL_COMMENT;
+		return step;
+	case LEX_MLCOMMENT:
+		step.mode = LEX_MLCOMMENT;
+		step.hl = HL_MLCOMMENT;
+		return step;
+	}
+
+	if ((syntax->flags & HL_HIGHLIGHT_STRINGS) && c && strchr(syntax->stringQuotes, c))
+	{
+		step.mode = LEX_STRING;
+		step.aux = c;
+		step.hl = HL_STRING;
+		return step;
+	}
+
+	if (mode == LEX_NUMBER && (isdigit(c) || c == '.'))
+	{
+		step.mode = LEX_NUMBER;
+		step.hl = HL_NUMBER;
+		return step;
+	}
+
+	if (mode == LEX_CODE && aux != 0 && lb->trie[aux][c])
+	{
+		step.aux = lb->trie[aux][c];
+		return step;
+	}
+
+	if (mode != LEX_CODE || aux != 0)
+	{
+		if (!isSeparator(c))
+		{
+			step.mode = LEX_WORD;
+			return step;
+		}
+		// a keyword is only complete once followed by a separator
+		if (mode == LEX_CODE && lb->trieFinal[aux] != HL_NORMAL)
+		{
+			step.back = lb->trieDepth[aux];
+			step.backHl = lb->trieFinal[aux];
+		}
+	}
+
+	// the previous byte was a separator
+	if ((syntax->flags & HL_HIGHLIGHT_NUMBERS) && isdigit(c))
+	{
+		step.mode = LEX_NUMBER;
+		step.hl = HL_NUMBER;
+	}
+	else if (lb->trie[0][c])
+	{
+		step.aux = lb->trie[0][c];
+	}
+	else if (!isSeparator(c))
+	{
+		step.mode = LEX_WORD;
+	}
+	return step;
+}
+
+// returns the slot holding key, or the empty slot where it belongs
+int lexFindSlot(const struct LexBuilder *lb, const struct LexKey *key)
+{
+	unsigned hash = 2166136261u;
+	hash = (hash ^ (unsigned)key->mode) * 16777619u;
+	hash = (hash ^ (unsigned)key->aux) * 16777619u;
+	hash = (hash ^ (unsigned)key->pendingLen) * 16777619u;
+	for (int i = 0; i < key->pendingLen; i++)
+	{
+		hash = (hash ^ key->pending[i]) * 16777619u;
+	}
+
+	int slot = hash & (lb->hashCap - 1);
+	while (lb->hash[slot] >= 0 && memcmp(&lb->keys[lb->hash[slot]], key, sizeof(*key)))
+	{
+		slot = (slot + 1) & (lb->hashCap - 1);
+	}
+	return slot;
+}
+
+int lexIntern(struct LexBuilder *lb, const struct LexKey *key)
+{
+	int slot = lexFindSlot(lb, key);
+	if (lb->hash[slot] >= 0)
+	{
+		return lb->hash[slot];
+	}
+
+	// keep the open-addressing table at most half full
+	if ((lb->numKeys + 1) * 2 > lb->hashCap)
+	{
+		lb->hashCap *= 2;
+		free(lb->hash);
+		lb->hash = malloc(sizeof(int) * lb->hashCap);
+		if (!lb->hash)
+		{
+			terminate("[error]@lexIntern | malloc");
+		}
+		for (int i = 0; i < lb->hashCap; i++)
+		{
+			lb->hash[i] = -1;
+		}
+		for (int i = 0; i < lb->numKeys; i++)
+		{
+			lb->hash[lexFindSlot(lb, &lb->keys[i])] = i;
+		}
+		slot = lexFindSlot(lb, key);
+	}
+
+	if (lb->numKeys == lb->capKeys)
+	{
+		lb->capKeys = lb->capKeys ? lb->capKeys * 2 : 256;
+		lb->keys = realloc(lb->keys, sizeof(struct LexKey) * lb->capKeys);
+		if (!lb->keys)
+		{
+			terminate("[error]@lexIntern | realloc");
+		}
+	}
+	lb->keys[lb->numKeys] = *key;
+	lb->hash[slot] = lb->numKeys;
+	return lb->numKeys++;
+}
+
+int lexInternStep(struct LexBuilder *lb, int mode, int aux)
+{
+	struct LexKey key;
+	memset(&key, 0, sizeof(key));
+	key.mode = mode;
+	key.aux = aux;
+	return lexIntern(lb, &key);
+}
+
+uint32_t lexTransition(struct LexBuilder *lb, const struct LexKey *key, unsigned char c)
+{
+	unsigned char s[SYNTAX_MAX_DELIMITER + 1];
+	memcpy(s, key->pending, key->pendingLen);
+	s[key->pendingLen] = c;
+	int sLen = key->pendingLen + 1;
+
+	const struct LexDelimiter *delimiters = NULL;
+	int numDelimiters = 0;
+	if (key->mode == LEX_CODE || key->mode == LEX_WORD || key->mode == LEX_NUMBER)
+	{
+		delimiters = lb->codeDelimiters;
+		numDelimiters = lb->numCodeDelimiters;
+	}
+	else if (key->mode == LEX_MLCOMMENT && lb->hasCommentEnd)
+	{
+		delimiters = &lb->commentEnd;
+		numDelimiters = 1;
+	}
+
+	// where ordinary lexing of the pending bytes would have left us
+	struct LexStep virtual = {key->mode, key->aux, HL_NORMAL, 0, HL_NORMAL};
+	for (int i = 0; i < key->pendingLen; i++)
+	{
+		virtual = lexOrdinaryStep(lb, virtual.mode, virtual.aux, key->pending[i]);
+	}
+	struct LexStep step = lexOrdinaryStep(lb, virtual.mode, virtual.aux, c);
+
+	for (int i = 0; i < numDelimiters; i++)
+	{
+		const struct LexDelimiter *d = &delimiters[i];
+		if (d->len == sLen && !memcmp(d->str, s, sLen))
+		{
+			int next = lexInternStep(lb, d->mode, 0);
+			if (key->pendingLen == 0)
+			{
+				// keep the keyword backfill of a one byte delimiter
+				return LEX_PACK(next, d->hl, step.backHl, step.back);
+			}
+			return LEX_PACK(next, d->hl, d->hl, key->pendingLen);
+		}
+	}
+
+	for (int i = 0; i < numDelimiters; i++)
+	{
+		const struct LexDelimiter *d = &delimiters[i];
+		if (d->len > sLen && !memcmp(d->str, s, sLen))
+		{
+			struct LexKey pending = *key;
+			pending.pending[pending.pendingLen++] = c;
+			return LEX_PACK(lexIntern(lb, &pending), step.hl, step.backHl, step.back);
+		}
+	}
+
+	if (key->pendingLen == 0)
+	{
+		return LEX_PACK(lexInternStep(lb, step.mode, step.aux), step.hl, step.backHl, step.back);
+	}
+
+	// the pending bytes were no delimiter: replay them from the first one
+	struct LexStep first = lexOrdinaryStep(lb, key->mode, key->aux, key->pending[0]);
+	struct LexKey rest;
+	memset(&rest, 0, sizeof(rest));
+	rest.mode = first.mode;
+	rest.aux = first.aux;
+	rest.pendingLen = key->pendingLen - 1;
+	memcpy(rest.pending, key->pending + 1, rest.pendingLen);
+	return lexTransition(lb, &rest, c);
+}
+
+void syntaxFreeLexer(struct SyntaxLexer *lexer)
+{
+	if (!lexer)
+	{
+		return;
+	}
+	free(lexer->table);
+	free(lexer->eolBack);
+	free(lexer->eolBackHl);
+	free(lexer->inComment);
+	free(lexer);
+}
+
+// returns NULL when the definition needs more states than a transition can address
+struct SyntaxLexer *syntaxCompileLexer(const struct EditorSyntax *syntax)
+{
+	struct LexBuilder lb;
+	memset(&lb, 0, sizeof(lb));
+	lb.syntax = syntax;
+	lb.hashCap = 1024;
+	lb.hash = malloc(sizeof(int) * lb.hashCap);
+	if (!lb.hash)
+	{
+		terminate("[error]@syntaxCompileLexer | malloc");
+	}
+	for (int i = 0; i < lb.hashCap; i++)
+	{
+		lb.hash[i] = -1;
+	}
+
+	lexTrieNewNode(&lb, 0);
+	for (int i = 0; syntax->keywords && syntax->keywords[i]; i++)
+	{
+		lexTrieAddKeyword(&lb, syntax->keywords[i]);
+	}
+
+	const char *slc = syntax->singleCommentStart;
+	const char *mlcStart = syntax->multiCommentStart;
+	const char *mlcEnd = syntax->multiCommentEnd;
+	if (slc && *slc)
+	{
+		lb.codeDelimiters[lb.numCodeDelimiters++] = (struct LexDelimiter){slc, strlen(slc), HL_COMMENT, LEX_COMMENT};
+	}
+	if (mlcStart && *mlcStart && mlcEnd && *mlcEnd)
+	{
+		lb.codeDelimiters[lb.numCodeDelimiters++] = (struct LexDelimiter){mlcStart, strlen(mlcStart), HL_MLCOMMENT, LEX_MLCOMMENT};
+		lb.commentEnd = (struct LexDelimiter){mlcEnd, strlen(mlcEnd), HL_MLCOMMENT, LEX_CODE};
+		lb.hasCommentEnd = 1;
+	}
+
+	struct SyntaxLexer *lexer = calloc(1, sizeof(struct SyntaxLexer));
+	if (!lexer)
+	{
+		terminate("[error]@syntaxCompileLexer | calloc");
+	}
+	lexer->entryState = lexInternStep(&lb, LEX_CODE, 0);
+	lexer->commentEntryState = lexInternStep(&lb, LEX_MLCOMMENT, 0);
+
+	int cap = 0;
+	for (int s = 0; s < lb.numKeys; s++)
+	{
+		if (s >= LEX_MAX_STATES)
+		{
+			syntaxFreeLexer(lexer);
+			lexer = NULL;
+			break;
+		}
+		if (s == cap)
+		{
+			cap = cap ? cap * 2 : 256;
+			lexer->table = realloc(lexer->table, sizeof(uint32_t) * 256 * cap);
+			lexer->eolBack = realloc(lexer->eolBack, cap);
+			lexer->eolBackHl = realloc(lexer->eolBackHl, cap);
+			lexer->inComment = realloc(lexer->inComment, cap);
+			if (!lexer->table || !lexer->eolBack || !lexer->eolBackHl || !lexer->inComment)
+			{
+				terminate("[error]@syntaxCompileLexer | realloc");
+			}
+		}
+
+		// copy: interning new states may move lb.keys
+		struct LexKey key = lb.keys[s];
+		for (int c = 0; c < 256; c++)
+		{
+			lexer->table[s * 256 + c] = lexTransition(&lb, &key, c);
+		}
+
+		struct LexStep virtual = {key.mode, key.aux, HL_NORMAL, 0, HL_NORMAL};
+		for (int i = 0; i < key.pendingLen; i++)
+		{
+			virtual = lexOrdinaryStep(&lb, virtual.mode, virtual.aux, key.pending[i]);
+		}
+		int isKeyword = (virtual.mode == LEX_CODE && lb.trieFinal[virtual.aux] != HL_NORMAL);
+		lexer->eolBack[s] = isKeyword ? lb.trieDepth[virtual.aux] : 0;
+		lexer->eolBackHl[s] = isKeyword ? lb.trieFinal[virtual.aux] : HL_NORMAL;
+		lexer->inComment[s] = (virtual.mode == LEX_MLCOMMENT);
+	}
+	if (lexer)
+	{
+		lexer->numStates = lb.numKeys;
+	}
+
+	free(lb.trie);
+	free(lb.trieFinal);
+	free(lb.trieDepth);
+	free(lb.keys);
+	free(lb.hash);
+	return lexer;
+}
+
+/*
+ * A row's highlight is a list of spans, one varint per run of columns sharing
+ * a class: (length << 4) | class. Runs follow each other from column 0 and
+ * columns past the last one are HL_NORMAL, so plain text needs no storage.
+ */
+const unsigned char *editorRowSpans(const EditorRow *row)
+{
+	return row->highlightLen > (int)sizeof(row->highlight.local) ? row->highlight.heap : row->highlight.local;
+}
+
+// decodes the span at *p; returns its class and stores its length
+int spanNext(const unsigned char **p, int *length)
+{
+	uint32_t value = 0;
+	int shift = 0;
+	unsigned char byte;
+	do
+	{
+		byte = *(*p)++;
+		value |= (uint32_t)(byte & 0x7f) << shift;
+		shift += 7;
+	} while (byte & 0x80);
+	*length = value >> 4;
+	return value & 0xf;
+}
+
+void editorSetRowSpans(EditorRow *row, const unsigned char *spans, int len)
+{
+	int local = sizeof(row->highlight.local);
+	if (len > local)
+	{
+		unsigned char *heap = realloc(row->highlightLen > local ? row->highlight.heap : NULL, len);
+		if (!heap)
+		{
+			terminate("[error]@editorSetRowSpans | realloc");
+		}
+		memcpy(heap, spans, len);
+		row->highlight.heap = heap;
+	}
+	else
+	{
+		if (row->highlightLen > local)
+		{
+			free(row->highlight.heap);
+		}
+		if (len)
+		{
+			memcpy(row->highlight.local, spans, len);
+		}
+	}
+	row->highlightLen = len;
+}
+
+void lexRunsFree(struct LexRuns *runs)
+{
+	free(runs->starts);
+	free(runs->classes);
+	free(runs->spans);
+}
+
+// recolours the columns from `from` on as a keyword backfill does, dropping the runs it covers;
+// returns the new number of runs
+int lexRunsBackfill(int *starts, unsigned char *classes, int n, int from, int hl)
+{
+	while (n && starts[n - 1] >= from)
+	{
+		n--;
+	}
+	if (!n || classes[n - 1] != hl)
+	{
+		starts[n] = from, classes[n++] = hl;
+	}
+	return n;
+}
+
+// lexes one row from the given entry state into spans; returns whether it ends inside a comment block
+int syntaxLexRow(const struct SyntaxLexer *lexer, EditorRow *row, int inCommentBlock, struct LexRuns *runs)
+{
+	if (!lexer)
+	{
+		editorSetRowSpans(row, NULL, 0);
+		row->brackets.net = BRACKET_STALE;
+		row->isOpenComment = 0;
+		return 0;
+	}
+
+	// a row has at most one run per column
+	if (runs->cap < row->rsize + 1)
+	{
+		runs->cap = MAX(row->rsize + 1, runs->cap * 2);
+		runs->starts = realloc(runs->starts, sizeof(int) * runs->cap);
+		runs->classes = realloc(runs->classes, runs->cap);
+		runs->spans = realloc(runs->spans, 5 * runs->cap);
+		if (!runs->starts || !runs->classes || !runs->spans)
+		{
+			terminate("[error]@syntaxLexRow | realloc");
+		}
+	}
+
+	const uint32_t *table = lexer->table;
+	const unsigned char *render = (const unsigned char *)editorRowRender(row);
+	int *starts = runs->starts;
+	unsigned char *classes = runs->classes;
+	int n = 0;
+	int state = inCommentBlock ? lexer->commentEntryState : lexer->entryState;
+
+	for (int i = 0; i < row->rsize; i++)
+	{
+		uint32_t t = table[(state << 8) | render[i]];
+		if (LEX_BACK(t))
+		{
+			n = lexRunsBackfill(starts, classes, n, i - LEX_BACK(t), LEX_BACK_HL(t));
+		}
+		int hl = LEX_HL(t);
+		if (!n || classes[n - 1] != hl)
+		{
+			starts[n] = i, classes[n++] = hl;
+		}
+		state = LEX_NEXT(t);
+	}
+	if (lexer->eolBack[state])
+	{
+		n = lexRunsBackfill(starts, classes, n, row->rsize - lexer->eolBack[state], lexer->eolBackHl[state]);
+	}
+
+	// trailing plain text is implied
+	int numRuns = (n && classes[n - 1] == HL_NORMAL) ? n - 1 : n;
+	unsigned char *out = runs->spans;
+	for (int k = 0; k < numRuns; k++)
+	{
+		uint32_t value = (uint32_t)(((k + 1 < n) ? starts[k + 1] : row->rsize) - starts[k]) << 4 | classes[k];
+		while (value >= 0x80)
+		{
+			*out++ = (value & 0x7f) | 0x80;
+			value >>= 7;
+		}
+		*out++ = value;
+	}
+	editorSetRowSpans(row, runs->spans, out - runs->spans);
+	row->brackets.net = BRACKET_STALE;
+
+	row->isOpenComment = lexer->inComment[state];
+	return row->isOpenComment;
+}
+
+// re-highlights rows first..last; isOpenComment of a row must hold the state the row after it was lexed with
+void editorUpdateSyntaxRange(int first, int last)
+{
+	const struct SyntaxLexer *lexer = EC.syntax ? EC.syntax->lexer : NULL;
+	int inCommentBlock = (first > 0 && EC.row[first - 1].isOpenComment);
+
+	// if remains in open comment block, update the following lines
+	int at;
+	for (at = first; at < EC.numRows; at++)
+	{
+		int wasOpenComment = EC.row[at].isOpenComment;
+		inCommentBlock = syntaxLexRow(lexer, &EC.row[at], inCommentBlock, &EC.lexRuns);
+		if (at >= last && wasOpenComment == inCommentBlock)
+		{
+			break;
+		}
+	}
+	// the rows past the edit whose brackets turned into comment, or back
+	if (at > last && last + 1 < EC.numRows)
+	{
+		editorBracketTouch(last + 1, MIN(at, EC.numRows - 1));
+	}
+}
+
+void editorUpdateSyntax(EditorRow *row)
+{
+	editorUpdateSyntaxRange(row->index, row->index);
+}
+
+struct HighlightJob
+{
+	struct EditorContext *context;
+	const struct SyntaxLexer *lexer;
+	int numChunks;
+	atomic_int nextChunk;
+};
+
+// lexes whole chunks, speculatively assuming each starts outside a comment block
+void *editorHighlightWorker(void *arg)
+{
+	struct HighlightJob *job = arg;
+	editorContext = job->context;
+	struct LexRuns runs = {0};
+	int chunk;
+	while ((chunk = atomic_fetch_add(&job->nextChunk, 1)) < job->numChunks)
+	{
+		int first = chunk * HL_CHUNK_ROWS;
+		int last = MIN(first + HL_CHUNK_ROWS, EC.numRows);
+		int inCommentBlock = 0;
+		for (int at = first; at < last; at++)
+		{
+			inCommentBlock = syntaxLexRow(job->lexer, &EC.row[at], inCommentBlock, &runs);
+		}
+	}
+	lexRunsFree(&runs);
+	return NULL;
+}
+
+// highlights every row, splitting large buffers into chunks lexed in parallel
+void editorHighlightAll()
+{
+	editorBracketTouch(0, EC.numRows - 1);
+	struct HighlightJob job;
+	job.context = editorContext;
+	job.lexer = EC.syntax ? EC.syntax->lexer : NULL;
+	job.numChunks = (EC.numRows + HL_CHUNK_ROWS - 1) / HL_CHUNK_ROWS;
+	atomic_init(&job.nextChunk, 0);
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int numThreads = MIN(MIN(cpus, job.numChunks), HL_MAX_THREADS);
+	pthread_t threads[HL_MAX_THREADS];
+	int started = 0;
+	for (int i = 1; i < numThreads; i++)
+	{
+		if (pthread_create(&threads[started], NULL, editorHighlightWorker, &job) == 0)
+		{
+			started++;
+		}
+	}
+	editorHighlightWorker(&job);
+	for (int i = 0; i < started; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+
+	// fix-up: re-lex from each chunk start whose real entry state differs from
+	// the assumed one, until the result converges with the speculative pass
+	struct LexRuns runs = {0};
+	for (int chunk = 1; chunk < job.numChunks; chunk++)
+	{
+		int at = chunk * HL_CHUNK_ROWS;
+		int last = MIN(at + HL_CHUNK_ROWS, EC.numRows);
+		int inCommentBlock = EC.row[at - 1].isOpenComment;
+		int assumed = 0;
+		while (at < last && inCommentBlock != assumed)
+		{
+			assumed = EC.row[at].isOpenComment;
+			inCommentBlock = syntaxLexRow(job.lexer, &EC.row[at], inCommentBlock, &runs);
+			at++;
+		}
+	}
+	lexRunsFree(&runs);
+}
+
+int editorSyntaxMatchesFile(const struct EditorSyntax *syntax, const char *filename)
+{
+	char *ext = strrchr(filename, '.');
+
+	// check matching specific extension
+	for (int i = 0; syntax->filematch[i] != NULL; i++)
+	{
+		int is_ext = (syntax->filematch[i][0] == '.');
+
+		// check extension matches or contains specific name
+		if ((is_ext && ext && strcmp(ext, syntax->filematch[i]) == 0) ||
+			(!is_ext && strstr(filename, syntax->filematch[i]) != NULL))
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+pthread_mutex_t syntaxLock = PTHREAD_MUTEX_INITIALIZER;
+
+void editorSelectSyntax()
+{
+	EC.syntax = NULL;
+	if (EC.filename == NULL)
+	{
+		return;
+	}
+
+	// loaded definitions take precedence over the built-in ones
+	for (int j = 0; j < EC.syntaxDBSize + HLDB_ENTRIES && !EC.syntax; j++)
+	{
+		struct EditorSyntax *syntax = (j < EC.syntaxDBSize) ? &EC.syntaxDB[j] : &HLDB[j - EC.syntaxDBSize];
+		if (editorSyntaxMatchesFile(syntax, EC.filename))
+		{
+			// the built-in definitions are shared by all contexts
+			pthread_mutex_lock(&syntaxLock);
+			if (!syntax->lexer)
+			{
+				syntax->lexer = syntaxCompileLexer(syntax);
+			}
+			pthread_mutex_unlock(&syntaxLock);
+			EC.syntax = syntax;
+		}
+	}
+}
+
+void editorSelectSyntaxHighlight()
+{
+	editorSelectSyntax();
+	// re-apply highlight
+	editorHighlightAll();
+}
+
+/*** Syntax definitions ***/
+void syntaxAppendWord(char ***list, int *count, const char *word)
+{
+	char **newList = realloc(*list, sizeof(char *) * (*count + 2));
+	if (!newList)
+	{
+		terminate("[error]@syntaxAppendWord | realloc");
+	}
+	newList[(*count)++] = strdup(word);
+	newList[*count] = NULL;
+	*list = newList;
+}
+
+void syntaxFreeWords(char **list)
+{
+	for (int i = 0; list && list[i]; i++)
+	{
+		free(list[i]);
+	}
+	free(list);
+}
+
+void editorFreeSyntax(struct EditorSyntax *syntax)
+{
+	free(syntax->fileType);
+	syntaxFreeWords(syntax->filematch);
+	syntaxFreeWords(syntax->keywords);
+	free(syntax->singleCommentStart);
+	free(syntax->multiCommentStart);
+	free(syntax->multiCommentEnd);
+	free(syntax->stringQuotes);
+	syntaxFreeLexer(syntax->lexer);
+}
+
+/*
+ * Language definition files hold one directive per line; lines starting
+ * with '#' are ignored:
+ *
+ *   filetype python
+ *   filematch .py .pyw SConstruct
+ *   keywords def class if else int| str|
+ *   comment #
+ *   multicomment /+ +/
+ *   strings " '
+ *   numbers
+ *   fold braces
+ *
+ * Keywords ending with '|' get the secondary keyword color, as in HLDB.
+ * Blocks are folded by their braces with "fold braces", by indentation
+ * otherwise.
+ */
+int editorLoadSyntaxFile(const char *path, struct EditorSyntax *syntax)
+{
+	FILE *fp = fopen(path, "r");
+	if (!fp)
+	{
+		return -1;
+	}
+
+	memset(syntax, 0, sizeof(*syntax));
+	int numFilematch = 0, numKeywords = 0;
+	int valid = 1;
+	char *line = NULL;
+	size_t size = 0;
+
+	while (getline(&line, &size, fp) != -1)
+	{
+		char *save;
+		char *key = strtok_r(line, " \t\r\n", &save);
+		if (!key || key[0] == '#')
+		{
+			continue;
+		}
+
+		char *value;
+		if (!strcmp(key, "filetype") && (value = strtok_r(NULL, " \t\r\n", &save)))
+		{
+			free(syntax->fileType);
+			syntax->fileType = strdup(value);
+		}
+		else if (!strcmp(key, "filematch"))
+		{
+			while ((value = strtok_r(NULL, " \t\r\n", &save)))
+				syntaxAppendWord(&syntax->filematch, &numFilematch, value);
+		}
+		else if (!strcmp(key, "keywords"))
+		{
+			while ((value = strtok_r(NULL, " \t\r\n", &save)))
+				syntaxAppendWord(&syntax->keywords, &numKeywords, value);
+		}
+		else if (!strcmp(key, "comment") && (value = strtok_r(NULL, " \t\r\n", &save)))
+		{
+			free(syntax->singleCommentStart);
+			syntax->singleCommentStart = strdup(value);
+		}
+		else if (!strcmp(key, "multicomment"))
+		{
+			char *start = strtok_r(NULL, " \t\r\n", &save);
+			char *end = strtok_r(NULL, " \t\r\n", &save);
+			if (!start || !end)
+			{
+				valid = 0;
+				continue;
+			}
+			free(syntax->multiCommentStart);
+			free(syntax->multiCommentEnd);
+			syntax->multiCommentStart = strdup(start);
+			syntax->multiCommentEnd = strdup(end);
+		}
+		else if (!strcmp(key, "strings"))
+		{
+			char quotes[64] = "";
+			while ((value = strtok_r(NULL, " \t\r\n", &save)))
+				strncat(quotes, value, sizeof(quotes) - strlen(quotes) - 1);
+			free(syntax->stringQuotes);
+			syntax->stringQuotes = strdup(quotes);
+			syntax->flags |= HL_HIGHLIGHT_STRINGS;
+		}
+		else if (!strcmp(key, "numbers"))
+		{
+			syntax->flags |= HL_HIGHLIGHT_NUMBERS;
+		}
+		else if (!strcmp(key, "fold") && (value = strtok_r(NULL, " \t\r\n", &save)) &&
+				 (!strcmp(value, "braces") || !strcmp(value, "indent")))
+		{
+			syntax->flags = !strcmp(value, "braces") ? syntax->flags | HL_FOLD_BRACES : syntax->flags & ~HL_FOLD_BRACES;
+		}
+		else
+		{
+			valid = 0;
+		}
+	}
+	free(line);
+	fclose(fp);
+
+	const char *delimiters[] = {syntax->singleCommentStart, syntax->multiCommentStart, syntax->multiCommentEnd};
+	for (int i = 0; i < 3; i++)
+	{
+		if (delimiters[i] && strlen(delimiters[i]) > SYNTAX_MAX_DELIMITER)
+		{
+			valid = 0;
+		}
+	}
+	if (!syntax->stringQuotes)
+	{
+		syntax->stringQuotes = strdup("");
+	}
+
+	if (!valid || !syntax->fileType || !syntax->filematch)
+	{
+		editorFreeSyntax(syntax);
+		return -1;
+	}
+	return 0;
+}
+
+int syntaxFileFilter(const struct dirent *entry)
+{
+	size_t len = strlen(entry->d_name);
+	size_t extLen = strlen(SYNTAX_FILE_EXTENSION);
+	return len > extLen && !strcmp(entry->d_name + len - extLen, SYNTAX_FILE_EXTENSION);
+}
+
+void editorLoadSyntaxDir(const char *dir)
+{
+	struct dirent **entries;
+	int count = scandir(dir, &entries, syntaxFileFilter, alphasort);
+	if (count < 0)
+	{
+		return;
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		char path[PATH_MAX];
+		snprintf(path, sizeof(path), "%s/%s", dir, entries[i]->d_name);
+		free(entries[i]);
+
+		struct EditorSyntax syntax;
+		if (editorLoadSyntaxFile(path, &syntax) == -1)
+		{
+			continue;
+		}
+
+		struct EditorSyntax *db = realloc(EC.syntaxDB, sizeof(struct EditorSyntax) * (EC.syntaxDBSize + 1));
+		if (!db)
+		{
+			terminate("[error]@editorLoadSyntaxDir | realloc");
+		}
+		EC.syntaxDB = db;
+		EC.syntaxDB[EC.syntaxDBSize++] = syntax;
+	}
+	free(entries);
+}
+
+// user definitions come first so they can override the system wide ones
+void editorLoadSyntaxDefinitions()
+{
+	char dir[PATH_MAX];
+	const char *config = getenv("XDG_CONFIG_HOME");
+	const char *home = getenv("HOME");
+	if (config && *config)
+	{
+		snprintf(dir, sizeof(dir), "%s/mte/syntax", config);
+		editorLoadSyntaxDir(dir);
+	}
+	else if (home && *home)
+	{
+		snprintf(dir, sizeof(dir), "%s/.config/mte/syntax", home);
+		editorLoadSyntaxDir(dir);
+	}
+
+	const char *system = getenv("MTE_SYNTAX_DIR");
+	editorLoadSyntaxDir(system && *system ? system : MTE_SYNTAX_DIR);
+}
+
+/*** journal ***/
+/*
+ * Every edit is appended to a binary journal next to the file
+ * (".name.mte-journal"). Records are varint encoded and buffered in memory,
+ * then written as CRC-protected frames and made durable with one fdatasync
+ * per batch. The header stores the identity of the file the edits apply to;
+ * on open a matching journal is replayed over the file, stopping at the
+ * first torn or corrupted frame.
+ */
+enum JournalOp
+{
+	J_INSERT_ROW = 1,
+	J_DEL_ROW,
+	J_INSERT_CHAR,
+	J_DEL_CHAR,
+	J_APPEND,
+	J_TRUNCATE,
+	J_INSERT_TEXT,
+	J_DELETE_TEXT,
+	J_INDENT,
+	J_COMMENT,
+	J_CHANGE_CASE,
+	J_REPLACE_ROWS,
+	J_SORT,
+	J_UNIQ,
+	J_FILTER,
+	J_DROP_TAIL,
+	J_NUM_OPS,
+};
+
+#define JOURNAL_MAX_ARGS 5
+
+// integer arguments of each record, and whether a byte string follows them
+const struct
+{
+	int numArgs;
+	int hasText;
+} JOURNAL_OPS[J_NUM_OPS] = {
+	[J_INSERT_ROW] = {1, 1},
+	[J_DEL_ROW] = {1, 0},
+	[J_INSERT_CHAR] = {3, 0},
+	[J_DEL_CHAR] = {2, 0},
+	[J_APPEND] = {1, 1},
+	[J_TRUNCATE] = {2, 0},
+	[J_INSERT_TEXT] = {2, 1},
+	[J_DELETE_TEXT] = {4, 0},
+	[J_INDENT] = {3, 0},
+	[J_COMMENT] = {2, 0},
+	[J_CHANGE_CASE] = {5, 0},
+	[J_REPLACE_ROWS] = {2, 1},
+	[J_SORT] = {3, 0},
+	[J_UNIQ] = {2, 0},
+	[J_FILTER] = {3, 1},
+	[J_DROP_TAIL] = {2, 0},
+};
+
+uint32_t journalCrcTable[256];
+
+void journalCrcInit()
+{
+	for (uint32_t i = 0; i < 256; i++)
+	{
+		uint32_t c = i;
+		for (int k = 0; k < 8; k++)
+		{
+			c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+		}
+		journalCrcTable[i] = c;
+	}
+}
+
+uint32_t journalCrc32(const unsigned char *data, size_t len)
+{
+	// contexts on other threads may ask for the first time at once
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+	pthread_once(&once, journalCrcInit);
+
+	uint32_t crc = 0xffffffffu;
+	for (size_t i = 0; i < len; i++)
+	{
+		crc = journalCrcTable[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	}
+	return crc ^ 0xffffffffu;
+}
+
+long long journalNowMs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+// journal path is ".<name>.mte-journal" in the directory of the file
+char *journalPathFor(const char *filename)
+{
+	const char *slash = strrchr(filename, '/');
+	int dirLen = slash ? slash - filename + 1 : 0;
+	size_t len = strlen(filename) + strlen(JOURNAL_SUFFIX) + 2;
+	char *path = malloc(len);
+	if (!path)
+	{
+		terminate("[error]@journalPathFor | malloc");
+	}
+	snprintf(path, len, "%.*s.%s%s", dirLen, filename, filename + dirLen, JOURNAL_SUFFIX);
+	return path;
+}
+
+void journalFillHeader(struct JournalHeader *header, const struct stat *st)
+{
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, JOURNAL_MAGIC, sizeof(header->magic));
+	header->size = st->st_size;
+	header->mtimeSec = st->st_mtim.tv_sec;
+	header->mtimeNsec = st->st_mtim.tv_nsec;
+	header->inode = st->st_ino;
+}
+
+// remembers which on-disk version of the file the following edits apply to
+void editorJournalAttach()
+{
+	struct EditorJournal *jr = &EC.journal;
+	struct stat st;
+	if (!jr->disabled && EC.filename && stat(EC.filename, &st) == 0)
+	{
+		free(jr->path);
+		jr->path = journalPathFor(EC.filename);
+		journalFillHeader(&jr->base, &st);
+		jr->hasBase = 1;
+	}
+}
+
+// drops the journal once its edits are on disk and starts over from the saved file
+void editorJournalReset()
+{
+	editorJournalClose();
+	editorJournalAttach();
+}
+
+// where records made from now on start in the journal file, -1 without a journal
+off_t editorJournalMark()
+{
+	struct EditorJournal *jr = &EC.journal;
+	editorJournalFlush();
+	if (!jr->hasBase)
+	{
+		return -1;
+	}
+	return jr->fd != -1 ? lseek(jr->fd, 0, SEEK_END) : (off_t)sizeof(struct JournalHeader);
+}
+
+// restarts the journal on the file just saved, carrying over the records written after mark
+void editorJournalRebase(off_t mark)
+{
+	struct EditorJournal *jr = &EC.journal;
+	editorJournalFlush();
+	off_t end = (jr->fd != -1 && mark >= 0) ? lseek(jr->fd, 0, SEEK_END) : -1;
+	if (end <= mark)
+	{
+		editorJournalReset();
+		return;
+	}
+
+	// the new journal replaces the old one with a rename, so a crash leaves one of them
+	char tmp[PATH_MAX];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", jr->path);
+	struct JournalHeader base;
+	struct stat st;
+	unsigned char *tail = malloc(end - mark);
+	int in = open(jr->path, O_RDONLY);
+	int out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	int ok = tail && in != -1 && out != -1 && stat(EC.filename, &st) == 0 &&
+			 pread(in, tail, end - mark, mark) == end - mark;
+	if (ok)
+	{
+		journalFillHeader(&base, &st);
+		ok = write(out, &base, sizeof(base)) == sizeof(base) &&
+			 write(out, tail, end - mark) == end - mark &&
+			 fdatasync(out) == 0 && rename(tmp, jr->path) == 0;
+	}
+	free(tail);
+	if (in != -1)
+	{
+		close(in);
+	}
+	if (!ok)
+	{
+		editorSetStatusMessage("Journal write failed: %s", strerror(errno));
+		if (out != -1)
+		{
+			close(out);
+			unlink(tmp);
+		}
+		return;
+	}
+	close(jr->fd);
+	jr->fd = out;
+	jr->base = base;
+}
+
+// the file grew on disk under a modified buffer: restarts the journal on the grown file, led
+// by a record dropping the dropLen appended bytes again so the edits replay over the text
+// they were made on; openLine tells whether the grown file ends in an unterminated line. The
+// rows appended next are journaled like any edit. Returns -1 when the journal is left as is
+int editorJournalRebaseAppend(const struct stat *st, int dropLen, int openLine)
+{
+	struct EditorJournal *jr = &EC.journal;
+	editorJournalFlush();
+	if (!jr->hasBase)
+	{
+		return -1;
+	}
+
+	unsigned char record[1 + 2 * 10];
+	int recordLen = 0;
+	record[recordLen++] = J_DROP_TAIL;
+	recordLen += journalEncodeVarint(&record[recordLen], dropLen);
+	recordLen += journalEncodeVarint(&record[recordLen], openLine);
+	uint32_t frame[2] = {recordLen, journalCrc32(record, recordLen)};
+
+	// the records so far follow the new one; like editorJournalRebase, the rename leaves one journal
+	off_t end = jr->fd != -1 ? lseek(jr->fd, 0, SEEK_END) : (off_t)sizeof(struct JournalHeader);
+	size_t recordsLen = end - sizeof(struct JournalHeader);
+	char tmp[PATH_MAX];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", jr->path);
+	struct JournalHeader base;
+	journalFillHeader(&base, st);
+	unsigned char *records = malloc(recordsLen + 1);
+	int in = recordsLen ? open(jr->path, O_RDONLY) : -1;
+	int out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	int ok = records && out != -1 &&
+			 (!recordsLen || (in != -1 && pread(in, records, recordsLen, sizeof(struct JournalHeader)) == (ssize_t)recordsLen)) &&
+			 write(out, &base, sizeof(base)) == sizeof(base) &&
+			 write(out, frame, sizeof(frame)) == sizeof(frame) &&
+			 write(out, record, recordLen) == recordLen &&
+			 write(out, records, recordsLen) == (ssize_t)recordsLen &&
+			 fdatasync(out) == 0 && rename(tmp, jr->path) == 0;
+	free(records);
+	if (in != -1)
+	{
+		close(in);
+	}
+	if (!ok)
+	{
+		editorSetStatusMessage("Journal write failed: %s", strerror(errno));
+		if (out != -1)
+		{
+			close(out);
+			unlink(tmp);
+		}
+		return -1;
+	}
+	if (jr->fd != -1)
+	{
+		close(jr->fd);
+	}
+	jr->fd = out;
+	jr->base = base;
+	return 0;
+}
+
+// creates the journal file with its header before the first record is buffered,
+// so the signal handler always has a file to flush pending records to
+int journalOpen(struct EditorJournal *jr)
+{
+	int fd = open(jr->path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1 || write(fd, &jr->base, sizeof(jr->base)) != sizeof(jr->base))
+	{
+		editorSetStatusMessage("Journal disabled: %s", strerror(errno));
+		if (fd != -1)
+		{
+			close(fd);
+		}
+		jr->hasBase = 0;
+		jr->pendingLen = 0;
+		return -1;
+	}
+	jr->fd = fd;
+	return 0;
+}
+
+// writes pending records as one frame and syncs it
+void editorJournalFlush()
+{
+	struct EditorJournal *jr = &EC.journal;
+	if (!jr->pendingLen || !jr->hasBase || (jr->fd == -1 && journalOpen(jr) == -1))
+	{
+		return;
+	}
+
+	uint32_t frame[2] = {jr->pendingLen, journalCrc32(jr->pending, jr->pendingLen)};
+	jr->busy = 1;
+	if (write(jr->fd, frame, sizeof(frame)) != sizeof(frame) ||
+		write(jr->fd, jr->pending, jr->pendingLen) != (ssize_t)jr->pendingLen ||
+		fdatasync(jr->fd) == -1)
+	{
+		editorSetStatusMessage("Journal write failed: %s", strerror(errno));
+	}
+	jr->pendingLen = 0;
+	jr->busy = 0;
+}
+
+// group commit: flush once the batch is large or its first record is old enough
+void editorJournalTick()
+{
+	struct EditorJournal *jr = &EC.journal;
+	if (jr->pendingLen && (jr->pendingLen >= JOURNAL_FLUSH_BYTES ||
+						   journalNowMs() - jr->pendingSince >= JOURNAL_FLUSH_MS))
+	{
+		editorJournalFlush();
+	}
+}
+
+// writes value as a varint to p; returns its length
+int journalEncodeVarint(unsigned char *p, uint64_t value)
+{
+	int len = 0;
+	do
+	{
+		unsigned char byte = value & 0x7f;
+		value >>= 7;
+		p[len++] = byte | (value ? 0x80 : 0);
+	} while (value);
+	return len;
+}
+
+void journalPutVarint(struct EditorJournal *jr, uint64_t value)
+{
+	jr->pendingLen += journalEncodeVarint(&jr->pending[jr->pendingLen], value);
+}
+
+// the rows of the buffer a record is about to change, first..last before the edit
+void journalTouchedRows(int op, const int *args, int *first, int *last)
+{
+	*first = *last = args[0];
+	if (op == J_INSERT_ROW)
+	{
+		*last = args[0] - 1;
+	}
+	else if (op == J_INDENT || op == J_COMMENT || op == J_SORT || op == J_UNIQ || op == J_FILTER)
+	{
+		*last = args[1];
+	}
+	else if (op == J_DELETE_TEXT || op == J_CHANGE_CASE)
+	{
+		*last = args[2];
+	}
+	else if (op == J_REPLACE_ROWS)
+	{
+		*last = args[0] + args[1] - 1;
+	}
+}
+
+// appends one record: op, its integer arguments and its byte string if it has one
+void editorJournalRecord(int op, const int *args, const char *s, size_t len)
+{
+	// every edit comes through here, so the diff view, the folds and the bracket and word indexes follow them too
+	int first, last;
+	journalTouchedRows(op, args, &first, &last);
+	editorDiffTouch(first, last);
+	editorFoldTouch(first, last);
+	editorBracketTouch(first, last);
+	editorWordsTouch(first, last);
+	struct EditorJournal *jr = &EC.journal;
+	if (jr->replaying || !jr->hasBase || (jr->fd == -1 && journalOpen(jr) == -1))
+	{
+		return;
+	}
+
+	size_t need = jr->pendingLen + 1 + (JOURNAL_MAX_ARGS + 1) * 10 + len;
+	if (need > jr->pendingCap)
+	{
+		jr->busy = 1;
+		size_t cap = jr->pendingCap ? jr->pendingCap : 4096;
+		while (cap < need)
+		{
+			cap *= 2;
+		}
+		unsigned char *pending = realloc(jr->pending, cap);
+		if (!pending)
+		{
+			terminate("[error]@editorJournalRecord | realloc");
+		}
+		jr->pending = pending;
+		jr->pendingCap = cap;
+		jr->busy = 0;
+	}
+
+	if (!jr->pendingLen)
+	{
+		jr->pendingSince = journalNowMs();
+	}
+	jr->busy = 1;
+	jr->pending[jr->pendingLen++] = op;
+	for (int i = 0; i < JOURNAL_OPS[op].numArgs; i++)
+	{
+		journalPutVarint(jr, args[i]);
+	}
+	if (JOURNAL_OPS[op].hasText)
+	{
+		journalPutVarint(jr, len);
+		memcpy(&jr->pending[jr->pendingLen], s, len);
+		jr->pendingLen += len;
+	}
+	jr->busy = 0;
+	editorJournalTick();
+}
+
+// last-chance flush on SIGHUP/SIGTERM, e.g. when the SSH session dies
+void editorJournalSignalHandler(int sig)
+{
+	// a host thread of the library may not be working on a context
+	struct EditorJournal *jr = editorContext ? &EC.journal : NULL;
+	if (jr && !jr->busy && jr->fd != -1 && jr->pendingLen)
+	{
+		uint32_t frame[2] = {jr->pendingLen, journalCrc32(jr->pending, jr->pendingLen)};
+		(void)!write(jr->fd, frame, sizeof(frame));
+		(void)!write(jr->fd, jr->pending, jr->pendingLen);
+		fdatasync(jr->fd);
+	}
+	_exit(128 + sig);
+}
+
+// removes the journal on a deliberate exit
+void editorJournalClose()
+{
+	struct EditorJournal *jr = &EC.journal;
+	jr->pendingLen = 0;
+	jr->hasBase = 0;
+	if (jr->fd != -1)
+	{
+		close(jr->fd);
+		jr->fd = -1;
+	}
+	if (jr->path)
+	{
+		unlink(jr->path);
+		free(jr->path);
+		jr->path = NULL;
+	}
+	free(jr->pending);
+	jr->pending = NULL;
+	jr->pendingCap = 0;
+}
+
+int journalGetVarint(const unsigned char **p, const unsigned char *end, int *value)
+{
+	uint64_t result = 0;
+	for (int shift = 0; shift < 35; shift += 7)
+	{
+		if (*p >= end)
+		{
+			return -1;
+		}
+		unsigned char byte = *(*p)++;
+		result |= (uint64_t)(byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+		{
+			if (result > INT_MAX)
+			{
+				return -1;
+			}
+			*value = result;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+// undoes an append to the file: drops the last dropLen bytes of the buffer as text, where
+// every row but an unterminated (openLine) last one ends in a line break
+int journalDropTail(int dropLen, int openLine)
+{
+	// bytes to cut from the rows joined with '\n', then the row and column the cut starts at
+	long long left = dropLen - !openLine;
+	int y = EC.numRows - 1;
+	while (y >= 0 && left > EC.row[y].size)
+	{
+		left -= EC.row[y].size + 1;
+		y--;
+	}
+	if (y < 0)
+	{
+		return -1;
+	}
+	int x = EC.row[y].size - left;
+	if (y == 0 && x == 0)
+	{
+		editorReplaceRows(0, EC.numRows, "", 0);
+	}
+	else if (x == 0)
+	{
+		// the text left ends in a line break, which ends the row before the cut
+		editorDeleteText(y - 1, EC.row[y - 1].size, EC.numRows - 1, EC.row[EC.numRows - 1].size);
+	}
+	else
+	{
+		editorDeleteText(y, x, EC.numRows - 1, EC.row[EC.numRows - 1].size);
+	}
+	return 0;
+}
+
+// applies one frame of records; returns -1 on a record that does not fit the buffer
+int editorJournalApply(const unsigned char *p, const unsigned char *end, int *applied)
+{
+	while (p < end)
+	{
+		int op = *p++;
+		int args[JOURNAL_MAX_ARGS] = {0};
+		int len = 0;
+		const char *s = NULL;
+		if (op <= 0 || op >= J_NUM_OPS)
+		{
+			return -1;
+		}
+
+		for (int i = 0; i < JOURNAL_OPS[op].numArgs; i++)
+		{
+			if (journalGetVarint(&p, end, &args[i]) == -1)
+			{
+				return -1;
+			}
+		}
+		if (JOURNAL_OPS[op].hasText)
+		{
+			if (journalGetVarint(&p, end, &len) == -1 || len > end - p)
+			{
+				return -1;
+			}
+			s = (const char *)p;
+			p += len;
+		}
+
+		int at = args[0];
+		// range records carry their last row after the first one
+		int last = (op == J_INDENT || op == J_COMMENT || op == J_SORT || op == J_UNIQ || op == J_FILTER) ? args[1] : (op == J_DELETE_TEXT || op == J_CHANGE_CASE) ? args[2] : at;
+		if (op == J_DROP_TAIL)
+		{
+			if (journalDropTail(at, args[1]) == -1)
+			{
+				return -1;
+			}
+			(*applied)++;
+			continue;
+		}
+		if (op == J_REPLACE_ROWS)
+		{
+			if (at > EC.numRows || args[1] > EC.numRows - at)
+			{
+				return -1;
+			}
+		}
+		else if ((op == J_INSERT_ROW && at > EC.numRows) || (op != J_INSERT_ROW && at >= EC.numRows) ||
+				 (op != J_INSERT_ROW && (last >= EC.numRows || last < at)))
+		{
+			return -1;
+		}
+
+		int endY, endX;
+		switch (op)
+		{
+		case J_INSERT_ROW:
+			editorInsertRow(at, (char *)s, len);
+			break;
+		case J_DEL_ROW:
+			editorDelRow(at);
+			break;
+		case J_INSERT_CHAR:
+			editorRowInsertChar(&EC.row[at], args[1], args[2]);
+			break;
+		case J_DEL_CHAR:
+			editorRowDelChar(&EC.row[at], args[1]);
+			break;
+		case J_APPEND:
+			editorRowAppendString(&EC.row[at], s, len);
+			break;
+		case J_TRUNCATE:
+			editorRowTruncate(&EC.row[at], args[1]);
+			break;
+		case J_INSERT_TEXT:
+			editorInsertText(at, args[1], s, len, &endY, &endX);
+			break;
+		case J_DELETE_TEXT:
+			editorDeleteText(at, args[1], args[2], args[3]);
+			break;
+		case J_INDENT:
+			editorIndentRows(at, last, args[2]);
+			break;
+		case J_COMMENT:
+			editorToggleComment(at, last);
+			break;
+		case J_CHANGE_CASE:
+			editorChangeCase(at, args[1], last, args[3], args[4]);
+			break;
+		case J_REPLACE_ROWS:
+			editorReplaceRows(at, args[1], s, len);
+			break;
+		case J_SORT:
+			if (editorSortRows(at, last, args[2]) == -1)
+			{
+				return -1;
+			}
+			break;
+		case J_UNIQ:
+			editorUniqRows(at, last);
+			break;
+		case J_FILTER:
+		{
+			char *pattern = strndup(s, len);
+			int removed = pattern ? editorFilterRows(at, last, pattern, args[2]) : -1;
+			free(pattern);
+			if (removed == -1)
+			{
+				return -1;
+			}
+		}
+		break;
+		}
+		(*applied)++;
+	}
+	return 0;
+}
+
+// replays a journal left behind by a previous session over the freshly opened file
+void editorJournalRecover()
+{
+	struct EditorJournal *jr = &EC.journal;
+	if (!jr->hasBase)
+	{
+		return;
+	}
+
+	int fd = open(jr->path, O_RDONLY);
+	if (fd == -1)
+	{
+		return;
+	}
+	struct stat st;
+	unsigned char *data = NULL;
+	if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(struct JournalHeader) ||
+		!(data = malloc(st.st_size)) || read(fd, data, st.st_size) != st.st_size)
+	{
+		free(data);
+		close(fd);
+		return;
+	}
+	close(fd);
+
+	if (memcmp(data, &jr->base, sizeof(struct JournalHeader)) != 0)
+	{
+		// the file changed since the journal was written: keep it aside, don't apply it
+		char stale[PATH_MAX];
+		snprintf(stale, sizeof(stale), "%s.stale", jr->path);
+		rename(jr->path, stale);
+		editorSetStatusMessage("Journal does not match the file, moved to %s", stale);
+		free(data);
+		return;
+	}
+
+	int applied = 0;
+	off_t offset = sizeof(struct JournalHeader);
+	jr->replaying = 1;
+	while (st.st_size - offset >= 8)
+	{
+		uint32_t frame[2];
+		memcpy(frame, data + offset, sizeof(frame));
+		if (frame[0] > st.st_size - offset - 8 ||
+			journalCrc32(data + offset + 8, frame[0]) != frame[1] ||
+			editorJournalApply(data + offset + 8, data + offset + 8 + frame[0], &applied) == -1)
+		{
+			break;
+		}
+		offset += 8 + frame[0];
+	}
+	jr->replaying = 0;
+	free(data);
+
+	// continue the same journal, dropping any torn tail
+	jr->fd = open(jr->path, O_WRONLY);
+	if (jr->fd != -1 && (ftruncate(jr->fd, offset) == -1 || lseek(jr->fd, 0, SEEK_END) == -1))
+	{
+		close(jr->fd);
+		jr->fd = -1;
+	}
+
+	if (applied)
+	{
+		EC.dirty = applied;
+		editorSetStatusMessage("Recovered %d unsaved edits from %s", applied, jr->path);
+	}
+}
+
+/*** Row operations ***/
+int editorRowCursorXToRenderX(EditorRow *row, int cursorX)
+{
+	// without tabs every char takes one column, however long the row
+	if (!row->render)
+	{
+		return cursorX;
+	}
+
+	int renderX = 0;
+	int j;
+	for (j = 0; j < cursorX; j++)
+	{
+		if (row->chars[j] == '\t')
+		{
+			renderX += (TAB_STOP - 1) - (renderX % TAB_STOP); // find next tab column
+		}
+		renderX++;
+	}
+
+	return renderX;
+}
+
+int editorRenderXToCursorX(const EditorRow *row, int cursorX)
+{
+	if (!row->render)
+	{
+		return cursorX;
+	}
+
+	int realCursorX = 0;
+
+	for (int i = 0; i < cursorX; i++)
+	{
+		if (row->chars[i] == '\t')
+		{
+			realCursorX += (TAB_STOP - (realCursorX % TAB_STOP));
+		}
+		else
+		{
+			realCursorX++;
+		}
+
+		if (realCursorX > cursorX)
+		{
+			return i;
+		}
+	}
+
+	return realCursorX;
+}
+
+// the char under a render column, or the end of the row past its last char
+int editorRowCursorXAt(const EditorRow *row, int renderX)
+{
+	if (renderX >= row->rsize)
+	{
+		return row->size;
+	}
+	return editorRenderXToCursorX(row, renderX);
+}
+
+// rows without tabs are displayed as stored, so they have no render copy of their own
+const char *editorRowRender(const EditorRow *row)
+{
+	return row->render ? row->render : row->chars;
+}
+
+// updates the rendered representation of a row; every change to its text ends up here,
+// so the row no longer matches the file
+void editorUpdateRender(EditorRow *row)
+{
+	row->origin = -1;
+
+	int tabs = 0;
+	int j;
+	for (j = 0; j < row->size; j++)
+	{
+		if (row->chars[j] == '\t')
+		{
+			tabs++;
+		}
+	}
+
+	free(row->render);
+	row->render = NULL;
+	row->rsize = row->size;
+	if (!tabs)
+	{
+		return;
+	}
+
+	// each tab is 8 chars so +7 per tab
+	row->render = malloc(row->size + tabs * (TAB_STOP - 1) + 1);
+	if (!row->render)
+	{
+		terminate("[error]@editorUpdateRow | malloc update row");
+	}
+	int at = 0;
+	for (j = 0; j < row->size; j++)
+	{
+		if (row->chars[j] == '\t')
+		{
+			row->render[at++] = ' ';
+			while (at % TAB_STOP != 0)
+			{
+				row->render[at++] = ' ';
+			}
+		}
+		else
+		{
+			row->render[at++] = row->chars[j];
+		}
+	}
+	row->render[at] = '\0';
+	row->rsize = at;
+}
+
+void editorUpdateRow(EditorRow *row)
+{
+	editorUpdateRender(row);
+	editorUpdateSyntax(row);
+}
+
+void editorReserveRows(int count)
+{
+	if (count <= EC.rowCapacity)
+	{
+		return;
+	}
+
+	int capacity = EC.rowCapacity ? EC.rowCapacity : 16;
+	while (capacity < count)
+	{
+		capacity *= 2;
+	}
+	EditorRow *rows = realloc(EC.row, sizeof(EditorRow) * capacity);
+	if (!rows)
+	{
+		terminate("[error]@editorReserveRows | realloc");
+	}
+	EC.row = rows;
+	EC.rowCapacity = capacity;
+}
+
+void editorInsertRow(int at, char *s, size_t len)
+{
+	if (at < 0 || at > EC.numRows)
+	{
+		return;
+	}
+
+	editorJournalRecord(J_INSERT_ROW, (int[]){at}, s, len);
+	editorReserveRows(EC.numRows + 1);
+	memmove(&EC.row[at + 1], &EC.row[at], sizeof(EditorRow) * (EC.numRows - at));
+	for (int j = at + 1; j <= EC.numRows; j++)
+	{
+		EC.row[j].index++;
+	}
+
+	EditorRow *newRow = &EC.row[at];
+	newRow->index = at;
+	newRow->chars = malloc(len + 1);
+	if (!newRow->chars)
+	{
+		terminate("[error]@editorInsertRow | malloc");
+	}
+
+	// strcpy stops at null byte, use memcpy instead
+	memcpy(newRow->chars, s, len);
+	newRow->chars[len] = '\0';
+	newRow->size = len;
+	newRow->rsize = 0;
+	newRow->shared = 0;
+	newRow->render = NULL;
+	newRow->highlightLen = 0;
+	newRow->isOpenComment = 0;
+	editorUpdateRow(newRow);
+
+	EC.dirty++;
+	EC.numRows++;
+}
+
+// hands the text of a row shared with a running save over to the save
+void editorRowDisown(EditorRow *row)
+{
+	struct EditorSaveJob *job = &EC.save;
+	if (job->numOrphans == job->orphanCap)
+	{
+		job->orphanCap = job->orphanCap ? job->orphanCap * 2 : 64;
+		job->orphans = realloc(job->orphans, sizeof(char *) * job->orphanCap);
+		if (!job->orphans)
+		{
+			terminate("[error]@editorRowDisown | realloc");
+		}
+	}
+	job->orphans[job->numOrphans++] = row->chars;
+	row->shared = 0;
+}
+
+// gives the row a private copy of its text before it is changed in place
+void editorRowUnshare(EditorRow *row)
+{
+	if (!row->shared)
+	{
+		return;
+	}
+	char *chars = malloc(row->size + 1);
+	if (!chars)
+	{
+		terminate("[error]@editorRowUnshare | malloc");
+	}
+	memcpy(chars, row->chars, row->size + 1);
+	editorRowDisown(row);
+	row->chars = chars;
+}
+
+void editorFreeRow(EditorRow *row)
+{
+	free(row->render);
+	if (row->shared)
+	{
+		editorRowDisown(row);
+	}
+	else
+	{
+		free(row->chars);
+	}
+	if (row->highlightLen > (int)sizeof(row->highlight.local))
+	{
+		free(row->highlight.heap);
+	}
+}
+
+void editorDelRow(int at)
+{
+	if (at < 0 || at >= EC.numRows)
+	{
+		return;
+	}
+
+	editorJournalRecord(J_DEL_ROW, (int[]){at}, NULL, 0);
+	editorFreeRow(&EC.row[at]);
+	memmove(&EC.row[at], &EC.row[at + 1], sizeof(EditorRow) * (EC.numRows - at - 1));
+	for (int j = at; j < EC.numRows - 1; j++)
+	{
+		EC.row[j].index--;
+	}
+
+	EC.numRows--;
+	EC.dirty++;
+}
+
+void editorRowAppendString(EditorRow *row, const char *s, size_t len)
+{
+	editorJournalRecord(J_APPEND, (int[]){row->index}, s, len);
+	editorRowUnshare(row);
+	row->chars = realloc(row->chars, row->size + len + 1);
+	memcpy(row->chars + row->size, s, len);
+
+	row->size += len;
+	row->chars[row->size] = '\0';
+
+	editorUpdateRow(row);
+	EC.dirty++;
+}
+
+void editorRowInsertChar(EditorRow *row, int at, int c)
+{
+	if (at < 0 || at > row->size)
+	{
+		at = row->size;
+	}
+	editorJournalRecord(J_INSERT_CHAR, (int[]){row->index, at, (unsigned char)c}, NULL, 0);
+	editorRowUnshare(row);
+	// 1 byte for new char, 1 more for null byte
+	char *newPtr = realloc(row->chars, row->size + 2);
+	if (!newPtr)
+	{
+		terminate("[error]@editorRowInsertChar | realloc");
+	}
+	row->chars = newPtr;
+	memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
+	row->size++;
+	row->chars[at] = c;
+	editorUpdateRow(row);
+	EC.dirty++;
+}
+
+void editorInsertNewline()
+{
+	if (EC.cursorX == 0)
+	{
+		editorInsertRow(EC.cursorY, "", 0);
+	}
+	else
+	{
+		EditorRow *currentRow = &EC.row[EC.cursorY];
+		size_t newRowLength = currentRow->size - EC.cursorX;
+		editorInsertRow(EC.cursorY + 1, &currentRow->chars[EC.cursorX], newRowLength);
+
+		editorRowTruncate(&EC.row[EC.cursorY], EC.cursorX);
+	}
+	EC.cursorY++;
+	EC.cursorX = EC.cursorXS = 0;
+}
+
+void editorRowTruncate(EditorRow *row, int size)
+{
+	if (size < 0 || size >= row->size)
+	{
+		return;
+	}
+	editorJournalRecord(J_TRUNCATE, (int[]){row->index, size}, NULL, 0);
+	editorRowUnshare(row);
+	row->size = size;
+	row->chars[size] = '\0';
+	editorUpdateRow(row);
+	EC.dirty++;
+}
+
+void editorRowDelChar(EditorRow *row, int at)
+{
+	if (at < 0 || at >= row->size)
+	{
+		return;
+	}
+	editorJournalRecord(J_DEL_CHAR, (int[]){row->index, at}, NULL, 0);
+	editorRowUnshare(row);
+	memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
+	row->size--;
+	editorUpdateRow(row);
+	EC.dirty++;
+}
+
+// inserts text containing '\n' line breaks at (at, x) with one row array shift
+// and one re-highlight of the affected rows; returns where the text ends
+void editorInsertText(int at, int x, const char *text, size_t len, int *endY, int *endX)
+{
+	if (at < 0 || at > EC.numRows)
+	{
+		return;
+	}
+	if (at == EC.numRows)
+	{
+		editorInsertRow(at, "", 0);
+	}
+	EditorRow *row = &EC.row[at];
+	if (x < 0 || x > row->size)
+	{
+		x = row->size;
+	}
+	editorJournalRecord(J_INSERT_TEXT, (int[]){at, x}, text, len);
+	editorRowUnshare(row);
+
+	int breaks = 0;
+	for (const char *p = text; (p = memchr(p, '\n', text + len - p)); p++)
+	{
+		breaks++;
+	}
+
+	if (!breaks)
+	{
+		char *chars = realloc(row->chars, row->size + len + 1);
+		if (!chars)
+		{
+			terminate("[error]@editorInsertText | realloc");
+		}
+		memmove(&chars[x + len], &chars[x], row->size - x + 1);
+		memcpy(&chars[x], text, len);
+		row->chars = chars;
+		row->size += len;
+		editorUpdateRender(row);
+		editorUpdateSyntaxRange(at, at);
+		EC.dirty++;
+		*endY = at;
+		*endX = x + len;
+		return;
+	}
+
+	// the rest of the row moves behind the last inserted line
+	int tailLen = row->size - x;
+	char *tail = malloc(tailLen + 1);
+	if (!tail)
+	{
+		terminate("[error]@editorInsertText | malloc");
+	}
+	memcpy(tail, &row->chars[x], tailLen);
+	int openComment = row->isOpenComment;
+
+	editorReserveRows(EC.numRows + breaks);
+	memmove(&EC.row[at + 1 + breaks], &EC.row[at + 1], sizeof(EditorRow) * (EC.numRows - at - 1));
+	for (int j = at + 1 + breaks; j < EC.numRows + breaks; j++)
+	{
+		EC.row[j].index += breaks;
+	}
+
+	const char *lineEnd = memchr(text, '\n', len);
+	row = &EC.row[at];
+	row->chars = realloc(row->chars, x + (lineEnd - text) + 1);
+	if (!row->chars)
+	{
+		terminate("[error]@editorInsertText | realloc");
+	}
+	memcpy(&row->chars[x], text, lineEnd - text);
+	row->size = x + (lineEnd - text);
+	row->chars[row->size] = '\0';
+
+	int lastLen = 0;
+	for (int i = 1; i <= breaks; i++)
+	{
+		const char *line = lineEnd + 1;
+		lineEnd = (i < breaks) ? memchr(line, '\n', text + len - line) : text + len;
+		int lineLen = lineEnd - line;
+		int extra = (i == breaks) ? tailLen : 0;
+
+		EditorRow *newRow = &EC.row[at + i];
+		newRow->index = at + i;
+		newRow->chars = malloc(lineLen + extra + 1);
+		if (!newRow->chars)
+		{
+			terminate("[error]@editorInsertText | malloc");
+		}
+		memcpy(newRow->chars, line, lineLen);
+		memcpy(&newRow->chars[lineLen], tail, extra);
+		newRow->size = lineLen + extra;
+		newRow->chars[newRow->size] = '\0';
+		newRow->rsize = 0;
+		newRow->shared = 0;
+		newRow->render = NULL;
+		newRow->highlightLen = 0;
+		newRow->isOpenComment = (i == breaks) ? openComment : 0;
+		lastLen = lineLen;
+	}
+	free(tail);
+	EC.numRows += breaks;
+
+	for (int j = at; j <= at + breaks; j++)
+	{
+		editorUpdateRender(&EC.row[j]);
+	}
+	editorUpdateSyntaxRange(at, at + breaks);
+	EC.dirty++;
+	*endY = at + breaks;
+	*endX = lastLen;
+}
+
+// deletes from (startY, startX) up to (endY, endX) with one row array shift
+void editorDeleteText(int startY, int startX, int endY, int endX)
+{
+	if (startY < 0 || endY >= EC.numRows || startY > endY)
+	{
+		return;
+	}
+	EditorRow *first = &EC.row[startY];
+	EditorRow *last = &EC.row[endY];
+	startX = MAX(0, MIN(startX, first->size));
+	endX = MAX(0, MIN(endX, last->size));
+	if (startY == endY && startX >= endX)
+	{
+		return;
+	}
+	editorJournalRecord(J_DELETE_TEXT, (int[]){startY, startX, endY, endX}, NULL, 0);
+	editorRowUnshare(first);
+
+	if (startY == endY)
+	{
+		memmove(&first->chars[startX], &first->chars[endX], first->size - endX + 1);
+		first->size -= endX - startX;
+	}
+	else
+	{
+		int tailLen = last->size - endX;
+		first->chars = realloc(first->chars, startX + tailLen + 1);
+		if (!first->chars)
+		{
+			terminate("[error]@editorDeleteText | realloc");
+		}
+		memcpy(&first->chars[startX], &last->chars[endX], tailLen);
+		first->size = startX + tailLen;
+		first->chars[first->size] = '\0';
+		// the row after the range was lexed with the last row's exit state
+		first->isOpenComment = last->isOpenComment;
+
+		for (int j = startY + 1; j <= endY; j++)
+		{
+			editorFreeRow(&EC.row[j]);
+		}
+		int removed = endY - startY;
+		memmove(&EC.row[startY + 1], &EC.row[endY + 1], sizeof(EditorRow) * (EC.numRows - endY - 1));
+		EC.numRows -= removed;
+		for (int j = startY + 1; j < EC.numRows; j++)
+		{
+			EC.row[j].index -= removed;
+		}
+	}
+
+	editorUpdateRender(first);
+	editorUpdateSyntaxRange(startY, startY);
+	EC.dirty++;
+}
+
+// returns the text from (startY, startX) up to (endY, endX) joined with '\n'. Needs to be freed after use.
+char *editorCopyText(int startY, int startX, int endY, int endX, size_t *len)
+{
+	size_t total = 0;
+	for (int j = startY; j <= endY; j++)
+	{
+		total += EC.row[j].size + 1;
+	}
+
+	char *text = malloc(total + 1);
+	if (!text)
+	{
+		terminate("[error]@editorCopyText | malloc");
+	}
+	char *p = text;
+	for (int j = startY; j <= endY; j++)
+	{
+		int from = (j == startY) ? MIN(startX, EC.row[j].size) : 0;
+		int to = (j == endY) ? MIN(endX, EC.row[j].size) : EC.row[j].size;
+		if (to > from)
+		{
+			memcpy(p, &EC.row[j].chars[from], to - from);
+			p += to - from;
+		}
+		if (j < endY)
+		{
+			*p++ = '\n';
+		}
+	}
+	*p = '\0';
+	*len = p - text;
+	return text;
+}
+
+// replaces removeLen bytes at `at` with text; leaves render and highlight to the caller
+void editorRowSplice(EditorRow *row, int at, int removeLen, const char *text, int len)
+{
+	editorRowUnshare(row);
+	if (len > removeLen)
+	{
+		row->chars = realloc(row->chars, row->size + len - removeLen + 1);
+		if (!row->chars)
+		{
+			terminate("[error]@editorRowSplice | realloc");
+		}
+	}
+	memmove(&row->chars[at + len], &row->chars[at + removeLen], row->size - at - removeLen + 1);
+	memcpy(&row->chars[at], text, len);
+	row->size += len - removeLen;
+}
+
+// adds a tab in front of each non-empty row in first..last, or removes one level of indentation
+void editorIndentRows(int first, int last, int dedent)
+{
+	first = MAX(first, 0);
+	last = MIN(last, EC.numRows - 1);
+	if (first > last)
+	{
+		return;
+	}
+	editorJournalRecord(J_INDENT, (int[]){first, last, dedent}, NULL, 0);
+
+	for (int j = first; j <= last; j++)
+	{
+		EditorRow *row = &EC.row[j];
+		if (!dedent)
+		{
+			if (row->size == 0)
+			{
+				continue;
+			}
+			editorRowSplice(row, 0, 0, "\t", 1);
+		}
+		else
+		{
+			int n = 0;
+			if (row->size && row->chars[0] == '\t')
+			{
+				n = 1;
+			}
+			else
+			{
+				while (n < TAB_STOP && n < row->size && row->chars[n] == ' ')
+				{
+					n++;
+				}
+			}
+			if (!n)
+			{
+				continue;
+			}
+			editorRowSplice(row, 0, n, "", 0);
+		}
+		editorUpdateRender(row);
+	}
+	editorUpdateSyntaxRange(first, last);
+	EC.dirty++;
+}
+
+// comments out first..last with the filetype's line comment at their common indentation,
+// or uncomments them when every non-blank row already is. Returns -1 without a line comment.
+int editorToggleComment(int first, int last)
+{
+	const char *token = EC.syntax ? EC.syntax->singleCommentStart : NULL;
+	first = MAX(first, 0);
+	last = MIN(last, EC.numRows - 1);
+	if (!token || !*token)
+	{
+		return -1;
+	}
+	if (first > last)
+	{
+		return 0;
+	}
+	int tokenLen = strlen(token);
+
+	int commented = 1;
+	int indent = INT_MAX;
+	for (int j = first; j <= last; j++)
+	{
+		EditorRow *row = &EC.row[j];
+		int n = 0;
+		while (n < row->size && isspace((unsigned char)row->chars[n]))
+		{
+			n++;
+		}
+		if (n == row->size)
+		{
+			continue;
+		}
+		indent = MIN(indent, n);
+		if (row->size - n < tokenLen || strncmp(&row->chars[n], token, tokenLen))
+		{
+			commented = 0;
+		}
+	}
+	if (indent == INT_MAX)
+	{
+		return 0;
+	}
+	editorJournalRecord(J_COMMENT, (int[]){first, last}, NULL, 0);
+
+	char *prefix = malloc(tokenLen + 2);
+	if (!prefix)
+	{
+		terminate("[error]@editorToggleComment | malloc");
+	}
+	memcpy(prefix, token, tokenLen);
+	prefix[tokenLen] = ' ';
+
+	for (int j = first; j <= last; j++)
+	{
+		EditorRow *row = &EC.row[j];
+		int n = 0;
+		while (n < row->size && isspace((unsigned char)row->chars[n]))
+		{
+			n++;
+		}
+		if (n == row->size)
+		{
+			continue;
+		}
+		if (commented)
+		{
+			int removeLen = tokenLen + (n + tokenLen < row->size && row->chars[n + tokenLen] == ' ');
+			editorRowSplice(row, n, removeLen, "", 0);
+		}
+		else
+		{
+			editorRowSplice(row, indent, 0, prefix, tokenLen + 1);
+		}
+		editorUpdateRender(row);
+	}
+	free(prefix);
+	editorUpdateSyntaxRange(first, last);
+	EC.dirty++;
+	return 0;
+}
+
+// converts the text from (startY, startX) up to (endY, endX) to upper or lower case in place
+void editorChangeCase(int startY, int startX, int endY, int endX, int upper)
+{
+	if (startY < 0 || endY >= EC.numRows || startY > endY)
+	{
+		return;
+	}
+	editorJournalRecord(J_CHANGE_CASE, (int[]){startY, startX, endY, endX, upper}, NULL, 0);
+
+	for (int j = startY; j <= endY; j++)
+	{
+		EditorRow *row = &EC.row[j];
+		int from = (j == startY) ? MAX(0, MIN(startX, row->size)) : 0;
+		int to = (j == endY) ? MAX(0, MIN(endX, row->size)) : row->size;
+		editorRowUnshare(row);
+		for (int i = from; i < to; i++)
+		{
+			row->chars[i] = upper ? toupper((unsigned char)row->chars[i]) : tolower((unsigned char)row->chars[i]);
+		}
+		editorUpdateRender(row);
+	}
+	editorUpdateSyntaxRange(startY, endY);
+	EC.dirty++;
+}
+
+// replaces rows at..at+count-1 with the lines of text, each terminated by '\n',
+// shifting the row array once
+void editorReplaceRows(int at, int count, const char *text, size_t len)
+{
+	if (at < 0 || count < 0 || at + count > EC.numRows)
+	{
+		return;
+	}
+	editorJournalRecord(J_REPLACE_ROWS, (int[]){at, count}, text, len);
+
+	int newCount = 0;
+	for (const char *p = text; (p = memchr(p, '\n', text + len - p)); p++)
+	{
+		newCount++;
+	}
+	if (len && text[len - 1] != '\n')
+	{
+		newCount++;
+	}
+	// state the row after the range was lexed with
+	int openComment = count ? EC.row[at + count - 1].isOpenComment : (at > 0 && EC.row[at - 1].isOpenComment);
+
+	for (int j = at; j < at + count; j++)
+	{
+		editorFreeRow(&EC.row[j]);
+	}
+	editorReserveRows(EC.numRows - count + newCount);
+	memmove(&EC.row[at + newCount], &EC.row[at + count], sizeof(EditorRow) * (EC.numRows - at - count));
+	EC.numRows += newCount - count;
+	for (int j = at + newCount; j < EC.numRows; j++)
+	{
+		EC.row[j].index = j;
+	}
+
+	const char *line = text;
+	for (int i = 0; i < newCount; i++)
+	{
+		const char *lineEnd = memchr(line, '\n', text + len - line);
+		if (!lineEnd)
+		{
+			lineEnd = text + len;
+		}
+		EditorRow *row = &EC.row[at + i];
+		row->index = at + i;
+		row->size = lineEnd - line;
+		row->chars = malloc(row->size + 1);
+		if (!row->chars)
+		{
+			terminate("[error]@editorReplaceRows | malloc");
+		}
+		memcpy(row->chars, line, row->size);
+		row->chars[row->size] = '\0';
+		row->rsize = 0;
+		row->shared = 0;
+		row->render = NULL;
+		row->highlightLen = 0;
+		row->isOpenComment = 0;
+		editorUpdateRender(row);
+		line = lineEnd + 1;
+	}
+
+	if (newCount)
+	{
+		EC.row[at + newCount - 1].isOpenComment = openComment;
+		editorUpdateSyntaxRange(at, at + newCount - 1);
+	}
+	else if (at < EC.numRows)
+	{
+		editorUpdateSyntaxRange(at, at);
+	}
+	EC.dirty++;
+}
+
+/*** editor operations ***/
+void editorInsertChar(int c)
+{
+	if (EC.cursorY == EC.numRows)
+	{
+		editorInsertRow(EC.numRows, "", 0);
+	}
+	editorRowInsertChar(&EC.row[EC.cursorY], EC.cursorX, c);
+	EC.cursorXS = ++EC.cursorX;
+}
+
+void editorDelChar()
+{
+	if (EC.cursorY == EC.numRows)
+	{
+		return;
+	}
+
+	EditorRow *currentRow = &EC.row[EC.cursorY];
+
+	if (EC.cursorX > 0)
+	{
+		editorRowDelChar(currentRow, EC.cursorX - 1);
+		EC.cursorX--;
+		EC.cursorXS = editorRowCursorXToRenderX(currentRow, EC.cursorX);
+		return;
+	}
+
+	if (EC.cursorY == 0)
+	{
+		return;
+	}
+
+	EC.cursorX = EC.row[EC.cursorY - 1].size;
+	editorRowAppendString(&EC.row[EC.cursorY - 1], currentRow->chars, currentRow->size);
+	editorDelRow(EC.cursorY);
+	EC.cursorY--;
+	EC.cursorXS = editorRowCursorXToRenderX(&EC.row[EC.cursorY], EC.cursorX);
+}
+
+/*** file IO ***/
+// the content hash of a buffer chains this over its rows, see EditorDisk
+uint64_t hashBytes(uint64_t hash, const char *s, size_t len)
+{
+	uint64_t word;
+	for (; len >= 8; s += 8, len -= 8)
+	{
+		memcpy(&word, s, 8);
+		hash = (hash ^ word) * 0x9e3779b97f4a7c15ull;
+		hash ^= hash >> 29;
+	}
+	// the length of the last word also separates rows
+	word = 0;
+	memcpy(&word, s, len);
+	hash = (hash ^ word ^ ((uint64_t)len << 56)) * 0x9e3779b97f4a7c15ull;
+	return hash ^ (hash >> 29);
+}
+
+// whether the file on disk is still the one loaded or saved last
+int editorDiskUnchanged(const char *filename)
+{
+	struct stat st;
+	struct JournalHeader now;
+	if (!EC.disk.valid || stat(filename, &st) == -1)
+	{
+		return 0;
+	}
+	journalFillHeader(&now, &st);
+	return !memcmp(&now, &EC.disk.identity, sizeof(now));
+}
+
+// reads a stream without a size up to its end, NULL when out of memory. Needs to be freed after use.
+char *loadReadAll(int fd, size_t *len)
+{
+	size_t cap = 65536;
+	char *buf = malloc(cap);
+	ssize_t n;
+	*len = 0;
+	while (buf && (n = read(fd, &buf[*len], cap - *len)) > 0)
+	{
+		*len += n;
+		if (*len == cap)
+		{
+			cap *= 2;
+			char *grown = realloc(buf, cap);
+			if (!grown)
+			{
+				free(buf);
+			}
+			buf = grown;
+		}
+	}
+	return buf;
+}
+
+// cuts up to count more rows out of the file into rows, highlighting them on the way
+int loadRows(struct EditorLoader *ld, EditorRow *rows, int count, struct LexRuns *runs)
+{
+	const struct SyntaxLexer *lexer = EC.syntax ? EC.syntax->lexer : NULL;
+	int n = 0;
+	while (n < count && ld->offset < ld->size)
+	{
+		const char *line = &ld->data[ld->offset];
+		const char *lineEnd = memchr(line, '\n', ld->size - ld->offset);
+		size_t rawLen = lineEnd ? (size_t)(lineEnd - line) + 1 : ld->size - ld->offset;
+		size_t len = rawLen;
+		// strip next line char
+		while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == ENTER_KEY))
+		{
+			len--;
+		}
+		// only rows stored as their text plus '\n' can be copied back verbatim on save
+		int verbatim = (rawLen == len + 1 && line[len] == '\n');
+		int index = ld->numRows + n;
+
+		EditorRow *row = &rows[n++];
+		row->index = index;
+		row->chars = malloc(len + 1);
+		if (!row->chars)
+		{
+			terminate("[error]@loadRows | malloc");
+		}
+		memcpy(row->chars, line, len);
+		row->chars[len] = '\0';
+		row->size = len;
+		row->rsize = 0;
+		row->shared = 0;
+		row->render = NULL;
+		row->highlightLen = 0;
+		row->isOpenComment = 0;
+		editorUpdateRender(row);
+		row->origin = verbatim ? (off_t)ld->offset : -1;
+
+		if (ld->offsets)
+		{
+			if (index + 1 >= ld->offsetsCap)
+			{
+				ld->offsetsCap *= 2;
+				ld->offsets = realloc(ld->offsets, sizeof(uint64_t) * ld->offsetsCap);
+				if (!ld->offsets)
+				{
+					terminate("[error]@loadRows | realloc");
+				}
+			}
+			ld->offsets[index] = ld->offset;
+		}
+		if (ld->cacheStates && (uint64_t)index < ld->cacheRows && ld->cacheOffsets[index] == ld->offset)
+		{
+			// spans are made when the row is first drawn, see editorDrawRow
+			row->isOpenComment = ld->cacheStates[index];
+			row->highlightLen = -1;
+			ld->inComment = row->isOpenComment;
+		}
+		else
+		{
+			ld->cacheStates = NULL;
+			ld->inComment = syntaxLexRow(lexer, row, ld->inComment, runs);
+		}
+
+		ld->exact &= verbatim;
+		ld->offset += rawLen;
+	}
+	ld->numRows += n;
+	return n;
+}
+
+// cuts the rest of the file into chunks of rows and hands them to the UI
+void *editorLoadWorker(void *arg)
+{
+	struct EditorLoader *ld = arg;
+	editorContext = ld->context;
+	struct LexRuns runs = {0};
+	while (ld->offset < ld->size && !atomic_load(&ld->cancel))
+	{
+		struct LoadChunk *chunk = malloc(sizeof(struct LoadChunk) + sizeof(EditorRow) * LOAD_CHUNK_ROWS);
+		if (!chunk)
+		{
+			terminate("[error]@editorLoadWorker | malloc");
+		}
+		chunk->next = NULL;
+		chunk->numRows = loadRows(ld, chunk->rows, LOAD_CHUNK_ROWS, &runs);
+
+		pthread_mutex_lock(&ld->lock);
+		if (ld->lastChunk)
+		{
+			ld->lastChunk->next = chunk;
+		}
+		else
+		{
+			ld->chunks = chunk;
+		}
+		ld->lastChunk = chunk;
+		pthread_mutex_unlock(&ld->lock);
+		atomic_store(&ld->loaded, ld->offset);
+	}
+	lexRunsFree(&runs);
+
+	pthread_mutex_lock(&ld->lock);
+	ld->done = 1;
+	pthread_mutex_unlock(&ld->lock);
+	return NULL;
+}
+
+// moves to where the cache says the last session left off, once that row is loaded
+void editorLoadRestoreCursor()
+{
+	struct EditorLoader *ld = &EC.loader;
+	if (!ld->restoreCursor || ld->cursorY >= EC.numRows)
+	{
+		return;
+	}
+	ld->restoreCursor = 0;
+	// unless the user moved already
+	if (EC.cursorX || EC.cursorY || EC.rowOffset)
+	{
+		return;
+	}
+	EC.cursorY = ld->cursorY;
+	EC.cursorX = EC.cursorXS = MIN(ld->cursorX, EC.row[EC.cursorY].size);
+	EC.rowOffset = MIN(ld->rowOffset, EC.cursorY);
+	EC.columnOffset = ld->columnOffset;
+}
+
+void loadRelease(struct EditorLoader *ld)
+{
+	if (ld->mapped)
+	{
+		munmap(ld->data, ld->size);
+	}
+	else
+	{
+		free(ld->data);
+	}
+	ld->data = NULL;
+	if (ld->cacheMap)
+	{
+		munmap(ld->cacheMap, ld->cacheLen);
+		ld->cacheMap = NULL;
+	}
+	ld->cacheStates = NULL;
+	free(ld->offsets);
+	ld->offsets = NULL;
+	close(ld->fd);
+}
+
+// the whole file is in the buffer: take over its disk state and start journal and watch
+void editorLoadFinish()
+{
+	struct EditorLoader *ld = &EC.loader;
+	if (!pthread_equal(ld->thread, pthread_self()))
+	{
+		pthread_join(ld->thread, NULL);
+	}
+	pthread_mutex_destroy(&ld->lock);
+	ld->active = 0;
+
+	EC.disk.valid = S_ISREG(ld->st.st_mode);
+	journalFillHeader(&EC.disk.identity, &ld->st);
+	EC.disk.size = ld->size;
+	EC.disk.exact = ld->exact;
+	if (ld->offsets)
+	{
+		ld->offsets[EC.numRows] = ld->size;
+		editorCacheStore(ld->offsets);
+	}
+	loadRelease(ld);
+	EC.dirty = 0;
+
+	editorJournalAttach();
+	editorJournalRecover();
+	editorWatchStart();
+	if (EC.watch.follow)
+	{
+		EC.cursorY = MAX(EC.numRows - 1, 0);
+		EC.cursorX = EC.cursorXS = 0;
+	}
+	if (ld->size >= CACHE_MIN_BYTES)
+	{
+		editorSetStatusMessage("Loaded %.20s (%d lines)", EC.filename, EC.numRows);
+	}
+}
+
+// takes the rows the loader published into the buffer; returns 1 when the screen needs a refresh
+int editorLoadTick()
+{
+	struct EditorLoader *ld = &EC.loader;
+	if (!ld->active)
+	{
+		return 0;
+	}
+	pthread_mutex_lock(&ld->lock);
+	struct LoadChunk *chunk = ld->chunks;
+	ld->chunks = ld->lastChunk = NULL;
+	int done = ld->done;
+	pthread_mutex_unlock(&ld->lock);
+
+	int oldNumRows = EC.numRows;
+	while (chunk)
+	{
+		struct LoadChunk *next = chunk->next;
+		editorReserveRows(EC.numRows + chunk->numRows);
+		memcpy(&EC.row[EC.numRows], chunk->rows, sizeof(EditorRow) * chunk->numRows);
+		EC.numRows += chunk->numRows;
+		free(chunk);
+		chunk = next;
+	}
+	if (EC.numRows != oldNumRows)
+	{
+		editorSearchRowsAppended(oldNumRows);
+		editorWordsRowsAppended(oldNumRows);
+		editorLoadRestoreCursor();
+	}
+
+	if (done)
+	{
+		editorLoadFinish();
+		return 1;
+	}
+	long long loaded = atomic_load(&ld->loaded);
+	editorSetStatusMessage("Loading %.20s... %d%% (%d lines)", EC.filename, (int)(loaded * 100 / ld->size), EC.numRows);
+	return 1;
+}
+
+// blocks until the whole file is in the buffer
+void editorLoadWait()
+{
+	struct EditorLoader *ld = &EC.loader;
+	if (!ld->active)
+	{
+		return;
+	}
+	if (!pthread_equal(ld->thread, pthread_self()))
+	{
+		pthread_join(ld->thread, NULL);
+		ld->thread = pthread_self();
+	}
+	editorLoadTick();
+}
+
+// stops a load in progress, e.g. when quitting before the file is in
+void editorLoadCancel()
+{
+	struct EditorLoader *ld = &EC.loader;
+	if (!ld->active)
+	{
+		return;
+	}
+	atomic_store(&ld->cancel, 1);
+	if (!pthread_equal(ld->thread, pthread_self()))
+	{
+		pthread_join(ld->thread, NULL);
+	}
+	ld->active = 0;
+	for (struct LoadChunk *chunk = ld->chunks, *next; chunk; chunk = next)
+	{
+		next = chunk->next;
+		for (int i = 0; i < chunk->numRows; i++)
+		{
+			editorFreeRow(&chunk->rows[i]);
+		}
+		free(chunk);
+	}
+	pthread_mutex_destroy(&ld->lock);
+	loadRelease(ld);
+}
+
+// starts loading a file; returns -1 with errno set when it can't be opened
+int editorOpen(const char *filename)
+{
+	free(EC.filename);
+	EC.filename = strdup(filename);
+	if (!EC.filename)
+	{
+		return -1;
+	}
+
+	int fd = open(filename, O_RDONLY);
+	struct EditorLoader *ld = &EC.loader;
+	if (fd == -1 || fstat(fd, &ld->st) == -1)
+	{
+		int error = errno;
+		if (fd != -1)
+		{
+			close(fd);
+		}
+		errno = error;
+		return -1;
+	}
+	ld->fd = fd;
+	ld->exact = 1;
+	ld->inComment = 0;
+	ld->numRows = 0;
+	ld->offset = 0;
+	ld->data = NULL;
+	ld->size = 0;
+	ld->mapped = 0;
+	if (S_ISREG(ld->st.st_mode) && ld->st.st_size > 0)
+	{
+		ld->data = mmap(NULL, ld->st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		ld->mapped = (ld->data != MAP_FAILED);
+		ld->size = ld->mapped ? (size_t)ld->st.st_size : 0;
+		ld->data = ld->mapped ? ld->data : NULL;
+		if (ld->mapped)
+		{
+			madvise(ld->data, ld->size, MADV_SEQUENTIAL);
+		}
+	}
+	if (!ld->mapped)
+	{
+		// pipes and the like have no size to map
+		ld->data = loadReadAll(fd, &ld->size);
+		if (!ld->data)
+		{
+			close(fd);
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+
+	editorSelectSyntax();
+	if (ld->size >= CACHE_MIN_BYTES)
+	{
+		EC.disk.cachePath = cachePathFor(filename);
+		if (!editorCacheOpen(ld))
+		{
+			// without room for the offsets the file just isn't cached
+			ld->offsetsCap = 4096;
+			ld->offsets = malloc(sizeof(uint64_t) * ld->offsetsCap);
+		}
+	}
+
+	// the first screens are cut right away, the rest of the file by the loader thread
+	struct LexRuns runs = {0};
+	editorReserveRows(LOAD_FIRST_ROWS);
+	EC.numRows = loadRows(ld, EC.row, LOAD_FIRST_ROWS, &runs);
+	lexRunsFree(&runs);
+	editorLoadRestoreCursor();
+
+	ld->active = 1;
+	ld->context = editorContext;
+	ld->chunks = ld->lastChunk = NULL;
+	ld->done = 0;
+	atomic_init(&ld->cancel, 0);
+	atomic_init(&ld->loaded, ld->offset);
+	pthread_mutex_init(&ld->lock, NULL);
+	if (ld->offset == ld->size || pthread_create(&ld->thread, NULL, editorLoadWorker, ld) != 0)
+	{
+		ld->thread = pthread_self();
+		editorLoadWorker(ld);
+		editorLoadTick();
+	}
+	return 0;
+}
+
+int saveWriteAll(int fd, const char *buf, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t n = write(fd, buf, len);
+		if (n == -1)
+		{
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+// appends len bytes from offset from of inFd to outFd; on Linux copy_file_range copies in
+// the kernel and shares the extents instead on filesystems with reflinks
+int saveCopyRange(int inFd, off_t from, int outFd, off_t len, atomic_llong *progress)
+{
+	while (len > 0)
+	{
+#ifdef __linux__
+		ssize_t n = copy_file_range(inFd, &from, outFd, NULL, MIN(len, SAVE_COPY_CHUNK), 0);
+		if (n > 0)
+		{
+			len -= n;
+			atomic_fetch_add(progress, n);
+			continue;
+		}
+		if (n == 0 || (errno != ENOSYS && errno != EXDEV && errno != EINVAL && errno != EOPNOTSUPP))
+		{
+			return -1;
+		}
+#endif
+
+		// no in-kernel copy between these files
+		char buf[65536];
+		while (len > 0)
+		{
+			ssize_t r = pread(inFd, buf, MIN(len, (off_t)sizeof(buf)), from);
+			if (r <= 0 || saveWriteAll(outFd, buf, r) == -1)
+			{
+				return -1;
+			}
+			from += r;
+			len -= r;
+			atomic_fetch_add(progress, r);
+		}
+	}
+	return 0;
+}
+
+// whether the old file already holds the snapshot: rows still at their origin are the bytes
+// there, so only the others are compared with the bytes they would overwrite
+int saveSameAsDisk(const struct EditorSaveJob *job)
+{
+	char buf[65536];
+	off_t offset = 0;
+	for (int i = 0; i < job->numRows; i++)
+	{
+		const struct SaveRow *row = &job->rows[i];
+		for (off_t done = 0; row->origin != offset && done <= row->size;)
+		{
+			ssize_t n = pread(job->in, buf, MIN((off_t)sizeof(buf), row->size + 1 - done), offset + done);
+			if (n <= 0)
+			{
+				return 0;
+			}
+			// the chunk may end with the line break after the text
+			ssize_t text = MIN(n, row->size - done);
+			if (memcmp(buf, &row->chars[done], text) || (text < n && buf[text] != '\n'))
+			{
+				return 0;
+			}
+			done += n;
+		}
+		offset += row->size + 1;
+	}
+	return 1;
+}
+
+// writes the snapshot to the temporary file and renames it over the original
+void *editorSaveWorker(void *arg)
+{
+	struct EditorSaveJob *job = arg;
+	editorContext = job->context;
+	if (job->canSkip && job->in != -1 && saveSameAsDisk(job))
+	{
+		// edits were undone by hand: the file already holds this text
+		job->skipped = 1;
+		atomic_store(&job->done, 1);
+		return NULL;
+	}
+
+	// unmodified runs of rows are cloned from the old file, the rest is written
+	char *buf = malloc(SAVE_BUFFER_SIZE);
+	size_t pending = 0;
+	int fd = open(job->tmpFilename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (!buf || fd == -1)
+	{
+		goto writeerr;
+	}
+
+	for (int j = 0; j < job->numRows;)
+	{
+		struct SaveRow *row = &job->rows[j];
+		if (job->in != -1 && row->origin >= 0)
+		{
+			off_t from = row->origin;
+			off_t end = from + row->size + 1;
+			for (j++; j < job->numRows && job->rows[j].origin == end; j++)
+			{
+				end += job->rows[j].size + 1;
+			}
+			if (saveWriteAll(fd, buf, pending) == -1 ||
+				saveCopyRange(job->in, from, fd, end - from, &job->written) == -1)
+			{
+				goto writeerr;
+			}
+			atomic_fetch_add(&job->written, pending);
+			pending = 0;
+			job->reused += end - from;
+			continue;
+		}
+
+		if (pending + row->size + 1 > SAVE_BUFFER_SIZE)
+		{
+			if (saveWriteAll(fd, buf, pending) == -1)
+			{
+				goto writeerr;
+			}
+			atomic_fetch_add(&job->written, pending);
+			pending = 0;
+		}
+		if (row->size + 1 > SAVE_BUFFER_SIZE)
+		{
+			if (saveWriteAll(fd, row->chars, row->size) == -1 || saveWriteAll(fd, "\n", 1) == -1)
+			{
+				goto writeerr;
+			}
+			atomic_fetch_add(&job->written, row->size + 1);
+		}
+		else
+		{
+			memcpy(&buf[pending], row->chars, row->size);
+			pending += row->size;
+			buf[pending++] = '\n';
+		}
+		j++;
+	}
+	if (saveWriteAll(fd, buf, pending) == -1 || close(fd) == -1)
+	{
+		fd = -1;
+		goto writeerr;
+	}
+	fd = -1;
+	if (rename(job->tmpFilename, job->filename) == -1 || stat(job->filename, &job->st) == -1)
+	{
+		goto writeerr;
+	}
+	free(buf);
+	atomic_store(&job->done, 1);
+	return NULL;
+
+writeerr:
+	job->error = errno;
+	free(buf);
+	if (fd != -1)
+	{
+		close(fd);
+	}
+	unlink(job->tmpFilename);
+	atomic_store(&job->done, 1);
+	return NULL;
+}
+
+/*
+ * Saving snapshots the rows and leaves the writing to a thread, so editing
+ * goes on meanwhile. The snapshot only copies the row pointers: rows are
+ * marked shared, and the first edit of a shared row copies its text first
+ * (editorRowUnshare). Texts the buffer dropped in the meantime are freed
+ * once the writer is done.
+ */
+int editorSave()
+{
+	struct EditorSaveJob *job = &EC.save;
+	if (job->active)
+	{
+		editorSetStatusMessage("Save already in progress");
+		return 1;
+	}
+	if (!EC.filename)
+	{
+		editorSetStatusMessage("No file name to save to");
+		return 1;
+	}
+
+	size_t len = strlen(EC.filename) + sizeof(".tmp");
+	job->filename = strdup(EC.filename);
+	job->tmpFilename = malloc(len);
+	job->rows = malloc(sizeof(struct SaveRow) * MAX(EC.numRows, 1));
+	if (!job->filename || !job->tmpFilename || !job->rows)
+	{
+		// nothing changed yet, so the buffer can go on unsaved
+		free(job->filename);
+		free(job->tmpFilename);
+		free(job->rows);
+		job->filename = job->tmpFilename = NULL;
+		job->rows = NULL;
+		editorSetStatusMessage("Can't save! Out of memory");
+		errno = ENOMEM;
+		return 1;
+	}
+	snprintf(job->tmpFilename, len, "%s.tmp", EC.filename);
+
+	// rows that stay unmodified will sit at these offsets in the new file
+	off_t offset = 0;
+	for (int i = 0; i < EC.numRows; i++)
+	{
+		EditorRow *row = &EC.row[i];
+		job->rows[i] = (struct SaveRow){row->chars, row->size, row->origin};
+		row->shared = 1;
+		row->origin = offset;
+		offset += row->size + 1;
+	}
+	job->numRows = EC.numRows;
+	job->total = offset;
+
+	int unchanged = editorDiskUnchanged(EC.filename);
+	job->in = unchanged ? open(EC.filename, O_RDONLY) : -1;
+	job->canSkip = unchanged && EC.disk.exact && job->total == EC.disk.size;
+	atomic_init(&job->written, 0);
+	atomic_init(&job->done, 0);
+	job->reused = 0;
+	job->skipped = 0;
+	job->error = 0;
+	job->dirtyAt = EC.dirty;
+	job->journalMark = editorJournalMark();
+	job->progressMs = journalNowMs();
+	job->active = 1;
+	job->context = editorContext;
+	// small buffers are written before the next key anyway
+	if (job->total < SAVE_BACKGROUND_BYTES || pthread_create(&job->thread, NULL, editorSaveWorker, job) != 0)
+	{
+		job->thread = pthread_self();
+		editorSaveWorker(job);
+		editorSaveFinish();
+	}
+	return 0;
+}
+
+// joins the writer and settles the buffer state with what was saved
+void editorSaveFinish()
+{
+	struct EditorSaveJob *job = &EC.save;
+	if (!job->active)
+	{
+		return;
+	}
+	if (!pthread_equal(job->thread, pthread_self()))
+	{
+		pthread_join(job->thread, NULL);
+	}
+	job->active = 0;
+	if (job->in != -1)
+	{
+		close(job->in);
+	}
+	for (int i = 0; i < job->numOrphans; i++)
+	{
+		free(job->orphans[i]);
+	}
+	job->numOrphans = 0;
+	free(job->rows);
+	job->rows = NULL;
+	free(job->filename);
+	free(job->tmpFilename);
+	job->filename = job->tmpFilename = NULL;
+	for (int i = 0; i < EC.numRows; i++)
+	{
+		EC.row[i].shared = 0;
+	}
+
+	if (job->error)
+	{
+		// row origins were moved to the new file, which is not there
+		EC.disk.valid = 0;
+		editorSetStatusMessage("Can't save! I/O error: %s", strerror(job->error));
+		return;
+	}
+
+	if (!job->skipped)
+	{
+		journalFillHeader(&EC.disk.identity, &job->st);
+		EC.disk.valid = 1;
+		EC.disk.size = job->total;
+		EC.disk.exact = 1;
+	}
+	// edits made during the save are still unsaved
+	EC.dirty -= job->dirtyAt;
+	editorJournalRebase(job->journalMark);
+	// our own write is not an outside change
+	editorWatchStart();
+	if (job->skipped)
+	{
+		editorSetStatusMessage("No changes to save (%s)", EC.filename);
+	}
+	else
+	{
+		editorSetStatusMessage("%lld bytes written to disk, %lld unchanged (%s)", job->total, job->reused, EC.filename);
+	}
+}
+
+// reports progress while a save runs; returns 1 when the screen needs a refresh
+int editorSaveTick()
+{
+	struct EditorSaveJob *job = &EC.save;
+	if (!job->active)
+	{
+		return 0;
+	}
+	if (atomic_load(&job->done))
+	{
+		editorSaveFinish();
+		return 1;
+	}
+	long long now = journalNowMs();
+	if (now - job->progressMs < SAVE_PROGRESS_MS)
+	{
+		return 0;
+	}
+	job->progressMs = now;
+	long long written = atomic_load(&job->written);
+	editorSetStatusMessage("Saving %.20s... %d%%", EC.filename, job->total ? (int)(written * 100 / job->total) : 0);
+	return 1;
+}
+
+/*** file cache ***/
+/*
+ * Large files get a sidecar cache in $XDG_CACHE_HOME/mte, named after a hash
+ * of their absolute path: the start offset of every line, the comment state
+ * each line ends in and the last cursor position. It is laid out to be used
+ * in place through mmap. On a later open of the unchanged file rows are only
+ * lexed once they are drawn, since the cached states give each row its entry
+ * state. Rows still copy their text out of the mapped file, so a reopen skips
+ * the line split and the lexing but not one copy of the file.
+ */
+struct CacheHeader
+{
+	char magic[8];
+	struct JournalHeader identity; // the file version the cache describes
+	uint64_t numRows;			   // numRows + 1 uint64 offsets and numRows states follow
+	uint64_t syntaxHash;
+	uint64_t bodyHash;	 // of the offsets and states
+	int32_t exact;
+	int32_t cursorX, cursorY, rowOffset, columnOffset;
+	uint32_t crc; // of the header up to here
+};
+
+// "<cache dir>/mte/<hash of the absolute path>", NULL when there is no cache directory
+char *cachePathFor(const char *filename)
+{
+	char real[PATH_MAX], dir[PATH_MAX];
+	const char *base = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	if (!realpath(filename, real))
+	{
+		return NULL;
+	}
+	if (base && *base)
+	{
+		snprintf(dir, sizeof(dir), "%s/mte", base);
+	}
+	else if (home && *home)
+	{
+		snprintf(dir, sizeof(dir), "%s/.cache/mte", home);
+	}
+	else
+	{
+		return NULL;
+	}
+
+	// the cache home itself may not exist yet
+	char *slash = strrchr(dir, '/');
+	*slash = '\0';
+	mkdir(dir, 0700);
+	*slash = '/';
+	if (mkdir(dir, 0700) == -1 && errno != EEXIST)
+	{
+		return NULL;
+	}
+
+	size_t len = strlen(dir) + 18;
+	char *path = malloc(len);
+	if (!path)
+	{
+		terminate("[error]@cachePathFor | malloc");
+	}
+	snprintf(path, len, "%s/%016llx", dir, (unsigned long long)hashBytes(0, real, strlen(real)));
+	return path;
+}
+
+// identifies the lexer the cached states were computed with, 0 for none
+uint64_t cacheSyntaxHash()
+{
+	const struct SyntaxLexer *lexer = EC.syntax ? EC.syntax->lexer : NULL;
+	if (!lexer)
+	{
+		return 0;
+	}
+	int entry[2] = {lexer->entryState, lexer->commentEntryState};
+	uint64_t hash = hashBytes(0, (const char *)lexer->table, sizeof(uint32_t) * 256 * lexer->numStates);
+	hash = hashBytes(hash, (const char *)lexer->inComment, lexer->numStates);
+	return hashBytes(hash, (const char *)entry, sizeof(entry)) | 1;
+}
+
+uint64_t cacheBodyHash(const uint64_t *offsets, const unsigned char *states, uint64_t numRows)
+{
+	return hashBytes(hashBytes(0, (const char *)offsets, sizeof(uint64_t) * (numRows + 1)), (const char *)states, numRows);
+}
+
+void cacheSealHeader(struct CacheHeader *header)
+{
+	header->crc = journalCrc32((const unsigned char *)header, offsetof(struct CacheHeader, crc));
+}
+
+// maps the cache of the file being loaded if it matches; the loader takes the
+// highlight states from it and the cursor goes back to where it was
+int editorCacheOpen(struct EditorLoader *ld)
+{
+	int cacheFd = EC.disk.cachePath ? open(EC.disk.cachePath, O_RDONLY) : -1;
+	struct stat cacheSt;
+	if (cacheFd == -1)
+	{
+		return 0;
+	}
+	if (fstat(cacheFd, &cacheSt) == -1 || cacheSt.st_size < (off_t)sizeof(struct CacheHeader))
+	{
+		close(cacheFd);
+		return 0;
+	}
+	char *map = mmap(NULL, cacheSt.st_size, PROT_READ, MAP_PRIVATE, cacheFd, 0);
+	close(cacheFd);
+	if (map == MAP_FAILED)
+	{
+		return 0;
+	}
+
+	const struct CacheHeader *header = (const struct CacheHeader *)map;
+	const uint64_t *offsets = (const uint64_t *)(header + 1);
+	uint64_t numRows = header->numRows;
+	struct JournalHeader identity;
+	journalFillHeader(&identity, &ld->st);
+	int valid = !memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) &&
+				header->crc == journalCrc32((const unsigned char *)header, offsetof(struct CacheHeader, crc)) &&
+				!memcmp(&header->identity, &identity, sizeof(identity)) && numRows < INT_MAX &&
+				(uint64_t)cacheSt.st_size == sizeof(*header) + sizeof(uint64_t) * (numRows + 1) + numRows;
+	const unsigned char *states = valid ? (const unsigned char *)&offsets[numRows + 1] : NULL;
+	if (!valid || offsets[numRows] != ld->size || header->bodyHash != cacheBodyHash(offsets, states, numRows))
+	{
+		munmap(map, cacheSt.st_size);
+		return 0;
+	}
+
+	ld->cacheMap = map;
+	ld->cacheLen = cacheSt.st_size;
+	ld->cacheRows = numRows;
+	ld->cacheOffsets = offsets;
+	// rows whose offset differs from the cached one are lexed after all, see loadRows
+	ld->cacheStates = (header->syntaxHash == cacheSyntaxHash()) ? states : NULL;
+	ld->restoreCursor = 1;
+	ld->cursorX = MAX(header->cursorX, 0);
+	ld->cursorY = MAX(header->cursorY, 0);
+	ld->rowOffset = MAX(header->rowOffset, 0);
+	ld->columnOffset = MAX(header->columnOffset, 0);
+	return 1;
+}
+
+// writes the cache for the buffer as it is on disk; offsets holds numRows + 1 line starts
+void editorCacheStore(const uint64_t *offsets)
+{
+	if (!EC.disk.cachePath || !EC.disk.valid)
+	{
+		return;
+	}
+	unsigned char *states = malloc(MAX(EC.numRows, 1));
+	if (!states)
+	{
+		terminate("[error]@editorCacheStore | malloc");
+	}
+	for (int i = 0; i < EC.numRows; i++)
+	{
+		states[i] = EC.row[i].isOpenComment;
+	}
+
+	struct CacheHeader header = {0};
+	memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+	header.identity = EC.disk.identity;
+	header.numRows = EC.numRows;
+	header.syntaxHash = cacheSyntaxHash();
+	header.exact = EC.disk.exact;
+	header.bodyHash = cacheBodyHash(offsets, states, EC.numRows);
+	header.cursorX = EC.cursorX;
+	header.cursorY = EC.cursorY;
+	header.rowOffset = EC.rowOffset;
+	header.columnOffset = EC.columnOffset;
+	cacheSealHeader(&header);
+
+	// written aside and renamed, so a reader never sees half a cache
+	char tmp[PATH_MAX];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", EC.disk.cachePath);
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1)
+	{
+		free(states);
+		return;
+	}
+	if (saveWriteAll(fd, (const char *)&header, sizeof(header)) == -1 ||
+		saveWriteAll(fd, (const char *)offsets, sizeof(uint64_t) * (EC.numRows + 1)) == -1 ||
+		saveWriteAll(fd, (const char *)states, EC.numRows) == -1 ||
+		close(fd) == -1 || rename(tmp, EC.disk.cachePath) == -1)
+	{
+		unlink(tmp);
+	}
+	free(states);
+}
+
+// on exit: remembers the cursor, or caches the file as last saved when every row maps onto it
+void editorCacheClose()
+{
+	struct EditorDisk *disk = &EC.disk;
+	if (!disk->cachePath || !disk->valid || !editorDiskUnchanged(EC.filename))
+	{
+		return;
+	}
+
+	struct CacheHeader header;
+	int fd = open(disk->cachePath, O_RDWR);
+	if (fd != -1 && pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+		!memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) &&
+		!memcmp(&header.identity, &disk->identity, sizeof(header.identity)))
+	{
+		header.cursorX = EC.cursorX;
+		header.cursorY = EC.cursorY;
+		header.rowOffset = EC.rowOffset;
+		header.columnOffset = EC.columnOffset;
+		cacheSealHeader(&header);
+		(void)!pwrite(fd, &header, sizeof(header), 0);
+		close(fd);
+		return;
+	}
+	if (fd != -1)
+	{
+		close(fd);
+	}
+
+	if (EC.dirty || disk->size < CACHE_MIN_BYTES)
+	{
+		return;
+	}
+	uint64_t *offsets = malloc(sizeof(uint64_t) * (EC.numRows + 1));
+	if (!offsets)
+	{
+		terminate("[error]@editorCacheClose | malloc");
+	}
+	uint64_t offset = 0;
+	for (int i = 0; i < EC.numRows; i++)
+	{
+		if (EC.row[i].origin != (off_t)offset)
+		{
+			free(offsets);
+			return;
+		}
+		offsets[i] = offset;
+		offset += EC.row[i].size + 1;
+	}
+	offsets[EC.numRows] = offset;
+	editorCacheStore(offsets);
+	free(offsets);
+}
+
+/*** file watch ***/
+/*
+ * The directory of the open file is watched with inotify. When the file grew
+ * and the bytes seen last ended where they did before, only the new tail is
+ * read and appended as rows. Any other change reloads the file and replaces
+ * just the rows between the unchanged head and tail, so the cursor stays on
+ * its line. Other systems than Linux have no inotify, and the file is not
+ * watched there.
+ */
+
+// remembers which version of the file the buffer reflects
+void watchRemember(int fd, const struct stat *st)
+{
+	struct EditorWatch *w = &EC.watch;
+	journalFillHeader(&w->identity, st);
+	off_t from = MAX(0, st->st_size - WATCH_TAIL_SAMPLE);
+	ssize_t n = pread(fd, w->tail, st->st_size - from, from);
+	w->tailLen = MAX(n, 0);
+	w->openLine = w->tailLen && w->tail[w->tailLen - 1] != '\n';
+}
+
+// the file only grew if the bytes before the old end are still the ones seen
+int watchIsAppend(int fd, const struct stat *st)
+{
+	struct EditorWatch *w = &EC.watch;
+	if ((uint64_t)st->st_ino != w->identity.inode || (uint64_t)st->st_size <= w->identity.size)
+	{
+		return 0;
+	}
+	char tail[WATCH_TAIL_SAMPLE];
+	return pread(fd, tail, w->tailLen, w->identity.size - w->tailLen) == w->tailLen &&
+		   !memcmp(tail, w->tail, w->tailLen);
+}
+
+// drops the \r of \r\n line breaks like editorOpen does
+size_t watchStripCarriageReturns(char *buf, size_t len)
+{
+	size_t out = 0;
+	for (size_t i = 0; i < len; i++)
+	{
+		if (buf[i] != '\r' || i + 1 >= len || buf[i + 1] != '\n')
+		{
+			buf[out++] = buf[i];
+		}
+	}
+	return out;
+}
+
+void editorWatchStart()
+{
+#ifdef __linux__
+	struct EditorWatch *w = &EC.watch;
+	if (w->disabled || !EC.filename)
+	{
+		return;
+	}
+	if (w->fd == -1)
+	{
+		w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (w->fd == -1)
+		{
+			return;
+		}
+	}
+
+	// watching the directory also catches editors that save by renaming over the file
+	const char *slash = strrchr(EC.filename, '/');
+	char *dir = slash ? strndup(EC.filename, slash - EC.filename + 1) : strdup(".");
+	if (!dir)
+	{
+		terminate("[error]@editorWatchStart | strdup");
+	}
+	inotify_add_watch(w->fd, dir, IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+	free(dir);
+
+	int fd = open(EC.filename, O_RDONLY);
+	struct stat st;
+	if (fd != -1 && fstat(fd, &st) == 0)
+	{
+		watchRemember(fd, &st);
+	}
+	if (fd != -1)
+	{
+		close(fd);
+	}
+#endif
+}
+
+// reads the bytes between the old and the new end of the file into new rows; returns how
+// many bytes they add to the buffer text
+size_t editorWatchAppend(int fd, off_t from, off_t to)
+{
+	struct EditorWatch *w = &EC.watch;
+	size_t cap = MIN(to - from, WATCH_READ_CHUNK);
+	char *buf = malloc(cap);
+	if (!buf)
+	{
+		terminate("[error]@editorWatchAppend | malloc");
+	}
+
+	size_t appended = 0;
+	while (from < to)
+	{
+		ssize_t n = pread(fd, buf, MIN((size_t)(to - from), cap), from);
+		if (n <= 0)
+		{
+			break;
+		}
+		// a \r ending the chunk may start a \r\n: read it again with the next one
+		if (n > 1 && from + n < to && buf[n - 1] == '\r')
+		{
+			n--;
+		}
+		from += n;
+		size_t len = watchStripCarriageReturns(buf, n);
+		appended += len;
+
+		// an unterminated last line is continued by the new bytes
+		int at = (w->openLine && EC.numRows) ? EC.numRows - 1 : EC.numRows;
+		int x = (at < EC.numRows) ? EC.row[at].size : 0;
+		w->openLine = buf[len - 1] != '\n';
+		if (!w->openLine)
+		{
+			len--;
+		}
+		int endY, endX;
+		editorInsertText(at, x, buf, len, &endY, &endX);
+	}
+	free(buf);
+	return appended;
+}
+
+// whether line of the text split at starts is the same as a row of the buffer
+int watchLineMatches(const char *text, const size_t *starts, int line, int rowIndex)
+{
+	const EditorRow *row = &EC.row[rowIndex];
+	return (int)(starts[line + 1] - starts[line] - 1) == row->size &&
+		   !memcmp(&text[starts[line]], row->chars, row->size);
+}
+
+// reloads the file, replacing only the rows between the common head and tail
+void editorWatchReload(int fd, off_t size)
+{
+	char *text = malloc(size + 1);
+	if (!text)
+	{
+		terminate("[error]@editorWatchReload | malloc");
+	}
+	size_t len = 0;
+	ssize_t n;
+	while (len < (size_t)size && (n = pread(fd, &text[len], size - len, len)) > 0)
+	{
+		len += n;
+	}
+	len = watchStripCarriageReturns(text, len);
+	if (len && text[len - 1] != '\n')
+	{
+		text[len++] = '\n';
+	}
+
+	int numLines = 0;
+	for (size_t i = 0; i < len; i++)
+	{
+		numLines += text[i] == '\n';
+	}
+	size_t *starts = malloc(sizeof(size_t) * (numLines + 1));
+	if (!starts)
+	{
+		terminate("[error]@editorWatchReload | malloc");
+	}
+	starts[0] = 0;
+	for (size_t i = 0, line = 1; i < len; i++)
+	{
+		if (text[i] == '\n')
+		{
+			starts[line++] = i + 1;
+		}
+	}
+
+	int head = 0, tail = 0;
+	while (head < numLines && head < EC.numRows && watchLineMatches(text, starts, head, head))
+	{
+		head++;
+	}
+	while (tail < numLines - head && tail < EC.numRows - head &&
+		   watchLineMatches(text, starts, numLines - 1 - tail, EC.numRows - 1 - tail))
+	{
+		tail++;
+	}
+
+	int oldRows = EC.numRows;
+	editorReplaceRows(head, oldRows - head - tail, &text[starts[head]], starts[numLines - tail] - starts[head]);
+	free(starts);
+	free(text);
+
+	// rows behind the change move with it, rows inside it keep their number if they still exist
+	int shift = EC.numRows - oldRows;
+	if (EC.cursorY >= oldRows - tail)
+	{
+		EC.cursorY += shift;
+	}
+	if (EC.rowOffset >= oldRows - tail)
+	{
+		EC.rowOffset += shift;
+	}
+	EC.cursorY = MAX(0, MIN(EC.cursorY, EC.numRows));
+	EC.rowOffset = MAX(0, MIN(EC.rowOffset, EC.numRows));
+	EC.cursorX = (EC.cursorY < EC.numRows) ? MIN(EC.cursorX, EC.row[EC.cursorY].size) : 0;
+}
+
+// checks the file after inotify reported it; returns 1 when the screen needs redrawing
+int editorWatchCheck()
+{
+	struct EditorWatch *w = &EC.watch;
+	struct stat st;
+	int fd = open(EC.filename, O_RDONLY);
+	if (fd == -1 || fstat(fd, &st) == -1)
+	{
+		// e.g. between the unlink and the rename of another editor's save
+		if (fd != -1)
+		{
+			close(fd);
+		}
+		return 0;
+	}
+	struct JournalHeader now;
+	journalFillHeader(&now, &st);
+	if (!memcmp(&now, &w->identity, sizeof(now)))
+	{
+		close(fd);
+		return 0;
+	}
+
+	int append = watchIsAppend(fd, &st);
+	int clean = !EC.dirty;
+	// an append to a modified buffer is undone by a journal record counting its bytes
+	if (append && !clean && st.st_size - w->identity.size > INT_MAX)
+	{
+		append = 0;
+	}
+	if (!append && !clean)
+	{
+		// the buffer still holds the version seen last, so later appends are not checked
+		// against a tail it never loaded
+		close(fd);
+		editorSetStatusMessage("%.20s changed on disk; saving will overwrite it", EC.filename);
+		return 1;
+	}
+
+	// for a clean buffer the data comes from the file itself and the journal restarts on it
+	// below; the rows appended to a modified buffer are journaled as edits of the grown file
+	struct EditorJournal *jr = &EC.journal;
+	int replaying = jr->replaying;
+	jr->replaying = replaying || clean;
+	if (append)
+	{
+		size_t appended = editorWatchAppend(fd, w->identity.size, st.st_size);
+		if (!clean)
+		{
+			editorJournalRebaseAppend(&st, appended, w->openLine);
+		}
+	}
+	else
+	{
+		editorWatchReload(fd, st.st_size);
+	}
+	jr->replaying = replaying;
+	watchRemember(fd, &st);
+	close(fd);
+
+	// rows the search classified may have changed
+	editorSearchRestart();
+
+	// appended rows are new text, the rows before them kept their offsets
+	EC.disk.identity = now;
+	EC.disk.exact = 0;
+	EC.disk.valid &= append;
+
+	if (clean)
+	{
+		EC.dirty = 0;
+		editorJournalReset();
+	}
+	if (w->follow)
+	{
+		EC.cursorY = MAX(EC.numRows - 1, 0);
+		EC.cursorX = EC.cursorXS = 0;
+	}
+	else if (!append)
+	{
+		editorSetStatusMessage("Reloaded %.20s", EC.filename);
+	}
+	return 1;
+}
+
+// drains inotify events without blocking; returns 1 when the buffer or status changed
+int editorWatchTick()
+{
+#ifdef __linux__
+	struct EditorWatch *w = &EC.watch;
+	// a running save renames over the file; editorSaveFinish restarts the watch
+	if (w->fd == -1 || !EC.filename || EC.save.active)
+	{
+		return 0;
+	}
+
+	const char *slash = strrchr(EC.filename, '/');
+	const char *name = slash ? slash + 1 : EC.filename;
+	_Alignas(struct inotify_event) char buf[4096];
+	int changed = 0;
+	ssize_t len;
+	while ((len = read(w->fd, buf, sizeof(buf))) > 0)
+	{
+		const struct inotify_event *event;
+		for (char *p = buf; p < buf + len; p += sizeof(*event) + event->len)
+		{
+			event = (const struct inotify_event *)p;
+			if ((event->mask & IN_Q_OVERFLOW) || (event->len && !strcmp(event->name, name)))
+			{
+				changed = 1;
+			}
+		}
+	}
+	return changed && editorWatchCheck();
+#else
+	return 0;
+#endif
+}
+
+// Ctrl-T: keep the cursor on the last line as the file grows, like tail -f
+void editorToggleFollow()
+{
+	struct EditorWatch *w = &EC.watch;
+	w->follow = !w->follow;
+	if (w->follow)
+	{
+		EC.cursorY = MAX(EC.numRows - 1, 0);
+		EC.cursorX = EC.cursorXS = 0;
+	}
+	editorSetStatusMessage("Follow mode %s", w->follow ? "on" : "off");
+}
+
+/*** regex ***/
+/*
+ * Patterns are parsed into a small syntax tree, compiled into Thompson NFA
+ * programs (one forward, one reversed) and executed by lazily built DFAs.
+ * DFA states are sets of NFA program counters, created on first use and kept
+ * in a bounded cache that is flushed when full, so matching is always linear
+ * in the length of the text.
+ */
+enum RegexNodeType
+{
+	RE_EMPTY = 0,
+	RE_SET,
+	RE_CONCAT,
+	RE_ALT,
+	RE_STAR,
+	RE_PLUS,
+	RE_QUEST,
+	RE_BOL,
+	RE_EOL,
+};
+
+enum RegexOp
+{
+	RI_SET = 0,
+	RI_SPLIT,
+	RI_JMP,
+	RI_BOL,
+	RI_EOL,
+	RI_MATCH,
+};
+
+#define REGEX_DFA_ACCEPT (1 << 0)
+#define REGEX_DFA_ACCEPT_AT_END (1 << 1)
+#define REGEX_DFA_DEAD (1 << 2)
+
+typedef struct RegexNode
+{
+	int type;
+	int left, right;
+	int set;
+} RegexNode;
+
+typedef struct RegexInst
+{
+	int op;
+	int x, y;
+	int set;
+} RegexInst;
+
+typedef struct RegexProg
+{
+	RegexInst *inst;
+	int len;
+	int cap;
+} RegexProg;
+
+typedef struct RegexDFA
+{
+	const RegexProg *prog;
+	unsigned char (*sets)[32];
+	int unanchored;
+	int numStates;
+	int *trans;
+	int *setStart;
+	int *setLen;
+	unsigned char *flags;
+	int *pool;
+	int poolLen, poolCap;
+	int *table;
+	int start[2];
+	int *stack;
+	int *list;
+	int listLen;
+	unsigned *mark;
+	unsigned markGen;
+} RegexDFA;
+
+typedef struct Regex
+{
+	unsigned char (*sets)[32];
+	int numSets;
+	RegexProg forward, reverse;
+	RegexDFA search, backward, anchored;
+} Regex;
+
+struct RegexParser
+{
+	const char *p;
+	int icase;
+	int error;
+	int noMemory; // the error is running out of memory rather than the pattern
+	RegexNode *nodes;
+	int numNodes, capNodes;
+	unsigned char (*sets)[32];
+	int numSets, capSets;
+};
+
+int regexNewNode(struct RegexParser *rp, int type, int left, int right, int set)
+{
+	if (rp->numNodes >= REGEX_MAX_NODES)
+	{
+		rp->error = 1;
+		return 0;
+	}
+	if (rp->numNodes == rp->capNodes)
+	{
+		int cap = rp->capNodes ? rp->capNodes * 2 : 64;
+		RegexNode *nodes = realloc(rp->nodes, sizeof(RegexNode) * cap);
+		if (!nodes)
+		{
+			rp->error = rp->noMemory = 1;
+			return 0;
+		}
+		rp->nodes = nodes;
+		rp->capNodes = cap;
+	}
+	RegexNode *node = &rp->nodes[rp->numNodes];
+	node->type = type;
+	node->left = left;
+	node->right = right;
+	node->set = set;
+	return rp->numNodes++;
+}
+
+// returns the index of an empty set, or -1 with the error set when out of memory
+int regexNewSet(struct RegexParser *rp)
+{
+	if (rp->numSets == rp->capSets)
+	{
+		int cap = rp->capSets ? rp->capSets * 2 : 16;
+		unsigned char(*sets)[32] = realloc(rp->sets, sizeof(*rp->sets) * cap);
+		if (!sets)
+		{
+			rp->error = rp->noMemory = 1;
+			return -1;
+		}
+		rp->sets = sets;
+		rp->capSets = cap;
+	}
+	memset(rp->sets[rp->numSets], 0, sizeof(*rp->sets));
+	return rp->numSets++;
+}
+
+void regexSetAdd(struct RegexParser *rp, int set, int c)
+{
+	c &= 0xff;
+	rp->sets[set][c >> 3] |= 1 << (c & 7);
+	if (rp->icase && isalpha(c))
+	{
+		int other = islower(c) ? toupper(c) : tolower(c);
+		rp->sets[set][other >> 3] |= 1 << (other & 7);
+	}
+}
+
+// \d \w \s and their negations, shared by atoms and bracket classes
+int regexSetAddEscapeClass(struct RegexParser *rp, int set, char c)
+{
+	int (*isClass)(int);
+	switch (tolower(c))
+	{
+	case 'd':
+		isClass = isdigit;
+		break;
+	case 'w':
+		isClass = isalnum;
+		break;
+	case 's':
+		isClass = isspace;
+		break;
+	default:
+		return 0;
+	}
+
+	int negate = isupper(c);
+	for (int i = 0; i < 256; i++)
+	{
+		int inClass = isClass(i) || (tolower(c) == 'w' && i == '_');
+		if (inClass != negate)
+		{
+			regexSetAdd(rp, set, i);
+		}
+	}
+	return 1;
+}
+
+int regexEscapeChar(char c)
+{
+	switch (c)
+	{
+	case 't':
+		return '\t';
+	case 'n':
+		return '\n';
+	case 'r':
+		return '\r';
+	default:
+		return (unsigned char)c;
+	}
+}
+
+int regexParseAlt(struct RegexParser *rp);
+
+int regexParseClass(struct RegexParser *rp)
+{
+	int set = regexNewSet(rp);
+	int negate = 0;
+	if (set < 0)
+	{
+		return 0;
+	}
+
+	rp->p++;
+	if (*rp->p == '^')
+	{
+		negate = 1;
+		rp->p++;
+	}
+
+	int first = 1;
+	while (*rp->p && (*rp->p != ']' || first))
+	{
+		first = 0;
+		int lo = (unsigned char)*rp->p++;
+		if (lo == '\\')
+		{
+			if (!*rp->p)
+			{
+				break;
+			}
+			if (regexSetAddEscapeClass(rp, set, *rp->p))
+			{
+				rp->p++;
+				continue;
+			}
+			lo = regexEscapeChar(*rp->p++);
+		}
+
+		int hi = lo;
+		if (rp->p[0] == '-' && rp->p[1] && rp->p[1] != ']')
+		{
+			rp->p++;
+			hi = (unsigned char)*rp->p++;
+			if (hi == '\\' && *rp->p)
+			{
+				hi = regexEscapeChar(*rp->p++);
+			}
+			if (hi < lo)
+			{
+				rp->error = 1;
+				return 0;
+			}
+		}
+
+		for (int c = lo; c <= hi; c++)
+		{
+			regexSetAdd(rp, set, c);
+		}
+	}
+
+	if (*rp->p != ']')
+	{
+		rp->error = 1;
+		return 0;
+	}
+	rp->p++;
+
+	if (negate)
+	{
+		for (int i = 0; i < 32; i++)
+		{
+			rp->sets[set][i] = ~rp->sets[set][i];
+		}
+	}
+	return regexNewNode(rp, RE_SET, -1, -1, set);
+}
+
+int regexParseAtom(struct RegexParser *rp)
+{
+	int set;
+	char c = *rp->p;
+
+	switch (c)
+	{
+	case '(':
+	{
+		rp->p++;
+		if (rp->p[0] == '?' && rp->p[1] == ':')
+		{
+			rp->p += 2;
+		}
+		int node = regexParseAlt(rp);
+		if (*rp->p != ')')
+		{
+			rp->error = 1;
+			return node;
+		}
+		rp->p++;
+		return node;
+	}
+	case '[':
+		return regexParseClass(rp);
+	case '.':
+		rp->p++;
+		if ((set = regexNewSet(rp)) < 0)
+		{
+			return 0;
+		}
+		memset(rp->sets[set], 0xff, sizeof(*rp->sets));
+		return regexNewNode(rp, RE_SET, -1, -1, set);
+	case '^':
+		rp->p++;
+		return regexNewNode(rp, RE_BOL, -1, -1, -1);
+	case '$':
+		rp->p++;
+		return regexNewNode(rp, RE_EOL, -1, -1, -1);
+	case '*':
+	case '+':
+	case '?':
+		// nothing to repeat
+		rp->error = 1;
+		return 0;
+	case '\\':
+		rp->p++;
+		if (!*rp->p)
+		{
+			rp->error = 1;
+			return 0;
+		}
+		if ((set = regexNewSet(rp)) < 0)
+		{
+			return 0;
+		}
+		if (!regexSetAddEscapeClass(rp, set, *rp->p))
+		{
+			regexSetAdd(rp, set, regexEscapeChar(*rp->p));
+		}
+		rp->p++;
+		return regexNewNode(rp, RE_SET, -1, -1, set);
+	default:
+		rp->p++;
+		if ((set = regexNewSet(rp)) < 0)
+		{
+			return 0;
+		}
+		regexSetAdd(rp, set, c);
+		return regexNewNode(rp, RE_SET, -1, -1, set);
+	}
+}
+
+int regexCloneNode(struct RegexParser *rp, int n)
+{
+	if (n < 0 || rp->error)
+	{
+		return n;
+	}
+	RegexNode node = rp->nodes[n];
+	int left = regexCloneNode(rp, node.left);
+	int right = regexCloneNode(rp, node.right);
+	return regexNewNode(rp, node.type, left, right, node.set);
+}
+
+// parses "{m}", "{m,}" or "{m,n}"; returns 0 and leaves the input untouched otherwise
+int regexParseCount(struct RegexParser *rp, int *min, int *max)
+{
+	const char *p = rp->p + 1;
+	if (!isdigit(*p))
+	{
+		return 0;
+	}
+
+	*min = 0;
+	while (isdigit(*p))
+	{
+		*min = *min * 10 + (*p++ - '0');
+		if (*min > REGEX_MAX_REPEAT)
+		{
+			return 0;
+		}
+	}
+
+	*max = *min;
+	if (*p == ',')
+	{
+		p++;
+		*max = -1;
+		if (isdigit(*p))
+		{
+			*max = 0;
+			while (isdigit(*p))
+			{
+				*max = *max * 10 + (*p++ - '0');
+				if (*max > REGEX_MAX_REPEAT)
+				{
+					return 0;
+				}
+			}
+			if (*max < *min)
+			{
+				return 0;
+			}
+		}
+	}
+
+	if (*p != '}')
+	{
+		return 0;
+	}
+	rp->p = p + 1;
+	return 1;
+}
+
+int regexExpandCount(struct RegexParser *rp, int atom, int min, int max)
+{
+	int node = -1;
+	for (int i = 0; i < min && !rp->error; i++)
+	{
+		int copy = i ? regexCloneNode(rp, atom) : atom;
+		node = (node < 0) ? copy : regexNewNode(rp, RE_CONCAT, node, copy, -1);
+	}
+
+	int tail = -1;
+	if (max < 0)
+	{
+		tail = regexNewNode(rp, RE_STAR, min ? regexCloneNode(rp, atom) : atom, -1, -1);
+	}
+	else
+	{
+		// x{m,n}: the optional part is nested as (x(x(x)?)?)?
+		for (int i = 0; i < max - min && !rp->error; i++)
+		{
+			int copy = (min || i) ? regexCloneNode(rp, atom) : atom;
+			int inner = (tail < 0) ? copy : regexNewNode(rp, RE_CONCAT, copy, tail, -1);
+			tail = regexNewNode(rp, RE_QUEST, inner, -1, -1);
+		}
+	}
+
+	if (tail >= 0)
+	{
+		node = (node < 0) ? tail : regexNewNode(rp, RE_CONCAT, node, tail, -1);
+	}
+	return (node < 0) ? regexNewNode(rp, RE_EMPTY, -1, -1, -1) : node;
+}
+
+int regexParseRepeat(struct RegexParser *rp)
+{
+	int node = regexParseAtom(rp);
+
+	while (!rp->error)
+	{
+		int min, max;
+		switch (*rp->p)
+		{
+		case '*':
+			node = regexNewNode(rp, RE_STAR, node, -1, -1);
+			break;
+		case '+':
+			node = regexNewNode(rp, RE_PLUS, node, -1, -1);
+			break;
+		case '?':
+			node = regexNewNode(rp, RE_QUEST, node, -1, -1);
+			break;
+		case '{':
+			if (!regexParseCount(rp, &min, &max))
+			{
+				return node;
+			}
+			node = regexExpandCount(rp, node, min, max);
+			continue;
+		default:
+			return node;
+		}
+		rp->p++;
+	}
+	return node;
+}
+
+int regexParseConcat(struct RegexParser *rp)
+{
+	int node = -1;
+	while (*rp->p && *rp->p != '|' && *rp->p != ')' && !rp->error)
+	{
+		int next = regexParseRepeat(rp);
+		node = (node < 0) ? next : regexNewNode(rp, RE_CONCAT, node, next, -1);
+	}
+	return (node < 0) ? regexNewNode(rp, RE_EMPTY, -1, -1, -1) : node;
+}
+
+int regexParseAlt(struct RegexParser *rp)
+{
+	int node = regexParseConcat(rp);
+	while (*rp->p == '|' && !rp->error)
+	{
+		rp->p++;
+		int right = regexParseConcat(rp);
+		node = regexNewNode(rp, RE_ALT, node, right, -1);
+	}
+	return node;
+}
+
+// regexCompile makes room for every instruction beforehand
+int regexEmit(RegexProg *prog, int op, int x, int y, int set)
+{
+	RegexInst *inst = &prog->inst[prog->len];
+	inst->op = op;
+	inst->x = x;
+	inst->y = y;
+	inst->set = set;
+	return prog->len++;
+}
+
+// reversed programs match the mirrored language: concatenations flip and ^/$ swap
+void regexCompileNode(const struct RegexParser *rp, RegexProg *prog, int n, int reverse)
+{
+	const RegexNode node = rp->nodes[n];
+	int pc, jmp;
+
+	switch (node.type)
+	{
+	case RE_SET:
+		regexEmit(prog, RI_SET, 0, 0, node.set);
+		break;
+	case RE_BOL:
+		regexEmit(prog, reverse ? RI_EOL : RI_BOL, 0, 0, -1);
+		break;
+	case RE_EOL:
+		regexEmit(prog, reverse ? RI_BOL : RI_EOL, 0, 0, -1);
+		break;
+	case RE_CONCAT:
+		regexCompileNode(rp, prog, reverse ? node.right : node.left, reverse);
+		regexCompileNode(rp, prog, reverse ? node.left : node.right, reverse);
+		break;
+	case RE_ALT:
+		pc = regexEmit(prog, RI_SPLIT, 0, 0, -1);
+		prog->inst[pc].x = pc + 1;
+		regexCompileNode(rp, prog, node.left, reverse);
+		jmp = regexEmit(prog, RI_JMP, 0, 0, -1);
+		prog->inst[pc].y = prog->len;
+		regexCompileNode(rp, prog, node.right, reverse);
+		prog->inst[jmp].x = prog->len;
+		break;
+	case RE_STAR:
+		pc = regexEmit(prog, RI_SPLIT, 0, 0, -1);
+		prog->inst[pc].x = pc + 1;
+		regexCompileNode(rp, prog, node.left, reverse);
+		regexEmit(prog, RI_JMP, pc, 0, -1);
+		prog->inst[pc].y = prog->len;
+		break;
+	case RE_PLUS:
+		pc = prog->len;
+		regexCompileNode(rp, prog, node.left, reverse);
+		regexEmit(prog, RI_SPLIT, pc, prog->len + 1, -1);
+		break;
+	case RE_QUEST:
+		pc = regexEmit(prog, RI_SPLIT, 0, 0, -1);
+		prog->inst[pc].x = pc + 1;
+		regexCompileNode(rp, prog, node.left, reverse);
+		prog->inst[pc].y = prog->len;
+		break;
+	default:
+		break;
+	}
+}
+
+void regexDfaReset(RegexDFA *dfa)
+{
+	dfa->numStates = 0;
+	dfa->poolLen = 0;
+	dfa->start[0] = dfa->start[1] = -1;
+	for (int i = 0; i < REGEX_DFA_MAX_STATES * 2; i++)
+	{
+		dfa->table[i] = -1;
+	}
+}
+
+// returns 0, or -1 when out of memory with whatever was allocated left for regexDfaFree.
+// The pool starts with room for one state of every instruction, so a search that can't
+// grow it can still go on by starting the cache over
+int regexDfaInit(RegexDFA *dfa, const RegexProg *prog, unsigned char (*sets)[32], int unanchored)
+{
+	dfa->prog = prog;
+	dfa->sets = sets;
+	dfa->unanchored = unanchored;
+	dfa->trans = malloc(sizeof(int) * 256 * REGEX_DFA_MAX_STATES);
+	dfa->setStart = malloc(sizeof(int) * REGEX_DFA_MAX_STATES);
+	dfa->setLen = malloc(sizeof(int) * REGEX_DFA_MAX_STATES);
+	dfa->flags = malloc(REGEX_DFA_MAX_STATES);
+	dfa->table = malloc(sizeof(int) * REGEX_DFA_MAX_STATES * 2);
+	dfa->stack = malloc(sizeof(int) * (prog->len * 2 + 2));
+	dfa->list = malloc(sizeof(int) * (prog->len * 2 + 2));
+	dfa->mark = calloc(prog->len, sizeof(unsigned));
+	dfa->pool = malloc(sizeof(int) * prog->len);
+	dfa->poolCap = prog->len;
+	dfa->markGen = 0;
+	if (!dfa->trans || !dfa->setStart || !dfa->setLen || !dfa->flags ||
+		!dfa->table || !dfa->stack || !dfa->list || !dfa->mark || !dfa->pool)
+	{
+		return -1;
+	}
+	regexDfaReset(dfa);
+	return 0;
+}
+
+void regexDfaFree(RegexDFA *dfa)
+{
+	free(dfa->trans);
+	free(dfa->setStart);
+	free(dfa->setLen);
+	free(dfa->flags);
+	free(dfa->table);
+	free(dfa->stack);
+	free(dfa->list);
+	free(dfa->mark);
+	free(dfa->pool);
+}
+
+void regexDfaNewList(RegexDFA *dfa)
+{
+	dfa->listLen = 0;
+	if (++dfa->markGen == 0)
+	{
+		memset(dfa->mark, 0, sizeof(unsigned) * dfa->prog->len);
+		dfa->markGen = 1;
+	}
+}
+
+// follows epsilon edges from pc; ^ is only crossed when atStart is set
+void regexDfaAddClosure(RegexDFA *dfa, int pc, int atStart)
+{
+	int top = 0;
+	dfa->stack[top++] = pc;
+	while (top)
+	{
+		pc = dfa->stack[--top];
+		if (dfa->mark[pc] == dfa->markGen)
+		{
+			continue;
+		}
+		dfa->mark[pc] = dfa->markGen;
+
+		const RegexInst *inst = &dfa->prog->inst[pc];
+		switch (inst->op)
+		{
+		case RI_JMP:
+			dfa->stack[top++] = inst->x;
+			break;
+		case RI_SPLIT:
+			dfa->stack[top++] = inst->y;
+			dfa->stack[top++] = inst->x;
+			break;
+		case RI_BOL:
+			if (atStart)
+			{
+				dfa->stack[top++] = pc + 1;
+			}
+			break;
+		default:
+			dfa->list[dfa->listLen++] = pc;
+			break;
+		}
+	}
+}
+
+int regexCompareInt(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+// interns dfa->list as a DFA state; returns -1 when the state cache is full or can't grow
+int regexDfaAddState(RegexDFA *dfa)
+{
+	qsort(dfa->list, dfa->listLen, sizeof(int), regexCompareInt);
+
+	unsigned hash = 2166136261u;
+	for (int i = 0; i < dfa->listLen; i++)
+	{
+		hash = (hash ^ (unsigned)dfa->list[i]) * 16777619u;
+	}
+
+	int mask = REGEX_DFA_MAX_STATES * 2 - 1;
+	int slot = hash & mask;
+	while (dfa->table[slot] >= 0)
+	{
+		int s = dfa->table[slot];
+		if (dfa->setLen[s] == dfa->listLen &&
+			!memcmp(&dfa->pool[dfa->setStart[s]], dfa->list, sizeof(int) * dfa->listLen))
+		{
+			return s;
+		}
+		slot = (slot + 1) & mask;
+	}
+
+	if (dfa->numStates == REGEX_DFA_MAX_STATES)
+	{
+		return -1;
+	}
+
+	unsigned char flags = 0;
+	int listLen = dfa->listLen;
+	for (int i = 0; i < listLen; i++)
+	{
+		if (dfa->prog->inst[dfa->list[i]].op == RI_MATCH)
+		{
+			flags |= REGEX_DFA_ACCEPT | REGEX_DFA_ACCEPT_AT_END;
+		}
+	}
+	if (!(flags & REGEX_DFA_ACCEPT))
+	{
+		// would crossing the pending $ assertions reach a match?
+		if (++dfa->markGen == 0)
+		{
+			memset(dfa->mark, 0, sizeof(unsigned) * dfa->prog->len);
+			dfa->markGen = 1;
+		}
+		for (int i = 0; i < listLen; i++)
+		{
+			if (dfa->prog->inst[dfa->list[i]].op == RI_EOL)
+			{
+				regexDfaAddClosure(dfa, dfa->list[i] + 1, 0);
+			}
+		}
+		for (int i = listLen; i < dfa->listLen; i++)
+		{
+			if (dfa->prog->inst[dfa->list[i]].op == RI_MATCH)
+			{
+				flags |= REGEX_DFA_ACCEPT_AT_END;
+			}
+		}
+		dfa->listLen = listLen;
+	}
+	if (!listLen && !dfa->unanchored)
+	{
+		flags |= REGEX_DFA_DEAD;
+	}
+
+	if (dfa->poolLen + listLen > dfa->poolCap)
+	{
+		int cap = (dfa->poolCap + listLen) * 2;
+		int *pool = realloc(dfa->pool, sizeof(int) * cap);
+		if (!pool)
+		{
+			return -1;
+		}
+		dfa->pool = pool;
+		dfa->poolCap = cap;
+	}
+
+	int s = dfa->numStates++;
+	dfa->setStart[s] = dfa->poolLen;
+	dfa->setLen[s] = listLen;
+	dfa->flags[s] = flags;
+	memcpy(&dfa->pool[dfa->poolLen], dfa->list, sizeof(int) * listLen);
+	dfa->poolLen += listLen;
+	for (int c = 0; c < 256; c++)
+	{
+		dfa->trans[s * 256 + c] = -1;
+	}
+	dfa->table[slot] = s;
+	return s;
+}
+
+int regexDfaInternList(RegexDFA *dfa)
+{
+	int s = regexDfaAddState(dfa);
+	if (s < 0)
+	{
+		// cache is full: drop every state and start over from this one
+		regexDfaReset(dfa);
+		s = regexDfaAddState(dfa);
+	}
+	return s;
+}
+
+int regexDfaStart(RegexDFA *dfa, int atStart)
+{
+	if (dfa->start[atStart] < 0)
+	{
+		regexDfaNewList(dfa);
+		regexDfaAddClosure(dfa, 0, atStart);
+		int s = regexDfaInternList(dfa);
+		dfa->start[atStart] = s;
+	}
+	return dfa->start[atStart];
+}
+
+// slow path of a DFA step: builds the successor state and caches the edge
+int regexDfaNext(RegexDFA *dfa, int s, unsigned char c)
+{
+	regexDfaNewList(dfa);
+	for (int i = 0; i < dfa->setLen[s]; i++)
+	{
+		int pc = dfa->pool[dfa->setStart[s] + i];
+		const RegexInst *inst = &dfa->prog->inst[pc];
+		if (inst->op == RI_SET && (dfa->sets[inst->set][c >> 3] & (1 << (c & 7))))
+		{
+			regexDfaAddClosure(dfa, pc + 1, 0);
+		}
+	}
+	if (dfa->unanchored)
+	{
+		regexDfaAddClosure(dfa, 0, 0);
+	}
+
+	int next = regexDfaAddState(dfa);
+	if (next < 0)
+	{
+		regexDfaReset(dfa);
+		return regexDfaAddState(dfa);
+	}
+	dfa->trans[s * 256 + c] = next;
+	return next;
+}
+
+#define REGEX_DFA_STEP(dfa, s, c)                      \
+	do                                                 \
+	{                                                  \
+		int next_ = (dfa)->trans[(s) * 256 + (c)];     \
+		(s) = (next_ >= 0) ? next_ : regexDfaNext((dfa), (s), (c)); \
+	} while (0)
+
+// returns 1 if any match starts at or after from
+int regexDfaMatchAny(RegexDFA *dfa, const unsigned char *text, int len, int from)
+{
+	int s = regexDfaStart(dfa, from == 0);
+	for (int i = from; i < len; i++)
+	{
+		if (dfa->flags[s] & REGEX_DFA_ACCEPT)
+		{
+			return 1;
+		}
+		REGEX_DFA_STEP(dfa, s, text[i]);
+	}
+	return (dfa->flags[s] & REGEX_DFA_ACCEPT_AT_END) != 0;
+}
+
+// runs the reversed program from the end of the line down to from. With
+// before < 0 it returns the leftmost match start, otherwise the rightmost
+// match start lower than before.
+int regexDfaMatchStart(RegexDFA *dfa, const unsigned char *text, int len, int from, int before)
+{
+	int s = regexDfaStart(dfa, 1);
+	int found = -1;
+	for (int p = len;; p--)
+	{
+		int flags = dfa->flags[s];
+		if ((flags & REGEX_DFA_ACCEPT) || (p == 0 && (flags & REGEX_DFA_ACCEPT_AT_END)))
+		{
+			if (before < 0)
+			{
+				found = p;
+			}
+			else if (p < before)
+			{
+				return p;
+			}
+		}
+		if (p == from)
+		{
+			break;
+		}
+		REGEX_DFA_STEP(dfa, s, text[p - 1]);
+	}
+	return found;
+}
+
+// returns the end of the longest match anchored at start, or -1
+int regexDfaMatchEnd(RegexDFA *dfa, const unsigned char *text, int len, int start)
+{
+	int s = regexDfaStart(dfa, start == 0);
+	int end = -1;
+	for (int i = start;; i++)
+	{
+		int flags = dfa->flags[s];
+		if (flags & REGEX_DFA_DEAD)
+		{
+			break;
+		}
+		if ((flags & REGEX_DFA_ACCEPT) || (i == len && (flags & REGEX_DFA_ACCEPT_AT_END)))
+		{
+			end = i;
+		}
+		if (i == len)
+		{
+			break;
+		}
+		REGEX_DFA_STEP(dfa, s, text[i]);
+	}
+	return end;
+}
+
+void regexFree(Regex *re)
+{
+	if (!re)
+	{
+		return;
+	}
+	regexDfaFree(&re->search);
+	regexDfaFree(&re->backward);
+	regexDfaFree(&re->anchored);
+	free(re->forward.inst);
+	free(re->reverse.inst);
+	free(re->sets);
+	free(re);
+}
+
+// compiles a pattern; a leading "(?i)" makes it case-insensitive. Returns NULL with errno
+// EINVAL on syntax errors, or ENOMEM when out of memory
+Regex *regexCompile(const char *pattern)
+{
+	struct RegexParser rp = {0};
+	rp.p = pattern;
+	if (!strncmp(rp.p, "(?i)", 4))
+	{
+		rp.icase = 1;
+		rp.p += 4;
+	}
+
+	int root = regexParseAlt(&rp);
+	if (rp.error || *rp.p)
+	{
+		free(rp.nodes);
+		free(rp.sets);
+		errno = rp.noMemory ? ENOMEM : EINVAL;
+		return NULL;
+	}
+
+	Regex *re = calloc(1, sizeof(Regex));
+	if (!re)
+	{
+		free(rp.nodes);
+		free(rp.sets);
+		errno = ENOMEM;
+		return NULL;
+	}
+	re->sets = rp.sets;
+	re->numSets = rp.numSets;
+
+	// no node emits more than two instructions, plus the final match
+	int cap = rp.numNodes * 2 + 1;
+	re->forward.inst = malloc(sizeof(RegexInst) * cap);
+	re->reverse.inst = malloc(sizeof(RegexInst) * cap);
+	re->forward.cap = re->reverse.cap = cap;
+	if (!re->forward.inst || !re->reverse.inst)
+	{
+		free(rp.nodes);
+		regexFree(re);
+		errno = ENOMEM;
+		return NULL;
+	}
+	regexCompileNode(&rp, &re->forward, root, 0);
+	regexEmit(&re->forward, RI_MATCH, 0, 0, -1);
+	regexCompileNode(&rp, &re->reverse, root, 1);
+	regexEmit(&re->reverse, RI_MATCH, 0, 0, -1);
+	free(rp.nodes);
+
+	if (regexDfaInit(&re->search, &re->forward, re->sets, 1) == -1 ||
+		regexDfaInit(&re->anchored, &re->forward, re->sets, 0) == -1 ||
+		regexDfaInit(&re->backward, &re->reverse, re->sets, 1) == -1)
+	{
+		regexFree(re);
+		errno = ENOMEM;
+		return NULL;
+	}
+	return re;
+}
+
+// finds the leftmost-longest match starting at or after from
+int regexSearch(Regex *re, const char *text, int len, int from, int *matchStart, int *matchEnd)
+{
+	const unsigned char *s = (const unsigned char *)text;
+	if (from < 0 || from > len || !regexDfaMatchAny(&re->search, s, len, from))
+	{
+		return 0;
+	}
+
+	int start = regexDfaMatchStart(&re->backward, s, len, from, -1);
+	int end = (start < 0) ? -1 : regexDfaMatchEnd(&re->anchored, s, len, start);
+	if (end < 0)
+	{
+		return 0;
+	}
+	*matchStart = start;
+	*matchEnd = end;
+	return 1;
+}
+
+// finds the longest match with the rightmost start lower than before (any start if before < 0)
+int regexSearchLast(Regex *re, const char *text, int len, int before, int *matchStart, int *matchEnd)
+{
+	const unsigned char *s = (const unsigned char *)text;
+	if (!regexDfaMatchAny(&re->search, s, len, 0))
+	{
+		return 0;
+	}
+
+	int start = regexDfaMatchStart(&re->backward, s, len, 0, before < 0 ? len + 1 : before);
+	int end = (start < 0) ? -1 : regexDfaMatchEnd(&re->anchored, s, len, start);
+	if (end < 0)
+	{
+		return 0;
+	}
+	*matchStart = start;
+	*matchEnd = end;
+	return 1;
+}
+
+/*** search ***/
+/*
+ * Typing in the search prompt classifies rows lazily, outward from the row
+ * the search started on. Rows found to match are kept in scan order; when
+ * the pattern grows by plain characters only those rows (and the ones not
+ * scanned yet) can match, so they are re-checked instead of the whole buffer.
+ * Any other change starts the scan over. The scan gives way to pending keys
+ * and carries on while the prompt is idle.
+ */
+
+// forgets the rows classified so far
+void editorSearchRestart()
+{
+	struct EditorSearch *sr = &EC.search;
+	sr->numRows = sr->kept = sr->checked = 0;
+	sr->scanned = 0;
+}
+
+// keeps the scan in order when the loader appends rows behind the ones it already wrapped past
+void editorSearchRowsAppended(int oldNumRows)
+{
+	struct EditorSearch *sr = &EC.search;
+	int origin = (sr->originRow < oldNumRows) ? sr->originRow : 0;
+	if (sr->scanned > oldNumRows - origin)
+	{
+		editorSearchRestart();
+	}
+}
+
+// whether pattern appends only plain characters to prev, so every row matching pattern matches prev
+int searchNarrows(const char *prev, const char *pattern)
+{
+	size_t len = strlen(prev);
+	if (strncmp(prev, pattern, len) != 0)
+	{
+		return 0;
+	}
+	return !pattern[len + strcspn(&pattern[len], "\\^$.|?*+()[]{}")];
+}
+
+void editorSearchSetPattern(const char *pattern)
+{
+	struct EditorSearch *sr = &EC.search;
+	if (sr->pattern && !strcmp(sr->pattern, pattern))
+	{
+		return;
+	}
+
+	Regex *regex = regexCompile(pattern);
+	if (sr->regex && regex && searchNarrows(sr->pattern, pattern))
+	{
+		// matches of the previous pattern and the rows it didn't check yet remain candidates
+		memmove(&sr->rows[sr->kept], &sr->rows[sr->checked], sizeof(int) * (sr->numRows - sr->checked));
+		sr->numRows -= sr->checked - sr->kept;
+		sr->kept = sr->checked = 0;
+	}
+	else
+	{
+		editorSearchRestart();
+	}
+	regexFree(sr->regex);
+	sr->regex = regex;
+	free(sr->pattern);
+	sr->pattern = strdup(pattern);
+	sr->shown = 0;
+}
+
+// classifies rows until the first match is known, or all rows when toFirst is 0;
+// stops early when a key is waiting or at the deadline (0 for none). Returns 1 once every row is classified.
+int editorSearchStep(int toFirst, long long deadline)
+{
+	struct EditorSearch *sr = &EC.search;
+	if (!sr->regex || !EC.numRows)
+	{
+		return 1;
+	}
+	int origin = (sr->originRow < EC.numRows) ? sr->originRow : 0;
+	int budget = SEARCH_STEP_ROWS;
+	while (!(toFirst && sr->kept))
+	{
+		if (--budget == 0)
+		{
+			if ((EC.hooks.inputPending && EC.hooks.inputPending()) || (deadline && journalNowMs() >= deadline))
+			{
+				return 0;
+			}
+			budget = SEARCH_STEP_ROWS;
+		}
+
+		int at;
+		int verify = (sr->checked < sr->numRows);
+		if (verify)
+		{
+			at = sr->rows[sr->checked++];
+		}
+		else
+		{
+			// every candidate is verified, drop the gap left by the rows that failed
+			sr->numRows = sr->checked = sr->kept;
+			if (sr->scanned == EC.numRows)
+			{
+				return 1;
+			}
+			at = (origin + sr->scanned++) % EC.numRows;
+		}
+
+		EditorRow *row = &EC.row[at];
+		int matchStart, matchEnd;
+		if (!regexSearch(sr->regex, editorRowRender(row), row->rsize, 0, &matchStart, &matchEnd))
+		{
+			continue;
+		}
+		if (verify)
+		{
+			sr->rows[sr->kept++] = at;
+			continue;
+		}
+		if (sr->numRows == sr->cap)
+		{
+			sr->cap = sr->cap ? sr->cap * 2 : 1024;
+			sr->rows = realloc(sr->rows, sizeof(int) * sr->cap);
+			if (!sr->rows)
+			{
+				terminate("[error]@editorSearchStep | realloc");
+			}
+		}
+		sr->rows[sr->numRows++] = at;
+		sr->kept = sr->checked = sr->numRows;
+	}
+	return 0;
+}
+
+void editorSearchShowMatch(int at, int matchStart, int matchEnd)
+{
+	struct EditorSearch *sr = &EC.search;
+	EditorRow *row = &EC.row[at];
+	int matchLen = matchEnd - matchStart;
+	sr->lastMatchRow = at;
+	sr->lastMatchX = matchStart;
+	EC.cursorY = at;
+	EC.rowOffset = at;
+	EC.cursorX = editorRenderXToCursorX(row, matchEnd);
+	EC.cursorXS = EC.cursorX;
+	EC.columnOffset = ((EC.cursorX - matchLen) / EC.screenColumns) * EC.screenColumns;
+
+	EC.overlay = (struct EditorOverlay){at, matchStart, matchEnd, HL_MATCH};
+}
+
+// jumps to the first match from where the search started, once it is known
+int editorSearchShowFirst()
+{
+	struct EditorSearch *sr = &EC.search;
+	int matchStart, matchEnd;
+	if (!sr->kept)
+	{
+		return 0;
+	}
+	EditorRow *row = &EC.row[sr->rows[0]];
+	regexSearch(sr->regex, editorRowRender(row), row->rsize, 0, &matchStart, &matchEnd);
+	editorSearchShowMatch(sr->rows[0], matchStart, matchEnd);
+	sr->shown = 1;
+	return 1;
+}
+
+// continues the scan while the prompt is idle; returns 1 when a match came into view
+int editorSearchTick()
+{
+	struct EditorSearch *sr = &EC.search;
+	if (!sr->active)
+	{
+		return 0;
+	}
+	if (!sr->shown)
+	{
+		editorSearchStep(1, 0);
+		return editorSearchShowFirst();
+	}
+	editorSearchStep(0, 0);
+	return 0;
+}
+
+/*** clipboard ***/
+// takes ownership of text; append extends the newest entry instead of adding one
+void editorKillRingPush(char *text, size_t len, int append)
+{
+	struct EditorKillRing *kr = &EC.killRing;
+	if (append && kr->count)
+	{
+		char *newest = realloc(kr->entries[kr->newest], kr->lengths[kr->newest] + len + 1);
+		if (!newest)
+		{
+			terminate("[error]@editorKillRingPush | realloc");
+		}
+		memcpy(&newest[kr->lengths[kr->newest]], text, len + 1);
+		kr->entries[kr->newest] = newest;
+		kr->lengths[kr->newest] += len;
+		free(text);
+	}
+	else
+	{
+		kr->newest = (kr->newest + 1) % KILL_RING_SIZE;
+		free(kr->entries[kr->newest]);
+		kr->entries[kr->newest] = text;
+		kr->lengths[kr->newest] = len;
+		if (kr->count < KILL_RING_SIZE)
+		{
+			kr->count++;
+		}
+	}
+	if (EC.hooks.clipboard)
+	{
+		EC.hooks.clipboard(kr->entries[kr->newest], kr->lengths[kr->newest]);
+	}
+}
+
+// copies the cursor line (with its line break) into the kill ring, optionally deleting it
+void editorKillLine(int cut)
+{
+	if (EC.cursorY >= EC.numRows)
+	{
+		return;
+	}
+
+	int y = EC.cursorY;
+	size_t len;
+	char *text = editorCopyText(y, 0, y, EC.row[y].size, &len);
+	text = realloc(text, len + 2);
+	if (!text)
+	{
+		terminate("[error]@editorKillLine | realloc");
+	}
+	text[len++] = '\n';
+	text[len] = '\0';
+
+	// consecutive cuts collect into one entry
+	editorKillRingPush(text, len, cut && EC.lastKey == CTRL_KEY('k'));
+
+	if (cut)
+	{
+		if (y + 1 < EC.numRows)
+		{
+			editorDeleteText(y, 0, y + 1, 0);
+		}
+		else
+		{
+			editorDeleteText(y, 0, y, EC.row[y].size);
+		}
+		EC.cursorX = EC.cursorXS = 0;
+	}
+	editorSetStatusMessage("%s %zu bytes", cut ? "Cut" : "Copied", len);
+}
+
+void editorInsertAtCursor(const char *text, size_t len)
+{
+	int endY, endX;
+	editorInsertText(EC.cursorY, EC.cursorX, text, len, &endY, &endX);
+	EC.cursorY = endY;
+	EC.cursorX = endX;
+	EC.cursorXS = editorRowCursorXToRenderX(&EC.row[endY], endX);
+}
+
+void editorYankEntry()
+{
+	struct EditorKillRing *kr = &EC.killRing;
+	int index = (kr->newest - kr->yankOffset + KILL_RING_SIZE) % KILL_RING_SIZE;
+	kr->yankStartY = EC.cursorY;
+	kr->yankStartX = (EC.cursorY < EC.numRows) ? MIN(EC.cursorX, EC.row[EC.cursorY].size) : 0;
+	editorInsertAtCursor(kr->entries[index], kr->lengths[index]);
+	kr->yankEndY = EC.cursorY;
+	kr->yankEndX = EC.cursorX;
+}
+
+void editorYank()
+{
+	if (!EC.killRing.count)
+	{
+		editorSetStatusMessage("Kill ring is empty");
+		return;
+	}
+	EC.killRing.yankOffset = 0;
+	editorYankEntry();
+}
+
+// replaces the text just yanked with the next older kill ring entry
+void editorYankPop()
+{
+	struct EditorKillRing *kr = &EC.killRing;
+	if (EC.lastKey != CTRL_KEY('v') && EC.lastKey != CTRL_KEY('y'))
+	{
+		editorSetStatusMessage("Ctrl-Y only works right after a paste");
+		return;
+	}
+
+	editorDeleteText(kr->yankStartY, kr->yankStartX, kr->yankEndY, kr->yankEndX);
+	EC.cursorY = kr->yankStartY;
+	EC.cursorX = kr->yankStartX;
+	kr->yankOffset = (kr->yankOffset + 1) % kr->count;
+	editorYankEntry();
+	editorSetStatusMessage("Kill ring entry %d/%d", kr->yankOffset + 1, kr->count);
+}
+
+/*** selection ***/
+// Ctrl-B starts a character selection, Ctrl-L a line selection; the same key ends it
+void editorSelectionStart(int mode)
+{
+	struct EditorSelection *sel = &EC.selection;
+	if (sel->mode == mode)
+	{
+		sel->mode = SEL_NONE;
+		return;
+	}
+	if (sel->mode == SEL_NONE)
+	{
+		sel->anchorY = EC.cursorY;
+		sel->anchorX = EC.cursorX;
+	}
+	sel->mode = mode;
+}
+
+// orders anchor and cursor; line selections cover their rows entirely
+void editorSelectionRange(int *startY, int *startX, int *endY, int *endX)
+{
+	struct EditorSelection *sel = &EC.selection;
+	int ay = sel->anchorY, ax = sel->anchorX;
+	int cy = EC.cursorY, cx = EC.cursorX;
+	// the line past the end of the buffer stands for the end of the last row
+	if (ay >= EC.numRows)
+	{
+		ay = EC.numRows - 1;
+		ax = EC.row[ay].size;
+	}
+	if (cy >= EC.numRows)
+	{
+		cy = EC.numRows - 1;
+		cx = EC.row[cy].size;
+	}
+
+	if (ay < cy || (ay == cy && ax <= cx))
+	{
+		*startY = ay, *startX = ax, *endY = cy, *endX = cx;
+	}
+	else
+	{
+		*startY = cy, *startX = cx, *endY = ay, *endX = ax;
+	}
+	if (sel->mode == SEL_LINE)
+	{
+		*startX = 0;
+		*endX = EC.row[*endY].size;
+	}
+}
+
+// returns the selected render columns [from, to) of a row, or 0 if it is not selected
+int editorSelectionColumns(int rowIndex, int *from, int *to)
+{
+	if (EC.selection.mode == SEL_NONE || !EC.numRows)
+	{
+		return 0;
+	}
+	int startY, startX, endY, endX;
+	editorSelectionRange(&startY, &startX, &endY, &endX);
+	if (rowIndex < startY || rowIndex > endY)
+	{
+		return 0;
+	}
+	EditorRow *row = &EC.row[rowIndex];
+	*from = (rowIndex == startY) ? editorRowCursorXToRenderX(row, MIN(startX, row->size)) : 0;
+	*to = (rowIndex == endY) ? editorRowCursorXToRenderX(row, MIN(endX, row->size)) : row->rsize;
+	return 1;
+}
+
+void editorSelectionEnd(int y, int x)
+{
+	EC.selection.mode = SEL_NONE;
+	EC.cursorY = MIN(y, EC.numRows - 1);
+	EC.cursorX = MIN(x, EC.row[EC.cursorY].size);
+	EC.cursorXS = editorRowCursorXToRenderX(&EC.row[EC.cursorY], EC.cursorX);
+}
+
+// removes the selected text in one pass; line selections take their line breaks along
+void editorSelectionDelete()
+{
+	int startY, startX, endY, endX;
+	editorSelectionRange(&startY, &startX, &endY, &endX);
+	if (EC.selection.mode == SEL_LINE)
+	{
+		editorDeleteRows(startY, endY);
+		startX = 0;
+	}
+	else
+	{
+		editorDeleteText(startY, startX, endY, endX);
+	}
+	editorSelectionEnd(startY, startX);
+}
+
+// copies the selection into the kill ring, optionally deleting it
+void editorSelectionYank(int cut)
+{
+	int startY, startX, endY, endX;
+	editorSelectionRange(&startY, &startX, &endY, &endX);
+	size_t len;
+	char *text = editorCopyText(startY, startX, endY, endX, &len);
+	if (EC.selection.mode == SEL_LINE)
+	{
+		text = realloc(text, len + 2);
+		if (!text)
+		{
+			terminate("[error]@editorSelectionYank | realloc");
+		}
+		text[len++] = '\n';
+		text[len] = '\0';
+	}
+	editorKillRingPush(text, len, 0);
+
+	if (cut)
+	{
+		editorSelectionDelete();
+	}
+	else
+	{
+		editorSelectionEnd(startY, startX);
+	}
+	editorSetStatusMessage("%s %d lines (%zu bytes)", cut ? "Cut" : "Copied", endY - startY + 1, len);
+}
+
+void editorSelectionIndent(int dedent)
+{
+	int startY, startX, endY, endX;
+	editorSelectionRange(&startY, &startX, &endY, &endX);
+	editorIndentRows(startY, endY, dedent);
+
+	// the selection stays so that the block can be shifted repeatedly
+	struct EditorSelection *sel = &EC.selection;
+	if (sel->anchorY < EC.numRows)
+	{
+		sel->anchorX = MIN(sel->anchorX, EC.row[sel->anchorY].size);
+	}
+	if (EC.cursorY < EC.numRows)
+	{
+		EC.cursorX = MIN(EC.cursorX, EC.row[EC.cursorY].size);
+	}
+}
+
+void editorSelectionComment()
+{
+	int startY, startX, endY, endX;
+	editorSelectionRange(&startY, &startX, &endY, &endX);
+	if (editorToggleComment(startY, endY) == -1)
+	{
+		editorSetStatusMessage("No line comment for this filetype");
+		return;
+	}
+	editorSelectionEnd(startY, 0);
+}
+
+void editorSelectionCase(int upper)
+{
+	int startY, startX, endY, endX;
+	editorSelectionRange(&startY, &startX, &endY, &endX);
+	editorChangeCase(startY, startX, endY, endX, upper);
+	editorSelectionEnd(startY, startX);
+}
+
+/*** operators ***/
+/*
+ * Normal mode applies an operator to the text between the cursor and where a
+ * motion would take it. Each operator is one range call (editorDeleteText,
+ * editorIndentRows, editorReplaceRows, editorInsertText) whatever the count,
+ * so 100000dd shifts the row array and renumbers it once rather than
+ * deleting row after row.
+ */
+
+// the column of the first char of a row that is not a blank
+int editorFirstNonBlank(int row)
+{
+	if (row < 0 || row >= EC.numRows)
+	{
+		return 0;
+	}
+	const EditorRow *r = &EC.row[row];
+	int x = 0;
+	while (x < r->size && isblank((unsigned char)r->chars[x]))
+	{
+		x++;
+	}
+	return x;
+}
+
+void operatorCursor(int y, int x)
+{
+	EC.cursorY = MAX(0, MIN(y, EC.numRows - 1));
+	EC.cursorX = EC.numRows ? MAX(0, MIN(x, EC.row[EC.cursorY].size)) : 0;
+	EC.cursorXS = EC.numRows ? editorRowCursorXToRenderX(&EC.row[EC.cursorY], EC.cursorX) : 0;
+}
+
+// what word motions tell apart: 0 blanks and the line end, 1 word chars, 2 other chars
+int motionClass(const EditorRow *row, int x)
+{
+	if (x >= row->size || isspace((unsigned char)row->chars[x]))
+	{
+		return 0;
+	}
+	return wordChar(row->chars[x]) ? 1 : 2;
+}
+
+// moves (*y, *x) count words on: 'w' to the next word start, 'b' back to a word start,
+// 'e' to a word end. An empty row counts as a word, as in vim
+void editorWordMotion(int motion, int count, int *y, int *x)
+{
+	if (!EC.numRows)
+	{
+		return;
+	}
+	while (count-- > 0)
+	{
+		int fromY = *y, fromX = *x;
+		const EditorRow *row = &EC.row[*y];
+		if (motion == 'w')
+		{
+			int c = motionClass(row, *x);
+			while (c && *x < row->size && motionClass(row, *x) == c)
+			{
+				(*x)++;
+			}
+			while (motionClass(row, *x) == 0)
+			{
+				if (*x < row->size)
+				{
+					(*x)++;
+					continue;
+				}
+				if (*y + 1 >= EC.numRows)
+				{
+					break;
+				}
+				row = &EC.row[++(*y)];
+				*x = 0;
+				if (!row->size)
+				{
+					break;
+				}
+			}
+		}
+		else if (motion == 'b')
+		{
+			// back over blanks and line ends to the previous word, then to its start
+			for (;;)
+			{
+				if (*x > 0)
+				{
+					(*x)--;
+				}
+				else if (*y > 0)
+				{
+					row = &EC.row[--(*y)];
+					*x = row->size;
+					if (!row->size)
+					{
+						break;
+					}
+					continue;
+				}
+				else
+				{
+					break;
+				}
+				if (motionClass(row, *x))
+				{
+					break;
+				}
+			}
+			int c = motionClass(row, *x);
+			while (c && *x > 0 && motionClass(row, *x - 1) == c)
+			{
+				(*x)--;
+			}
+		}
+		else
+		{
+			(*x)++;
+			while (motionClass(row, *x) == 0 && (*x < row->size || *y + 1 < EC.numRows))
+			{
+				if (*x < row->size)
+				{
+					(*x)++;
+				}
+				else
+				{
+					row = &EC.row[++(*y)];
+					*x = 0;
+				}
+			}
+			int c = motionClass(row, *x);
+			while (c && motionClass(row, *x + 1) == c)
+			{
+				(*x)++;
+			}
+			*x = MIN(*x, MAX(row->size - 1, 0));
+		}
+		// at either end of the buffer the rest of the count changes nothing
+		if (*y == fromY && *x == fromX)
+		{
+			break;
+		}
+	}
+}
+
+// removes rows first..last together with their line breaks in one range delete
+void editorDeleteRows(int first, int last)
+{
+	if (last + 1 < EC.numRows)
+	{
+		editorDeleteText(first, 0, last + 1, 0);
+	}
+	else if (first > 0)
+	{
+		editorDeleteText(first - 1, EC.row[first - 1].size, last, EC.row[last].size);
+	}
+	else
+	{
+		editorDeleteText(0, 0, last, EC.row[last].size);
+	}
+}
+
+// applies an operator to the rows first..last as a whole, e.g. 300>> or 100000dd
+void editorOperatorLines(int op, int first, int last)
+{
+	first = MAX(first, 0);
+	last = MIN(last, EC.numRows - 1);
+	if (first > last)
+	{
+		return;
+	}
+	int lines = last - first + 1;
+	if (op == OP_INDENT || op == OP_DEDENT)
+	{
+		editorIndentRows(first, last, op == OP_DEDENT);
+		operatorCursor(first, editorFirstNonBlank(first));
+		editorSetStatusMessage("Shifted %d lines", lines);
+		return;
+	}
+
+	size_t len;
+	char *text = editorCopyText(first, 0, last, EC.row[last].size, &len);
+	text = realloc(text, len + 2);
+	if (!text)
+	{
+		terminate("[error]@editorOperatorLines | realloc");
+	}
+	text[len++] = '\n';
+	text[len] = '\0';
+	editorKillRingPush(text, len, 0);
+
+	switch (op)
+	{
+	case OP_YANK:
+		operatorCursor(first, EC.cursorX);
+		editorSetStatusMessage("Copied %d lines", lines);
+		break;
+	case OP_CHANGE:
+		// the rows make way for one empty row to type into
+		editorDeleteText(first, 0, last, EC.row[last].size);
+		operatorCursor(first, 0);
+		break;
+	case OP_DELETE:
+		editorDeleteRows(first, last);
+		operatorCursor(first, editorFirstNonBlank(MIN(first, EC.numRows - 1)));
+		editorSetStatusMessage("Cut %d lines", lines);
+		break;
+	}
+}
+
+// applies an operator to the text from (startY, startX) up to (endY, endX), e.g. d3w
+void editorOperatorRange(int op, int startY, int startX, int endY, int endX)
+{
+	if (op == OP_INDENT || op == OP_DEDENT)
+	{
+		editorOperatorLines(op, startY, endY);
+		return;
+	}
+	if (startY < 0 || endY >= EC.numRows || (startY == endY && startX >= endX))
+	{
+		return;
+	}
+	size_t len;
+	char *text = editorCopyText(startY, startX, endY, endX, &len);
+	editorKillRingPush(text, len, 0);
+	if (op != OP_YANK)
+	{
+		editorDeleteText(startY, startX, endY, endX);
+	}
+	operatorCursor(startY, startX);
+}
+
+// joins rows first..last into one in a single replace, as vim's J does: the leading blanks
+// of each joined row become one space, none after a blank or before a ')'. The cursor goes
+// on the space of the last join (where it would be when none was put), and that column is
+// returned, or -1 if there was nothing to join
+int editorJoinRows(int first, int last)
+{
+	first = MAX(first, 0);
+	last = MIN(last, EC.numRows - 1);
+	if (first >= last)
+	{
+		return -1;
+	}
+	size_t total = 0;
+	for (int j = first; j <= last; j++)
+	{
+		total += EC.row[j].size + 1;
+	}
+	char *text = malloc(total + 1);
+	if (!text)
+	{
+		terminate("[error]@editorJoinRows | malloc");
+	}
+	size_t len = EC.row[first].size;
+	memcpy(text, EC.row[first].chars, len);
+	size_t join = len;
+	for (int j = first + 1; j <= last; j++)
+	{
+		const EditorRow *row = &EC.row[j];
+		int from = editorFirstNonBlank(j);
+		join = len;
+		if (from < row->size && len && !isblank((unsigned char)text[len - 1]) && row->chars[from] != ')')
+		{
+			text[len++] = ' ';
+		}
+		memcpy(&text[len], &row->chars[from], row->size - from);
+		len += row->size - from;
+	}
+	text[len++] = '\n';
+	editorReplaceRows(first, last - first + 1, text, len);
+	free(text);
+	operatorCursor(first, join);
+	return join;
+}
+
+// puts the newest kill ring entry count times with one insert: entries of whole lines go
+// below the cursor row (above it when !after), anything else after (at) the cursor
+void editorPut(int after, int count)
+{
+	struct EditorKillRing *kr = &EC.killRing;
+	if (!kr->count || !kr->lengths[kr->newest])
+	{
+		editorSetStatusMessage("Kill ring is empty");
+		return;
+	}
+	const char *entry = kr->entries[kr->newest];
+	size_t len = kr->lengths[kr->newest];
+	count = MAX(count, 1);
+	if ((size_t)count > ((size_t)1 << 30) / len)
+	{
+		editorSetStatusMessage("Too many copies to put");
+		return;
+	}
+
+	int lines = entry[len - 1] == '\n';
+	int y = MIN(EC.cursorY, EC.numRows);
+	int x = 0;
+	// past the last row, whole lines go behind its end with the line break in front
+	int behind = 0;
+	if (lines)
+	{
+		y = after ? MIN(y + 1, EC.numRows) : y;
+		behind = y == EC.numRows && y > 0;
+	}
+	else if (y < EC.numRows)
+	{
+		x = MIN(EC.cursorX, EC.row[y].size);
+		x = (after && EC.row[y].size) ? MIN(x + 1, EC.row[y].size) : x;
+	}
+
+	size_t total = len * count;
+	char *text = malloc(total + 1);
+	if (!text)
+	{
+		terminate("[error]@editorPut | malloc");
+	}
+	char *p = text + behind;
+	for (int i = 0; i < count; i++, p += len)
+	{
+		memcpy(p, entry, len);
+	}
+	if (behind)
+	{
+		text[0] = '\n';
+	}
+	int endY, endX;
+	editorInsertText(behind ? y - 1 : y, behind ? EC.row[y - 1].size : x, text, total, &endY, &endX);
+	free(text);
+
+	if (lines)
+	{
+		operatorCursor(y, editorFirstNonBlank(y));
+	}
+	else
+	{
+		operatorCursor(endY, endX - 1);
+	}
+}
+
+/*** line commands ***/
+/*
+ * sort, uniq, keep and drop rearrange whole rows. The new order is worked out
+ * on row indices alone and then applied to the row array in place, so no text
+ * is copied and the buffer changes in one step. Indices are sorted in parallel
+ * in memory: every row is in memory already, and the two index arrays add 8
+ * bytes a row.
+ */
+
+// a slice of the indices for one sorting thread: sorts src[from, to) in place,
+// or merges src[from, mid) and src[mid, to) into dst when dst is set
+struct SortPart
+{
+	struct EditorContext *context;
+	int *src, *dst;
+	int from, mid, to;
+};
+
+// byte order like `LC_ALL=C sort`, equal rows kept in buffer order
+int sortCompareRows(const void *a, const void *b)
+{
+	int x = *(const int *)a, y = *(const int *)b;
+	const EditorRow *rx = &EC.row[x], *ry = &EC.row[y];
+	int c = memcmp(rx->chars, ry->chars, MIN(rx->size, ry->size));
+	if (!c)
+	{
+		c = (rx->size > ry->size) - (rx->size < ry->size);
+	}
+	return c ? c : (x > y) - (x < y);
+}
+
+int sortSameRows(const EditorRow *a, const EditorRow *b)
+{
+	return a->size == b->size && !memcmp(a->chars, b->chars, a->size);
+}
+
+void *sortWorker(void *arg)
+{
+	struct SortPart *part = arg;
+	editorContext = part->context;
+	if (!part->dst)
+	{
+		qsort(&part->src[part->from], part->to - part->from, sizeof(int), sortCompareRows);
+		return NULL;
+	}
+
+	int i = part->from, j = part->mid, out = part->from;
+	while (i < part->mid && j < part->to)
+	{
+		part->dst[out++] = (sortCompareRows(&part->src[j], &part->src[i]) < 0) ? part->src[j++] : part->src[i++];
+	}
+	memcpy(&part->dst[out], &part->src[i], sizeof(int) * (part->mid - i));
+	out += part->mid - i;
+	memcpy(&part->dst[out], &part->src[j], sizeof(int) * (part->to - j));
+	return NULL;
+}
+
+void sortRunParts(struct SortPart *parts, int numParts)
+{
+	pthread_t threads[HL_MAX_THREADS];
+	int started[HL_MAX_THREADS] = {0};
+	for (int i = 1; i < numParts; i++)
+	{
+		started[i] = (pthread_create(&threads[i], NULL, sortWorker, &parts[i]) == 0);
+		if (!started[i])
+		{
+			sortWorker(&parts[i]);
+		}
+	}
+	sortWorker(&parts[0]);
+	for (int i = 1; i < numParts; i++)
+	{
+		if (started[i])
+		{
+			pthread_join(threads[i], NULL);
+		}
+	}
+}
+
+// sorts order[0, n) on one slice per CPU, then merges neighbouring slices pairwise
+void sortIndices(int *order, int *scratch, int n)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int numParts = MAX(1, MIN(MIN(cpus, HL_MAX_THREADS), n / SORT_MIN_PART));
+	struct SortPart parts[HL_MAX_THREADS];
+	int bounds[HL_MAX_THREADS + 1];
+	for (int i = 0; i <= numParts; i++)
+	{
+		bounds[i] = (long long)n * i / numParts;
+	}
+	for (int i = 0; i < numParts; i++)
+	{
+		parts[i] = (struct SortPart){editorContext, order, NULL, bounds[i], bounds[i + 1], bounds[i + 1]};
+	}
+	sortRunParts(parts, numParts);
+
+	int *src = order, *dst = scratch;
+	while (numParts > 1)
+	{
+		int merged = 0;
+		for (int i = 0; i < numParts; i += 2)
+		{
+			// an odd slice out is merged with nothing, which copies it over
+			int to = bounds[MIN(i + 2, numParts)];
+			parts[merged] = (struct SortPart){editorContext, src, dst, bounds[i], bounds[i + 1], to};
+			bounds[merged++] = bounds[i];
+		}
+		bounds[merged] = n;
+		numParts = merged;
+		sortRunParts(parts, numParts);
+		int *swap = src;
+		src = dst;
+		dst = swap;
+	}
+	if (src != order)
+	{
+		memcpy(order, src, sizeof(int) * n);
+	}
+}
+
+// moves the first of every group of equal rows to the front of out, the others to its back
+int sortSplitUnique(const int *sorted, int *out, int n)
+{
+	int kept = 0, back = n;
+	for (int i = 0; i < n; i++)
+	{
+		if (kept && sortSameRows(&EC.row[sorted[i]], &EC.row[out[kept - 1]]))
+		{
+			out[--back] = sorted[i];
+		}
+		else
+		{
+			out[kept++] = sorted[i];
+		}
+	}
+	return kept;
+}
+
+// closes the gap left by the rows from first + kept to first + count, which are
+// already freed, and re-highlights the rows that were rearranged
+void editorRowsRearranged(int first, int count, int kept, int openComment)
+{
+	memmove(&EC.row[first + kept], &EC.row[first + count], sizeof(EditorRow) * (EC.numRows - first - count));
+	EC.numRows -= count - kept;
+	for (int j = first; j < EC.numRows; j++)
+	{
+		EC.row[j].index = j;
+	}
+
+	if (kept)
+	{
+		EC.row[first + kept - 1].isOpenComment = openComment;
+		if (first == 0 && kept == EC.numRows)
+		{
+			editorHighlightAll();
+		}
+		else
+		{
+			editorUpdateSyntaxRange(first, first + kept - 1);
+		}
+	}
+	else if (first < EC.numRows)
+	{
+		editorUpdateSyntaxRange(first, first);
+	}
+	editorSearchRestart();
+	EC.dirty++;
+}
+
+// moves row order[i] to first + i along the cycles of the permutation, then frees
+// the rows from first + kept on; order is used up
+void editorPermuteRows(int first, int *order, int count, int kept)
+{
+	int openComment = EC.row[first + count - 1].isOpenComment;
+	for (int i = 0; i < count; i++)
+	{
+		if (order[i] < 0)
+		{
+			continue;
+		}
+		EditorRow saved = EC.row[first + i];
+		int j = i;
+		while (order[j] - first != i)
+		{
+			int next = order[j] - first;
+			EC.row[first + j] = EC.row[first + next];
+			order[j] = -1;
+			j = next;
+		}
+		EC.row[first + j] = saved;
+		order[j] = -1;
+	}
+	for (int j = first + kept; j < first + count; j++)
+	{
+		editorFreeRow(&EC.row[j]);
+	}
+	editorRowsRearranged(first, count, kept, openComment);
+}
+
+// sorts rows first..last, dropping repeated ones with unique; returns the number dropped,
+// or -1 with errno ENOMEM and the rows untouched
+int editorSortRows(int first, int last, int unique)
+{
+	first = MAX(first, 0);
+	last = MIN(last, EC.numRows - 1);
+	int count = last - first + 1;
+	if (count < 2)
+	{
+		return 0;
+	}
+
+	int kept = count;
+	int *order = malloc(sizeof(int) * count);
+	int *scratch = malloc(sizeof(int) * count);
+	if (!order || !scratch)
+	{
+		free(order);
+		free(scratch);
+		errno = ENOMEM;
+		return -1;
+	}
+	for (int i = 0; i < count; i++)
+	{
+		order[i] = first + i;
+	}
+	sortIndices(order, scratch, count);
+	if (unique)
+	{
+		kept = sortSplitUnique(order, scratch, count);
+		int *swap = order;
+		order = scratch;
+		scratch = swap;
+	}
+	free(scratch);
+
+	editorJournalRecord(J_SORT, (int[]){first, last, unique}, NULL, 0);
+	editorPermuteRows(first, order, count, kept);
+	free(order);
+	return count - kept;
+}
+
+// removes the rows of first..last for which drop holds, in one pass that keeps the others in order;
+// kept is the last row kept before the one asked about, if any. Returns the number removed.
+int editorDropRows(int first, int last, int (*drop)(const EditorRow *row, const EditorRow *kept, void *arg), void *arg)
+{
+	int openComment = EC.row[last].isOpenComment;
+	int to = first;
+	for (int j = first; j <= last; j++)
+	{
+		if (drop(&EC.row[j], (to > first) ? &EC.row[to - 1] : NULL, arg))
+		{
+			editorFreeRow(&EC.row[j]);
+			continue;
+		}
+		EC.row[to++] = EC.row[j];
+	}
+	if (to > last)
+	{
+		return 0;
+	}
+	editorRowsRearranged(first, last - first + 1, to - first, openComment);
+	return last + 1 - to;
+}
+
+int uniqDrop(const EditorRow *row, const EditorRow *kept, void *arg)
+{
+	(void)arg;
+	return kept && sortSameRows(row, kept);
+}
+
+// removes rows equal to the one before them, like uniq(1)
+int editorUniqRows(int first, int last)
+{
+	first = MAX(first, 0);
+	last = MIN(last, EC.numRows - 1);
+	if (first >= last)
+	{
+		return 0;
+	}
+	editorJournalRecord(J_UNIQ, (int[]){first, last}, NULL, 0);
+	return editorDropRows(first, last, uniqDrop, NULL);
+}
+
+struct FilterRows
+{
+	Regex *regex;
+	int keep;
+};
+
+int filterDrop(const EditorRow *row, const EditorRow *kept, void *arg)
+{
+	(void)kept;
+	struct FilterRows *filter = arg;
+	int found = regexDfaMatchAny(&filter->regex->search, (const unsigned char *)row->chars, row->size, 0);
+	return found != filter->keep;
+}
+
+// keeps (or drops) only the rows of first..last matching pattern; returns the number removed, or -1 for a bad pattern
+int editorFilterRows(int first, int last, const char *pattern, int keep)
+{
+	first = MAX(first, 0);
+	last = MIN(last, EC.numRows - 1);
+	struct FilterRows filter = {regexCompile(pattern), keep};
+	if (!filter.regex)
+	{
+		return -1;
+	}
+	int removed = 0;
+	if (first <= last)
+	{
+		editorJournalRecord(J_FILTER, (int[]){first, last, keep}, pattern, strlen(pattern));
+		removed = editorDropRows(first, last, filterDrop, &filter);
+	}
+	regexFree(filter.regex);
+	return removed;
+}
+
+// runs "sort", "sort -u", "uniq", "keep REGEX" or "drop REGEX" over rows first..last;
+// reports the result in the status message and returns -1 if the command was not run
+int editorLineCommand(const char *command, int first, int last)
+{
+	while (isspace((unsigned char)*command))
+	{
+		command++;
+	}
+	int nameLen = strcspn(command, " \t");
+	const char *arg = command + nameLen;
+	while (isspace((unsigned char)*arg))
+	{
+		arg++;
+	}
+	int count = MIN(last, EC.numRows - 1) - MAX(first, 0) + 1;
+	long long started = journalNowMs();
+
+	if (nameLen == 4 && !strncmp(command, "sort", 4) && (!*arg || !strcmp(arg, "-u")))
+	{
+		int removed = editorSortRows(first, last, *arg != '\0');
+		if (removed == -1)
+		{
+			editorSetStatusMessage("Sort failed: %s", strerror(errno));
+			return -1;
+		}
+		editorSetStatusMessage("Sorted %d lines, %d duplicates removed (%lld ms)", MAX(count, 0), removed, journalNowMs() - started);
+	}
+	else if (nameLen == 4 && !strncmp(command, "uniq", 4) && !*arg)
+	{
+		int removed = editorUniqRows(first, last);
+		editorSetStatusMessage("Removed %d repeated lines (%lld ms)", removed, journalNowMs() - started);
+	}
+	else if (nameLen == 4 && (!strncmp(command, "keep", 4) || !strncmp(command, "drop", 4)) && *arg)
+	{
+		int removed = editorFilterRows(first, last, arg, command[0] == 'k');
+		if (removed == -1)
+		{
+			editorSetStatusMessage("Invalid pattern: %s", arg);
+			return -1;
+		}
+		editorSetStatusMessage("Removed %d of %d lines (%lld ms)", removed, MAX(count, 0), journalNowMs() - started);
+	}
+	else
+	{
+		editorSetStatusMessage("Unknown command: %s (sort, sort -u, uniq, keep REGEX, drop REGEX)", command);
+		return -1;
+	}
+	return 0;
+}
+
+/*** diff ***/
+/*
+ * The diff view compares the buffer with the file on disk line by line.
+ * Both sides are reduced to one hash per line; the file's hashes are taken
+ * again only when the file changes, the buffer's only for the rows edited
+ * since the last update (every edit passes through editorJournalRecord,
+ * which widens that window). The hashes are compared with Myers' algorithm
+ * in linear space, splitting at the middle snake of each part; parts that
+ * would cost more than about the square root of their size are split at the
+ * furthest reaching diagonal instead, which keeps huge rewrites fast at the
+ * price of a less minimal script.
+ */
+
+// one comparison: a is the file, b the buffer; forward and backward are indexed by diagonal
+struct DiffRun
+{
+	const uint64_t *a, *b;
+	int *forward, *backward;
+	unsigned char *changedA, *changedB;
+	int maxCost;
+};
+
+// widens the window of edited rows by the rows an edit is about to touch, see journalTouchedRows
+void editorDiffTouch(int first, int last)
+{
+	struct EditorDiff *df = &EC.diff;
+	if (!df->active)
+	{
+		return;
+	}
+	df->first = MIN(df->first, first);
+	df->tail = MAX(MIN(df->tail, EC.numRows - 1 - last), 0);
+}
+
+int diffSameFile(const struct stat *a, const struct stat *b)
+{
+	return a->st_dev == b->st_dev && a->st_ino == b->st_ino && a->st_size == b->st_size &&
+		   a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+// hashes the lines of the file as editorOpen would cut them into rows
+void diffLoadLines(const struct stat *st)
+{
+	struct EditorDiff *df = &EC.diff;
+	df->numLines = 0;
+	df->hasBase = (st != NULL);
+	if (!st)
+	{
+		return;
+	}
+	df->base = *st;
+
+	int fd = open(EC.filename, O_RDONLY);
+	if (fd == -1 || st->st_size == 0)
+	{
+		if (fd != -1)
+		{
+			close(fd);
+		}
+		return;
+	}
+	char *data = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		return;
+	}
+	madvise(data, st->st_size, MADV_SEQUENTIAL);
+
+	int cap = 0;
+	for (off_t offset = 0; offset < st->st_size;)
+	{
+		const char *line = &data[offset];
+		const char *lineEnd = memchr(line, '\n', st->st_size - offset);
+		size_t rawLen = lineEnd ? (size_t)(lineEnd - line) + 1 : (size_t)(st->st_size - offset);
+		size_t len = rawLen;
+		while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == ENTER_KEY))
+		{
+			len--;
+		}
+		if (df->numLines == cap)
+		{
+			cap = cap ? cap * 2 : 1024;
+			df->lineHashes = realloc(df->lineHashes, sizeof(uint64_t) * cap);
+			if (!df->lineHashes)
+			{
+				terminate("[error]@diffLoadLines | realloc");
+			}
+		}
+		df->lineHashes[df->numLines++] = hashBytes(0, line, len);
+		offset += rawLen;
+	}
+	munmap(data, st->st_size);
+}
+
+// finds where to split a[aLo, aHi) against b[bLo, bHi): on the middle snake, or
+// past the furthest reaching diagonal once the edit distance exceeds maxCost
+void diffSplit(struct DiffRun *run, int aLo, int aHi, int bLo, int bHi, int *splitA, int *splitB)
+{
+	const uint64_t *a = run->a, *b = run->b;
+	int *vf = run->forward, *vb = run->backward;
+	int dmin = aLo - bHi, dmax = aHi - bLo;
+	int fmid = aLo - bLo, bmid = aHi - bHi;
+	int fmin = fmid, fmax = fmid, bmin = bmid, bmax = bmid;
+	int odd = (fmid - bmid) & 1;
+	vf[fmid] = aLo;
+	vb[bmid] = aHi;
+
+	for (int cost = 1;; cost++)
+	{
+		// extend the forward paths by one edit; the diagonals out of range get sentinels
+		if (fmin > dmin)
+		{
+			vf[--fmin - 1] = -1;
+		}
+		else
+		{
+			++fmin;
+		}
+		if (fmax < dmax)
+		{
+			vf[++fmax + 1] = -1;
+		}
+		else
+		{
+			--fmax;
+		}
+		for (int d = fmax; d >= fmin; d -= 2)
+		{
+			int x = (vf[d - 1] >= vf[d + 1]) ? vf[d - 1] + 1 : vf[d + 1];
+			int y = x - d;
+			while (x < aHi && y < bHi && a[x] == b[y])
+			{
+				x++, y++;
+			}
+			vf[d] = x;
+			if (odd && bmin <= d && d <= bmax && vb[d] <= x)
+			{
+				*splitA = x;
+				*splitB = y;
+				return;
+			}
+		}
+
+		if (bmin > dmin)
+		{
+			vb[--bmin - 1] = INT_MAX;
+		}
+		else
+		{
+			++bmin;
+		}
+		if (bmax < dmax)
+		{
+			vb[++bmax + 1] = INT_MAX;
+		}
+		else
+		{
+			--bmax;
+		}
+		for (int d = bmax; d >= bmin; d -= 2)
+		{
+			int x = (vb[d - 1] < vb[d + 1]) ? vb[d - 1] : vb[d + 1] - 1;
+			int y = x - d;
+			while (x > aLo && y > bLo && a[x - 1] == b[y - 1])
+			{
+				x--, y--;
+			}
+			vb[d] = x;
+			if (!odd && fmin <= d && d <= fmax && x <= vf[d])
+			{
+				*splitA = x;
+				*splitB = y;
+				return;
+			}
+		}
+
+		if (cost < run->maxCost)
+		{
+			continue;
+		}
+		// too expensive: split after whichever path got furthest
+		int forwardBest = -1, forwardX = aLo;
+		for (int d = fmax; d >= fmin; d -= 2)
+		{
+			int x = MIN(vf[d], aHi);
+			int y = x - d;
+			if (y > bHi)
+			{
+				x = bHi + d;
+				y = bHi;
+			}
+			if (x + y > forwardBest)
+			{
+				forwardBest = x + y;
+				forwardX = x;
+			}
+		}
+		int backwardBest = INT_MAX, backwardX = aHi;
+		for (int d = bmax; d >= bmin; d -= 2)
+		{
+			int x = MAX(aLo, vb[d]);
+			int y = x - d;
+			if (y < bLo)
+			{
+				x = bLo + d;
+				y = bLo;
+			}
+			if (x + y < backwardBest)
+			{
+				backwardBest = x + y;
+				backwardX = x;
+			}
+		}
+		if ((aHi + bHi) - backwardBest < forwardBest - (aLo + bLo))
+		{
+			*splitA = forwardX;
+			*splitB = forwardBest - forwardX;
+		}
+		else
+		{
+			*splitA = backwardX;
+			*splitB = backwardBest - backwardX;
+		}
+		return;
+	}
+}
+
+// marks the lines of a[aLo, aHi) and b[bLo, bHi) that are not part of a longest common subsequence
+void diffCompare(struct DiffRun *run, int aLo, int aHi, int bLo, int bHi)
+{
+	while (aLo < aHi && bLo < bHi && run->a[aLo] == run->b[bLo])
+	{
+		aLo++, bLo++;
+	}
+	while (aLo < aHi && bLo < bHi && run->a[aHi - 1] == run->b[bHi - 1])
+	{
+		aHi--, bHi--;
+	}
+	if (aLo == aHi || bLo == bHi)
+	{
+		memset(&run->changedA[aLo], 1, aHi - aLo);
+		memset(&run->changedB[bLo], 1, bHi - bLo);
+		return;
+	}
+
+	int splitA, splitB;
+	diffSplit(run, aLo, aHi, bLo, bHi, &splitA, &splitB);
+	diffCompare(run, aLo, splitA, bLo, splitB);
+	diffCompare(run, splitA, aHi, splitB, bHi);
+}
+
+void diffAddHunk(int row, int rows, int line, int lines)
+{
+	struct EditorDiff *df = &EC.diff;
+	if (df->numHunks == df->hunkCap)
+	{
+		df->hunkCap = df->hunkCap ? df->hunkCap * 2 : 64;
+		df->hunks = realloc(df->hunks, sizeof(struct DiffHunk) * df->hunkCap);
+		if (!df->hunks)
+		{
+			terminate("[error]@diffAddHunk | realloc");
+		}
+	}
+	df->hunks[df->numHunks++] = (struct DiffHunk){row, rows, line, lines};
+	df->added += rows;
+	df->removed += lines;
+}
+
+// rebuilds the hunks from the hashes of both sides
+void diffComputeHunks()
+{
+	struct EditorDiff *df = &EC.diff;
+	// only the part between the common head and tail is compared
+	int head = 0, n = df->numLines, m = df->numHashed;
+	while (head < n && head < m && df->lineHashes[head] == df->rowHashes[head])
+	{
+		head++;
+	}
+	while (n > head && m > head && df->lineHashes[n - 1] == df->rowHashes[m - 1])
+	{
+		n--, m--;
+	}
+	n -= head;
+	m -= head;
+
+	struct DiffRun run = {&df->lineHashes[head], &df->rowHashes[head], NULL, NULL, NULL, NULL, DIFF_MIN_COST};
+	run.forward = malloc(sizeof(int) * (n + m + 3));
+	run.backward = malloc(sizeof(int) * (n + m + 3));
+	run.changedA = calloc(n + 1, 1);
+	run.changedB = calloc(m + 1, 1);
+	if (!run.forward || !run.backward || !run.changedA || !run.changedB)
+	{
+		terminate("[error]@diffComputeHunks | malloc");
+	}
+	// diagonals run from -(m + 1) to n + 1
+	run.forward += m + 1;
+	run.backward += m + 1;
+	while (run.maxCost * run.maxCost < n + m)
+	{
+		run.maxCost *= 2;
+	}
+	diffCompare(&run, 0, n, 0, m);
+
+	df->numHunks = df->added = df->removed = 0;
+	for (int i = 0, j = 0; i < n || j < m;)
+	{
+		if (i < n && j < m && !run.changedA[i] && !run.changedB[j])
+		{
+			i++, j++;
+			continue;
+		}
+		int line = i, row = j;
+		while (i < n && run.changedA[i])
+		{
+			i++;
+		}
+		while (j < m && run.changedB[j])
+		{
+			j++;
+		}
+		diffAddHunk(head + row, j - row, head + line, i - line);
+	}
+	free(run.forward - (m + 1));
+	free(run.backward - (m + 1));
+	free(run.changedA);
+	free(run.changedB);
+}
+
+// brings the hunks up to date with the buffer and the file on disk; returns 1 if they changed
+int editorDiffUpdate()
+{
+	struct EditorDiff *df = &EC.diff;
+	if (!df->active)
+	{
+		return 0;
+	}
+
+	struct stat st;
+	int exists = EC.filename && stat(EC.filename, &st) == 0;
+	int reload = (exists != df->hasBase) || (exists && !diffSameFile(&st, &df->base));
+	if (reload)
+	{
+		diffLoadLines(exists ? &st : NULL);
+	}
+	// rows may also have changed behind the edit hook's back, e.g. appended by the loader
+	if (reload || (df->first == INT_MAX && EC.numRows != df->numHashed))
+	{
+		df->first = 0;
+		df->tail = 0;
+	}
+	if (df->first == INT_MAX)
+	{
+		return 0;
+	}
+
+	// rows past the edited window only moved; the ones in it are hashed again
+	if (EC.numRows > df->hashCap)
+	{
+		df->hashCap = MAX(EC.numRows, df->hashCap * 2);
+		df->rowHashes = realloc(df->rowHashes, sizeof(uint64_t) * df->hashCap);
+		if (!df->rowHashes)
+		{
+			terminate("[error]@editorDiffUpdate | realloc");
+		}
+	}
+	int tail = MIN(df->tail, MIN(df->numHashed, EC.numRows));
+	int end = EC.numRows - tail;
+	memmove(&df->rowHashes[end], &df->rowHashes[df->numHashed - tail], sizeof(uint64_t) * tail);
+	for (int j = MIN(df->first, end); j < end; j++)
+	{
+		df->rowHashes[j] = hashBytes(0, EC.row[j].chars, EC.row[j].size);
+	}
+	df->numHashed = EC.numRows;
+	df->first = INT_MAX;
+	df->tail = EC.numRows;
+
+	diffComputeHunks();
+	return 1;
+}
+
+int editorDiffToggle()
+{
+	struct EditorDiff *df = &EC.diff;
+	df->active = !df->active;
+	if (df->active)
+	{
+		// start over: read the file again and hash every row
+		df->hasBase = -1;
+		editorDiffUpdate();
+	}
+	return df->active;
+}
+
+// the index of the first hunk starting after row, or numHunks
+int diffHunkAfter(int row)
+{
+	struct EditorDiff *df = &EC.diff;
+	int lo = 0, hi = df->numHunks;
+	while (lo < hi)
+	{
+		int mid = lo + (hi - lo) / 2;
+		if (df->hunks[mid].row <= row)
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+// how the diff view marks a row, see enum DiffMarker
+int editorDiffMarker(int row)
+{
+	struct EditorDiff *df = &EC.diff;
+	if (!df->active || !df->numHunks)
+	{
+		return DIFF_NONE;
+	}
+	int next = diffHunkAfter(row);
+	if (next > 0)
+	{
+		const struct DiffHunk *hunk = &df->hunks[next - 1];
+		if (row < hunk->row + hunk->rows)
+		{
+			return hunk->lines ? DIFF_CHANGED : DIFF_ADDED;
+		}
+		// lines removed in front of the first row are shown on it
+		if (row == 0 && hunk->row == 0 && !hunk->rows)
+		{
+			return DIFF_REMOVED;
+		}
+	}
+	// removed lines are shown on the row above them, the last ones on the last row
+	if (next < df->numHunks && df->hunks[next].row == row + 1 && !df->hunks[next].rows)
+	{
+		return DIFF_REMOVED;
+	}
+	if (row == EC.numRows - 1 && df->hunks[df->numHunks - 1].row == EC.numRows)
+	{
+		return DIFF_REMOVED;
+	}
+	return DIFF_NONE;
+}
+
+// moves the cursor to the start of the next (or previous) hunk, wrapping around; returns -1 without hunks
+int editorDiffJump(int forward)
+{
+	struct EditorDiff *df = &EC.diff;
+	if (!df->numHunks)
+	{
+		editorSetStatusMessage("No differences from the file on disk");
+		return -1;
+	}
+	int at;
+	if (forward)
+	{
+		at = diffHunkAfter(EC.cursorY);
+		at = (at == df->numHunks) ? 0 : at;
+	}
+	else
+	{
+		// hunks starting before the cursor row
+		at = diffHunkAfter(EC.cursorY - 1) - 1;
+		at = (at < 0) ? df->numHunks - 1 : at;
+	}
+	const struct DiffHunk *hunk = &df->hunks[at];
+	EC.cursorY = MIN(hunk->row, MAX(EC.numRows - 1, 0));
+	EC.cursorX = 0;
+	EC.cursorXS = 0;
+	editorSetStatusMessage("Hunk %d/%d: lines %d-%d of the file, -%d +%d", at + 1, df->numHunks, hunk->line + 1,
+						   hunk->line + MAX(hunk->lines, 1), hunk->lines, hunk->rows);
+	return at;
+}
+
+/*** folding ***/
+/*
+ * Closed folds are kept as a sorted array of disjoint row ranges, each with
+ * the number of rows hidden by the folds before it. Mapping a row to its
+ * line on screen and back, or stepping over a fold, is a binary search.
+ * Edits move the folds after them and open the ones they touch, using the
+ * same window of edited rows as the diff view.
+ *
+ * Blocks are found by braces (outside strings and comments) for syntaxes
+ * with HL_FOLD_BRACES, by indentation otherwise.
+ */
+
+void editorFoldTouch(int first, int last)
+{
+	struct EditorFolds *fd = &EC.folds;
+	if (!fd->numFolds)
+	{
+		return;
+	}
+	fd->first = MIN(fd->first, first);
+	fd->tail = MAX(MIN(fd->tail, EC.numRows - 1 - last), 0);
+}
+
+// recomputes the rows hidden before each fold from index from on
+void foldRecount(int from)
+{
+	struct EditorFolds *fd = &EC.folds;
+	for (int i = MAX(from, 1); i < fd->numFolds; i++)
+	{
+		const struct Fold *prev = &fd->folds[i - 1];
+		fd->folds[i].hidden = prev->hidden + prev->end - prev->start;
+	}
+	if (from == 0 && fd->numFolds)
+	{
+		fd->folds[0].hidden = 0;
+	}
+}
+
+// shifts the folds past the rows edited since the last call and opens the ones among them
+void editorFoldSync()
+{
+	struct EditorFolds *fd = &EC.folds;
+	if (fd->first != INT_MAX)
+	{
+		int untouched = fd->numRows - fd->tail;
+		int delta = EC.numRows - fd->numRows;
+		int kept = 0;
+		for (int i = 0; i < fd->numFolds; i++)
+		{
+			struct Fold fold = fd->folds[i];
+			if (fold.start >= untouched)
+			{
+				fold.start += delta;
+				fold.end += delta;
+			}
+			else if (fold.end >= fd->first)
+			{
+				continue;
+			}
+			fd->folds[kept++] = fold;
+		}
+		fd->numFolds = kept;
+		foldRecount(0);
+		fd->first = INT_MAX;
+	}
+	// rows the loader appends come after every fold
+	fd->tail = fd->numRows = EC.numRows;
+}
+
+// the number of folds starting before row
+int foldsBefore(int row)
+{
+	struct EditorFolds *fd = &EC.folds;
+	int lo = 0, hi = fd->numFolds;
+	while (lo < hi)
+	{
+		int mid = lo + (hi - lo) / 2;
+		if (fd->folds[mid].start < row)
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+void foldRemove(int i)
+{
+	struct EditorFolds *fd = &EC.folds;
+	memmove(&fd->folds[i], &fd->folds[i + 1], sizeof(struct Fold) * (fd->numFolds - i - 1));
+	fd->numFolds--;
+	foldRecount(i);
+}
+
+// closes start..end, merging the folds it overlaps
+void foldAdd(int start, int end)
+{
+	struct EditorFolds *fd = &EC.folds;
+	int from = foldsBefore(start);
+	if (from > 0 && fd->folds[from - 1].end >= start)
+	{
+		from--;
+	}
+	int to = from;
+	while (to < fd->numFolds && fd->folds[to].start <= end)
+	{
+		to++;
+	}
+	if (to > from)
+	{
+		start = MIN(start, fd->folds[from].start);
+		end = MAX(end, fd->folds[to - 1].end);
+	}
+
+	if (fd->numFolds + 1 > fd->cap)
+	{
+		fd->cap = fd->cap ? fd->cap * 2 : 64;
+		fd->folds = realloc(fd->folds, sizeof(struct Fold) * fd->cap);
+		if (!fd->folds)
+		{
+			terminate("[error]@foldAdd | realloc");
+		}
+	}
+	memmove(&fd->folds[from + 1], &fd->folds[to], sizeof(struct Fold) * (fd->numFolds - to));
+	fd->numFolds += 1 - (to - from);
+	fd->folds[from] = (struct Fold){start, end, 0};
+	foldRecount(from);
+}
+
+// the row shown after row, stepping over a fold it heads
+int editorFoldNext(int row)
+{
+	editorFoldSync();
+	int i = foldsBefore(row + 1) - 1;
+	if (i >= 0 && row + 1 <= EC.folds.folds[i].end)
+	{
+		return EC.folds.folds[i].end + 1;
+	}
+	return row + 1;
+}
+
+// the row shown before row, the head of a fold ending right above it
+int editorFoldPrev(int row)
+{
+	editorFoldSync();
+	int i = foldsBefore(row - 1) - 1;
+	if (i >= 0 && row - 1 <= EC.folds.folds[i].end)
+	{
+		return EC.folds.folds[i].start;
+	}
+	return row - 1;
+}
+
+// the line a row is shown on, counting from the top of the buffer; hidden rows are on their fold's
+int editorFoldVisible(int row)
+{
+	editorFoldSync();
+	int i = foldsBefore(row) - 1;
+	if (i < 0)
+	{
+		return row;
+	}
+	const struct Fold *fold = &EC.folds.folds[i];
+	if (row <= fold->end)
+	{
+		return fold->start - fold->hidden;
+	}
+	return row - fold->hidden - (fold->end - fold->start);
+}
+
+// the row shown on a line, see editorFoldVisible
+int editorFoldRowAt(int visible)
+{
+	editorFoldSync();
+	struct EditorFolds *fd = &EC.folds;
+	int lo = 0, hi = fd->numFolds;
+	while (lo < hi)
+	{
+		int mid = lo + (hi - lo) / 2;
+		if (fd->folds[mid].start - fd->folds[mid].hidden < visible)
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+	if (!lo)
+	{
+		return visible;
+	}
+	const struct Fold *fold = &fd->folds[lo - 1];
+	return visible + fold->hidden + fold->end - fold->start;
+}
+
+// the number of rows hidden under row when it heads a closed fold
+int editorFoldHidden(int row)
+{
+	editorFoldSync();
+	int i = foldsBefore(row + 1) - 1;
+	if (i >= 0 && EC.folds.folds[i].start == row)
+	{
+		return EC.folds.folds[i].end - row;
+	}
+	return 0;
+}
+
+// opens the fold hiding row; returns 1 if there was one
+int editorFoldReveal(int row)
+{
+	editorFoldSync();
+	int i = foldsBefore(row) - 1;
+	if (i < 0 || row > EC.folds.folds[i].end)
+	{
+		return 0;
+	}
+	foldRemove(i);
+	return 1;
+}
+
+// counts the code braces of a row, outside strings and comments: the closing ones
+// without an opening one before them, then the opening ones left unclosed
+void foldRowBraces(int at, int *closes, int *opens)
+{
+	EditorRow *row = &EC.row[at];
+	const char *render = editorRowRender(row);
+	*closes = *opens = 0;
+	if (!memchr(render, '{', row->rsize) && !memchr(render, '}', row->rsize))
+	{
+		return;
+	}
+	if (row->highlightLen < 0)
+	{
+		editorUpdateSyntaxRange(at, at);
+	}
+
+	const unsigned char *span = editorRowSpans(row);
+	const unsigned char *spansEnd = span + row->highlightLen;
+	int spanEnd = 0, hl = HL_NORMAL;
+	for (int i = 0; i < row->rsize; i++)
+	{
+		if (render[i] != '{' && render[i] != '}')
+		{
+			continue;
+		}
+		while (i >= spanEnd)
+		{
+			int length = INT_MAX - spanEnd;
+			hl = (span < spansEnd) ? spanNext(&span, &length) : HL_NORMAL;
+			spanEnd += length;
+		}
+		if (hl == HL_STRING || hl == HL_COMMENT || hl == HL_MLCOMMENT)
+		{
+			continue;
+		}
+		if (render[i] == '{')
+		{
+			(*opens)++;
+		}
+		else if (*opens)
+		{
+			(*opens)--;
+		}
+		else
+		{
+			(*closes)++;
+		}
+	}
+}
+
+// the indentation of a row in columns, or -1 if it is blank
+int foldIndent(int at)
+{
+	const EditorRow *row = &EC.row[at];
+	int indent = 0;
+	for (int i = 0; i < row->size; i++)
+	{
+		if (row->chars[i] == '\t')
+		{
+			indent += TAB_STOP - indent % TAB_STOP;
+		}
+		else if (row->chars[i] == ' ')
+		{
+			indent++;
+		}
+		else
+		{
+			return indent;
+		}
+	}
+	return -1;
+}
+
+int foldByBraces()
+{
+	return EC.syntax && (EC.syntax->flags & HL_FOLD_BRACES);
+}
+
+// the row to fold a brace block under: the row before a lone `{` (Allman style), else at itself
+int foldHeader(int at)
+{
+	const EditorRow *row = &EC.row[at];
+	int indent = 0;
+	while (indent < row->size && isspace((unsigned char)row->chars[indent]))
+	{
+		indent++;
+	}
+	if (at == 0 || row->size - indent != 1 || row->chars[indent] != '{' || foldIndent(at - 1) < 0)
+	{
+		return at;
+	}
+	int closes, opens;
+	foldRowBraces(at - 1, &closes, &opens);
+	return (closes || opens) ? at : at - 1;
+}
+
+// the last row of the block row at opens, or -1. With braces that is the block of its last
+// unclosed brace; a closing row that opens the next block (`} else {`) is left out of it.
+int foldBlockEnd(int at)
+{
+	if (foldByBraces())
+	{
+		int closes, opens;
+		foldRowBraces(at, &closes, &opens);
+		if (!opens)
+		{
+			return (at + 1 < EC.numRows && foldHeader(at + 1) == at) ? foldBlockEnd(at + 1) : -1;
+		}
+		for (int j = at + 1, depth = 1; j < EC.numRows; j++)
+		{
+			foldRowBraces(j, &closes, &opens);
+			if (closes >= depth)
+			{
+				return opens ? j - 1 : j;
+			}
+			depth += opens - closes;
+		}
+		return -1;
+	}
+
+	int indent = foldIndent(at);
+	int end = -1;
+	for (int j = at + 1; indent >= 0 && j < EC.numRows; j++)
+	{
+		int rowIndent = foldIndent(j);
+		if (rowIndent < 0)
+		{
+			continue;
+		}
+		if (rowIndent <= indent)
+		{
+			break;
+		}
+		end = j;
+	}
+	return end;
+}
+
+// the row opening the innermost block around row at, not counting the blocks at itself opens; -1 if none
+int foldBlockStart(int at)
+{
+	if (foldByBraces())
+	{
+		// closing braces below that still wait for their opening one
+		int pending = 0;
+		for (int j = at - 1; j >= 0; j--)
+		{
+			int closes, opens;
+			foldRowBraces(j, &closes, &opens);
+			if (opens > pending)
+			{
+				return foldHeader(j);
+			}
+			pending += closes - opens;
+		}
+		return -1;
+	}
+
+	int indent = foldIndent(at);
+	indent = (indent < 0) ? INT_MAX : indent;
+	for (int j = at - 1; indent > 0 && j >= 0; j--)
+	{
+		int rowIndent = foldIndent(j);
+		if (rowIndent >= 0 && rowIndent < indent)
+		{
+			return j;
+		}
+	}
+	return -1;
+}
+
+// opens the fold row heads, or closes the innermost block around it; returns 1 when
+// a fold was closed, 0 when one was opened and -1 when row is in no block
+int editorFoldToggle(int row)
+{
+	editorFoldSync();
+	int i = foldsBefore(row + 1) - 1;
+	if (i >= 0 && EC.folds.folds[i].start == row)
+	{
+		foldRemove(i);
+		return 0;
+	}
+
+	int start = foldByBraces() ? foldHeader(row) : row;
+	int end = foldBlockEnd(start);
+	while (end <= row && (start = foldBlockStart(start)) != -1)
+	{
+		end = foldBlockEnd(start);
+		if (end < row)
+		{
+			end = -1;
+		}
+	}
+	if (start == -1 || end <= start)
+	{
+		return -1;
+	}
+	foldAdd(start, end);
+	return 1;
+}
+
+// folds rows first..last under first; returns -1 for fewer than two rows
+int editorFoldRows(int first, int last)
+{
+	editorFoldSync();
+	first = MAX(first, 0);
+	last = MIN(last, EC.numRows - 1);
+	if (first >= last)
+	{
+		return -1;
+	}
+	foldAdd(first, last);
+	return 0;
+}
+
+// closes every outermost block in one pass over the rows; returns the number of folds
+int editorFoldAll()
+{
+	editorFoldSync();
+	struct EditorFolds *fd = &EC.folds;
+	fd->numFolds = 0;
+	int header = -1, depth = 0;
+	for (int j = 0; j < EC.numRows; j++)
+	{
+		int start = -1, end = -1;
+		if (foldByBraces())
+		{
+			int closes, opens;
+			foldRowBraces(j, &closes, &opens);
+			if (depth && closes >= depth)
+			{
+				start = header;
+				end = opens ? j - 1 : j;
+				depth = 0;
+			}
+			else if (depth)
+			{
+				depth -= closes;
+			}
+			if (opens)
+			{
+				header = depth ? header : foldHeader(j);
+				depth += opens;
+			}
+		}
+		else if ((end = foldBlockEnd(j)) > j)
+		{
+			start = j;
+		}
+		if (start == -1 || end <= start)
+		{
+			continue;
+		}
+
+		if (fd->numFolds == fd->cap)
+		{
+			fd->cap = fd->cap ? fd->cap * 2 : 64;
+			fd->folds = realloc(fd->folds, sizeof(struct Fold) * fd->cap);
+			if (!fd->folds)
+			{
+				terminate("[error]@editorFoldAll | realloc");
+			}
+		}
+		fd->folds[fd->numFolds++] = (struct Fold){start, end, 0};
+		if (!foldByBraces())
+		{
+			j = end;
+		}
+	}
+	foldRecount(0);
+	return fd->numFolds;
+}
+
+void editorUnfoldAll()
+{
+	EC.folds.numFolds = 0;
+}
+
+/*** brackets ***/
+/*
+ * Matching brackets are found by depth: every row keeps a summary of its code
+ * brackets (see struct BracketSummary), dropped whenever the row is lexed
+ * again so it follows each edited line, and blocks of BRACKET_BLOCK_ROWS rows
+ * summarise those again. A match is the first bracket past the depth it was opened at, found
+ * by skipping whole blocks and rows on their summaries and reading only the
+ * row it is in. All kinds of bracket share one depth.
+ */
+
+static const signed char bracketDelta[256] = {['('] = 1, ['['] = 1, ['{'] = 1, [')'] = -1, [']'] = -1, ['}'] = -1};
+
+// brackets in strings and comments don't count
+int bracketSkips(int hl)
+{
+	return hl == HL_STRING || hl == HL_COMMENT || hl == HL_MLCOMMENT;
+}
+
+// summarises a row from its highlight spans, see struct BracketSummary
+void bracketSummarize(EditorRow *row)
+{
+	const unsigned char *render = (const unsigned char *)editorRowRender(row);
+	const unsigned char *span = editorRowSpans(row);
+	const unsigned char *spansEnd = span + row->highlightLen;
+	struct BracketSummary summary = {0, BRACKET_NONE, BRACKET_NONE};
+	// one span at a time, passing over strings and comments whole
+	for (int i = 0; i < row->rsize;)
+	{
+		int end = row->rsize, hl = HL_NORMAL;
+		if (span < spansEnd)
+		{
+			int length;
+			hl = spanNext(&span, &length);
+			end = MIN(i + length, row->rsize);
+		}
+		if (bracketSkips(hl))
+		{
+			i = end;
+			continue;
+		}
+		for (; i < end; i++)
+		{
+			int delta = bracketDelta[render[i]];
+			if (delta)
+			{
+				summary.minBefore = MIN(summary.minBefore, summary.net);
+				summary.net += delta;
+				summary.minAfter = MIN(summary.minAfter, summary.net);
+			}
+		}
+	}
+	row->brackets = summary;
+}
+
+void editorBracketTouch(int first, int last)
+{
+	struct EditorBrackets *bk = &EC.brackets;
+	bk->generation++;
+	bk->first = MIN(bk->first, first);
+	bk->tail = MAX(MIN(bk->tail, EC.numRows - 1 - last), 0);
+}
+
+// drops the block summaries of the rows edited since the last call
+void editorBracketSync()
+{
+	struct EditorBrackets *bk = &EC.brackets;
+	int numBlocks = (EC.numRows + BRACKET_BLOCK_ROWS - 1) / BRACKET_BLOCK_ROWS;
+	if (numBlocks > bk->cap)
+	{
+		int cap = MAX(numBlocks, bk->cap * 2);
+		bk->blocks = realloc(bk->blocks, sizeof(struct BracketSummary) * cap);
+		bk->valid = realloc(bk->valid, cap);
+		if (!bk->blocks || !bk->valid)
+		{
+			terminate("[error]@editorBracketSync | realloc");
+		}
+		memset(&bk->valid[bk->cap], 0, cap - bk->cap);
+		bk->cap = cap;
+	}
+
+	// rows that moved invalidate every block after them; the loader only appends
+	int from = numBlocks, to = numBlocks - 1;
+	if (bk->first != INT_MAX)
+	{
+		from = bk->first / BRACKET_BLOCK_ROWS;
+		if (EC.numRows == bk->numRows)
+		{
+			to = MIN((EC.numRows - 1 - bk->tail) / BRACKET_BLOCK_ROWS, numBlocks - 1);
+		}
+	}
+	if (EC.numRows != bk->numRows)
+	{
+		from = MIN(from, MIN(bk->numRows, EC.numRows) / BRACKET_BLOCK_ROWS);
+	}
+	if (from <= to)
+	{
+		memset(&bk->valid[from], 0, to - from + 1);
+	}
+	bk->numBlocks = numBlocks;
+	bk->first = INT_MAX;
+	bk->tail = bk->numRows = EC.numRows;
+}
+
+const struct BracketSummary *bracketRow(int at)
+{
+	EditorRow *row = &EC.row[at];
+	if (row->highlightLen < 0)
+	{
+		editorUpdateSyntaxRange(at, at);
+	}
+	if (row->brackets.net == BRACKET_STALE)
+	{
+		bracketSummarize(row);
+	}
+	return &row->brackets;
+}
+
+const struct BracketSummary *bracketBlock(int block)
+{
+	struct EditorBrackets *bk = &EC.brackets;
+	if (!bk->valid[block])
+	{
+		struct BracketSummary summary = {0, BRACKET_NONE, BRACKET_NONE};
+		int last = MIN((block + 1) * BRACKET_BLOCK_ROWS, EC.numRows);
+		for (int at = block * BRACKET_BLOCK_ROWS; at < last; at++)
+		{
+			const struct BracketSummary *row = bracketRow(at);
+			summary.minBefore = MIN(summary.minBefore, summary.net + row->minBefore);
+			summary.minAfter = MIN(summary.minAfter, summary.net + row->minAfter);
+			summary.net += row->net;
+		}
+		bk->blocks[block] = summary;
+		bk->valid[block] = 1;
+	}
+	return &bk->blocks[block];
+}
+
+void bracketLineReserve(struct BracketLine *line)
+{
+	line->cap = line->cap ? line->cap * 2 : BRACKET_CHUNK;
+	line->cols = realloc(line->cols, sizeof(int) * line->cap);
+	line->depths = realloc(line->depths, sizeof(int) * line->cap);
+	line->kinds = realloc(line->kinds, line->cap);
+	line->chunks = realloc(line->chunks, sizeof(struct BracketSummary) * (line->cap / BRACKET_CHUNK));
+	if (!line->cols || !line->depths || !line->kinds || !line->chunks)
+	{
+		terminate("[error]@bracketLineReserve | realloc");
+	}
+}
+
+// the brackets of a row, kept for the last two rows asked for
+struct BracketLine *bracketLine(int at)
+{
+	struct EditorBrackets *bk = &EC.brackets;
+	for (int i = 0; i < 2; i++)
+	{
+		struct BracketLine *line = &bk->lines[i];
+		if (line->cols && line->row == at && line->generation == bk->generation)
+		{
+			bk->lastLine = i;
+			return line;
+		}
+	}
+	bk->lastLine ^= 1;
+	struct BracketLine *line = &bk->lines[bk->lastLine];
+	line->row = at;
+	line->generation = bk->generation;
+	line->count = 0;
+	if (!line->cols)
+	{
+		bracketLineReserve(line);
+	}
+
+	EditorRow *row = &EC.row[at];
+	if (row->highlightLen < 0)
+	{
+		editorUpdateSyntaxRange(at, at);
+	}
+	const char *render = editorRowRender(row);
+	const unsigned char *span = editorRowSpans(row);
+	const unsigned char *spansEnd = span + row->highlightLen;
+	int spanEnd = 0, hl = HL_NORMAL, depth = 0;
+	for (int i = 0; i < row->rsize; i++)
+	{
+		int delta = bracketDelta[(unsigned char)render[i]];
+		if (!delta)
+		{
+			continue;
+		}
+		while (i >= spanEnd)
+		{
+			int length = INT_MAX - spanEnd;
+			hl = (span < spansEnd) ? spanNext(&span, &length) : HL_NORMAL;
+			spanEnd += length;
+		}
+		if (bracketSkips(hl))
+		{
+			continue;
+		}
+
+		if (line->count == line->cap)
+		{
+			bracketLineReserve(line);
+		}
+		int j = line->count++;
+		line->cols[j] = i;
+		line->depths[j] = depth;
+		line->kinds[j] = render[i];
+		depth += delta;
+
+		struct BracketSummary *chunk = &line->chunks[j / BRACKET_CHUNK];
+		if (j % BRACKET_CHUNK == 0)
+		{
+			*chunk = (struct BracketSummary){0, BRACKET_NONE, BRACKET_NONE};
+		}
+		chunk->minBefore = MIN(chunk->minBefore, depth - delta);
+		chunk->minAfter = MIN(chunk->minAfter, depth);
+	}
+	return line;
+}
+
+// the first bracket from index from on that leaves depth at most limit, or -1
+int bracketLineForward(const struct BracketLine *line, int from, int limit)
+{
+	for (int j = from; j < line->count;)
+	{
+		if (j % BRACKET_CHUNK == 0 && line->chunks[j / BRACKET_CHUNK].minAfter > limit)
+		{
+			j += BRACKET_CHUNK;
+			continue;
+		}
+		if (line->depths[j] + bracketDelta[(unsigned char)line->kinds[j]] <= limit)
+		{
+			return j;
+		}
+		j++;
+	}
+	return -1;
+}
+
+// the last bracket up to index from that is entered at depth at most limit, or -1
+int bracketLineBackward(const struct BracketLine *line, int from, int limit)
+{
+	for (int j = from; j >= 0;)
+	{
+		if (j % BRACKET_CHUNK == BRACKET_CHUNK - 1 && line->chunks[j / BRACKET_CHUNK].minBefore > limit)
+		{
+			j -= BRACKET_CHUNK;
+			continue;
+		}
+		if (line->depths[j] <= limit)
+		{
+			return j;
+		}
+		j--;
+	}
+	return -1;
+}
+
+// the row after row at where the depth falls to limit (relative to the start of at), or -1;
+// *depth gets the depth at the start of that row
+int bracketRowsForward(int at, int limit, int *depth)
+{
+	int d = bracketRow(at)->net;
+	for (int k = at + 1; k < EC.numRows;)
+	{
+		if (k % BRACKET_BLOCK_ROWS == 0)
+		{
+			const struct BracketSummary *block = bracketBlock(k / BRACKET_BLOCK_ROWS);
+			if (d + block->minAfter > limit)
+			{
+				d += block->net;
+				k += BRACKET_BLOCK_ROWS;
+				continue;
+			}
+		}
+		const struct BracketSummary *row = bracketRow(k);
+		if (d + row->minAfter <= limit)
+		{
+			*depth = d;
+			return k;
+		}
+		d += row->net;
+		k++;
+	}
+	return -1;
+}
+
+// the row before row at where a bracket is entered at depth limit, see bracketRowsForward
+int bracketRowsBackward(int at, int limit, int *depth)
+{
+	int d = 0;
+	for (int k = at - 1; k >= 0;)
+	{
+		if (k % BRACKET_BLOCK_ROWS == BRACKET_BLOCK_ROWS - 1)
+		{
+			const struct BracketSummary *block = bracketBlock(k / BRACKET_BLOCK_ROWS);
+			if (d - block->net + block->minBefore > limit)
+			{
+				d -= block->net;
+				k -= BRACKET_BLOCK_ROWS;
+				continue;
+			}
+		}
+		const struct BracketSummary *row = bracketRow(k);
+		d -= row->net;
+		if (d + row->minBefore <= limit)
+		{
+			*depth = d;
+			return k;
+		}
+		k--;
+	}
+	return -1;
+}
+
+// the index of the bracket at render column col of a line, or -1
+int bracketLineAt(const struct BracketLine *line, int col)
+{
+	int lo = 0, hi = line->count;
+	while (lo < hi)
+	{
+		int mid = lo + (hi - lo) / 2;
+		if (line->cols[mid] < col)
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+	return (lo < line->count && line->cols[lo] == col) ? lo : -1;
+}
+
+// finds the bracket matching the one at column x of row, or else right before it; returns 1
+// with the column of that bracket in *atX and its match, 0 if there is none or it is of another kind
+int editorBracketMatch(int row, int x, int *atX, int *matchRow, int *matchX)
+{
+	if (row < 0 || row >= EC.numRows)
+	{
+		return 0;
+	}
+	EditorRow *r = &EC.row[row];
+	int here = (x < r->size && bracketDelta[(unsigned char)r->chars[x]]);
+	if (!here && !(x > 0 && x <= r->size && bracketDelta[(unsigned char)r->chars[x - 1]]))
+	{
+		return 0;
+	}
+	editorBracketSync();
+	struct BracketLine *line = bracketLine(row);
+	int i = here ? bracketLineAt(line, editorRowCursorXToRenderX(r, x)) : -1;
+	if (i == -1 && x > 0)
+	{
+		i = bracketLineAt(line, editorRowCursorXToRenderX(r, x - 1));
+		x--;
+	}
+	if (i == -1)
+	{
+		return 0;
+	}
+
+	// depths relative to the start of row; brackets in it come before any other row
+	char kind = line->kinds[i];
+	int depth = line->depths[i];
+	int at = row, j;
+	if (bracketDelta[(unsigned char)kind] > 0)
+	{
+		j = bracketLineForward(line, i + 1, depth);
+		if (j == -1)
+		{
+			int start;
+			if ((at = bracketRowsForward(row, depth, &start)) == -1)
+			{
+				return 0;
+			}
+			line = bracketLine(at);
+			j = bracketLineForward(line, 0, depth - start);
+		}
+	}
+	else
+	{
+		j = bracketLineBackward(line, i - 1, depth - 1);
+		if (j == -1)
+		{
+			int start;
+			if ((at = bracketRowsBackward(row, depth - 1, &start)) == -1)
+			{
+				return 0;
+			}
+			line = bracketLine(at);
+			j = bracketLineBackward(line, line->count - 1, depth - 1 - start);
+		}
+	}
+
+	static const char *pairs = "()[]{}";
+	int k = strchr(pairs, kind) - pairs;
+	if (j == -1 || line->kinds[j] != pairs[k ^ 1])
+	{
+		return 0;
+	}
+	*atX = x;
+	*matchRow = at;
+	*matchX = editorRowCursorXAt(&EC.row[at], line->cols[j]);
+	return 1;
+}
+
+/*** completion ***/
+/*
+ * Completion offers the words of the buffer that start with the one before
+ * the cursor, best first: the ones that occur often and close to the cursor.
+ * The distinct words live in an arena, counted through a hash table and
+ * ranged by prefix through an index kept in byte order. Edits take the rows
+ * they are about to change out of the counts (editorWordsTouch) and the next
+ * query counts them again, so a query reads the rows edited since the last
+ * one and the rows around the cursor, never the whole buffer.
+ */
+
+int wordChar(unsigned char c)
+{
+	return isalnum(c) || c == '_' || c >= 0x80;
+}
+
+// finds the next word of s from *i on; returns its length and start, or 0
+int wordNext(const char *s, int len, int *i, int *start)
+{
+	while (*i < len)
+	{
+		while (*i < len && !wordChar(s[*i]))
+		{
+			(*i)++;
+		}
+		*start = *i;
+		while (*i < len && wordChar(s[*i]))
+		{
+			(*i)++;
+		}
+		int n = *i - *start;
+		if (n >= WORD_MIN_LEN && n <= WORD_MAX_LEN && !isdigit((unsigned char)s[*start]))
+		{
+			return n;
+		}
+	}
+	return 0;
+}
+
+// the index of a word, or -1; *slot receives its slot or the free one it would take
+int wordFind(const char *s, int len, uint32_t hash, int *slot)
+{
+	struct EditorWords *wd = &EC.words;
+	int mask = wd->numSlots - 1;
+	for (int i = hash & mask;; i = (i + 1) & mask)
+	{
+		int w = wd->slots[i] - 1;
+		if (w == -1 || (wd->words[w].hash == hash && wd->words[w].len == len &&
+						!memcmp(&wd->arena[wd->words[w].offset], s, len)))
+		{
+			*slot = i;
+			return w;
+		}
+	}
+}
+
+void wordsRehash(int numSlots)
+{
+	struct EditorWords *wd = &EC.words;
+	free(wd->slots);
+	if ((wd->slots = calloc(numSlots, sizeof(int))) == NULL)
+	{
+		terminate("[error]@wordsRehash | calloc");
+	}
+	wd->numSlots = numSlots;
+	for (int w = 0; w < wd->numWords; w++)
+	{
+		int i = wd->words[w].hash & (numSlots - 1);
+		while (wd->slots[i])
+		{
+			i = (i + 1) & (numSlots - 1);
+		}
+		wd->slots[i] = w + 1;
+	}
+}
+
+// adds delta to the count of a word, entering it when it is new
+void wordsCount(const char *s, int len, int delta)
+{
+	struct EditorWords *wd = &EC.words;
+	uint32_t hash = (uint32_t)hashBytes(0, s, len);
+	int slot;
+	int w = wordFind(s, len, hash, &slot);
+	if (w == -1)
+	{
+		if (wd->numWords == wd->cap)
+		{
+			wd->cap = wd->cap ? wd->cap * 2 : 1024;
+			if ((wd->words = realloc(wd->words, sizeof(struct Word) * wd->cap)) == NULL ||
+				(wd->sorted = realloc(wd->sorted, sizeof(int) * wd->cap)) == NULL)
+			{
+				terminate("[error]@wordsCount | realloc");
+			}
+		}
+		if (wd->arenaLen + len > wd->arenaCap)
+		{
+			wd->arenaCap = MAX(wd->arenaCap * 2, 65536);
+			if ((wd->arena = realloc(wd->arena, wd->arenaCap)) == NULL)
+			{
+				terminate("[error]@wordsCount | realloc");
+			}
+		}
+		memcpy(&wd->arena[wd->arenaLen], s, len);
+		w = wd->numWords++;
+		wd->words[w] = (struct Word){(uint32_t)wd->arenaLen, hash, len, 0, 0, 0};
+		wd->arenaLen += len;
+		wd->slots[slot] = w + 1;
+		wd->dead++;
+		if (wd->numWords * 2 > wd->numSlots)
+		{
+			wordsRehash(wd->numSlots * 2);
+		}
+	}
+	struct Word *word = &wd->words[w];
+	wd->dead -= word->count == 0;
+	word->count += delta;
+	wd->dead += word->count == 0;
+}
+
+void wordsRow(int at, int delta)
+{
+	const EditorRow *row = &EC.row[at];
+	int i = 0, start, len;
+	while ((len = wordNext(row->chars, row->size, &i, &start)))
+	{
+		wordsCount(&row->chars[start], len, delta);
+	}
+}
+
+// counts the rows taken out by the edits since the last query again
+void editorWordsSync()
+{
+	struct EditorWords *wd = &EC.words;
+	if (!wd->active || wd->first == INT_MAX)
+	{
+		return;
+	}
+	for (int at = wd->first; at < EC.numRows - wd->tail; at++)
+	{
+		wordsRow(at, 1);
+	}
+	wd->first = INT_MAX;
+}
+
+// rows first to last are about to change; rows before the edit count
+void editorWordsTouch(int first, int last)
+{
+	struct EditorWords *wd = &EC.words;
+	if (!wd->active)
+	{
+		return;
+	}
+	last = MIN(last, EC.numRows - 1);
+	// only one run of rows is out at a time, a separate edit puts the last one back first
+	if (wd->first != INT_MAX && (first > EC.numRows - wd->tail || last < wd->first - 1))
+	{
+		editorWordsSync();
+	}
+	if (wd->first == INT_MAX)
+	{
+		for (int at = first; at <= last; at++)
+		{
+			wordsRow(at, -1);
+		}
+		wd->first = first;
+		wd->tail = EC.numRows - 1 - last;
+		return;
+	}
+	for (int at = first; at <= last; at++)
+	{
+		if (at < wd->first || at >= EC.numRows - wd->tail)
+		{
+			wordsRow(at, -1);
+		}
+	}
+	wd->first = MIN(wd->first, first);
+	wd->tail = MAX(MIN(wd->tail, EC.numRows - 1 - last), 0);
+}
+
+// counts the rows the loader appended
+void editorWordsRowsAppended(int oldNumRows)
+{
+	struct EditorWords *wd = &EC.words;
+	if (!wd->active)
+	{
+		return;
+	}
+	for (int at = oldNumRows; at < EC.numRows; at++)
+	{
+		wordsRow(at, 1);
+	}
+	if (wd->first != INT_MAX)
+	{
+		wd->tail += EC.numRows - oldNumRows;
+	}
+}
+
+// orders words by bytes, a word before the longer ones it starts
+int wordCompare(const char *a, int alen, const char *b, int blen)
+{
+	int c = memcmp(a, b, MIN(alen, blen));
+	return c ? c : alen - blen;
+}
+
+int wordSortCompare(const void *a, const void *b)
+{
+	const struct Word *wa = &EC.words.words[*(const int *)a];
+	const struct Word *wb = &EC.words.words[*(const int *)b];
+	return wordCompare(&EC.words.arena[wa->offset], wa->len, &EC.words.arena[wb->offset], wb->len);
+}
+
+// drops the words that no longer occur once they are most of the index
+void wordsCompact()
+{
+	struct EditorWords *wd = &EC.words;
+	if (wd->dead <= wd->numWords / 2 || wd->numWords < 4096)
+	{
+		return;
+	}
+	size_t arenaLen = 0;
+	int numWords = 0;
+	for (int w = 0; w < wd->numWords; w++)
+	{
+		struct Word word = wd->words[w];
+		if (word.count)
+		{
+			memmove(&wd->arena[arenaLen], &wd->arena[word.offset], word.len);
+			word.offset = arenaLen;
+			arenaLen += word.len;
+			wd->words[numWords++] = word;
+		}
+	}
+	wd->arenaLen = arenaLen;
+	wd->numWords = numWords;
+	wd->dead = 0;
+	wd->numSorted = 0;
+	wordsRehash(wd->numSlots);
+}
+
+// merges the words entered since the last query into the sorted index
+void wordsSort()
+{
+	struct EditorWords *wd = &EC.words;
+	int n = wd->numWords - wd->numSorted;
+	if (!n)
+	{
+		return;
+	}
+	for (int w = wd->numSorted; w < wd->numWords; w++)
+	{
+		wd->sorted[w] = w;
+	}
+	qsort(&wd->sorted[wd->numSorted], n, sizeof(int), wordSortCompare);
+	if (wd->numSorted)
+	{
+		int *merged = malloc(sizeof(int) * wd->numWords);
+		if (merged == NULL)
+		{
+			terminate("[error]@wordsSort | malloc");
+		}
+		int i = 0, j = wd->numSorted, k = 0;
+		while (i < wd->numSorted || j < wd->numWords)
+		{
+			if (j == wd->numWords || (i < wd->numSorted && wordSortCompare(&wd->sorted[i], &wd->sorted[j]) <= 0))
+			{
+				merged[k++] = wd->sorted[i++];
+			}
+			else
+			{
+				merged[k++] = wd->sorted[j++];
+			}
+		}
+		memcpy(wd->sorted, merged, sizeof(int) * wd->numWords);
+		free(merged);
+	}
+	wd->numSorted = wd->numWords;
+}
+
+void wordsBuild()
+{
+	struct EditorWords *wd = &EC.words;
+	wd->active = 1;
+	wd->first = INT_MAX;
+	wordsRehash(4096);
+	for (int at = 0; at < EC.numRows; at++)
+	{
+		wordsRow(at, 1);
+	}
+}
+
+// marks the words with the prefix that occur within COMPLETE_NEAR_ROWS rows of the cursor
+void wordsNear(int row, int x, const char *prefix, int prefixLen)
+{
+	struct EditorWords *wd = &EC.words;
+	unsigned stamp = ++wd->stamp;
+	for (int d = 0; d <= COMPLETE_NEAR_ROWS; d++)
+	{
+		for (int side = 0; side < (d ? 2 : 1); side++)
+		{
+			int at = side ? row + d : row - d;
+			if (at < 0 || at >= EC.numRows)
+			{
+				continue;
+			}
+			const EditorRow *r = &EC.row[at];
+			int i = 0, start, len;
+			while ((len = wordNext(r->chars, r->size, &i, &start)))
+			{
+				// the word being completed is not a candidate for itself
+				if (len <= prefixLen || memcmp(&r->chars[start], prefix, prefixLen) || (at == row && i == x))
+				{
+					continue;
+				}
+				int slot;
+				int w = wordFind(&r->chars[start], len, (uint32_t)hashBytes(0, &r->chars[start], len), &slot);
+				if (w != -1 && wd->words[w].stamp != stamp)
+				{
+					wd->words[w].stamp = stamp;
+					wd->words[w].near = d;
+				}
+			}
+		}
+	}
+}
+
+// makes the word index of the current context ready for a query
+void wordsPrepare()
+{
+	if (!EC.words.active)
+	{
+		wordsBuild();
+	}
+	editorWordsSync();
+	wordsCompact();
+	wordsSort();
+}
+
+// the first of the sorted words of the current context not before the prefix
+int wordsPrefixStart(const char *prefix, int prefixLen)
+{
+	struct EditorWords *wd = &EC.words;
+	int lo = 0, hi = wd->numSorted;
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		const struct Word *word = &wd->words[wd->sorted[mid]];
+		if (wordCompare(&wd->arena[word->offset], word->len, prefix, prefixLen) < 0)
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+// how often a word occurs in the buffer of a prepared context
+int wordsCountIn(struct EditorContext *ctx, const char *s, int len)
+{
+	struct EditorContext *self = editorContext;
+	editorContext = ctx;
+	int slot;
+	int w = wordFind(s, len, (uint32_t)hashBytes(0, s, len), &slot);
+	int count = (w == -1) ? 0 : EC.words.words[w].count;
+	editorContext = self;
+	return count;
+}
+
+// a candidate while ranking: a word of the index of ctx
+struct CompletionPick
+{
+	struct EditorContext *ctx;
+	int word;
+	double score;
+};
+
+// keeps the best max picks in picks, best first
+void completionRank(struct CompletionPick *picks, int *count, int max, struct CompletionPick pick)
+{
+	int k = *count < max ? (*count)++ : max;
+	for (; k > 0 && picks[k - 1].score < pick.score; k--)
+	{
+		if (k < max)
+		{
+			picks[k] = picks[k - 1];
+		}
+	}
+	if (k < max)
+	{
+		picks[k] = pick;
+	}
+}
+
+// fills candidates with up to max words completing the one before column x of a row, best
+// first, and returns their number; the caller frees them. Words of the numOthers other
+// contexts count too, as if they were far from the cursor; no other thread may use those
+// contexts meanwhile
+int editorCompletions(int row, int x, struct EditorContext **others, int numOthers, char **candidates, int max)
+{
+	const EditorRow *r = &EC.row[row];
+	x = MIN(x, r->size);
+	int start = x;
+	while (start > 0 && wordChar(r->chars[start - 1]))
+	{
+		start--;
+	}
+	int prefixLen = x - start;
+	const char *prefix = &r->chars[start];
+	if (!prefixLen || prefixLen >= WORD_MAX_LEN || isdigit((unsigned char)*prefix))
+	{
+		return 0;
+	}
+
+	struct EditorContext *self = editorContext;
+	for (int b = 0; b < numOthers; b++)
+	{
+		editorContext = others[b];
+		wordsPrepare();
+	}
+	editorContext = self;
+	struct EditorWords *wd = &EC.words;
+	wordsPrepare();
+	wordsNear(row, x, prefix, prefixLen);
+
+	// every word the prefix starts, in this buffer and then in the others; a word is scored once,
+	// from all the buffers it occurs in, by the first buffer that has it
+	struct CompletionPick picks[COMPLETE_MAX];
+	int count = 0;
+	max = MIN(max, COMPLETE_MAX);
+	for (int b = -1; b < numOthers; b++)
+	{
+		editorContext = (b == -1) ? self : others[b];
+		struct EditorWords *bw = &EC.words;
+		int first = wordsPrefixStart(prefix, prefixLen);
+		editorContext = self;
+		for (int i = first; i < bw->numSorted; i++)
+		{
+			const struct Word *word = &bw->words[bw->sorted[i]];
+			const char *s = &bw->arena[word->offset];
+			if (word->len < prefixLen || memcmp(s, prefix, prefixLen))
+			{
+				break;
+			}
+			if (word->len == prefixLen || !word->count)
+			{
+				continue;
+			}
+			int seen = b != -1 && wordsCountIn(self, s, word->len);
+			for (int o = 0; o < b && !seen; o++)
+			{
+				seen = wordsCountIn(others[o], s, word->len);
+			}
+			if (seen)
+			{
+				continue;
+			}
+			int total = word->count;
+			for (int o = b + 1; o < numOthers; o++)
+			{
+				total += wordsCountIn(others[o], s, word->len);
+			}
+			int near = (b == -1 && word->stamp == wd->stamp) ? word->near : COMPLETE_NEAR_ROWS;
+			completionRank(picks, &count, max, (struct CompletionPick){b == -1 ? self : others[b], bw->sorted[i], (double)total / (1 + near)});
+		}
+	}
+	for (int i = 0; i < count; i++)
+	{
+		const struct Word *word = &picks[i].ctx->words.words[picks[i].word];
+		if ((candidates[i] = strndup(&picks[i].ctx->words.arena[word->offset], word->len)) == NULL)
+		{
+			terminate("[error]@editorCompletions | strndup");
+		}
+	}
+	return count;
+}
+
+// completes the word before the cursor; pressed again, replaces the completion with the next one
+void editorComplete()
+{
+	struct EditorCompletion *cp = &EC.completion;
+	if (EC.lastKey == CTRL_KEY('r') && cp->count && EC.cursorY == cp->row && EC.cursorX == cp->x + cp->inserted)
+	{
+		editorDeleteText(cp->row, cp->x, cp->row, cp->x + cp->inserted);
+		cp->current = (cp->current + 1) % cp->count;
+	}
+	else
+	{
+		for (int i = 0; i < cp->count; i++)
+		{
+			free(cp->candidates[i]);
+		}
+		cp->count = EC.cursorY < EC.numRows ? editorCompletions(EC.cursorY, EC.cursorX, NULL, 0, cp->candidates, COMPLETE_MAX) : 0;
+		if (!cp->count)
+		{
+			editorSetStatusMessage("No completions");
+			return;
+		}
+		cp->current = 0;
+		cp->row = EC.cursorY;
+		cp->x = MIN(EC.cursorX, EC.row[EC.cursorY].size);
+		cp->prefixLen = cp->x;
+		while (cp->prefixLen > 0 && wordChar(EC.row[cp->row].chars[cp->prefixLen - 1]))
+		{
+			cp->prefixLen--;
+		}
+		cp->prefixLen = cp->x - cp->prefixLen;
+	}
+
+	const char *candidate = cp->candidates[cp->current];
+	cp->inserted = strlen(candidate) - cp->prefixLen;
+	EC.cursorY = cp->row;
+	EC.cursorX = cp->x;
+	editorInsertAtCursor(candidate + cp->prefixLen, cp->inserted);
+	editorSetStatusMessage("Completion %d/%d: %s (Ctrl-R again for the next)", cp->current + 1, cp->count, candidate);
+}
+
+/*** hex ***/
+/*
+ * Binary files are not split into rows: hex mode maps the file and the view
+ * reads the bytes it shows from the mapping. Typing overwrites bytes, which
+ * are kept as patches in a tree by offset until a save writes them back in place
+ * with pwrite, leaving the rest of the file untouched. Only the patches and
+ * one search chunk take memory, whatever the size of the file.
+ */
+
+// whether a file looks binary: a NUL byte in its first HEX_DETECT_BYTES
+int editorHexDetect(const char *filename)
+{
+	int fd = open(filename, O_RDONLY);
+	if (fd == -1)
+	{
+		return 0;
+	}
+	struct stat st;
+	char head[HEX_DETECT_BYTES];
+	ssize_t n = (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) ? pread(fd, head, sizeof(head), 0) : -1;
+	close(fd);
+	return n > 0 && memchr(head, '\0', n) != NULL;
+}
+
+// opens a file in hex mode instead of reading it into rows; returns 0 or -1 (errno set).
+// The one descriptor is kept for saving, so patches go into the file on screen even if
+// its name is taken by another one meanwhile; a file that can't be written is still shown
+int editorHexOpen(const char *filename)
+{
+	struct EditorHex *hx = &EC.hex;
+	int writeError = 0;
+	int fd = open(filename, O_RDWR);
+	if (fd == -1)
+	{
+		writeError = errno;
+		fd = open(filename, O_RDONLY);
+	}
+	if (fd == -1)
+	{
+		return -1;
+	}
+	struct stat st;
+	const unsigned char *map = NULL;
+	if (fstat(fd, &st) == -1 || (st.st_size > 0 && (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED))
+	{
+		int error = errno;
+		close(fd);
+		errno = error;
+		return -1;
+	}
+
+	free(EC.filename);
+	EC.filename = strdup(filename);
+	if (!EC.filename)
+	{
+		terminate("[error]@editorHexOpen | strdup");
+	}
+	hx->active = 1;
+	hx->fd = fd;
+	hx->writeError = writeError;
+	hx->map = map;
+	hx->mapSize = hx->size = st.st_size;
+	hx->root = hx->freeList = -1;
+	hx->numPatches = hx->used = 0;
+	hx->cursor = hx->top = 0;
+	hx->nibble = hx->text = 0;
+	hx->patternLen = 0;
+	EC.dirty = 0;
+	return 0;
+}
+
+// the treap order of a patch: a hash of its offset, so bytes typed in a row don't
+// line up into a list
+uint64_t hexPriority(size_t offset)
+{
+	uint64_t x = offset * 0x9e3779b97f4a7c15ull;
+	return x ^ x >> 29;
+}
+
+// the patch at offset, or -1
+int hexPatchFind(size_t offset)
+{
+	struct EditorHex *hx = &EC.hex;
+	int node = hx->root;
+	while (node != -1 && hx->patches[node].offset != offset)
+	{
+		node = (offset < hx->patches[node].offset) ? hx->patches[node].left : hx->patches[node].right;
+	}
+	return node;
+}
+
+int hexPatchNew(size_t offset, unsigned char value)
+{
+	struct EditorHex *hx = &EC.hex;
+	int node = hx->freeList;
+	if (node != -1)
+	{
+		hx->freeList = hx->patches[node].left;
+	}
+	else
+	{
+		if (hx->used == hx->cap)
+		{
+			hx->cap = hx->cap ? hx->cap * 2 : 256;
+			hx->patches = realloc(hx->patches, sizeof(struct HexPatch) * hx->cap);
+			if (!hx->patches)
+			{
+				terminate("[error]@hexPatchNew | realloc");
+			}
+		}
+		node = hx->used++;
+	}
+	hx->patches[node] = (struct HexPatch){offset, value, -1, -1};
+	hx->numPatches++;
+	return node;
+}
+
+// adds a patch for a byte that has none below node; returns the new root of the subtree
+int hexPatchInsert(int node, size_t offset, unsigned char value)
+{
+	struct EditorHex *hx = &EC.hex;
+	if (node == -1)
+	{
+		return hexPatchNew(offset, value);
+	}
+	// the array may move while the child is inserted
+	if (offset < hx->patches[node].offset)
+	{
+		int child = hexPatchInsert(hx->patches[node].left, offset, value);
+		hx->patches[node].left = child;
+		if (hexPriority(offset) > hexPriority(hx->patches[node].offset) && hx->patches[child].offset == offset)
+		{
+			hx->patches[node].left = hx->patches[child].right;
+			hx->patches[child].right = node;
+			return child;
+		}
+	}
+	else
+	{
+		int child = hexPatchInsert(hx->patches[node].right, offset, value);
+		hx->patches[node].right = child;
+		if (hexPriority(offset) > hexPriority(hx->patches[node].offset) && hx->patches[child].offset == offset)
+		{
+			hx->patches[node].right = hx->patches[child].left;
+			hx->patches[child].left = node;
+			return child;
+		}
+	}
+	return node;
+}
+
+// joins two subtrees, every patch of a before those of b
+int hexPatchMerge(int a, int b)
+{
+	struct EditorHex *hx = &EC.hex;
+	if (a == -1 || b == -1)
+	{
+		return (a == -1) ? b : a;
+	}
+	if (hexPriority(hx->patches[a].offset) > hexPriority(hx->patches[b].offset))
+	{
+		hx->patches[a].right = hexPatchMerge(hx->patches[a].right, b);
+		return a;
+	}
+	hx->patches[b].left = hexPatchMerge(a, hx->patches[b].left);
+	return b;
+}
+
+// drops the patch at offset below node; returns the new root of the subtree
+int hexPatchRemove(int node, size_t offset)
+{
+	struct EditorHex *hx = &EC.hex;
+	if (node == -1)
+	{
+		return -1;
+	}
+	struct HexPatch *patch = &hx->patches[node];
+	if (offset != patch->offset)
+	{
+		if (offset < patch->offset)
+		{
+			patch->left = hexPatchRemove(patch->left, offset);
+		}
+		else
+		{
+			patch->right = hexPatchRemove(patch->right, offset);
+		}
+		return node;
+	}
+	int merged = hexPatchMerge(patch->left, patch->right);
+	patch->left = hx->freeList;
+	hx->freeList = node;
+	hx->numPatches--;
+	return merged;
+}
+
+// lays the patches below node over len bytes of the file read from offset on; patched
+// (may be NULL) receives 1 for the bytes that were overwritten
+void hexOverlayFrom(int node, size_t offset, unsigned char *bytes, unsigned char *patched, size_t len)
+{
+	struct EditorHex *hx = &EC.hex;
+	while (node != -1)
+	{
+		const struct HexPatch *patch = &hx->patches[node];
+		if (patch->offset < offset)
+		{
+			node = patch->right;
+			continue;
+		}
+		if (patch->offset >= offset + len)
+		{
+			node = patch->left;
+			continue;
+		}
+		bytes[patch->offset - offset] = patch->value;
+		if (patched)
+		{
+			patched[patch->offset - offset] = 1;
+		}
+		hexOverlayFrom(patch->left, offset, bytes, patched, len);
+		node = patch->right;
+	}
+}
+
+void hexOverlay(size_t offset, unsigned char *bytes, unsigned char *patched, size_t len)
+{
+	if (patched)
+	{
+		memset(patched, 0, len);
+	}
+	hexOverlayFrom(EC.hex.root, offset, bytes, patched, len);
+}
+
+// the mapping faults past the end of a file cut short outside the editor, so the view
+// shrinks to the file before any read from it; patches past the new end are dropped
+void editorHexCheckSize()
+{
+	struct EditorHex *hx = &EC.hex;
+	struct stat st;
+	if (!hx->active || fstat(hx->fd, &st) == -1 || (size_t)st.st_size >= hx->size)
+	{
+		return;
+	}
+	hx->size = st.st_size;
+	while (hx->root != -1)
+	{
+		int last = hx->root;
+		while (hx->patches[last].right != -1)
+		{
+			last = hx->patches[last].right;
+		}
+		if (hx->patches[last].offset < hx->size)
+		{
+			break;
+		}
+		hx->root = hexPatchRemove(hx->root, hx->patches[last].offset);
+	}
+	hx->cursor = MIN(hx->cursor, hx->size ? hx->size - 1 : 0);
+	hx->top = MIN(hx->top, hx->cursor);
+	EC.dirty = hx->numPatches;
+	editorSetStatusMessage("%.20s was cut to %llu bytes by another program", EC.filename, (unsigned long long)hx->size);
+}
+
+// copies len bytes from offset on as they are after the patches, see hexOverlay; bytes
+// past the end of the file read as 0
+void editorHexRead(size_t offset, unsigned char *bytes, unsigned char *patched, size_t len)
+{
+	struct EditorHex *hx = &EC.hex;
+	editorHexCheckSize();
+	size_t n = (offset < hx->size) ? MIN(len, hx->size - offset) : 0;
+	memcpy(bytes, &hx->map[offset], n);
+	memset(&bytes[n], 0, len - n);
+	hexOverlay(offset, bytes, patched, len);
+}
+
+// overwrites a byte; writing back what the file holds drops the patch
+void editorHexSet(size_t offset, unsigned char value)
+{
+	struct EditorHex *hx = &EC.hex;
+	editorHexCheckSize();
+	if (offset >= hx->size)
+	{
+		return;
+	}
+	int node = hexPatchFind(offset);
+	if (value == hx->map[offset])
+	{
+		if (node != -1)
+		{
+			hx->root = hexPatchRemove(hx->root, offset);
+		}
+	}
+	else if (node != -1)
+	{
+		hx->patches[node].value = value;
+	}
+	else
+	{
+		hx->root = hexPatchInsert(hx->root, offset, value);
+	}
+	EC.dirty = hx->numPatches;
+}
+
+void editorHexRevert(size_t offset)
+{
+	editorHexCheckSize();
+	if (offset < EC.hex.size)
+	{
+		editorHexSet(offset, EC.hex.map[offset]);
+	}
+}
+
+// runs of adjacent patches gathered for one pwrite each
+struct HexRun
+{
+	unsigned char bytes[4096];
+	size_t start, len;
+	int error;
+};
+
+int hexRunWrite(struct HexRun *run)
+{
+	if (run->len && !run->error)
+	{
+		ssize_t written = pwrite(EC.hex.fd, run->bytes, run->len, run->start);
+		if (written != (ssize_t)run->len)
+		{
+			run->error = (written == -1) ? errno : EIO;
+		}
+	}
+	run->len = 0;
+	return run->error;
+}
+
+// adds the patches below node to the runs in offset order, writing each run as it ends
+void hexRunAdd(struct HexRun *run, int node)
+{
+	struct EditorHex *hx = &EC.hex;
+	while (node != -1 && !run->error)
+	{
+		hexRunAdd(run, hx->patches[node].left);
+		const struct HexPatch *patch = &hx->patches[node];
+		if (run->len && (patch->offset != run->start + run->len || run->len == sizeof(run->bytes)))
+		{
+			hexRunWrite(run);
+		}
+		if (!run->len)
+		{
+			run->start = patch->offset;
+		}
+		run->bytes[run->len++] = patch->value;
+		node = patch->right;
+	}
+}
+
+// writes the patches into the file in place, one pwrite per run of adjacent bytes;
+// returns 0 or -1 with the patches kept
+int editorHexSave()
+{
+	struct EditorHex *hx = &EC.hex;
+	if (!hx->numPatches)
+	{
+		editorSetStatusMessage("No changes to write");
+		return 0;
+	}
+	if (hx->writeError)
+	{
+		editorSetStatusMessage("Can't save! I/O error: %s", strerror(hx->writeError));
+		return -1;
+	}
+	struct HexRun run = {.len = 0, .error = 0};
+	hexRunAdd(&run, hx->root);
+	if (hexRunWrite(&run) || fdatasync(hx->fd) == -1)
+	{
+		editorSetStatusMessage("Can't save! I/O error: %s", strerror(run.error ? run.error : errno));
+		return -1;
+	}
+	// the private mapping is never written to, so it still shows the file's pages
+	editorSetStatusMessage("%d bytes written in place", hx->numPatches);
+	hx->root = hx->freeList = -1;
+	hx->numPatches = hx->used = 0;
+	EC.dirty = 0;
+	return 0;
+}
+
+int hexDigit(int c)
+{
+	return isdigit(c) ? c - '0' : tolower(c) - 'a' + 10;
+}
+
+// reads a byte pattern typed as hex pairs ("de ad be ef", the spaces optional) or as
+// "text" in quotes; returns its length, or -1 when it is neither
+int editorHexParsePattern(const char *s, unsigned char *pattern, int max)
+{
+	int len = 0;
+	if (*s == '"')
+	{
+		s++;
+		const char *end = strrchr(s, '"');
+		len = MIN((end ? end : s + strlen(s)) - s, max);
+		memcpy(pattern, s, len);
+		return len ? len : -1;
+	}
+	for (;;)
+	{
+		while (*s == ' ')
+		{
+			s++;
+		}
+		if (!*s)
+		{
+			break;
+		}
+		if (!isxdigit((unsigned char)s[0]) || !isxdigit((unsigned char)s[1]) || len == max)
+		{
+			return -1;
+		}
+		pattern[len++] = hexDigit((unsigned char)s[0]) << 4 | hexDigit((unsigned char)s[1]);
+		s += 2;
+	}
+	return len ? len : -1;
+}
+
+// finds the first occurrence of a pattern at or after from, wrapping around the end of the
+// file; returns 1 and its offset, or 0. The file is read a chunk at a time with the patches
+// laid over it, so edited bytes are found as they are now. Chunks are read rather than
+// copied from the mapping, which would keep every page of the file mapped afterwards
+int editorHexFind(const unsigned char *pattern, int len, size_t from, size_t *found)
+{
+	struct EditorHex *hx = &EC.hex;
+	if (len <= 0 || (size_t)len > hx->size)
+	{
+		return 0;
+	}
+	unsigned char *chunk = malloc(HEX_SEARCH_CHUNK + len - 1);
+	if (!chunk)
+	{
+		terminate("[error]@editorHexFind | malloc");
+	}
+	from = MIN(from, hx->size);
+	// from on to the end, then the start up to the matches that begin before from
+	for (int pass = 0; pass < 2; pass++)
+	{
+		size_t start = pass ? 0 : from;
+		size_t end = pass ? MIN(from + len - 1, hx->size) : hx->size;
+		for (size_t at = start; at + len <= end; at += HEX_SEARCH_CHUNK)
+		{
+			size_t n = MIN((size_t)HEX_SEARCH_CHUNK + len - 1, end - at);
+			ssize_t got = pread(hx->fd, chunk, n, at);
+			if (got < (ssize_t)len)
+			{
+				break;
+			}
+			n = got;
+			hexOverlay(at, chunk, NULL, n);
+			const unsigned char *hit = memmem(chunk, n, pattern, len);
+			if (hit)
+			{
+				*found = at + (hit - chunk);
+				free(chunk);
+				return 1;
+			}
+		}
+	}
+	free(chunk);
+	return 0;
+}
+
+/*** library ***/
+_Static_assert((int)MTE_HL_KEYWORD_SUB == (int)HL_KEYWORD_SUB, "MteHighlight mirrors EditorHighlight");
+
+// makes ctx the context of the calling thread; returns the one to restore afterwards
+struct EditorContext *mteEnter(struct EditorContext *ctx)
+{
+	struct EditorContext *previous = editorContext;
+	editorContext = ctx;
+	return previous;
+}
+
+MteContext *mteCreate(int flags)
+{
+	struct EditorContext *ctx = calloc(1, sizeof(struct EditorContext));
+	if (!ctx)
+	{
+		return NULL;
+	}
+	struct EditorContext *previous = mteEnter(ctx);
+	EC.journal.fd = -1;
+	EC.journal.disabled = !(flags & MTE_JOURNAL);
+	EC.watch.fd = -1;
+	EC.watch.disabled = !(flags & MTE_WATCH);
+	EC.overlay.row = -1;
+	EC.messageLifeTime = 5;
+	// a frontend sets the real size; search and cursor restore keep their view within it
+	EC.screenRows = 24;
+	EC.screenColumns = 80;
+	editorLoadSyntaxDefinitions();
+	mteEnter(previous);
+	return ctx;
+}
+
+void mteDestroy(MteContext *ctx)
+{
+	struct EditorContext *previous = mteEnter(ctx);
+	editorLoadCancel();
+	// let a running save complete
+	editorSaveFinish();
+	editorCacheClose();
+	editorJournalClose();
+	if (EC.watch.fd != -1)
+	{
+		close(EC.watch.fd);
+	}
+	releaseMemory();
+	mteEnter(previous == ctx ? NULL : previous);
+	free(ctx);
+}
+
+int mteOpen(MteContext *ctx, const char *filename)
+{
+	struct EditorContext *previous = mteEnter(ctx);
+	int result = -1;
+	if (EC.filename || EC.numRows)
+	{
+		errno = EBUSY;
+	}
+	else if ((result = editorOpen(filename)) == 0)
+	{
+		editorLoadWait();
+	}
+	mteEnter(previous);
+	return result;
+}
+
+int mteSave(MteContext *ctx, const char *filename)
+{
+	struct EditorContext *previous = mteEnter(ctx);
+	// a save of the same context started by a frontend
+	editorSaveFinish();
+	if (filename)
+	{
+		char *copy = strdup(filename);
+		if (!copy)
+		{
+			mteEnter(previous);
+			return -1;
+		}
+		free(EC.filename);
+		EC.filename = copy;
+		editorSelectSyntaxHighlight();
+	}
+
+	int result = -1;
+	if (!EC.filename)
+	{
+		errno = EINVAL;
+	}
+	else if (editorSave() == 0)
+	{
+		editorSaveFinish();
+		if (EC.save.error)
+		{
+			errno = EC.save.error;
+		}
+		else
+		{
+			result = 0;
+		}
+	}
+	mteEnter(previous);
+	return result;
+}
+
+int mteTick(MteContext *ctx)
+{
+	struct EditorContext *previous = mteEnter(ctx);
+	editorJournalTick();
+	int changed = editorWatchTick();
+	mteEnter(previous);
+	return changed;
+}
+
+const char *mteMessage(MteContext *ctx)
+{
+	return ctx->statusMsg;
+}
+
+int mteDirty(MteContext *ctx)
+{
+	return ctx->dirty != 0;
+}
+
+int mteNumRows(MteContext *ctx)
+{
+	return ctx->numRows;
+}
+
+const char *mteRow(MteContext *ctx, int row, int *len)
+{
+	if (row < 0 || row >= ctx->numRows)
+	{
+		return NULL;
+	}
+	*len = ctx->row[row].size;
+	return ctx->row[row].chars;
+}
+
+int mteInsert(MteContext *ctx, int row, int col, const char *text, size_t len, int *endRow, int *endCol)
+{
+	// rows and journal records count their bytes in an int
+	if (row < 0 || row > ctx->numRows || col < 0 || (row < ctx->numRows && col > ctx->row[row].size) || len > INT_MAX)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	struct EditorContext *previous = mteEnter(ctx);
+	int endY = row, endX = col;
+	editorInsertText(row, col, text, len, &endY, &endX);
+	mteEnter(previous);
+	if (endRow)
+	{
+		*endRow = endY;
+	}
+	if (endCol)
+	{
+		*endCol = endX;
+	}
+	return 0;
+}
+
+// whether (startRow, startCol) .. (endRow, endCol) is an ordered range of the buffer
+int mteValidRange(MteContext *ctx, int startRow, int startCol, int endRow, int endCol)
+{
+	if (startRow < 0 || endRow >= ctx->numRows || startRow > endRow)
+	{
+		return 0;
+	}
+	if (startCol < 0 || startCol > ctx->row[startRow].size || endCol < 0 || endCol > ctx->row[endRow].size)
+	{
+		return 0;
+	}
+	return startRow < endRow || startCol <= endCol;
+}
+
+int mteDelete(MteContext *ctx, int startRow, int startCol, int endRow, int endCol)
+{
+	if (!mteValidRange(ctx, startRow, startCol, endRow, endCol))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	struct EditorContext *previous = mteEnter(ctx);
+	editorDeleteText(startRow, startCol, endRow, endCol);
+	mteEnter(previous);
+	return 0;
+}
+
+char *mteCopy(MteContext *ctx, int startRow, int startCol, int endRow, int endCol, size_t *len)
+{
+	if (!mteValidRange(ctx, startRow, startCol, endRow, endCol))
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+	struct EditorContext *previous = mteEnter(ctx);
+	char *text = editorCopyText(startRow, startCol, endRow, endCol, len);
+	mteEnter(previous);
+	return text;
+}
+
+int mteHighlight(MteContext *ctx, int row, unsigned char *classes)
+{
+	if (row < 0 || row >= ctx->numRows)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	struct EditorContext *previous = mteEnter(ctx);
+	EditorRow *r = &EC.row[row];
+	if (r->highlightLen < 0)
+	{
+		editorUpdateSyntaxRange(row, row);
+	}
+	mteEnter(previous);
+
+	// spans cover render columns; a char takes the class of its first column
+	const unsigned char *span = editorRowSpans(r);
+	const unsigned char *spansEnd = span + r->highlightLen;
+	int hl = HL_NORMAL, spanEnd = 0, renderX = 0;
+	for (int i = 0; i < r->size; i++)
+	{
+		while (renderX >= spanEnd)
+		{
+			if (span == spansEnd)
+			{
+				hl = HL_NORMAL;
+				spanEnd = INT_MAX;
+				break;
+			}
+			int length;
+			hl = spanNext(&span, &length);
+			spanEnd += length;
+		}
+		classes[i] = hl;
+		renderX += (r->chars[i] == '\t') ? TAB_STOP - renderX % TAB_STOP : 1;
+	}
+	return 0;
+}
+
+int mteCompletions(MteContext *ctx, int row, int col, MteContext **others, int numOthers, char **candidates, int max)
+{
+	if (row < 0 || row >= ctx->numRows || col < 0 || numOthers < 0)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	struct EditorContext *previous = mteEnter(ctx);
+	int count = editorCompletions(row, col, others, numOthers, candidates, max);
+	mteEnter(previous);
+	return count;
+}
+
+MteRegex *mteRegexCompile(const char *pattern)
+{
+	return regexCompile(pattern);
+}
+
+void mteRegexFree(MteRegex *re)
+{
+	regexFree(re);
+}
+
+int mteRegexSearch(MteRegex *re, const char *text, int len, int from, int *start, int *end)
+{
+	return regexSearch(re, text, len, from, start, end);
+}
+
+int mteFind(MteContext *ctx, MteRegex *re, int *row, int *col, int *len)
+{
+	int from = MAX(*col, 0);
+	for (int at = MAX(*row, 0); at < ctx->numRows; at++, from = 0)
+	{
+		EditorRow *r = &ctx->row[at];
+		int start, end;
+		if (regexSearch(re, r->chars, r->size, from, &start, &end))
+		{
+			*row = at;
+			*col = start;
+			*len = end - start;
+			return 1;
+		}
+	}
+	return 0;
+}
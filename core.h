@@ -0,0 +1,678 @@
+/*
+ * Internal declarations shared by the mte core (libmte) and its terminal
+ * frontend. Programs embedding the core use the public API in mte.h.
+ */
+#ifndef MTE_CORE_H
+#define MTE_CORE_H
+
+/*** includes ***/
+#define _DEFAULT_SOURCE
+#define _BSD_SOURCE
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/param.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "mte.h"
+
+// the BSD names of the stat times and of a sync that can skip the metadata
+#ifdef __APPLE__
+#define st_mtim st_mtimespec
+#define fdatasync fsync
+#endif
+
+/*** defines ***/
+#define CTRL_KEY(k) ((k) & 0x1f)
+#define TAB_STOP 8
+#define ESC_KEY '\x1b'
+#define ENTER_KEY '\r'
+#define SEPARATORS ",.;%<>()[]{}+-*/~="
+
+#define REGEX_MAX_REPEAT 1000
+#define REGEX_MAX_NODES 20000
+#define REGEX_DFA_MAX_STATES 512
+
+#define HL_HIGHLIGHT_NUMBERS (1 << 0)
+#define HL_HIGHLIGHT_STRINGS (1 << 1)
+#define HL_FOLD_BRACES (1 << 2)
+
+// a depth no bracket reaches, the least depth of a row without brackets
+#define BRACKET_NONE (INT_MAX / 4)
+// the summary of a row lexed since it was last read
+#define BRACKET_STALE INT_MIN
+#define BRACKET_BLOCK_ROWS 1024
+#define BRACKET_CHUNK 256
+
+// words shorter or longer than these are not offered for completion
+#define WORD_MIN_LEN 2
+#define WORD_MAX_LEN 64
+// candidates offered at once, and how far from the cursor nearby words are looked for
+#define COMPLETE_MAX 16
+#define COMPLETE_NEAR_ROWS 256
+
+// a NUL byte this early makes a file binary, as for git and grep
+#define HEX_DETECT_BYTES 8000
+#define HEX_ROW_BYTES 16
+#define HEX_SEARCH_CHUNK (1 << 20)
+#define HEX_PATTERN_MAX 256
+
+#ifndef MTE_SYNTAX_DIR
+#define MTE_SYNTAX_DIR "/usr/local/share/mte/syntax"
+#endif
+#define SYNTAX_FILE_EXTENSION ".syntax"
+#define SYNTAX_MAX_DELIMITER 3
+#define SYNTAX_MAX_KEYWORD 255
+
+// lexer transitions are packed as next state | byte class | backfill class | backfill length
+#define LEX_NEXT(t) ((t) & 0xffff)
+#define LEX_HL(t) (((t) >> 16) & 0xf)
+#define LEX_BACK_HL(t) (((t) >> 20) & 0xf)
+#define LEX_BACK(t) ((t) >> 24)
+#define LEX_PACK(next, hl, backHl, back) \
+	((uint32_t)(next) | ((uint32_t)(hl) << 16) | ((uint32_t)(backHl) << 20) | ((uint32_t)(back) << 24))
+#define LEX_MAX_STATES 0xffff
+
+#define KILL_RING_SIZE 16
+#define CLIPBOARD_MAX (1 << 20)
+
+#define JOURNAL_SUFFIX ".mte-journal"
+#define JOURNAL_MAGIC "MTEJRNL1"
+#define JOURNAL_FLUSH_BYTES (64 * 1024)
+#define JOURNAL_FLUSH_MS 1000
+
+#define CACHE_MAGIC "MTECACH2"
+#define CACHE_MIN_BYTES (1 << 20)
+
+#define LOAD_FIRST_ROWS 256
+#define LOAD_CHUNK_ROWS 16384
+
+#define SAVE_BUFFER_SIZE (1 << 20)
+#define SAVE_COPY_CHUNK (64 << 20)
+#define SAVE_PROGRESS_MS 200
+#define SAVE_BACKGROUND_BYTES (4 << 20)
+
+#define WATCH_TAIL_SAMPLE 64
+#define WATCH_READ_CHUNK (8 << 20)
+
+#define HL_CHUNK_ROWS 16384
+#define SEARCH_STEP_ROWS 4096
+#define SEARCH_KEY_MS 30
+#define HL_MAX_THREADS 64
+
+#define SORT_MIN_PART 4096
+
+#define DIFF_MIN_COST 256
+
+enum EditorKey
+{
+	BACKSPACE = 127,
+	ARROW_LEFT = 1001,
+	ARROW_RIGHT,
+	ARROW_UP,
+	ARROW_DOWN,
+	DEL_KEY,
+	PAGE_UP,
+	PAGE_DOWN,
+	HOME_KEY,
+	END_KEY,
+	PASTE_START,
+	MOUSE_EVENT,
+	IGNORED_KEY,
+};
+
+enum EditorHighlight
+{
+	HL_NORMAL = 0,
+	HL_NUMBER,
+	HL_MATCH,
+	HL_STRING,
+	HL_COMMENT,
+	HL_MLCOMMENT,
+	HL_KEYWORD_MAIN,
+	HL_KEYWORD_SUB,
+};
+
+/*** data ***/
+struct JournalHeader
+{
+	char magic[8];
+	uint64_t size;
+	int64_t mtimeSec;
+	int64_t mtimeNsec;
+	uint64_t inode;
+};
+
+// compiled form of an EditorSyntax: one transition per (state, byte)
+struct SyntaxLexer
+{
+	int numStates;
+	uint32_t *table;
+	int entryState;
+	int commentEntryState;
+	unsigned char *eolBack;
+	unsigned char *eolBackHl;
+	unsigned char *inComment;
+};
+
+struct EditorSyntax
+{
+	char *fileType;
+	char **filematch;
+	char **keywords;
+	char *singleCommentStart;
+	char *multiCommentStart;
+	char *multiCommentEnd;
+	char *stringQuotes;
+	int flags;
+	struct SyntaxLexer *lexer;
+};
+
+struct EditorKillRing
+{
+	char *entries[KILL_RING_SIZE];
+	size_t lengths[KILL_RING_SIZE];
+	int newest, count;
+	int yankOffset;
+	int yankStartY, yankStartX, yankEndY, yankEndX;
+};
+
+enum SelectionMode
+{
+	SEL_NONE = 0,
+	SEL_CHAR,
+	SEL_LINE,
+};
+
+// what a normal mode operator does with the text a motion spans
+enum EditorOperator
+{
+	OP_NONE = 0,
+	OP_DELETE,
+	OP_YANK,
+	OP_CHANGE,
+	OP_INDENT,
+	OP_DEDENT,
+};
+
+// a temporary highlight drawn over a row's spans, such as the current search match
+struct EditorOverlay
+{
+	int row;
+	int start, end;
+	int hl;
+};
+
+// the selection runs from the anchor to the cursor
+struct EditorSelection
+{
+	int mode;
+	int anchorY, anchorX;
+};
+
+struct EditorJournal
+{
+	int fd;
+	char *path;
+	struct JournalHeader base;
+	int hasBase;
+	int disabled;
+	int replaying;
+	volatile sig_atomic_t busy;
+	unsigned char *pending;
+	size_t pendingLen, pendingCap;
+	long long pendingSince;
+};
+
+// the file on disk as the buffer last loaded or saved it
+struct EditorDisk
+{
+	struct JournalHeader identity;
+	int valid;	   // row origins refer to this file
+	int exact;	   // the file is the rows, each followed by '\n'
+	long long size;
+	char *cachePath; // sidecar cache of large files, see editorCacheOpen
+};
+
+// incremental search state; rows holds matching rows in scan order, see editorSearchStep
+struct EditorSearch
+{
+	int active;
+	char *pattern;
+	struct Regex *regex;
+	int originRow;
+	int *rows;
+	int numRows, cap;
+	int kept;	 // rows[0..kept) match the pattern
+	int checked; // rows[kept..checked) were dropped, rows[checked..numRows) are still to verify
+	int scanned; // rows classified so far, counting from originRow and wrapping around
+	int shown;	 // the first match of the pattern was jumped to
+	int lastMatchRow, lastMatchX;
+	int direction;
+};
+
+// a row as the save thread sees it; chars stays valid until the save finishes
+struct SaveRow
+{
+	const char *chars;
+	int size;
+	off_t origin;
+};
+
+// background save of a snapshot of the rows, see editorSave
+struct EditorSaveJob
+{
+	int active;
+	pthread_t thread;
+	struct EditorContext *context;
+	struct SaveRow *rows;
+	int numRows;
+	// texts the buffer let go of while the writer may still read them
+	char **orphans;
+	int numOrphans, orphanCap;
+	// copied for the writer, as the buffer may be renamed while it runs
+	char *filename;
+	char *tmpFilename; // written first, then renamed over filename
+	int in;		 // the old file to copy unmodified runs from, or -1
+	int canSkip; // the file may already hold the text, compare it first
+	long long total;
+	atomic_llong written;
+	atomic_int done;
+	// results, read once done is set
+	long long reused;
+	int skipped;
+	int error;
+	struct stat st;
+	// buffer state at the snapshot
+	int dirtyAt;
+	off_t journalMark;
+	long long progressMs;
+};
+
+// inotify state for the open file (Linux only) and what of it the buffer has seen
+struct EditorWatch
+{
+	int fd;
+	struct JournalHeader identity;
+	char tail[WATCH_TAIL_SAMPLE];
+	int tailLen;
+	int openLine;
+	int follow;
+	int disabled;
+};
+
+// the code brackets of a row as depth changes: the depth after the row, and the least depth
+// just before and just after any of its brackets, all relative to the row start
+struct BracketSummary
+{
+	int net;
+	int minBefore, minAfter;
+};
+
+typedef struct EditorRow
+{
+	int index;
+	int size;
+	int rsize;
+	int shared; // chars is also referenced by the snapshot of a running save
+	char *chars;
+	char *render; // NULL while the rendered text is chars itself, see editorRowRender
+	// run-length highlight spans, kept inline while they fit in a pointer
+	union
+	{
+		unsigned char *heap;
+		unsigned char local[sizeof(unsigned char *)];
+	} highlight;
+	int highlightLen;
+	int isOpenComment;
+	struct BracketSummary brackets; // made from the highlight when first needed, see bracketRow
+	off_t origin; // where the row starts in the file on disk while it is unmodified, else -1
+} EditorRow;
+
+// rows the loader thread has cut out but the buffer hasn't taken yet
+struct LoadChunk
+{
+	struct LoadChunk *next;
+	int numRows;
+	EditorRow rows[];
+};
+
+// progressive open of a file, see editorOpen
+struct EditorLoader
+{
+	int active;
+	pthread_t thread;
+	struct EditorContext *context;
+	pthread_mutex_t lock;
+	struct LoadChunk *chunks, *lastChunk; // published, guarded by lock
+	int done;							  // guarded by lock
+	atomic_int cancel;
+	atomic_llong loaded;
+	struct stat st;
+	int fd;
+	char *data; // the file, mapped or read
+	size_t size;
+	int mapped;
+	// owned by the loader thread while it runs
+	size_t offset;
+	int numRows;
+	int inComment;
+	int exact;
+	uint64_t *offsets; // line starts for a new cache, NULL while a valid one is used
+	int offsetsCap;
+	// the valid cache of the file, if any
+	char *cacheMap;
+	size_t cacheLen;
+	uint64_t cacheRows;
+	const uint64_t *cacheOffsets;
+	const unsigned char *cacheStates;
+	int restoreCursor;
+	int cursorX, cursorY, rowOffset, columnOffset;
+};
+
+// scratch space of a lexing thread: run starts, then their encoded spans
+struct LexRuns
+{
+	int *starts;
+	unsigned char *classes;
+	unsigned char *spans;
+	int cap;
+};
+
+// a run of buffer rows that differs from a run of lines of the file on disk; either may be empty
+struct DiffHunk
+{
+	int row, rows;
+	int line, lines;
+};
+
+enum DiffMarker
+{
+	DIFF_NONE = 0,
+	DIFF_ADDED,
+	DIFF_CHANGED,
+	DIFF_REMOVED, // lines of the file are missing below the row
+};
+
+// the buffer against the file on disk, see editorDiffUpdate
+struct EditorDiff
+{
+	int active;
+	int hasBase;
+	struct stat base; // the file lineHashes were taken from
+	uint64_t *lineHashes;
+	int numLines;
+	uint64_t *rowHashes;
+	int numHashed, hashCap;
+	// rows edited since the last update: from first on, all but the last tail
+	int first, tail;
+	struct DiffHunk *hunks;
+	int numHunks, hunkCap;
+	int added, removed;
+};
+
+// a closed fold: row start stays visible, the rows after it up to end are hidden
+struct Fold
+{
+	int start, end;
+	int hidden; // rows hidden by the folds before this one
+};
+
+// closed folds, disjoint and ordered by start, see editorFoldSync
+struct EditorFolds
+{
+	struct Fold *folds;
+	int numFolds, cap;
+	// rows edited since the last sync: from first on, all but the last tail of numRows
+	int first, tail, numRows;
+};
+
+// the brackets of one row with the depth before each, relative to the row start
+struct BracketLine
+{
+	int row;
+	unsigned generation;
+	int count, cap;
+	int *cols; // render columns
+	int *depths;
+	char *kinds;
+	struct BracketSummary *chunks; // least depths per BRACKET_CHUNK brackets
+};
+
+// bracket depths summarised per block of rows, so matches are found without reading the text between
+struct EditorBrackets
+{
+	struct BracketSummary *blocks;
+	unsigned char *valid;
+	int numBlocks, cap;
+	// rows edited since the last sync, as for the folds
+	int first, tail, numRows;
+	// bumped by every edit, for the rows kept in lines
+	unsigned generation;
+	struct BracketLine lines[2];
+	int lastLine;
+};
+
+// a distinct word of the buffer; its text is in the arena
+struct Word
+{
+	uint32_t offset;
+	uint32_t hash;
+	int len;
+	int count; // occurrences in the buffer, 0 once they are all gone
+	// the rows between the cursor and its nearest occurrence, for the query with this stamp
+	int near;
+	unsigned stamp;
+};
+
+// the words of the buffer with their counts, built on the first completion and then kept up
+// by the edits: rows leave the index before they change and come back at the next query
+struct EditorWords
+{
+	int active;
+	char *arena;
+	size_t arenaLen, arenaCap;
+	struct Word *words;
+	int numWords, cap, dead;
+	int *slots; // open addressing over word indices plus one
+	int numSlots;
+	int *sorted; // word indices in byte order; the words after numSorted are not merged in yet
+	int numSorted;
+	// rows out of the index: from first on, all but the last tail
+	int first, tail;
+	unsigned stamp;
+};
+
+// the candidates offered for the word before the cursor, cycled by pressing Ctrl-R again
+struct EditorCompletion
+{
+	char *candidates[COMPLETE_MAX];
+	int count, current;
+	int row, x, prefixLen, inserted;
+};
+
+// a byte overwritten in hex mode, not yet written to the file. Patches form a treap
+// ordered by offset, linked by their index in the patch array (-1 for none)
+struct HexPatch
+{
+	size_t offset;
+	unsigned char value;
+	int left, right;
+};
+
+// hex mode: the file is mapped read-only and shown straight from the mapping, overwritten
+// bytes are kept as patches in a tree by offset and written back in place on save, so the
+// memory used follows the edits rather than the size of the file
+struct EditorHex
+{
+	int active;
+	int fd;
+	int writeError; // why the file could not be opened for writing, 0 if it could
+	const unsigned char *map;
+	size_t mapSize, size; // size shrinks when the file is cut short outside the editor
+	struct HexPatch *patches;
+	int root, freeList; // removed patches are chained through left
+	int numPatches, used, cap;
+	// the byte under the cursor and the first byte on screen
+	size_t cursor, top;
+	int nibble; // the low half of the cursor byte is typed next
+	int text;	// typing into the text column rather than the hex one
+	unsigned char pattern[HEX_PATTERN_MAX];
+	int patternLen;
+};
+
+// how the core reaches its frontend; every hook may be NULL
+struct EditorHooks
+{
+	// whether the user is waiting to be served, so long scans can give way
+	int (*inputPending)();
+	// text copied into the kill ring
+	void (*clipboard)(const char *text, size_t len);
+	// runs before terminate reports a fatal error
+	void (*fatal)();
+};
+
+struct EditorContext
+{
+	int rowOffset, columnOffset;
+	int screenRows, screenColumns;
+	int cursorX, cursorY, cursorXS;
+	int renderX;
+	int numRows;
+	int rowCapacity;
+	int messageLifeTime;
+	int dirty;
+	char *filename;
+	char statusMsg[80];
+	time_t statusMsgTime;
+	EditorRow *row;
+	struct EditorSyntax *syntax;
+	struct EditorSyntax *syntaxDB;
+	int syntaxDBSize;
+	struct EditorJournal journal;
+	struct EditorDisk disk;
+	struct EditorLoader loader;
+	struct EditorSaveJob save;
+	struct EditorSearch search;
+	struct EditorWatch watch;
+	struct EditorKillRing killRing;
+	struct EditorSelection selection;
+	struct EditorOverlay overlay;
+	struct LexRuns lexRuns;
+	struct EditorDiff diff;
+	struct EditorFolds folds;
+	struct EditorBrackets brackets;
+	struct EditorWords words;
+	struct EditorCompletion completion;
+	struct EditorHex hex;
+	struct EditorHooks hooks;
+	int lastKey;
+};
+
+// the context the calling thread works on; the library calls set it, see mteEnter
+extern _Thread_local struct EditorContext *editorContext;
+#define EC (*editorContext)
+
+/*** function prototypes ***/
+void terminate(const char *s);
+void editorSetStatusMessage(const char *fmt, ...);
+const unsigned char *editorRowSpans(const EditorRow *row);
+int spanNext(const unsigned char **p, int *length);
+void editorUpdateSyntaxRange(int first, int last);
+void editorUpdateSyntax(EditorRow *row);
+void editorSelectSyntaxHighlight();
+long long journalNowMs();
+void editorJournalTick();
+void editorJournalSignalHandler(int sig);
+int editorRowCursorXToRenderX(EditorRow *row, int cursorX);
+int editorRenderXToCursorX(const EditorRow *row, int cursorX);
+int editorRowCursorXAt(const EditorRow *row, int renderX);
+const char *editorRowRender(const EditorRow *row);
+void editorInsertNewline();
+void editorInsertChar(int c);
+void editorDelChar();
+int editorLoadTick();
+void editorLoadWait();
+int editorOpen(const char *filename);
+int editorSave();
+int editorSaveTick();
+int editorWatchTick();
+void editorToggleFollow();
+void regexFree(struct Regex *re);
+int regexSearch(struct Regex *re, const char *text, int len, int from, int *matchStart, int *matchEnd);
+int regexSearchLast(struct Regex *re, const char *text, int len, int before, int *matchStart, int *matchEnd);
+void editorSearchRestart();
+void editorSearchSetPattern(const char *pattern);
+int editorSearchStep(int toFirst, long long deadline);
+void editorSearchShowMatch(int at, int matchStart, int matchEnd);
+int editorSearchShowFirst();
+int editorSearchTick();
+void editorKillLine(int cut);
+void editorInsertAtCursor(const char *text, size_t len);
+void editorYank();
+void editorYankPop();
+void editorSelectionStart(int mode);
+void editorSelectionRange(int *startY, int *startX, int *endY, int *endX);
+int editorSelectionColumns(int rowIndex, int *from, int *to);
+void editorSelectionDelete();
+void editorSelectionYank(int cut);
+void editorSelectionIndent(int dedent);
+void editorSelectionComment();
+void editorSelectionCase(int upper);
+void editorDeleteRows(int first, int last);
+int editorFirstNonBlank(int row);
+void editorWordMotion(int motion, int count, int *y, int *x);
+void editorOperatorLines(int op, int first, int last);
+void editorOperatorRange(int op, int startY, int startX, int endY, int endX);
+int editorJoinRows(int first, int last);
+void editorPut(int after, int count);
+int editorLineCommand(const char *command, int first, int last);
+int editorDiffToggle();
+int editorDiffUpdate();
+int editorDiffMarker(int row);
+int editorDiffJump(int forward);
+int editorFoldNext(int row);
+int editorFoldPrev(int row);
+int editorFoldVisible(int row);
+int editorFoldRowAt(int visible);
+int editorFoldHidden(int row);
+int editorFoldReveal(int row);
+int editorFoldToggle(int row);
+int editorFoldRows(int first, int last);
+int editorFoldAll();
+void editorUnfoldAll();
+int editorBracketMatch(int row, int x, int *atX, int *matchRow, int *matchX);
+int editorCompletions(int row, int x, struct EditorContext **others, int numOthers, char **candidates, int max);
+void editorComplete();
+int editorHexDetect(const char *filename);
+int editorHexOpen(const char *filename);
+void editorHexCheckSize();
+void editorHexRead(size_t offset, unsigned char *bytes, unsigned char *patched, size_t len);
+void editorHexSet(size_t offset, unsigned char value);
+void editorHexRevert(size_t offset);
+int editorHexSave();
+int editorHexParsePattern(const char *s, unsigned char *pattern, int max);
+int editorHexFind(const unsigned char *pattern, int len, size_t from, size_t *found);
+
+#endif
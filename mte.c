@@ -1,32 +1,14 @@
 /*** includes ***/
-#define _DEFAULT_SOURCE
-#define _BSD_SOURCE
-#define _GNU_SOURCE
-
-#include <ctype.h>
-#include <errno.h>
-#include <fcntl.h>
-#include <stdio.h>
-#include <stdarg.h>
-#include <stdlib.h>
-#include <string.h>
+#include "core.h"
+
 #include <sys/ioctl.h>
-#include <sys/types.h>
-#include <sys/param.h>
 #include <termios.h>
-#include <time.h>
-#include <unistd.h>
 
 /*** defines ***/
-#define CTRL_KEY(k) ((k) & 0x1f)
 #define MTE_VERSION "0.0.1"
-#define TAB_STOP 8
 #define KILO_QUIT_TIMES 2
-#define ESC_KEY '\x1b'
 #define ESC_SEQ(seq) "\x1b[" seq
-#define ENTER_KEY '\r'
 #define NEW_LINE "\r\n"
-#define SEPARATORS ",.;%<>()[]{}+-*/~="
 
 #define ESC_SEQ_CLEAR_SCREEN "\x1b[2J]"
 #define ESC_SEQ_DEFAULT_BG_COLOR "\x1b[m"
@@ -39,6 +21,15 @@
 #define ESC_SEQ_INVERT_BG_COLOR "\x1b[7m"
 #define ESC_SEQ_RESET_CURSOR "\x1b[H"
 #define ESC_SEQ_SHOW_CURSOR "\x1b[?25h"
+#define ESC_SEQ_ENABLE_BRACKETED_PASTE "\x1b[?2004h"
+#define ESC_SEQ_DISABLE_BRACKETED_PASTE "\x1b[?2004l"
+#define ESC_SEQ_PASTE_END "\x1b[201~"
+#define ESC_SEQ_MOUSE_REPORT "\x1b[<"
+#define ESC_SEQ_ENABLE_MOUSE "\x1b[?1002h\x1b[?1006h"
+#define ESC_SEQ_DISABLE_MOUSE "\x1b[?1006l\x1b[?1002l"
+#define ESC_SEQ_BEGIN_SYNC "\x1b[?2026h"
+#define ESC_SEQ_END_SYNC "\x1b[?2026l"
+#define ESC_SEQ_QUERY_SYNC "\x1b[?2026$p"
 
 #define NEW_LINE_SZ 2
 #define ESC_SEQ_CLEAR_SCREEN_SZ 4
@@ -52,130 +43,133 @@
 #define ESC_SEQ_INVERT_BG_COLOR_SZ 4
 #define ESC_SEQ_RESET_CURSOR_SZ 3
 #define ESC_SEQ_SHOW_CURSOR_SZ 6
+#define ESC_SEQ_ENABLE_BRACKETED_PASTE_SZ 8
+#define ESC_SEQ_DISABLE_BRACKETED_PASTE_SZ 8
+#define ESC_SEQ_PASTE_END_SZ 6
+#define ESC_SEQ_MOUSE_REPORT_SZ 3
+#define ESC_SEQ_ENABLE_MOUSE_SZ 16
+#define ESC_SEQ_DISABLE_MOUSE_SZ 16
+#define ESC_SEQ_BEGIN_SYNC_SZ 8
+#define ESC_SEQ_END_SYNC_SZ 8
+#define ESC_SEQ_QUERY_SYNC_SZ 9
+
+#define INPUT_BUFFER_SIZE 4096
+#define PASTE_IDLE_READS 50
+#define MOUSE_REPORT_MAX 32
+#define MOUSE_WHEEL_ROWS 3
+
+#define FRAME_DEFAULT_FPS 60
+#define FRAME_MAX_FPS 1000
+
+#define DIFF_GUTTER 2
+#define HEX_OFFSET_DIGITS 10
+
+#define NORMAL_MAX_COUNT 100000000
+#define NORMAL_TYPED_MAX 16
 
-#define HL_HIGHLIGHT_NUMBERS (1 << 0)
-#define HL_HIGHLIGHT_STRINGS (1 << 1)
-
-enum EditorKey
-{
-	BACKSPACE = 127,
-	ARROW_LEFT = 1001,
-	ARROW_RIGHT,
-	ARROW_UP,
-	ARROW_DOWN,
-	DEL_KEY,
-	PAGE_UP,
-	PAGE_DOWN,
-	HOME_KEY,
-	END_KEY,
+/*** data ***/
+struct InputBuffer
+{
+	char data[INPUT_BUFFER_SIZE];
+	int start, len;
 };
 
-enum EditorHighlight
+enum MouseAction
 {
-	HL_NORMAL = 0,
-	HL_NUMBER,
-	HL_MATCH,
-	HL_STRING,
-	HL_COMMENT,
-	HL_MLCOMMENT,
-	HL_KEYWORD_MAIN,
-	HL_KEYWORD_SUB,
+	MOUSE_NONE = 0,
+	MOUSE_CLICK,
+	MOUSE_DRAG,
+	MOUSE_RELEASE,
+	MOUSE_WHEEL,
 };
 
-/*** data ***/
-struct EditorSyntax
-{
-	char *fileType;
-	char **filematch;
-	char **keywords;
-	char *singleCommentStart;
-	char *multiCommentStart;
-	char *multiCommentEnd;
-	int flags;
+// the latest mouse report, in 0-based screen cells; wheel notches that arrive together are summed
+struct EditorMouse
+{
+	int action;
+	int x, y;
+	int wheel;
+	int pressed;
 };
 
-typedef struct EditorRow
-{
-	int index;
-	int size;
-	int rsize;
-	char *chars;
-	char *render;
-	unsigned char *highlight;
-	int isOpenComment;
-} EditorRow;
-
-struct EditorContext
-{
-	int rowOffset, columnOffset;
-	int screenRows, screenColumns;
-	int cursorX, cursorY, cursorXS;
-	int renderX;
-	int numRows;
-	int messageLifeTime;
-	int dirty;
-	char *filename;
-	char statusMsg[80];
-	time_t statusMsgTime;
-	EditorRow *row;
-	struct EditorSyntax *syntax;
-	struct termios oldtio;
-} EC;
-
-/*** filetypes ***/
-char *C_HL_EXTENSIONS[] = {".c", ".h", ".cpp", ".hpp", NULL};
-char *C_HL_keywords[] = {
-	"switch", "if", "while", "for", "break", "continue", "return", "else",
-	"struct", "union", "typedef", "static", "enum", "class", "case", "#define", "#include",
-	"int|",
-	"long|", "double|", "float|", "char|", "unsigned|", "signed|",
-	"void|", NULL};
-
-// store all HL catagories
-struct EditorSyntax HLDB[] = {
-	{"c",
-	 C_HL_EXTENSIONS,
-	 C_HL_keywords,
-	 "//", "/*", "*/", HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS},
+// what the text area of the terminal shows: one content hash per screen line
+struct EditorScreen
+{
+	uint64_t *lines;
+	int rows;
+	long long rowOffset; // the screen line of the buffer at the top, closed folds counting as one
+	int syncOutput;
+};
+
+// paces repaints: keys that arrive together are all applied before the next frame is drawn.
+// Times are in microseconds
+struct EditorFrames
+{
+	long long interval;
+	long long lastPaint;
+	// when the oldest key not yet on screen was read, 0 if none
+	long long inputAt;
+	// keys applied since the last frame
+	int keys;
+	unsigned long painted, skipped, measured;
+	long long latency, latencyMax, latencyTotal;
+};
+
+// the bracket at the cursor and its match, in render columns, see editorBracketUpdate
+struct EditorBracketPair
+{
+	int active;
+	int row, col;
+	int matchRow, matchCol;
+};
+
+// vim-like normal mode and the command being typed in it: a count, a pending operator with
+// the count given before it, a 'g' prefix; typed echoes the keys in the status bar
+struct EditorNormal
+{
+	int active;
+	int count;
+	int op, opCount;
+	int prefix;
+	char typed[NORMAL_TYPED_MAX + 1];
+	int typedLen;
 };
 
-#define HLDB_ENTRIES (int)(sizeof(HLDB) / sizeof(HLDB[0]))
+// what the terminal frontend keeps besides the editor context
+struct EditorTerminal
+{
+	struct termios oldtio;
+	struct InputBuffer input;
+	struct EditorMouse mouse;
+	struct EditorScreen screen;
+	struct EditorFrames frames;
+	struct EditorBracketPair brackets;
+	struct EditorNormal normal;
+} ET;
 
 /*** function prototypes ***/
-void editorSetStatusMessage(const char *fmt, ...);
 void throwErrorLog(const char *fmt, ...);
-void editorFreeRow(EditorRow *row);
+int editorInputPending();
+long long frameNowUs();
+int editorTextColumns();
 void editorRefresh();
+void editorFrameDone();
+void editorFrameReport();
+void editorMoveCursorRows(int delta);
+void editorNormalEnter();
+void editorNormalClamp();
+int editorProcessNormalKey(int key);
+int editorProcessHexKey(int key);
 char *editorPrompt(const char *prompt, void (*callback)(char *s, int));
-int editorRenderXToCursorX(const EditorRow *row, int cursorX);
+void editorLinePrompt(int first, int last);
 
 /*** terminal ***/
-void releaseMemory()
-{
-	free(EC.filename);
-	if (EC.row)
-	{
-		for (int i = 0; i < EC.numRows; i++)
-		{
-			editorFreeRow(&EC.row[i]);
-		}
-		free(EC.row);
-	}
-}
-
-void terminate(const char *s)
-{
-	(void)!write(STDOUT_FILENO, ESC_SEQ_CLEAR_SCREEN, ESC_SEQ_CLEAR_SCREEN_SZ);
-	(void)!write(STDOUT_FILENO, ESC_SEQ_RESET_CURSOR, ESC_SEQ_RESET_CURSOR_SZ);
-	perror(s);
-	releaseMemory();
-	exit(1);
-}
-
 void disableRawMode()
 {
+	(void)!write(STDOUT_FILENO, ESC_SEQ_DISABLE_BRACKETED_PASTE, ESC_SEQ_DISABLE_BRACKETED_PASTE_SZ);
+	(void)!write(STDOUT_FILENO, ESC_SEQ_DISABLE_MOUSE, ESC_SEQ_DISABLE_MOUSE_SZ);
 	// Reset raw mode & input leftover will be discarded
-	if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &EC.oldtio) == -1)
+	if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &ET.oldtio) == -1)
 	{
 		terminate("[Error]@disableRawMode | tcsetattr");
 	}
@@ -184,13 +178,13 @@ void disableRawMode()
 void enableRawMode()
 {
 	// Get current parameters & register exit recovery
-	if (tcgetattr(STDIN_FILENO, &EC.oldtio) == -1)
+	if (tcgetattr(STDIN_FILENO, &ET.oldtio) == -1)
 	{
 		terminate("[Error]@enableRawMode | tcgetattr");
 	}
 	atexit(disableRawMode);
 
-	struct termios newtio = EC.oldtio;
+	struct termios newtio = ET.oldtio;
 	newtio.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
 	newtio.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
 	newtio.c_cflag |= (CS8);
@@ -204,18 +198,270 @@ void enableRawMode()
 	}
 
 	(void)!write(STDOUT_FILENO, ESC_SEQ_ENABLE_ALT_SCREEN, ESC_SEQ_ENABLE_ALT_SCREEN_SZ);
+	(void)!write(STDOUT_FILENO, ESC_SEQ_ENABLE_BRACKETED_PASTE, ESC_SEQ_ENABLE_BRACKETED_PASTE_SZ);
+	(void)!write(STDOUT_FILENO, ESC_SEQ_ENABLE_MOUSE, ESC_SEQ_ENABLE_MOUSE_SZ);
+}
+
+// whether a key is waiting, so long work can give way to it
+int editorInputPending()
+{
+	struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+	return ET.input.len > 0 || poll(&pfd, 1, 0) > 0;
+}
+
+// reads stdin in chunks and hands out one byte at a time; returns read()'s result when empty
+int editorReadByte(char *c)
+{
+	if (!ET.input.len)
+	{
+		ssize_t size = read(STDIN_FILENO, ET.input.data, sizeof(ET.input.data));
+		if (size <= 0)
+		{
+			return size;
+		}
+		ET.input.start = 0;
+		ET.input.len = size;
+	}
+	*c = ET.input.data[ET.input.start++];
+	ET.input.len--;
+	return 1;
+}
+
+// reads a bracketed paste up to its end marker; line breaks come back as '\n'.
+// Returned buffer needs to be manually free after use.
+char *editorReadPaste(size_t *pasteLen)
+{
+	size_t cap = INPUT_BUFFER_SIZE, len = 0;
+	char *buf = malloc(cap);
+	if (!buf)
+	{
+		terminate("[error]@editorReadPaste | malloc");
+	}
+
+	int idle = 0;
+	while (idle < PASTE_IDLE_READS)
+	{
+		if (!ET.input.len)
+		{
+			ssize_t size = read(STDIN_FILENO, ET.input.data, sizeof(ET.input.data));
+			if (size == -1 && errno != EAGAIN)
+			{
+				terminate("[Error]@editorReadPaste | read");
+			}
+			if (size <= 0)
+			{
+				idle++;
+				continue;
+			}
+			idle = 0;
+			ET.input.start = 0;
+			ET.input.len = size;
+		}
+
+		size_t chunk = ET.input.len;
+		if (len + chunk > cap)
+		{
+			while (len + chunk > cap)
+			{
+				cap *= 2;
+			}
+			buf = realloc(buf, cap);
+			if (!buf)
+			{
+				terminate("[error]@editorReadPaste | realloc");
+			}
+		}
+		memcpy(&buf[len], &ET.input.data[ET.input.start], chunk);
+		size_t searchFrom = (len >= ESC_SEQ_PASTE_END_SZ) ? len - ESC_SEQ_PASTE_END_SZ + 1 : 0;
+		len += chunk;
+		ET.input.start += chunk;
+		ET.input.len = 0;
+
+		char *end = memmem(&buf[searchFrom], len - searchFrom, ESC_SEQ_PASTE_END, ESC_SEQ_PASTE_END_SZ);
+		if (end)
+		{
+			// keys typed right after the paste stay in the input buffer
+			size_t extra = &buf[len] - (end + ESC_SEQ_PASTE_END_SZ);
+			ET.input.start -= extra;
+			ET.input.len = extra;
+			len = end - buf;
+			break;
+		}
+	}
+
+	// terminals send line breaks as \r; accept \r\n and \n too
+	size_t out = 0;
+	for (size_t i = 0; i < len; i++)
+	{
+		if (buf[i] == '\r')
+		{
+			buf[out++] = '\n';
+			if (i + 1 < len && buf[i + 1] == '\n')
+			{
+				i++;
+			}
+		}
+		else
+		{
+			buf[out++] = buf[i];
+		}
+	}
+	*pasteLen = out;
+	return buf;
+}
+
+// parses the "<button>;<x>;<y>M" tail of an SGR mouse report; returns its length, 0 if incomplete, -1 if malformed
+int mouseParseReport(const char *s, int len, int *button, int *x, int *y, int *release)
+{
+	int fields[3] = {0, 0, 0};
+	int field = 0, digits = 0;
+	for (int i = 0; i < len; i++)
+	{
+		char c = s[i];
+		if (c >= '0' && c <= '9' && fields[field] < 100000)
+		{
+			fields[field] = fields[field] * 10 + (c - '0');
+			digits++;
+		}
+		else if (c == ';' && digits && field < 2)
+		{
+			field++;
+			digits = 0;
+		}
+		else if ((c == 'M' || c == 'm') && digits && field == 2)
+		{
+			*button = fields[0];
+			*x = fields[1] - 1;
+			*y = fields[2] - 1;
+			*release = (c == 'm');
+			return i + 1;
+		}
+		else
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// what a report means to the editor; wheel reports also give their direction
+int mouseAction(int button, int release, int *wheel)
+{
+	if (button & 64)
+	{
+		// 64 is up and 65 down; sideways wheels are not used
+		if ((button & 3) > 1)
+		{
+			return MOUSE_NONE;
+		}
+		*wheel = (button & 1) ? 1 : -1;
+		return MOUSE_WHEEL;
+	}
+	// only the left button places the cursor and selects
+	if (button & 3)
+	{
+		return MOUSE_NONE;
+	}
+	if (release)
+	{
+		return MOUSE_RELEASE;
+	}
+	return (button & 32) ? MOUSE_DRAG : MOUSE_CLICK;
+}
+
+// buffers input that is already waiting, without blocking; returns the number of unread bytes
+int editorInputPeek()
+{
+	if (!ET.input.len && editorInputPending())
+	{
+		ssize_t size = read(STDIN_FILENO, ET.input.data, sizeof(ET.input.data));
+		if (size > 0)
+		{
+			ET.input.start = 0;
+			ET.input.len = size;
+		}
+	}
+	return ET.input.len;
+}
+
+// reads the rest of a mouse report after ESC [ <. A burst of wheel or drag reports that has
+// already arrived is folded into one event, so fast scrolling costs a single repaint
+int editorReadMouse()
+{
+	char report[MOUSE_REPORT_MAX];
+	int len = 0, consumed = 0;
+	int button, x, y, release;
+	while (len < MOUSE_REPORT_MAX && consumed == 0)
+	{
+		if (editorReadByte(&report[len]) != 1)
+		{
+			return IGNORED_KEY;
+		}
+		consumed = mouseParseReport(report, ++len, &button, &x, &y, &release);
+	}
+	if (consumed <= 0)
+	{
+		return IGNORED_KEY;
+	}
+
+	struct EditorMouse *mouse = &ET.mouse;
+	int wheel = 0;
+	mouse->action = mouseAction(button, release, &wheel);
+	mouse->x = x;
+	mouse->y = y;
+	mouse->wheel = wheel;
+
+	while (mouse->action == MOUSE_WHEEL || mouse->action == MOUSE_DRAG)
+	{
+		if (editorInputPeek() <= ESC_SEQ_MOUSE_REPORT_SZ)
+		{
+			break;
+		}
+		const char *next = &ET.input.data[ET.input.start];
+		if (memcmp(next, ESC_SEQ_MOUSE_REPORT, ESC_SEQ_MOUSE_REPORT_SZ))
+		{
+			break;
+		}
+		// a report cut off at the end of the buffer is left for the next read
+		consumed = mouseParseReport(next + ESC_SEQ_MOUSE_REPORT_SZ, ET.input.len - ESC_SEQ_MOUSE_REPORT_SZ,
+									&button, &x, &y, &release);
+		if (consumed <= 0 || mouseAction(button, release, &wheel) != mouse->action)
+		{
+			break;
+		}
+		consumed += ESC_SEQ_MOUSE_REPORT_SZ;
+		ET.input.start += consumed;
+		ET.input.len -= consumed;
+		mouse->x = x;
+		mouse->y = y;
+		if (mouse->action == MOUSE_WHEEL)
+		{
+			mouse->wheel += wheel;
+		}
+	}
+	return MOUSE_EVENT;
 }
 
 int editorReadKey()
 {
 	ssize_t size;
 	char c;
-	while ((size = read(STDIN_FILENO, &c, 1)) != 1)
+	while ((size = editorReadByte(&c)) != 1)
 	{
 		if (size == -1 && errno != EAGAIN)
 		{
 			terminate("[Error]@editorReadKey | read");
 		}
+		// idle: commit batched journal records and pick up changes made on disk
+		editorJournalTick();
+		if (editorLoadTick() | editorSaveTick() | editorWatchTick() | editorSearchTick())
+		{
+			editorRefresh();
+		}
+	}
+	if (!ET.frames.inputAt)
+	{
+		ET.frames.inputAt = frameNowUs();
 	}
 
 	// ESC keys
@@ -223,41 +469,68 @@ int editorReadKey()
 	{
 		char seq[3];
 
-		if (read(STDIN_FILENO, &seq[0], 1) != 1)
+		if (editorReadByte(&seq[0]) != 1)
 		{
 			return ESC_KEY;
 		}
-		if (read(STDIN_FILENO, &seq[1], 1) != 1)
+		// a key typed right after ESC is not a sequence, keep it for the next read
+		if (seq[0] != '[' && seq[0] != 'O')
 		{
+			ET.input.start--;
+			ET.input.len++;
 			return ESC_KEY;
 		}
+		if (editorReadByte(&seq[1]) != 1)
+		{
+			return IGNORED_KEY;
+		}
 
 		if (seq[0] == '[')
 		{
+			if (seq[1] == '<')
+			{
+				return editorReadMouse();
+			}
 			if (seq[1] >= '0' && seq[1] <= '9')
 			{
-				if (read(STDIN_FILENO, &seq[2], 1) != 1)
-					return ESC_KEY;
+				// ESC [ <number> ~
+				int code = seq[1] - '0';
+				while (1)
+				{
+					if (editorReadByte(&seq[2]) != 1)
+						return IGNORED_KEY;
+					if (seq[2] < '0' || seq[2] > '9' || code > 1000)
+						break;
+					code = code * 10 + (seq[2] - '0');
+				}
 				if (seq[2] == '~')
 				{
-					switch (seq[1])
+					switch (code)
 					{
-					case '1':
+					case 1:
 						return HOME_KEY;
-					case '3':
+					case 3:
 						return DEL_KEY;
-					case '4':
+					case 4:
 						return END_KEY;
-					case '5':
+					case 5:
 						return PAGE_UP;
-					case '6':
+					case 6:
 						return PAGE_DOWN;
-					case '7':
+					case 7:
 						return HOME_KEY;
-					case '8':
+					case 8:
 						return END_KEY;
+					case 200:
+						return PASTE_START;
 					}
 				}
+				// drop the rest of a sequence with parameters, such as a modified arrow
+				while (seq[2] < 0x40 || seq[2] > 0x7e)
+				{
+					if (editorReadByte(&seq[2]) != 1)
+						break;
+				}
 			}
 			else
 			{
@@ -288,7 +561,8 @@ int editorReadKey()
 				return HOME_KEY;
 			}
 		}
-		return ESC_KEY;
+		// malformed or unknown sequences are not a bare ESC
+		return IGNORED_KEY;
 	}
 	return c;
 }
@@ -298,10 +572,18 @@ void editorExit()
 	(void)!write(STDOUT_FILENO, ESC_SEQ_CLEAR_SCREEN, ESC_SEQ_CLEAR_SCREEN_SZ);
 	(void)!write(STDOUT_FILENO, ESC_SEQ_RESET_CURSOR, ESC_SEQ_RESET_CURSOR_SZ);
 	(void)!write(STDOUT_FILENO, ESC_SEQ_DISABLE_ALT_SCREEN, ESC_SEQ_DISABLE_ALT_SCREEN_SZ);
-	releaseMemory();
+	mteDestroy(editorContext);
+	free(ET.screen.lines);
 	exit(0);
 }
 
+// clears the screen so that a fatal error is readable
+void editorClearScreen()
+{
+	(void)!write(STDOUT_FILENO, ESC_SEQ_CLEAR_SCREEN, ESC_SEQ_CLEAR_SCREEN_SZ);
+	(void)!write(STDOUT_FILENO, ESC_SEQ_RESET_CURSOR, ESC_SEQ_RESET_CURSOR_SZ);
+}
+
 int getCursorPosition(int *rows, int *cols)
 {
 	char buf[32];
@@ -342,6 +624,33 @@ int getCursorPosition(int *rows, int *cols)
 	return 0;
 }
 
+// asks whether the terminal knows synchronized output (DEC mode 2026). Terminals ignore
+// queries they do not understand, so a cursor position request marks the end of the replies.
+int editorQuerySyncOutput()
+{
+	if (write(STDOUT_FILENO, ESC_SEQ_QUERY_SYNC ESC_SEQ_GET_CURSOR, ESC_SEQ_QUERY_SYNC_SZ + ESC_SEQ_GET_CURSOR_SZ) !=
+		ESC_SEQ_QUERY_SYNC_SZ + ESC_SEQ_GET_CURSOR_SZ)
+	{
+		return 0;
+	}
+
+	char buf[64];
+	unsigned int i = 0;
+	while (i < sizeof(buf) - 1)
+	{
+		if (read(STDIN_FILENO, &buf[i], 1) != 1 || buf[i] == 'R')
+		{
+			break;
+		}
+		i++;
+	}
+	buf[i] = '\0';
+
+	// reply is CSI ? 2026 ; Ps $ y, where 1 and 2 mean the mode is known
+	char *reply = strstr(buf, "\x1b[?2026;");
+	return reply && (reply[8] == '1' || reply[8] == '2');
+}
+
 int getWindowSize(int *rows, int *cols)
 {
 	struct winsize ws;
@@ -363,525 +672,564 @@ int getWindowSize(int *rows, int *cols)
 	return 0;
 }
 
-/*** Syntax highlight***/
-int isSeparator(int c)
+/*** search ***/
+void editorSearchCallback(char *pattern, int key)
 {
-	return isspace(c) || strchr(SEPARATORS, c) != NULL;
-}
+	struct EditorSearch *sr = &EC.search;
 
-void editorUpdateSyntax(EditorRow *row)
-{
-	row->highlight = realloc(row->highlight, row->rsize);
-	if (row->rsize && !row->highlight)
+	// drop the previous match highlight
+	EC.overlay.row = -1;
+
+	if (key == ENTER_KEY || key == ESC_KEY || key == CTRL_KEY('c'))
 	{
-		terminate("[error]@editorUpdateSyntax | realloc");
+		sr->active = 0;
+		regexFree(sr->regex);
+		sr->regex = NULL;
+		free(sr->pattern);
+		sr->pattern = NULL;
+		editorSearchRestart();
+		return;
 	}
-	memset(row->highlight, HL_NORMAL, row->rsize);
 
-	if (!EC.syntax)
+	switch (key)
+	{
+	case ARROW_UP:
+	case ARROW_LEFT:
+		sr->direction = -1;
+		break;
+	case ARROW_RIGHT:
+	case ARROW_DOWN:
+		sr->direction = 1;
+		break;
+	default:
+		sr->lastMatchRow = -1;
+		sr->lastMatchX = -1;
+		sr->direction = 1;
+		editorSearchSetPattern(pattern);
+		// a long scan goes on in editorSearchTick once the prompt has been redrawn
+		editorSearchStep(1, journalNowMs() + SEARCH_KEY_MS);
+		editorSearchShowFirst();
+		return;
+	}
+	if (!sr->regex)
 	{
 		return;
 	}
 
-	char **keywords = EC.syntax->keywords;
-	const char *singleCommentStart = EC.syntax->singleCommentStart;
-	const char *multiCommentStart = EC.syntax->multiCommentStart;
-	const char *multiCommentEnd = EC.syntax->multiCommentEnd;
-
-	int singleCommentStartLen = singleCommentStart ? strlen(singleCommentStart) : 0;
-	int multiCommentStartLen = multiCommentStart ? strlen(multiCommentStart) : 0;
-	int multiCommentEndLen = multiCommentEnd ? strlen(multiCommentEnd) : 0;
-
-	int isLastCharSeparator = 1;
-	int inStringBlock = 0;
-	int inCommentBlock = (row->index > 0 && EC.row[row->index - 1].isOpenComment);
-
-	int i = 0;
-	while (i < row->rsize)
+	int currentLine = MAX(sr->lastMatchRow, 0);
+	int currentX = sr->lastMatchX;
+	for (int i = 0; i < EC.numRows; i++)
 	{
-		char c = row->render[i];
-		unsigned char lastHighlight = (i > 0) ? row->highlight[i - 1] : HL_NORMAL;
-
-		// check for single-line comments
-		if (singleCommentStartLen && !inStringBlock && !inCommentBlock)
+		if (currentLine < 0)
 		{
-			if (!strncmp(&row->render[i], singleCommentStart, singleCommentStartLen))
-			{
-				memset(&row->highlight[i], HL_COMMENT, row->rsize - i);
-				break;
-			}
+			currentLine = EC.numRows - 1;
 		}
-
-		if (multiCommentStartLen && multiCommentEndLen && !inStringBlock)
+		else if (currentLine == EC.numRows)
 		{
-			if (inCommentBlock)
-			{
-				row->highlight[i] = HL_MLCOMMENT;
-				// end of multi line comment
-				if (!strncmp(&row->render[i], multiCommentEnd, multiCommentEndLen))
-				{
-					memset(&row->highlight[i], HL_MLCOMMENT, multiCommentEndLen);
-					i += multiCommentEndLen;
-					inCommentBlock = 0;
-					isLastCharSeparator = 1;
-					continue;
-				}
-
-				i++;
-				continue;
-			}
-			// start of multi line comment
-			else if (!strncmp(&row->render[i], multiCommentStart, multiCommentStartLen))
-			{
-				memset(&row->highlight[i], HL_MLCOMMENT, multiCommentStartLen);
-				i += multiCommentStartLen;
-				inCommentBlock = 1;
-				continue;
-			}
+			currentLine = 0;
 		}
 
-		if (EC.syntax->flags & HL_HIGHLIGHT_STRINGS)
+		EditorRow *row = &EC.row[currentLine];
+		int matchStart, matchEnd;
+		int found;
+		if (sr->direction > 0)
 		{
-			if (inStringBlock)
-			{
-				row->highlight[i] = HL_STRING;
-
-				if (c == '\\' && i + 1 < row->rsize)
-				{
-					row->highlight[i + 1] = HL_STRING;
-					i += 2;
-					continue;
-				}
-
-				// end of string
-				if (c == inStringBlock)
-				{
-					inStringBlock = 0;
-				}
-				isLastCharSeparator = 1;
-				i++;
-				continue;
-			}
-
-			// start of string
-			if (c == '"' || c == '\'')
-			{
-				row->highlight[i] = HL_STRING;
-				inStringBlock = c;
-				i++;
-				continue;
-			}
+			found = regexSearch(sr->regex, editorRowRender(row), row->rsize, currentX + 1, &matchStart, &matchEnd);
 		}
-
-		if (EC.syntax->flags & HL_HIGHLIGHT_NUMBERS)
+		else
 		{
-			if ((isdigit(c) && (isLastCharSeparator || lastHighlight == HL_NUMBER)) || (c == '.' && lastHighlight == HL_NUMBER))
-			{
-				row->highlight[i] = HL_NUMBER;
-				isLastCharSeparator = 0;
-				i++;
-				continue;
-			}
+			found = regexSearchLast(sr->regex, editorRowRender(row), row->rsize, currentX, &matchStart, &matchEnd);
 		}
 
-		// keyword highlight
-		if (isLastCharSeparator)
+		if (found)
 		{
-			int j;
-			for (j = 0; keywords[j]; j++)
-			{
-				int keywordLen = strlen(keywords[j]);
-				int isSubKeyword = keywords[j][keywordLen - 1] == '|';
-				if (isSubKeyword)
-				{
-					keywordLen--;
-				}
-
-				if (!strncmp(&row->render[i], keywords[j], keywordLen) && isSeparator(row->render[i + keywordLen]))
-				{
-					memset(&row->highlight[i], isSubKeyword ? HL_KEYWORD_SUB : HL_KEYWORD_MAIN, keywordLen);
-					i += keywordLen;
-					break;
-				}
-			}
-			if (keywords[j] != NULL)
-			{
-				isLastCharSeparator = 0;
-				continue;
-			}
+			editorSearchShowMatch(currentLine, matchStart, matchEnd);
+			break;
 		}
 
-		isLastCharSeparator = isSeparator(c);
-		i++;
+		sr->lastMatchX = -1;
+		currentX = -1;
+		currentLine += sr->direction;
 	}
-
-	// if remains in open comment block, update the following line
-	int changed = (row->isOpenComment != inCommentBlock);
-	row->isOpenComment = inCommentBlock;
-	if (changed && row->index + 1 < EC.numRows)
-		editorUpdateSyntax(&EC.row[row->index + 1]);
 }
-
-int editorSyntaxToColor(int highlight)
+void editorSearch()
 {
-	switch (highlight)
+	int originCursorX = EC.cursorX, originCursorY = EC.cursorY, originCursorXS = EC.cursorXS;
+	int originRowOffset = EC.rowOffset, originColumnOffset = EC.columnOffset;
+
+	EC.search.active = 1;
+	EC.search.originRow = EC.cursorY;
+	EC.search.lastMatchRow = -1;
+	EC.search.lastMatchX = -1;
+	EC.search.direction = 1;
+	char *pattern = editorPrompt("Search (regex): %s (Press ESC or Ctrl+C to cancel)", editorSearchCallback);
+	if (pattern)
 	{
-	case HL_NUMBER:
-		return 36;
-	case HL_MATCH:
-		return 34;
-	case HL_STRING:
-		return 33;
-	case HL_MLCOMMENT:
-	case HL_COMMENT:
-		return 32;
-	case HL_KEYWORD_MAIN:
-		return 35;
-	case HL_KEYWORD_SUB:
-		return 31;
-	default:
-		return 37;
+		free(pattern);
+		return;
 	}
+
+	EC.cursorX = originCursorX;
+	EC.cursorXS = originCursorXS;
+	EC.cursorY = originCursorY;
+	EC.rowOffset = originRowOffset;
+	EC.columnOffset = originColumnOffset;
 }
 
-void editorSelectSyntaxHighlight()
+/*** buffer append ***/
+struct abuf
+{
+	char *b;
+	int len;
+};
+
+#define ABUF_INIT \
+	{             \
+		NULL, 0}
+
+void abAppend(struct abuf *ab, const char *s, int len)
 {
-	if (EC.filename == NULL)
+	char *newBuf = realloc(ab->b, ab->len + len);
+	if (newBuf)
 	{
-		EC.syntax = NULL;
-		return;
+		memcpy(&newBuf[ab->len], s, len);
+		ab->b = newBuf;
+		ab->len += len;
 	}
+}
+
+void abFree(struct abuf *ab)
+{
+	free(ab->b);
+}
 
-	char *ext = strrchr(EC.filename, '.');
-	if (ext == NULL)
+/*** clipboard ***/
+// hands copied text to the terminal clipboard (OSC 52), which also works over SSH
+void editorSetClipboard(const char *text, size_t len)
+{
+	static const char base64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	if (len > CLIPBOARD_MAX)
 	{
-		EC.syntax = NULL;
 		return;
 	}
 
-	// iterate HL catagories
-	for (int j = 0; j < HLDB_ENTRIES; j++)
+	struct abuf ab = ABUF_INIT;
+	abAppend(&ab, "\x1b]52;c;", 7);
+	for (size_t i = 0; i < len; i += 3)
 	{
-		struct EditorSyntax *syntax = &HLDB[j];
+		unsigned v = (unsigned char)text[i] << 16;
+		if (i + 1 < len)
+			v |= (unsigned char)text[i + 1] << 8;
+		if (i + 2 < len)
+			v |= (unsigned char)text[i + 2];
 
-		// check matching specific extension
-		for (int i = 0; syntax->filematch[i] != NULL; i++)
-		{
-			int is_ext = (syntax->filematch[i][0] == '.');
-
-			// check extension matches or contains specific name
-			if ((is_ext && strcmp(ext, syntax->filematch[i]) == 0) ||
-				(!is_ext && strstr(EC.filename, syntax->filematch[i]) != NULL))
-			{
-				EC.syntax = syntax;
-				// re-apply highlight
-				for (int fileRow = 0; fileRow < EC.numRows; fileRow++)
-				{
-					editorUpdateSyntax(&EC.row[fileRow]);
-				}
-
-				return;
-			}
-		}
+		char out[4] = {base64[(v >> 18) & 63], base64[(v >> 12) & 63],
+					   i + 1 < len ? base64[(v >> 6) & 63] : '=',
+					   i + 2 < len ? base64[v & 63] : '='};
+		abAppend(&ab, out, 4);
 	}
-
-	// if no syntax is found, set syntax to NULL
-	EC.syntax = NULL;
+	abAppend(&ab, "\x07", 1);
+	(void)!write(STDOUT_FILENO, ab.b, ab.len);
+	abFree(&ab);
 }
-
-/*** Row operations ***/
-int editorRowCursorXToRenderX(EditorRow *row, int cursorX)
+// bracketed paste: the whole block is inserted at once
+void editorPaste()
 {
-	int renderX = 0;
-	int j;
-	for (j = 0; j < cursorX; j++)
-	{
-		if (row->chars[j] == '\t')
-		{
-			renderX += (TAB_STOP - 1) - (renderX % TAB_STOP); // find next tab column
-		}
-		renderX++;
-	}
-
-	return renderX;
+	size_t len;
+	char *text = editorReadPaste(&len);
+	editorInsertAtCursor(text, len);
+	editorSetStatusMessage("Pasted %zu bytes", len);
+	free(text);
 }
 
-// updates the rendered representation of a row of text in the editor.
-void editorUpdateRow(EditorRow *row)
+/*** selection ***/
+// keys acting on an active selection; returns 0 for keys that keep their usual meaning
+int editorProcessSelectionKey(int key)
 {
-	int tabs = 0;
-	int j;
-	for (j = 0; j < row->size; j++)
+	if (EC.selection.mode == SEL_NONE)
 	{
-		if (row->chars[j] == '\t')
-		{
-			tabs++;
-		}
+		return 0;
+	}
+	if (!EC.numRows)
+	{
+		EC.selection.mode = SEL_NONE;
+		return 0;
 	}
 
-	free(row->render);
-	// each tab is 8 chars so +7 per tab
-	row->render = malloc(row->size + tabs * (TAB_STOP - 1) + 1);
-	if (!row->render)
+	switch (key)
+	{
+	case ESC_KEY:
+		EC.selection.mode = SEL_NONE;
+		break;
+	case 'd':
+	case 'x':
+	case CTRL_KEY('k'):
+		editorSelectionYank(1);
+		break;
+	case BACKSPACE:
+	case CTRL_KEY('h'):
+	case DEL_KEY:
+		editorSelectionDelete();
+		break;
+	case 'y':
+	case CTRL_KEY('c'):
+		editorSelectionYank(0);
+		break;
+	case '>':
+	case '\t':
+		editorSelectionIndent(0);
+		break;
+	case '<':
+		editorSelectionIndent(1);
+		break;
+	case '/':
+		editorSelectionComment();
+		break;
+	case 'u':
+	case 'U':
+		editorSelectionCase(key == 'U');
+		break;
+	case ':':
+	case CTRL_KEY('e'):
 	{
-		terminate("[error]@editorUpdateRow | malloc update row");
+		int startY, startX, endY, endX;
+		editorSelectionRange(&startY, &startX, &endY, &endX);
+		EC.selection.mode = SEL_NONE;
+		EC.cursorY = startY;
+		EC.cursorX = 0;
+		editorLinePrompt(startY, endY);
 	}
-	int at = 0;
-	for (j = 0; j < row->size; j++)
+	break;
+	case 'z':
 	{
-		if (row->chars[j] == '\t')
+		int startY, startX, endY, endX;
+		editorSelectionRange(&startY, &startX, &endY, &endX);
+		EC.selection.mode = SEL_NONE;
+		if (editorFoldRows(startY, endY) == 0)
 		{
-			row->render[at++] = ' ';
-			while (at % TAB_STOP != 0)
-			{
-				row->render[at++] = ' ';
-			}
+			EC.cursorY = startY;
+			EC.cursorX = 0;
+			EC.cursorXS = 0;
 		}
-		else
+	}
+	break;
+	case CTRL_KEY('v'):
+	case PASTE_START:
+		// pasting replaces the selection
+		editorSelectionDelete();
+		return 0;
+	default:
+		if (key == ENTER_KEY || (key < 128 && isprint(key)))
 		{
-			row->render[at++] = row->chars[j];
+			editorSetStatusMessage("Selection: d cut | y copy | > < indent | / comment | u U case | : sort/filter lines | z fold | ESC cancel");
+			break;
 		}
+		return 0;
 	}
-	row->render[at] = '\0';
-	row->rsize = at;
-
-	editorUpdateSyntax(row);
+	return 1;
 }
 
-void editorInsertRow(int at, char *s, size_t len)
+/*** input ***/
+// return the buffer entered by the user. Returned buffer needs to be manually free after use.
+char *editorPrompt(const char *prompt, void (*callback)(char *s, int))
 {
-	if (at < 0 || at > EC.numRows)
+	size_t bufsize = 128;
+	char *buffer = malloc(bufsize);
+	if (!buffer)
 	{
-		return;
+		terminate("[error]@editorPrompt | malloc");
 	}
 
-	EC.row = realloc(EC.row, sizeof(EditorRow) * (EC.numRows + 1));
-	if (!EC.row)
-	{
-		terminate("[error]@editorInsertRow | realloc");
-	}
+	size_t buflen = 0;
+	buffer[0] = '\0';
 
-	memmove(&EC.row[at + 1], &EC.row[at], sizeof(EditorRow) * (EC.numRows - at));
-	for (int j = at + 1; j <= EC.numRows; j++)
+	while (1)
 	{
-		EC.row[j].index++;
-	}
+		editorSetStatusMessage(prompt, buffer);
+		editorRefresh();
 
-	EditorRow *newRow = &EC.row[at];
-	newRow->index = at;
-	newRow->chars = malloc(len + 1);
-	if (!newRow->chars)
-	{
-		terminate("[error]@editorInsertRow | malloc");
-	}
+		int c = editorReadKey();
+		// the mouse is not used in prompts
+		if (c == MOUSE_EVENT || c == IGNORED_KEY)
+		{
+			continue;
+		}
+		if (c == ESC_KEY || c == CTRL_KEY('c'))
+		{
+			editorSetStatusMessage("");
+			if (callback)
+			{
+				callback(buffer, c);
+			}
+			free(buffer);
+			return NULL;
+		}
 
-	// strcpy stops at null byte, use memcpy instead
-	memcpy(newRow->chars, s, len);
-	newRow->chars[len] = '\0';
-	newRow->size = len;
-	newRow->rsize = 0;
-	newRow->render = NULL;
-	newRow->highlight = NULL;
-	newRow->isOpenComment = 0;
-	editorUpdateRow(newRow);
+		if (c == PASTE_START)
+		{
+			size_t len;
+			char *text = editorReadPaste(&len);
+			for (size_t i = 0; i < len; i++)
+			{
+				if (iscntrl((unsigned char)text[i]))
+				{
+					continue;
+				}
+				if (buflen == bufsize - 1)
+				{
+					bufsize *= 2;
+					buffer = realloc(buffer, bufsize);
+					if (!buffer)
+					{
+						terminate("[error]@editorPrompt | realloc");
+					}
+				}
+				buffer[buflen++] = text[i];
+			}
+			buffer[buflen] = '\0';
+			free(text);
+		}
+		else if (c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE)
+		{
+			if (buflen)
+			{
+				buffer[--buflen] = '\0';
+			}
+		}
+		else if (c == ENTER_KEY)
+		{
+			if (buflen != 0)
+			{
+				editorSetStatusMessage("");
+				if (callback)
+				{
+					callback(buffer, c);
+				}
+				return buffer;
+			}
+		}
+		else if (!iscntrl(c) && c < 128)
+		{
+			if (buflen == bufsize - 1)
+			{
+				bufsize *= 2;
+				buffer = realloc(buffer, bufsize);
+				if (!buffer)
+				{
+					terminate("[error]@editorPrompt | realloc");
+				}
+			}
+			buffer[buflen++] = c;
+			buffer[buflen] = '\0';
+		}
 
-	EC.dirty++;
-	EC.numRows++;
+		if (callback)
+		{
+			callback(buffer, c);
+		}
+	}
 }
 
-void editorFreeRow(EditorRow *row)
+void editorMoveCursorLeft()
 {
-	free(row->render);
-	free(row->chars);
-	free(row->highlight);
+	if (EC.cursorX > 0)
+	{
+		EC.cursorX--;
+		EC.cursorXS = editorRowCursorXToRenderX(&EC.row[EC.cursorY], EC.cursorX);
+	}
+	else if (EC.cursorY > 0)
+	{
+		EC.cursorY = editorFoldPrev(EC.cursorY);
+		EC.cursorX = EC.row[EC.cursorY].size;
+		EC.cursorXS = EC.cursorX;
+	}
 }
 
-void editorDelRow(int at)
+void editorMoveCursorRight()
 {
-	if (at < 0 || at >= EC.numRows)
+	if (EC.cursorY >= EC.numRows)
 	{
 		return;
 	}
 
-	editorFreeRow(&EC.row[at]);
-	memmove(&EC.row[at], &EC.row[at + 1], sizeof(EditorRow) * (EC.numRows - at - 1));
-	for (int j = at; j < EC.numRows - 1; j++)
+	if (EC.cursorX < EC.row[EC.cursorY].size)
 	{
-		EC.row[j].index--;
+		EC.cursorX++;
+		EC.cursorXS = editorRowCursorXToRenderX(&EC.row[EC.cursorY], EC.cursorX);
+		return;
 	}
 
-	EC.numRows--;
-	EC.dirty++;
+	EC.cursorY = editorFoldNext(EC.cursorY);
+	EC.cursorX = 0;
+	EC.cursorXS = EC.cursorX;
 }
 
-void editorRowAppendString(EditorRow *row, const char *s, size_t len)
+void editorMoveCursorUp()
 {
-	row->chars = realloc(row->chars, row->size + len + 1);
-	memcpy(row->chars + row->size, s, len);
-
-	row->size += len;
-	row->chars[row->size] = '\0';
+	if (EC.cursorY > 0)
+	{
+		EC.cursorY = editorFoldPrev(EC.cursorY);
+		EC.cursorX = EC.renderX;
+	}
+}
 
-	editorUpdateRow(row);
-	EC.dirty++;
+void editorMoveCursorDown()
+{
+	int next = editorFoldNext(EC.cursorY);
+	if (next < EC.numRows)
+	{
+		EC.cursorY = next;
+		EC.cursorX = EC.renderX;
+	}
 }
 
-void editorRowInsertChar(EditorRow *row, int at, int c)
+void editorRefreshCursor()
 {
-	if (at < 0 || at > row->size)
+	int rowLen;
+	if (EC.cursorY < EC.numRows)
 	{
-		at = row->size;
+		rowLen = EC.row[EC.cursorY].size;
+	}
+	else
+	{
+		EC.cursorY = EC.numRows;
+		rowLen = 0;
+	}
+
+	if (EC.cursorX < 0)
+	{
+		EC.cursorX = 0;
 	}
-	// 1 byte for new char, 1 more for null byte
-	char *newPtr = realloc(row->chars, row->size + 2);
-	if (!newPtr)
+	else if (EC.cursorX > rowLen)
 	{
-		terminate("[error]@editorRowInsertChar | realloc");
+		EC.cursorX = rowLen;
 	}
-	row->chars = newPtr;
-	memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
-	row->size++;
-	row->chars[at] = c;
-	editorUpdateRow(row);
-	EC.dirty++;
+
+	EC.cursorXS = EC.cursorX;
+	EC.cursorX = editorRenderXToCursorX(&EC.row[EC.cursorY], EC.cursorX);
 }
 
-void editorInsertNewline()
+void editorMoveCursor(int direction)
 {
-	if (EC.cursorX == 0)
+	switch (direction)
 	{
-		editorInsertRow(EC.cursorY, "", 0);
+	case ARROW_LEFT:
+		editorMoveCursorLeft();
+		break;
+	case ARROW_RIGHT:
+		editorMoveCursorRight();
+		break;
+	case ARROW_UP:
+		editorMoveCursorUp();
+		break;
+	case ARROW_DOWN:
+		editorMoveCursorDown();
+		break;
 	}
-	else
-	{
-		EditorRow *currentRow = &EC.row[EC.cursorY];
-		size_t newRowLength = currentRow->size - EC.cursorX;
-		editorInsertRow(EC.cursorY + 1, &currentRow->chars[EC.cursorX], newRowLength);
 
-		currentRow = &EC.row[EC.cursorY];
-		currentRow->size = EC.cursorX;
-		currentRow->chars[currentRow->size] = '\0';
+	// snap to the last char before the tab char on vertical line changes
+	if (direction == ARROW_DOWN || direction == ARROW_UP)
+	{
+		// back to the last cursor X before the snapping
+		EC.cursorX = EC.cursorXS;
+		// new cursorX is at most the old cursorX
+		EC.cursorX = editorRenderXToCursorX(&EC.row[EC.cursorY], EC.cursorX);
+	}
 
-		editorUpdateRow(currentRow);
+	int rowLen = (EC.cursorY >= EC.numRows) ? 0 : EC.row[EC.cursorY].size;
+	if (EC.cursorX > rowLen)
+	{
+		EC.cursorX = rowLen;
 	}
-	EC.cursorY++;
-	EC.cursorX = EC.cursorXS = 0;
 }
 
-void editorRowDelChar(EditorRow *row, int at)
+// moves the cursor delta screen lines at once, closed folds counting as one, keeping its memorized column
+void editorMoveCursorRows(int delta)
 {
-	if (at < 0 || at >= row->size)
+	if (!EC.numRows)
 	{
 		return;
 	}
-	memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
-	row->size--;
-	editorUpdateRow(row);
-	EC.dirty++;
+	int line = editorFoldVisible(MIN(EC.cursorY, EC.numRows)) + delta;
+	EC.cursorY = editorFoldRowAt(MAX(0, MIN(line, editorFoldVisible(EC.numRows) - 1)));
+	EC.cursorX = editorRowCursorXAt(&EC.row[EC.cursorY], EC.cursorXS);
 }
 
-/*** editor operations ***/
-void editorInsertChar(int c)
+// puts the cursor on the char shown in a cell of the text area
+void editorMoveCursorToScreen(int y, int x)
 {
-	if (EC.cursorY == EC.numRows)
+	if (!EC.numRows)
+	{
+		return;
+	}
+	EC.cursorY = editorFoldRowAt(MAX(editorFoldVisible(EC.rowOffset) + y, 0));
+	if (EC.cursorY >= EC.numRows)
 	{
-		editorInsertRow(EC.numRows, "", 0);
+		EC.cursorY = editorFoldPrev(EC.numRows);
 	}
-	editorRowInsertChar(&EC.row[EC.cursorY], EC.cursorX, c);
-	EC.cursorXS = ++EC.cursorX;
+	EditorRow *row = &EC.row[EC.cursorY];
+	EC.cursorX = editorRowCursorXAt(row, EC.columnOffset + MAX(x - (EC.screenColumns - editorTextColumns()), 0));
+	EC.cursorXS = editorRowCursorXToRenderX(row, EC.cursorX);
 }
 
-void editorDelChar()
+// moves the view by whole screen lines and takes the cursor along only as far as needed to keep it visible
+void editorScrollRows(int delta)
 {
-	if (EC.cursorY == EC.numRows)
+	int lines = editorFoldVisible(EC.numRows);
+	int top = MIN(MAX(editorFoldVisible(EC.rowOffset) + delta, 0), MAX(lines - EC.screenRows, 0));
+	EC.rowOffset = editorFoldRowAt(top);
+	if (!EC.numRows)
 	{
 		return;
 	}
-
-	EditorRow *currentRow = &EC.row[EC.cursorY];
-
-	if (EC.cursorX > 0)
-	{
-		editorRowDelChar(currentRow, EC.cursorX - 1);
-		EC.cursorX--;
-		EC.cursorXS = editorRowCursorXToRenderX(currentRow, EC.cursorX);
-		return;
-	}
-
-	if (EC.cursorY == 0)
-	{
-		return;
-	}
-
-	EC.cursorX = EC.row[EC.cursorY - 1].size;
-	editorRowAppendString(&EC.row[EC.cursorY - 1], currentRow->chars, currentRow->size);
-	editorDelRow(EC.cursorY);
-	EC.cursorY--;
-	EC.cursorXS = editorRowCursorXToRenderX(&EC.row[EC.cursorY], EC.cursorX);
-}
-
-/*** file IO ***/
-char *editorRowsToString(int *buflen)
-{
-	int totalLength = 0;
-
-	for (int i = 0; i < EC.numRows; i++)
-	{
-		totalLength += EC.row[i].size + 1;
-	}
-
-	char *buffer = malloc(totalLength + 1); // Add one for the null-terminator
-	char *p = buffer;
-	for (int i = 0; i < EC.numRows; i++)
+	int cursor = editorFoldVisible(EC.cursorY);
+	int shown = MIN(MAX(cursor, top), MIN(top + EC.screenRows, lines) - 1);
+	if (shown != cursor)
 	{
-		memcpy(p, EC.row[i].chars, EC.row[i].size);
-		p += EC.row[i].size;
-		*p++ = '\n';
+		EC.cursorY = editorFoldRowAt(shown);
+		EC.cursorX = editorRowCursorXAt(&EC.row[EC.cursorY], EC.cursorXS);
 	}
-	*p = '\0';
-
-	*buflen = totalLength;
-
-	return buffer;
 }
 
-void editorOpen(const char *filename)
+void editorProcessMouse()
 {
-	free(EC.filename);
-	size_t fnlen = strlen(filename) + 1;
-	EC.filename = malloc(fnlen);
-	if (EC.filename)
-	{
-		memcpy(EC.filename, filename, fnlen);
-	}
-
-	editorSelectSyntaxHighlight();
-
-	FILE *fp = fopen(filename, "r");
-	if (!fp)
-	{
-		terminate("[Error]@editorOpen | fopen");
-	}
-
-	char *line = NULL;
-	ssize_t lineLen = 0;
-	size_t size = 0;
-	while ((lineLen = getline(&line, &size, fp)) != -1)
+	struct EditorMouse *mouse = &ET.mouse;
+	switch (mouse->action)
 	{
-		// strip next line char
-		while (lineLen > 0 && (line[lineLen - 1] == '\n' ||
-							   line[lineLen - 1] == ENTER_KEY))
+	case MOUSE_CLICK:
+		// clicks on the status and message bars do nothing
+		if (mouse->y >= EC.screenRows)
+		{
+			break;
+		}
+		mouse->pressed = 1;
+		EC.selection.mode = SEL_NONE;
+		editorMoveCursorToScreen(mouse->y, mouse->x);
+		break;
+	case MOUSE_DRAG:
+		if (!mouse->pressed)
+		{
+			break;
+		}
+		// the selection is anchored where the button went down
+		if (EC.selection.mode == SEL_NONE)
 		{
-			lineLen--;
+			editorSelectionStart(SEL_CHAR);
 		}
-		editorInsertRow(EC.numRows, line, lineLen);
+		// dragging past the text area edges scrolls by way of editorScroll
+		editorMoveCursorToScreen(mouse->y, mouse->x);
+		break;
+	case MOUSE_RELEASE:
+		mouse->pressed = 0;
+		break;
+	case MOUSE_WHEEL:
+		editorScrollRows(mouse->wheel * MOUSE_WHEEL_ROWS);
+		break;
 	}
-	EC.dirty = 0;
-	free(line);
-	fclose(fp);
 }
 
-int editorSave()
+// names the buffer first if it has no file yet
+void editorSavePrompt()
 {
 	if (!EC.filename)
 	{
@@ -889,519 +1237,976 @@ int editorSave()
 		if (!EC.filename)
 		{
 			editorSetStatusMessage("Cancelled");
-			return 1;
+			return;
 		}
 
 		// update syntax after naming
 		editorSelectSyntaxHighlight();
 	}
+	editorSave();
+}
 
-	const char *extension = ".tmp";
-	char tmpFilename[128];
-	strcpy(tmpFilename, EC.filename);
-	strncat(tmpFilename, extension, strlen(extension));
-
-	int bufferLength;
-	char *buf = editorRowsToString(&bufferLength);
-
-	int fd = open(tmpFilename, O_RDWR | O_CREAT, 0644);
-	if (fd == -1)
+// runs a line command over rows first..last, see editorLineCommand
+void editorLinePrompt(int first, int last)
+{
+	char *command = editorPrompt("Lines (sort, sort -u, uniq, keep RE, drop RE): %s", NULL);
+	if (!command)
 	{
-		goto writeerr;
+		editorSetStatusMessage("Cancelled");
+		return;
 	}
+	editorLineCommand(command, first, last);
+	free(command);
+
+	EC.cursorY = MIN(EC.cursorY, EC.numRows);
+	EC.cursorX = (EC.cursorY < EC.numRows) ? MIN(EC.cursorX, EC.row[EC.cursorY].size) : 0;
+	EC.cursorXS = (EC.cursorY < EC.numRows) ? editorRowCursorXToRenderX(&EC.row[EC.cursorY], EC.cursorX) : 0;
+}
 
-	if (ftruncate(fd, bufferLength) == -1)
+// moves the cursor to the bracket matching the one at (or right before) it
+void editorBracketJump()
+{
+	int x, row, col;
+	if (!editorBracketMatch(EC.cursorY, EC.cursorX, &x, &row, &col))
 	{
-		goto writeerr;
+		editorSetStatusMessage("No matching bracket here");
+		return;
 	}
+	EC.cursorY = row;
+	EC.cursorX = col;
+	EC.cursorXS = editorRowCursorXToRenderX(&EC.row[row], col);
+}
 
-	if (write(fd, buf, bufferLength) == -1)
+// what can be done with a file that is still loading: moving around, searching, copying and quitting
+int editorLoadAllowsKey(int key)
+{
+	switch (key)
 	{
-		goto writeerr;
+	case CTRL_KEY('q'):
+	case CTRL_KEY('f'):
+	case CTRL_KEY('c'):
+	case CTRL_KEY('b'):
+	case CTRL_KEY('l'):
+	case CTRL_KEY('t'):
+	case CTRL_KEY('j'):
+	case ESC_KEY:
+	case ARROW_UP:
+	case ARROW_DOWN:
+	case ARROW_LEFT:
+	case ARROW_RIGHT:
+	case PAGE_UP:
+	case PAGE_DOWN:
+	case HOME_KEY:
+	case END_KEY:
+	case MOUSE_EVENT:
+		return 1;
 	}
-
-	close(fd);
-	free(buf);
-	rename(tmpFilename, EC.filename);
-	EC.dirty = 0;
-	editorSetStatusMessage("%d bytes written to disk (%s)", bufferLength, EC.filename);
-	return 0;
-
-writeerr:
-	free(buf);
-	if (fd != -1)
+	// a selection can be copied
+	if (EC.selection.mode != SEL_NONE && key == 'y')
 	{
-		close(fd);
+		return 1;
 	}
-	editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
-	return 1;
+	// normal mode motions and selections, but no operator
+	return ET.normal.active && !ET.normal.op && key > 0 && key < 128 && strchr("0123456789hjklwbe^$gG%+- \r/vV", key);
 }
 
-/*** search ***/
-void editorSearchCallback(char *pattern, int key)
+void editorProcessKeyEvent()
 {
-	static int lastMatchRow = -1;
-	static int lastMatchX = -1;
-	static int direction = 1;
-	static int savedHighlightLine;
-	static char *savedHighlightChars = NULL;
+	static int quitTimes = KILO_QUIT_TIMES;
 
-	// restore highlight
-	if (savedHighlightChars)
+	editorLoadTick();
+	int key = editorReadKey();
+	if (key == IGNORED_KEY)
 	{
-		memcpy(EC.row[savedHighlightLine].highlight, savedHighlightChars, EC.row[savedHighlightLine].rsize);
-		free(savedHighlightChars);
-		savedHighlightChars = NULL;
+		return;
 	}
-
-	if (key == ENTER_KEY || key == ESC_KEY)
+	if (EC.hex.active && editorProcessHexKey(key))
 	{
-		lastMatchRow = -1;
-		lastMatchX = -1;
-		direction = 1;
+		quitTimes = KILO_QUIT_TIMES;
+		return;
+	}
+	if (EC.loader.active && !editorLoadAllowsKey(key))
+	{
+		if (key == PASTE_START)
+		{
+			size_t len;
+			free(editorReadPaste(&len));
+		}
+		editorSetStatusMessage("Still loading %.20s, only moving, searching and copying for now", EC.filename);
+		return;
+	}
+	if (editorProcessNormalKey(key) || editorProcessSelectionKey(key))
+	{
+		quitTimes = KILO_QUIT_TIMES;
+		EC.lastKey = key;
+		editorNormalClamp();
 		return;
 	}
-
 	switch (key)
 	{
+	case CTRL_KEY('q'):
+	{
+		if (EC.dirty && quitTimes > 0)
+		{
+			editorSetStatusMessage("Discard unsaved buffer? Press "
+								   "Ctrl-Q %d more times to quit.",
+								   quitTimes);
+			quitTimes--;
+			return;
+		}
+		editorExit();
+	}
+	break;
+	case CTRL_KEY('s'):
+	{
+		editorSavePrompt();
+	}
+	break;
 	case ARROW_UP:
+	case ARROW_DOWN:
 	case ARROW_LEFT:
-		direction = -1;
-		break;
 	case ARROW_RIGHT:
-	case ARROW_DOWN:
-		direction = 1;
-		break;
-	default:
-		lastMatchRow = -1;
-		lastMatchX = -1;
-		direction = 1;
-		break;
+	{
+		editorMoveCursor(key);
 	}
-
-	int currentLine = MAX(lastMatchRow, 0);
-	int currentX = lastMatchX;
-	for (int i = 0; i < EC.numRows; i++)
+	break;
+	case PAGE_UP:
+	case PAGE_DOWN:
 	{
-		if (currentLine < 0)
+		/* handle row offset and preserve line position, counting closed folds as one line */
+		int top = editorFoldVisible(EC.rowOffset);
+		if (key == PAGE_UP)
 		{
-			currentLine = EC.numRows - 1;
+			top = MAX(top - EC.screenRows, 0);
 		}
-		else if (currentLine == EC.numRows)
+		else if (key == PAGE_DOWN)
 		{
-			currentLine = 0;
+			top = MIN(top + EC.screenRows, editorFoldVisible(EC.numRows));
 		}
+		EC.rowOffset = editorFoldRowAt(top);
 
-		const EditorRow *row = &EC.row[currentLine];
-		char *match = NULL;
-		if (direction > 0)
+		/* update cursor position */
+		editorMoveCursorRows(key == PAGE_UP ? -EC.screenRows : EC.screenRows);
+	}
+	break;
+	case HOME_KEY:
+	{
+		EC.cursorX = 0;
+		EC.cursorXS = EC.cursorX;
+	}
+	break;
+	case END_KEY:
+	{
+		EC.cursorX = EC.row[EC.cursorY].size;
+		EC.cursorXS = EC.cursorX;
+	}
+	break;
+	case CTRL_KEY('d'):
+		editorFrameReport();
+		break;
+	case ENTER_KEY:
+		editorInsertNewline();
+		break;
+	case BACKSPACE:
+	case CTRL_KEY('h'):
+	case DEL_KEY:
+	{
+		if (key == DEL_KEY)
 		{
-			if (currentX == -1)
-				match = strstr(row->render, pattern);
-			else
-				match = strstr(row->render + currentX + 1, pattern);
+			editorMoveCursor(ARROW_RIGHT);
+		}
+		editorDelChar();
+	}
+	break;
+	case CTRL_KEY('b'):
+		editorSelectionStart(SEL_CHAR);
+		break;
+	case CTRL_KEY('l'):
+		editorSelectionStart(SEL_LINE);
+		break;
+	case CTRL_KEY('t'):
+		editorToggleFollow();
+		break;
+	case ESC_KEY:
+		editorNormalEnter();
+		break;
+	case CTRL_KEY('f'):
+		editorSearch();
+		break;
+	case CTRL_KEY('e'):
+		editorLinePrompt(0, EC.numRows - 1);
+		break;
+	case CTRL_KEY('j'):
+		editorBracketJump();
+		break;
+	case CTRL_KEY('g'):
+		if (editorDiffToggle())
+		{
+			editorSetStatusMessage("Diff against the file on disk: %d hunks, +%d -%d lines (Ctrl-N/Ctrl-P to jump)",
+								   EC.diff.numHunks, EC.diff.added, EC.diff.removed);
 		}
 		else
 		{
-			char *lastPossibleMatch = NULL;
-			char *searchStart = row->render;
-			while ((match = strstr(searchStart, pattern)) && (currentX == -1 || (match < row->render + currentX)))
-			{
-				lastPossibleMatch = match;
-				searchStart = match + 1;
-			}
-			match = lastPossibleMatch;
-		}
-
-		if (match)
-		{
-			lastMatchRow = currentLine;
-			EC.cursorY = currentLine;
-			EC.rowOffset = currentLine;
-			lastMatchX = match - row->render;
-			EC.cursorX = editorRenderXToCursorX(row, match - row->render + strlen(pattern));
-			EC.cursorXS = EC.cursorX;
-			EC.columnOffset = ((EC.cursorX - (int)strlen(pattern)) / EC.screenColumns) * EC.screenColumns;
-			
-			// Save for highlight restore
-			savedHighlightLine = currentLine;
-			savedHighlightChars = malloc(row->rsize);
-			memcpy(savedHighlightChars, row->highlight, row->rsize);
-			memset(&row->highlight[match - row->render], HL_MATCH, strlen(pattern));
+			editorSetStatusMessage("Diff view off");
+		}
+		break;
+	case CTRL_KEY('n'):
+	case CTRL_KEY('p'):
+		if (!EC.diff.active)
+		{
+			editorDiffToggle();
+		}
+		editorDiffJump(key == CTRL_KEY('n'));
+		break;
+	case CTRL_KEY('o'):
+		switch (editorFoldToggle(EC.cursorY))
+		{
+		case 1:
+			// the fold is closed under its first row
+			EC.cursorY = editorFoldPrev(editorFoldNext(EC.cursorY));
+			EC.cursorX = 0;
+			EC.cursorXS = 0;
+			break;
+		case -1:
+			editorSetStatusMessage("Nothing to fold here");
 			break;
 		}
-
-		lastMatchX = -1;
-		currentX = -1;
-		currentLine += direction;
+		break;
+	case CTRL_KEY('w'):
+		if (EC.folds.numFolds)
+		{
+			editorUnfoldAll();
+			editorSetStatusMessage("Opened all folds");
+		}
+		else
+		{
+			editorSetStatusMessage("Folded %d blocks (Ctrl-O to open one, Ctrl-W to open all)", editorFoldAll());
+			EC.cursorY = editorFoldPrev(editorFoldNext(EC.cursorY));
+			EC.cursorX = 0;
+			EC.cursorXS = 0;
+		}
+		break;
+	case CTRL_KEY('k'):
+		editorKillLine(1);
+		break;
+	case CTRL_KEY('c'):
+		editorKillLine(0);
+		break;
+	case CTRL_KEY('v'):
+		editorYank();
+		break;
+	case CTRL_KEY('y'):
+		editorYankPop();
+		break;
+	case CTRL_KEY('r'):
+		editorComplete();
+		break;
+	case PASTE_START:
+		editorPaste();
+		break;
+	case MOUSE_EVENT:
+		editorProcessMouse();
+		break;
+	default:
+		// normal mode types nothing
+		if (!ET.normal.active)
+		{
+			editorInsertChar(key);
+		}
+		break;
 	}
+	quitTimes = KILO_QUIT_TIMES;
+	EC.lastKey = key;
+	editorNormalClamp();
 }
 
-void editorSearch()
+/*** normal mode ***/
+/*
+ * ESC switches from typing to a vim-like normal mode: [count] motion moves the
+ * cursor, [count] operator [count] motion applies d, y, c, > or < to the text
+ * the motion spans, and a doubled operator (dd, 3yy, 300>>) to whole lines.
+ * A motion works out where it ends in one step and an operator hands the
+ * range to a single core call (see editorOperatorLines), so a count never
+ * turns into a loop of row edits or cursor moves.
+ */
+
+int normalOperator(int key)
 {
-	int originCursorX = EC.cursorX, originCursorY = EC.cursorY, originCursorXS = EC.cursorXS;
-	int originRowOffset = EC.rowOffset, originColumnOffset = EC.columnOffset;
+	switch (key)
+	{
+	case 'd':
+		return OP_DELETE;
+	case 'y':
+		return OP_YANK;
+	case 'c':
+		return OP_CHANGE;
+	case '>':
+		return OP_INDENT;
+	case '<':
+		return OP_DEDENT;
+	}
+	return OP_NONE;
+}
 
-	char *pattern = editorPrompt("Search: %s (Press ESC or Ctrl+C to cancel)", editorSearchCallback);
-	if (pattern)
+void normalTyped(int key)
+{
+	struct EditorNormal *nm = &ET.normal;
+	if (nm->typedLen < NORMAL_TYPED_MAX)
 	{
-		free(pattern);
-		return;
+		nm->typed[nm->typedLen++] = key;
+		nm->typed[nm->typedLen] = '\0';
 	}
-
-	EC.cursorX = originCursorX;
-	EC.cursorXS = originCursorXS;
-	EC.cursorY = originCursorY;
-	EC.rowOffset = originRowOffset;
-	EC.columnOffset = originColumnOffset;
 }
 
-/*** buffer append ***/
-struct abuf
+void normalReset()
 {
-	char *b;
-	int len;
-};
-
-#define ABUF_INIT \
-	{             \
-		NULL, 0}
+	struct EditorNormal *nm = &ET.normal;
+	nm->count = nm->op = nm->opCount = nm->prefix = 0;
+	nm->typedLen = 0;
+	nm->typed[0] = '\0';
+}
 
-void abAppend(struct abuf *ab, const char *s, int len)
+void editorNormalEnter()
 {
-	char *newBuf = realloc(ab->b, ab->len + len);
-	if (newBuf)
+	normalReset();
+	ET.normal.active = 1;
+	// as in vim, the cursor steps back onto the last char typed
+	if (EC.cursorY < EC.numRows && EC.cursorX > 0)
 	{
-		memcpy(&newBuf[ab->len], s, len);
-		ab->b = newBuf;
-		ab->len += len;
+		EC.cursorX--;
+		EC.cursorXS = editorRowCursorXToRenderX(&EC.row[EC.cursorY], EC.cursorX);
 	}
 }
 
-void abFree(struct abuf *ab)
+void normalInsert(int y, int x)
 {
-	free(ab->b);
+	ET.normal.active = 0;
+	EC.cursorY = y;
+	EC.cursorX = (y < EC.numRows) ? MIN(x, EC.row[y].size) : 0;
+	EC.cursorXS = (y < EC.numRows) ? editorRowCursorXToRenderX(&EC.row[y], EC.cursorX) : 0;
 }
 
-/*** input ***/
-
-// return the buffer entered by the user. Returned buffer needs to be manually free after use.
-char *editorPrompt(const char *prompt, void (*callback)(char *s, int))
+// normal mode keeps the cursor on a char of a row
+void editorNormalClamp()
 {
-	size_t bufsize = 128;
-	char *buffer = malloc(bufsize);
-	if (!buffer)
+	if (!ET.normal.active || !EC.numRows)
 	{
-		terminate("[error]@editorPrompt | malloc");
+		return;
 	}
+	EC.cursorY = MIN(EC.cursorY, EC.numRows - 1);
+	EC.cursorX = MIN(EC.cursorX, MAX(EC.row[EC.cursorY].size - 1, 0));
+}
 
-	size_t buflen = 0;
-	buffer[0] = '\0';
+// applies an operator to rows first..last, widened to the closed folds at either end
+void normalLines(int op, int first, int last)
+{
+	first = editorFoldPrev(editorFoldNext(MAX(first, 0)));
+	last = editorFoldNext(MIN(last, EC.numRows - 1)) - 1;
+	editorOperatorLines(op, first, last);
+}
 
-	while (1)
+// where a motion key takes the cursor from (*y, *x); returns 0 for keys that are not motions.
+// *linewise marks motions that operators apply to whole rows, *inclusive those that take
+// the char they end on along
+int normalMotion(int key, int count, int counted, int *y, int *x, int *linewise, int *inclusive)
+{
+	*linewise = *inclusive = 0;
+	switch (key)
 	{
-		editorSetStatusMessage(prompt, buffer);
-		editorRefresh();
-
-		int c = editorReadKey();
-		if (c == ESC_KEY || c == CTRL_KEY('c'))
-		{
-			editorSetStatusMessage("");
-			if (callback)
-			{
-				callback(buffer, c);
-			}
-			free(buffer);
-			return NULL;
+	case 'h':
+	case ARROW_LEFT:
+	case BACKSPACE:
+		*x = MAX(*x - count, 0);
+		break;
+	case 'l':
+	case ARROW_RIGHT:
+	case ' ':
+		*x = MIN(*x + count, EC.row[*y].size);
+		break;
+	case 'j':
+	case 'k':
+	case ARROW_DOWN:
+	case ARROW_UP:
+	case ENTER_KEY:
+	case '+':
+	case '-':
+	{
+		int up = key == 'k' || key == ARROW_UP || key == '-';
+		int line = editorFoldVisible(*y) + (up ? -count : count);
+		*y = editorFoldRowAt(MAX(0, MIN(line, editorFoldVisible(EC.numRows) - 1)));
+		*x = (key == ENTER_KEY || key == '+' || key == '-') ? editorFirstNonBlank(*y)
+															: editorRowCursorXAt(&EC.row[*y], EC.cursorXS);
+		*linewise = 1;
+	}
+	break;
+	case 'w':
+	case 'b':
+	case 'e':
+		editorWordMotion(key, count, y, x);
+		*inclusive = key == 'e';
+		break;
+	case '0':
+	case HOME_KEY:
+		*x = 0;
+		break;
+	case '^':
+		*x = editorFirstNonBlank(*y);
+		break;
+	case '$':
+	case END_KEY:
+		*y = MIN(*y + count - 1, EC.numRows - 1);
+		*x = EC.row[*y].size;
+		break;
+	case 'G':
+	case 'g':
+		// G goes to the last row and gg to the first, both to row count when given one
+		*y = counted ? MIN(count, EC.numRows) - 1 : (key == 'G') ? EC.numRows - 1 : 0;
+		*x = editorFirstNonBlank(*y);
+		*linewise = 1;
+		break;
+	case '%':
+	{
+		int atX;
+		if (!editorBracketMatch(*y, *x, &atX, y, x))
+		{
+			return 0;
 		}
+		*inclusive = 1;
+	}
+	break;
+	default:
+		return 0;
+	}
+	return 1;
+}
 
-		if (c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE)
+// runs an operator over the text a motion from the cursor spans
+void normalApply(int op, int key, int y, int x, int ty, int tx, int linewise, int inclusive)
+{
+	if (linewise)
+	{
+		normalLines(op, MIN(y, ty), MAX(y, ty));
+		return;
+	}
+	int sy = y, sx = x, ey = ty, ex = tx;
+	if (ty < y || (ty == y && tx < x))
+	{
+		sy = ty, sx = tx, ey = y, ex = x;
+	}
+	if (inclusive)
+	{
+		ex = MIN(ex + 1, EC.row[ey].size);
+	}
+	// a word motion that ends at the start of a row stops at the end of the row before
+	if (key == 'w' && ey > sy && ex <= editorFirstNonBlank(ey))
+	{
+		ey--;
+		ex = EC.row[ey].size;
+	}
+	editorOperatorRange(op, sy, sx, ey, ex);
+}
+
+// keys of normal mode; returns 0 for keys that keep their usual meaning, such as
+// Ctrl keys, paste and the mouse, and for the keys of an active selection
+int editorProcessNormalKey(int key)
+{
+	struct EditorNormal *nm = &ET.normal;
+	if (!nm->active)
+	{
+		return 0;
+	}
+	int selecting = EC.selection.mode != SEL_NONE;
+	if (key == ESC_KEY)
+	{
+		normalReset();
+		return !selecting;
+	}
+	if (key >= '0' && key <= '9' && (key != '0' || nm->count))
+	{
+		nm->count = MIN(nm->count * 10 + key - '0', NORMAL_MAX_COUNT);
+		normalTyped(key);
+		return 1;
+	}
+	if (key == 'g' && !nm->prefix)
+	{
+		nm->prefix = 'g';
+		normalTyped(key);
+		return 1;
+	}
+
+	// the keys typed so far and this one make a command, whatever it turns out to be
+	int gg = nm->prefix == 'g';
+	int op = nm->op;
+	int counted = nm->count || nm->opCount;
+	int count = (int)MIN((long long)MAX(nm->count, 1) * MAX(nm->opCount, 1), NORMAL_MAX_COUNT);
+	normalReset();
+	if (gg && key != 'g')
+	{
+		return 1;
+	}
+
+	int y = MIN(EC.cursorY, EC.numRows - 1), x = EC.cursorX;
+	int ty = y, tx = x, linewise = 0, inclusive = 0;
+	int moved = EC.numRows && normalMotion(key, count, counted, &ty, &tx, &linewise, &inclusive);
+	if (op)
+	{
+		int kind = normalOperator(op);
+		if (!EC.numRows)
 		{
-			if (buflen)
-			{
-				buffer[--buflen] = '\0';
-			}
+			return 1;
 		}
-		else if (c == ENTER_KEY)
+		if (key == op)
 		{
-			if (buflen != 0)
-			{
-				editorSetStatusMessage("");
-				if (callback)
-				{
-					callback(buffer, c);
-				}
-				return buffer;
-			}
+			normalLines(kind, y, y + count - 1);
 		}
-		else if (!iscntrl(c) && c < 128)
+		else if (moved)
 		{
-			if (buflen == bufsize - 1)
+			// cw changes to the end of the word, as vim does
+			if (kind == OP_CHANGE && key == 'w' && x < EC.row[y].size && !isspace((unsigned char)EC.row[y].chars[x]))
 			{
-				bufsize *= 2;
-				buffer = realloc(buffer, bufsize);
-				if (!buffer)
-				{
-					terminate("[error]@editorPrompt | realloc");
-				}
+				key = 'e';
+				ty = y, tx = x;
+				normalMotion(key, count, counted, &ty, &tx, &linewise, &inclusive);
 			}
-			buffer[buflen++] = c;
-			buffer[buflen] = '\0';
+			normalApply(kind, key, y, x, ty, tx, linewise, inclusive);
 		}
-
-		if (callback)
+		else
 		{
-			callback(buffer, c);
+			return 1;
+		}
+		if (kind == OP_CHANGE)
+		{
+			normalInsert(EC.cursorY, EC.cursorX);
 		}
+		return 1;
 	}
-}
-
-int editorRenderXToCursorX(const EditorRow *row, int cursorX)
-{
-	int realCursorX = 0;
-
-	for (int i = 0; i < cursorX; i++)
+	if (moved)
+	{
+		EC.cursorY = ty;
+		EC.cursorX = tx;
+		// vertical moves keep the memorized column
+		if (!linewise || key == 'G' || key == 'g' || key == ENTER_KEY || key == '+' || key == '-')
+		{
+			EC.cursorXS = editorRowCursorXToRenderX(&EC.row[ty], tx);
+		}
+		return 1;
+	}
+	if (selecting)
 	{
-		if (row->chars[i] == '\t')
+		if (key == 'v' || key == 'V')
 		{
-			realCursorX += (TAB_STOP - (realCursorX % TAB_STOP));
+			editorSelectionStart(key == 'V' ? SEL_LINE : SEL_CHAR);
+			return 1;
+		}
+		return 0;
+	}
+	if (normalOperator(key))
+	{
+		nm->op = key;
+		nm->opCount = counted ? count : 0;
+		if (nm->opCount)
+		{
+			snprintf(nm->typed, sizeof(nm->typed), "%d%c", nm->opCount, key);
+			nm->typedLen = strlen(nm->typed);
 		}
 		else
 		{
-			realCursorX++;
+			normalTyped(key);
 		}
+		return 1;
+	}
 
-		if (realCursorX > cursorX)
+	int size = (y >= 0 && y < EC.numRows) ? EC.row[y].size : 0;
+	switch (key)
+	{
+	case 'x':
+		if (EC.numRows)
+		{
+			editorOperatorRange(OP_DELETE, y, x, y, MIN(x + count, size));
+		}
+		break;
+	case 'X':
+		if (EC.numRows)
+		{
+			editorOperatorRange(OP_DELETE, y, MAX(x - count, 0), y, x);
+		}
+		break;
+	case 'D':
+	case 'C':
+		if (EC.numRows)
+		{
+			int last = MIN(y + count - 1, EC.numRows - 1);
+			editorOperatorRange(OP_DELETE, y, x, last, EC.row[last].size);
+		}
+		if (key == 'C')
+		{
+			normalInsert(EC.cursorY, EC.cursorX);
+		}
+		break;
+	case 'Y':
+		if (EC.numRows)
+		{
+			normalLines(OP_YANK, y, y + count - 1);
+		}
+		break;
+	case 'S':
+		if (EC.numRows)
+		{
+			normalLines(OP_CHANGE, y, y + count - 1);
+		}
+		normalInsert(EC.cursorY, EC.cursorX);
+		break;
+	case 'J':
+		if (editorJoinRows(y, y + MAX(count, 2) - 1) == -1)
+		{
+			editorSetStatusMessage("Nothing to join");
+		}
+		break;
+	case 'p':
+	case 'P':
+		editorPut(key == 'p', count);
+		break;
+	case 'i':
+		normalInsert(MAX(y, 0), x);
+		break;
+	case 'a':
+		normalInsert(MAX(y, 0), x + 1);
+		break;
+	case 'I':
+		normalInsert(MAX(y, 0), editorFirstNonBlank(y));
+		break;
+	case 'A':
+		normalInsert(MAX(y, 0), size);
+		break;
+	case 'o':
+	case 'O':
+		EC.cursorY = MAX(y, 0);
+		EC.cursorX = (key == 'o') ? size : 0;
+		editorInsertAtCursor("\n", 1);
+		normalInsert(key == 'o' ? EC.cursorY : MAX(y, 0), 0);
+		break;
+	case 'v':
+	case 'V':
+		if (EC.numRows)
 		{
-			return i;
+			editorSelectionStart(key == 'V' ? SEL_LINE : SEL_CHAR);
 		}
+		break;
+	case '/':
+		editorSearch();
+		break;
+	default:
+		// the rest of the printable keys do nothing rather than type
+		return key < 128 && !iscntrl(key);
 	}
+	return 1;
+}
+
+/*** hex view ***/
+// a line of the hex view: the offset, the bytes in hex with a gap halfway, then the bytes as text
 
-	return realCursorX;
+int hexByteColumn(int i, int rowBytes)
+{
+	return HEX_OFFSET_DIGITS + 2 + 3 * i + (i >= rowBytes / 2);
 }
 
-void editorMoveCursorLeft()
+int hexTextColumn(int i, int rowBytes)
 {
-	if (EC.cursorX > 0)
-	{
-		EC.cursorX--;
-		EC.cursorXS = editorRowCursorXToRenderX(&EC.row[EC.cursorY], EC.cursorX);
-	}
-	else if (EC.cursorY > 0)
+	return HEX_OFFSET_DIGITS + 4 + 3 * rowBytes + i;
+}
+
+// the most bytes a line shows within the width of the screen, a power of two
+int editorHexRowBytes()
+{
+	int rowBytes = HEX_ROW_BYTES;
+	while (rowBytes > 1 && hexTextColumn(rowBytes, rowBytes) > EC.screenColumns)
 	{
-		EC.cursorY--;
-		EC.cursorX = EC.row[EC.cursorY].size;
-		EC.cursorXS = EC.cursorX;
+		rowBytes /= 2;
 	}
+	return rowBytes;
 }
 
-void editorMoveCursorRight()
+int editorHexCursorColumn()
 {
-	if (EC.cursorY >= EC.numRows)
+	struct EditorHex *hx = &EC.hex;
+	int rowBytes = editorHexRowBytes();
+	int i = hx->cursor % rowBytes;
+	return hx->text ? hexTextColumn(i, rowBytes) : hexByteColumn(i, rowBytes) + hx->nibble;
+}
+
+// keeps the cursor byte on screen, lines starting at multiples of the line width
+void editorHexScroll()
+{
+	struct EditorHex *hx = &EC.hex;
+	editorHexCheckSize();
+	size_t rowBytes = editorHexRowBytes();
+	size_t page = rowBytes * EC.screenRows;
+	hx->top -= hx->top % rowBytes;
+	if (hx->cursor < hx->top)
 	{
-		return;
+		hx->top = hx->cursor - hx->cursor % rowBytes;
 	}
-
-	if (EC.cursorX < EC.row[EC.cursorY].size)
+	if (hx->cursor >= hx->top + page)
 	{
-		EC.cursorX++;
-		EC.cursorXS = editorRowCursorXToRenderX(&EC.row[EC.cursorY], EC.cursorX);
-		return;
+		hx->top = hx->cursor - hx->cursor % rowBytes - page + rowBytes;
 	}
-
-	EC.cursorY++;
-	EC.cursorX = 0;
-	EC.cursorXS = EC.cursorX;
 }
 
-void editorMoveCursorUp()
+void editorDrawHexRow(struct abuf *ab, size_t offset)
 {
-	if (EC.cursorY > 0)
+	struct EditorHex *hx = &EC.hex;
+	if (offset >= hx->size && offset)
 	{
-		EC.cursorY--;
-		EC.cursorX = EC.renderX;
+		abAppend(ab, "~", 1);
+		return;
 	}
-}
+	int rowBytes = editorHexRowBytes();
+	int n = MIN((size_t)rowBytes, hx->size - offset);
+	unsigned char bytes[HEX_ROW_BYTES], patched[HEX_ROW_BYTES];
+	editorHexRead(offset, bytes, patched, n);
 
-void editorMoveCursorDown()
-{
-	if (EC.cursorY < EC.numRows - 1)
+	char buf[32];
+	abAppend(ab, buf, snprintf(buf, sizeof(buf), "%0*llx  ", HEX_OFFSET_DIGITS, (unsigned long long)offset));
+	for (int i = 0; i < rowBytes; i++)
 	{
-		EC.cursorY++;
-		EC.cursorX = EC.renderX;
+		if (i == rowBytes / 2)
+		{
+			abAppend(ab, " ", 1);
+		}
+		if (i >= n)
+		{
+			abAppend(ab, "   ", 3);
+			continue;
+		}
+		// overwritten bytes are shown in red until they are written
+		if (patched[i])
+		{
+			abAppend(ab, ESC_SEQ("31m"), 5);
+		}
+		abAppend(ab, buf, snprintf(buf, sizeof(buf), "%02x", bytes[i]));
+		if (patched[i])
+		{
+			abAppend(ab, ESC_SEQ_DEFAULT_FG_COLOR, ESC_SEQ_DEFAULT_FG_COLOR_SZ);
+		}
+		abAppend(ab, " ", 1);
+	}
+	abAppend(ab, " ", 1);
+	for (int i = 0; i < n; i++)
+	{
+		char c = (bytes[i] >= 32 && bytes[i] < 127) ? bytes[i] : '.';
+		if (patched[i])
+		{
+			abAppend(ab, ESC_SEQ("31m"), 5);
+		}
+		abAppend(ab, &c, 1);
+		if (patched[i])
+		{
+			abAppend(ab, ESC_SEQ_DEFAULT_FG_COLOR, ESC_SEQ_DEFAULT_FG_COLOR_SZ);
+		}
 	}
 }
 
-void editorRefreshCursor()
+// finds the byte pattern from the cursor on (past it when skip), wrapping around
+void editorHexFindNext(int skip)
 {
-	int rowLen;
-	if (EC.cursorY < EC.numRows)
+	struct EditorHex *hx = &EC.hex;
+	if (!hx->patternLen)
 	{
-		rowLen = EC.row[EC.cursorY].size;
+		editorSetStatusMessage("No byte pattern yet, Ctrl-F to enter one");
+		return;
 	}
-	else
+	size_t found;
+	if (!editorHexFind(hx->pattern, hx->patternLen, hx->cursor + skip, &found))
 	{
-		EC.cursorY = EC.numRows;
-		rowLen = 0;
+		editorSetStatusMessage("Pattern not found");
+		return;
 	}
+	editorSetStatusMessage("Found at 0x%llx%s (Ctrl-N for the next)", (unsigned long long)found,
+						   found < hx->cursor + skip ? ", wrapped around" : "");
+	hx->cursor = found;
+}
 
-	if (EC.cursorX < 0)
+void editorHexFindPrompt()
+{
+	struct EditorHex *hx = &EC.hex;
+	char *input = editorPrompt("Find bytes (hex like 7f 45 4c 46, or \"text\"): %s", NULL);
+	if (!input)
 	{
-		EC.cursorX = 0;
+		editorSetStatusMessage("Cancelled");
+		return;
 	}
-	else if (EC.cursorX > rowLen)
+	// an empty pattern looks for the last one again
+	int len = *input ? editorHexParsePattern(input, hx->pattern, HEX_PATTERN_MAX) : hx->patternLen;
+	free(input);
+	if (len <= 0)
 	{
-		EC.cursorX = rowLen;
+		hx->patternLen = 0;
+		editorSetStatusMessage("Not a byte pattern");
+		return;
 	}
-
-	EC.cursorXS = EC.cursorX;
-	EC.cursorX = editorRenderXToCursorX(&EC.row[EC.cursorY], EC.cursorX);
+	hx->patternLen = len;
+	editorHexFindNext(0);
 }
 
-void editorMoveCursor(int direction)
+void editorHexGotoPrompt()
 {
-	switch (direction)
+	struct EditorHex *hx = &EC.hex;
+	char *input = editorPrompt("Go to offset (0x hex or decimal): %s", NULL);
+	if (!input)
 	{
-	case ARROW_LEFT:
-		editorMoveCursorLeft();
-		break;
-	case ARROW_RIGHT:
-		editorMoveCursorRight();
-		break;
-	case ARROW_UP:
-		editorMoveCursorUp();
-		break;
-	case ARROW_DOWN:
-		editorMoveCursorDown();
-		break;
+		editorSetStatusMessage("Cancelled");
+		return;
 	}
-
-	// snap to the last char before the tab char on vertical line changes
-	if (direction == ARROW_DOWN || direction == ARROW_UP)
+	char *end;
+	errno = 0;
+	unsigned long long offset = strtoull(input, &end, 0);
+	if (!*input || *end || errno)
 	{
-		// back to the last cursor X before the snapping
-		EC.cursorX = EC.cursorXS;
-		// new cursorX is at most the old cursorX
-		EC.cursorX = editorRenderXToCursorX(&EC.row[EC.cursorY], EC.cursorX);
+		editorSetStatusMessage("Not an offset: %.20s", input);
 	}
-
-	int rowLen = (EC.cursorY >= EC.numRows) ? 0 : EC.row[EC.cursorY].size;
-	if (EC.cursorX > rowLen)
+	else
 	{
-		EC.cursorX = rowLen;
+		hx->cursor = MIN(offset, hx->size ? hx->size - 1 : 0);
 	}
+	free(input);
 }
 
-void editorProcessKeyEvent()
+// keys of hex mode; returns 0 for the ones that keep their usual meaning (Ctrl-Q)
+int editorProcessHexKey(int key)
 {
-	static int quitTimes = KILO_QUIT_TIMES;
-
-	int key = editorReadKey();
+	struct EditorHex *hx = &EC.hex;
+	size_t rowBytes = editorHexRowBytes();
+	size_t page = rowBytes * EC.screenRows;
+	size_t last = hx->size ? hx->size - 1 : 0;
+	// any key but a second hex digit ends the byte being typed
+	int nibble = hx->nibble;
+	hx->nibble = 0;
 	switch (key)
 	{
 	case CTRL_KEY('q'):
-	{
-		if (EC.dirty && quitTimes > 0)
-		{
-			editorSetStatusMessage("Discard unsaved buffer? Press "
-								   "Ctrl-Q %d more times to quit.",
-								   quitTimes);
-			quitTimes--;
-			return;
-		}
-		editorExit();
-	}
-	break;
+		return 0;
 	case CTRL_KEY('s'):
-	{
-		editorSave();
-	}
-	break;
-	case ARROW_UP:
-	case ARROW_DOWN:
+		editorHexSave();
+		break;
+	case CTRL_KEY('f'):
+		editorHexFindPrompt();
+		break;
+	case CTRL_KEY('n'):
+		editorHexFindNext(1);
+		break;
+	case CTRL_KEY('g'):
+		editorHexGotoPrompt();
+		break;
+	case '\t':
+		hx->text = !hx->text;
+		break;
 	case ARROW_LEFT:
+		hx->cursor -= hx->cursor > 0;
+		break;
 	case ARROW_RIGHT:
-	{
-		editorMoveCursor(key);
-	}
-	break;
+		hx->cursor = MIN(hx->cursor + 1, last);
+		break;
+	case ARROW_UP:
+		hx->cursor -= (hx->cursor >= rowBytes) ? rowBytes : 0;
+		break;
+	case ARROW_DOWN:
+		hx->cursor += (hx->cursor + rowBytes <= last) ? rowBytes : 0;
+		break;
 	case PAGE_UP:
+		hx->cursor = (hx->cursor >= page) ? hx->cursor - page : hx->cursor % rowBytes;
+		hx->top = (hx->top >= page) ? hx->top - page : 0;
+		break;
 	case PAGE_DOWN:
-	{
-		/* handle row offset and preserve line position */
-		if (key == PAGE_UP)
-		{
-			EC.rowOffset -= EC.screenRows;
-			if (EC.rowOffset < 0)
-			{
-				EC.rowOffset = 0;
-			}
-		}
-		else if (key == PAGE_DOWN)
-		{
-			EC.rowOffset += EC.screenRows;
-			if (EC.rowOffset > EC.numRows)
-			{
-				EC.rowOffset = EC.numRows;
-			}
-		}
-
-		/* update cursor position */
-		int shifts = EC.screenRows;
-		while (shifts--)
-		{
-			editorMoveCursor(key == PAGE_UP ? ARROW_UP : ARROW_DOWN);
-		}
-	}
-	break;
-	case HOME_KEY:
-	{
-		EC.cursorX = 0;
-		EC.cursorXS = EC.cursorX;
-	}
-	break;
-	case END_KEY:
-	{
-		EC.cursorX = EC.row[EC.cursorY].size;
-		EC.cursorXS = EC.cursorX;
-	}
-	break;
-	case CTRL_KEY('d'):
-	{
-		FILE *fp = fopen("log.txt", "a+");
-		fprintf(fp, "cursorX: %d, cursorXS: %d, renderX: %d, renderX: %d\n", EC.cursorX, EC.cursorXS, EC.renderX, editorRowCursorXToRenderX(&EC.row[EC.cursorY], EC.cursorX));
-		fclose(fp);
-	}
-	break;
-	case ENTER_KEY:
-		editorInsertNewline();
+		hx->cursor = MIN(hx->cursor + page, last);
+		hx->top = MIN(hx->top + page, last - last % rowBytes);
+		break;
+	case HOME_KEY:
+		hx->cursor -= hx->cursor % rowBytes;
+		break;
+	case END_KEY:
+		hx->cursor = MIN(hx->cursor - hx->cursor % rowBytes + rowBytes - 1, last);
 		break;
 	case BACKSPACE:
-	case CTRL_KEY('h'):
 	case DEL_KEY:
-	{
-		if (key == DEL_KEY)
+		editorHexRevert(hx->cursor);
+		break;
+	case MOUSE_EVENT:
+		// the wheel moves the view, taking the cursor along as far as needed
+		if (ET.mouse.action == MOUSE_WHEEL)
 		{
-			editorMoveCursor(ARROW_RIGHT);
+			long long lines = (long long)ET.mouse.wheel * MOUSE_WHEEL_ROWS;
+			size_t delta = (lines < 0 ? -lines : lines) * rowBytes;
+			hx->top = (lines < 0) ? (hx->top >= delta ? hx->top - delta : 0) : MIN(hx->top + delta, last - last % rowBytes);
+			hx->cursor = MAX(hx->cursor, hx->top);
+			hx->cursor = MIN(hx->cursor, MIN(hx->top + page - 1, last));
 		}
-		editorDelChar();
+		break;
+	case PASTE_START:
+	{
+		size_t len;
+		free(editorReadPaste(&len));
+		editorSetStatusMessage("Pasting is not supported in hex mode");
 	}
 	break;
-	case CTRL_KEY('l'):
-	case ESC_KEY:
-		/* unimplemented */
-		break;
-	case CTRL_KEY('f'):
-		editorSearch();
-		break;
 	default:
-		editorInsertChar(key);
+		if (!hx->size || key >= 128)
+		{
+			break;
+		}
+		if (hx->text)
+		{
+			if (key >= 32 && key < 127)
+			{
+				editorHexSet(hx->cursor, key);
+				hx->cursor = MIN(hx->cursor + 1, last);
+			}
+		}
+		else if (isxdigit(key))
+		{
+			int digit = isdigit(key) ? key - '0' : tolower(key) - 'a' + 10;
+			unsigned char byte;
+			editorHexRead(hx->cursor, &byte, NULL, 1);
+			editorHexSet(hx->cursor, nibble ? (byte & 0xf0) | digit : (byte & 0x0f) | digit << 4);
+			if (nibble)
+			{
+				hx->cursor = MIN(hx->cursor + 1, last);
+			}
+			hx->nibble = !nibble;
+		}
 		break;
 	}
-	quitTimes = KILO_QUIT_TIMES;
+	return 1;
 }
 
 /*** output ***/
+int editorSyntaxToColor(int highlight)
+{
+	switch (highlight)
+	{
+	case HL_NUMBER:
+		return 36;
+	case HL_MATCH:
+		return 34;
+	case HL_STRING:
+		return 33;
+	case HL_MLCOMMENT:
+	case HL_COMMENT:
+		return 32;
+	case HL_KEYWORD_MAIN:
+		return 35;
+	case HL_KEYWORD_SUB:
+		return 31;
+	default:
+		return 37;
+	}
+}
+
+// the width of the text area, right of the diff view's gutter
+int editorTextColumns()
+{
+	return EC.screenColumns - (EC.diff.active ? DIFF_GUTTER : 0);
+}
+
 void editorScroll()
 {
 	EC.renderX = 0;
@@ -1410,21 +2215,26 @@ void editorScroll()
 		EC.renderX = editorRowCursorXToRenderX(&EC.row[EC.cursorY], EC.cursorX);
 	}
 
-	if (EC.cursorY < EC.rowOffset)
+	// the cursor row is never hidden; the view is scrolled by screen lines, a closed fold being one
+	editorFoldReveal(EC.cursorY);
+	int top = editorFoldVisible(EC.rowOffset);
+	int cursor = editorFoldVisible(EC.cursorY);
+	if (cursor < top)
 	{
-		EC.rowOffset = EC.cursorY;
+		top = cursor;
 	}
-	if (EC.cursorY >= EC.rowOffset + EC.screenRows)
+	if (cursor >= top + EC.screenRows)
 	{
-		EC.rowOffset = EC.cursorY - EC.screenRows + 1;
+		top = cursor - EC.screenRows + 1;
 	}
+	EC.rowOffset = editorFoldRowAt(top);
 	if (EC.renderX < EC.columnOffset)
 	{
 		EC.columnOffset = EC.renderX;
 	}
-	if (EC.renderX >= EC.columnOffset + EC.screenColumns)
+	if (EC.renderX >= EC.columnOffset + editorTextColumns())
 	{
-		EC.columnOffset = EC.renderX - EC.screenColumns + 1;
+		EC.columnOffset = EC.renderX - editorTextColumns() + 1;
 	}
 }
 
@@ -1448,9 +2258,43 @@ void editorDrawStatusBar(struct abuf *ab)
 	abAppend(ab, ESC_SEQ_INVERT_BG_COLOR, ESC_SEQ_INVERT_BG_COLOR_SZ);
 
 	char status[80], rstatus[80];
-	int statusLen = snprintf(status, sizeof(status), "%.20s - %d lines %s",
-							 EC.filename ? EC.filename : "[Unamed]", EC.numRows, EC.dirty ? "(modified)" : "");
-	int rstatusLen = snprintf(rstatus, sizeof(rstatus), "%s | Ln: %d/%d | Col: %d", EC.syntax ? EC.syntax->fileType : "No filetype", EC.cursorY + 1, EC.numRows, EC.renderX);
+	const char *mode = "";
+	char normal[40];
+	if (EC.selection.mode != SEL_NONE)
+	{
+		mode = (EC.selection.mode == SEL_LINE) ? " -- LINE SELECT --" : " -- SELECT --";
+	}
+	else if (EC.watch.follow)
+	{
+		mode = " -- FOLLOW --";
+	}
+	else if (ET.normal.active)
+	{
+		snprintf(normal, sizeof(normal), " -- NORMAL -- %s", ET.normal.typed);
+		mode = normal;
+	}
+	char diff[48] = "";
+	if (EC.diff.active)
+	{
+		snprintf(diff, sizeof(diff), " -- DIFF +%d -%d --", EC.diff.added, EC.diff.removed);
+	}
+	int statusLen, rstatusLen;
+	if (EC.hex.active)
+	{
+		statusLen = snprintf(status, sizeof(status), "%.20s - %llu bytes %s -- HEX --", EC.filename,
+							 (unsigned long long)EC.hex.size, EC.dirty ? "(modified)" : "");
+		rstatusLen = snprintf(rstatus, sizeof(rstatus), "%s | Offset: 0x%llx", EC.hex.text ? "text" : "hex",
+							  (unsigned long long)EC.hex.cursor);
+	}
+	else
+	{
+		statusLen = snprintf(status, sizeof(status), "%.20s - %d lines %s%s%s",
+							 EC.filename ? EC.filename : "[Unamed]", EC.numRows, EC.dirty ? "(modified)" : "", mode, diff);
+		rstatusLen = snprintf(rstatus, sizeof(rstatus), "%s | Ln: %d/%d | Col: %d", EC.syntax ? EC.syntax->fileType : "No filetype", EC.cursorY + 1, EC.numRows, EC.renderX);
+	}
+	// snprintf counts what did not fit too
+	statusLen = MIN(statusLen, (int)sizeof(status) - 1);
+	rstatusLen = MIN(rstatusLen, (int)sizeof(rstatus) - 1);
 	if (statusLen > EC.screenColumns)
 	{
 		statusLen = EC.screenColumns;
@@ -1493,99 +2337,311 @@ void editorDrawWelcomeMessage(struct abuf *ab)
 	abAppend(ab, welcomeMsg, msgLen);
 }
 
-void editorDrawRows(struct abuf *ab)
+// finds the bracket pair to underline at the cursor, while nothing is selected
+void editorBracketUpdate()
 {
-	for (int y = 0; y < EC.screenRows; y++)
+	struct EditorBracketPair *pair = &ET.brackets;
+	int x;
+	pair->active = (EC.selection.mode == SEL_NONE &&
+					editorBracketMatch(EC.cursorY, EC.cursorX, &x, &pair->matchRow, &pair->matchCol));
+	if (pair->active)
+	{
+		pair->row = EC.cursorY;
+		pair->col = editorRowCursorXToRenderX(&EC.row[pair->row], x);
+		pair->matchCol = editorRowCursorXToRenderX(&EC.row[pair->matchRow], pair->matchCol);
+	}
+}
+
+// draws buffer row rowIndex on screen row y (0-based) of the text area, without clearing the rest of the line
+void editorDrawRow(struct abuf *ab, int y, int rowIndex)
+{
+	if (EC.diff.active)
+	{
+		// gutter: + added, ~ changed, _ lines of the file removed below
+		switch (rowIndex < EC.numRows ? editorDiffMarker(rowIndex) : DIFF_NONE)
+		{
+		case DIFF_ADDED:
+			abAppend(ab, ESC_SEQ("32m+ ") ESC_SEQ_DEFAULT_FG_COLOR, 7 + ESC_SEQ_DEFAULT_FG_COLOR_SZ);
+			break;
+		case DIFF_CHANGED:
+			abAppend(ab, ESC_SEQ("33m~ ") ESC_SEQ_DEFAULT_FG_COLOR, 7 + ESC_SEQ_DEFAULT_FG_COLOR_SZ);
+			break;
+		case DIFF_REMOVED:
+			abAppend(ab, ESC_SEQ("31m_ ") ESC_SEQ_DEFAULT_FG_COLOR, 7 + ESC_SEQ_DEFAULT_FG_COLOR_SZ);
+			break;
+		default:
+			abAppend(ab, "  ", DIFF_GUTTER);
+			break;
+		}
+	}
+
+	if (rowIndex >= EC.numRows)
+	{
+		// Display welcome message or tilde on empty rows
+		if (EC.numRows == 0 && y == EC.screenRows / 3)
+		{
+			editorDrawWelcomeMessage(ab);
+		}
+		else
+		{
+			abAppend(ab, "~", 1);
+		}
+	}
+	else
 	{
-		int rowIndex = y + EC.rowOffset;
+		// Determine the number of characters to draw from the current row
+		int len = EC.row[rowIndex].rsize - EC.columnOffset;
+		if (len < 0)
+		{
+			len = 0;
+		}
+		if (len > editorTextColumns())
+		{
+			len = editorTextColumns();
+		}
 
-		if (rowIndex >= EC.numRows)
+		EditorRow *row = &EC.row[rowIndex];
+		if (row->highlightLen < 0)
+		{
+			editorUpdateSyntaxRange(rowIndex, rowIndex);
+		}
+		const char *render = editorRowRender(row);
+		const unsigned char *span = editorRowSpans(row);
+		const unsigned char *spansEnd = span + row->highlightLen;
+		int spanEnd = 0, spanHl = HL_NORMAL;
+
+		// overlays: the selection in reverse video, the search match recoloured, the bracket pair underlined
+		int brackets[2] = {-1, -1};
+		if (ET.brackets.active)
+		{
+			brackets[0] = (ET.brackets.row == rowIndex) ? ET.brackets.col : -1;
+			brackets[1] = (ET.brackets.matchRow == rowIndex) ? ET.brackets.matchCol : -1;
+		}
+		int selFrom = 0, selTo = 0;
+		editorSelectionColumns(rowIndex, &selFrom, &selTo);
+		int matchFrom = (EC.overlay.row == rowIndex) ? EC.overlay.start : 0;
+		int matchTo = (EC.overlay.row == rowIndex) ? EC.overlay.end : 0;
+
+		int currentColor = -1, selected = 0, underlined = 0;
+		// Draw the visible portion of the row, one segment per span and overlay boundary
+		for (int col = EC.columnOffset; col < EC.columnOffset + len;)
 		{
-			// Display welcome message or tilde on empty rows
-			if (EC.numRows == 0 && y == EC.screenRows / 3)
+			while (col >= spanEnd)
 			{
-				editorDrawWelcomeMessage(ab);
+				int length = INT_MAX - spanEnd;
+				spanHl = (span < spansEnd) ? spanNext(&span, &length) : HL_NORMAL;
+				spanEnd += length;
 			}
-			else
+			int hl = spanHl;
+			int segEnd = MIN(spanEnd, EC.columnOffset + len);
+			if (col < matchFrom)
 			{
-				abAppend(ab, "~", 1);
+				segEnd = MIN(segEnd, matchFrom);
 			}
-		}
-		else
-		{
-			// Determine the number of characters to draw from the current row
-			int len = EC.row[rowIndex].rsize - EC.columnOffset;
-			if (len < 0)
+			else if (col < matchTo)
 			{
-				len = 0;
+				hl = EC.overlay.hl;
+				segEnd = MIN(segEnd, matchTo);
 			}
-			if (len > EC.screenColumns)
+			int inSelection = (col >= selFrom && col < selTo);
+			segEnd = MIN(segEnd, inSelection ? selTo : (col < selFrom) ? selFrom : segEnd);
+			int onBracket = (col == brackets[0] || col == brackets[1]);
+			for (int b = 0; b < 2; b++)
 			{
-				len = EC.screenColumns;
+				segEnd = (col < brackets[b]) ? MIN(segEnd, brackets[b]) : segEnd;
 			}
+			segEnd = onBracket ? col + 1 : segEnd;
 
-			char *c = &EC.row[rowIndex].render[EC.columnOffset];
-			unsigned char *hl = &EC.row[rowIndex].highlight[EC.columnOffset];
-			int currentColor = -1;
-			// Draw the visible portion of the row
-			for (int j = 0; j < len; j++)
+			// Keep normal text in default else highlight
+			int color = (hl == HL_NORMAL) ? 39 : editorSyntaxToColor(hl);
+			if (color != currentColor)
 			{
-				// non-printable character
-				if (iscntrl(c[j]))
-				{
-					char symbol = (c[j] <= 26) ? '@' + c[j] : '?';
-					abAppend(ab, "\x1b[7m", 4);
-					abAppend(ab, &symbol, 1);
-					abAppend(ab, "\x1b[m", 3);
+				currentColor = color;
+				char buf[16];
+				int clen = snprintf(buf, sizeof(buf), ESC_SEQ("%dm"), color);
+				abAppend(ab, buf, clen);
+			}
+			if (inSelection != selected)
+			{
+				selected = inSelection;
+				abAppend(ab, selected ? "\x1b[7m" : "\x1b[27m", selected ? 4 : 5);
+			}
+			if (onBracket != underlined)
+			{
+				underlined = onBracket;
+				abAppend(ab, underlined ? "\x1b[4m" : "\x1b[24m", underlined ? 4 : 5);
+			}
 
-					// restore current color
-					if (currentColor != -1)
-					{
-						char buf[16];
-						int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", currentColor);
-						abAppend(ab, buf, clen);
-					}
+			for (int j = col; j < segEnd;)
+			{
+				int k = j;
+				while (k < segEnd && !iscntrl((unsigned char)render[k]))
+				{
+					k++;
 				}
-				// Keep normal text in default else highlight
-				else if (hl[j] == HL_NORMAL)
+				abAppend(ab, &render[j], k - j);
+				if (k == segEnd)
 				{
-					if (currentColor != HL_NORMAL)
-					{
-						abAppend(ab, ESC_SEQ_DEFAULT_FG_COLOR, ESC_SEQ_DEFAULT_FG_COLOR_SZ);
-						currentColor = HL_NORMAL;
-					}
-					abAppend(ab, &c[j], 1);
+					break;
 				}
-				else
+
+				// non-printable character
+				char symbol = (render[k] <= 26) ? '@' + render[k] : '?';
+				abAppend(ab, "\x1b[7m", 4);
+				abAppend(ab, &symbol, 1);
+				abAppend(ab, "\x1b[m", 3);
+
+				// restore current color
+				char buf[16];
+				int clen = snprintf(buf, sizeof(buf), ESC_SEQ("%dm"), currentColor);
+				abAppend(ab, buf, clen);
+				if (selected)
 				{
-					int color = editorSyntaxToColor(hl[j]);
-					if (color != currentColor)
-					{
-						currentColor = color;
-						char buf[16];
-						int clen = snprintf(buf, sizeof(buf), ESC_SEQ("%dm"), color);
-						abAppend(ab, buf, clen);
-					}
-					abAppend(ab, &c[j], 1);
+					abAppend(ab, "\x1b[7m", 4);
 				}
+				j = k + 1;
 			}
-			abAppend(ab, ESC_SEQ_DEFAULT_FG_COLOR, ESC_SEQ_DEFAULT_FG_COLOR_SZ);
+			col = segEnd;
+		}
+		if (selected)
+		{
+			abAppend(ab, "\x1b[27m", 5);
 		}
+		if (underlined)
+		{
+			abAppend(ab, "\x1b[24m", 5);
+		}
+		abAppend(ab, ESC_SEQ_DEFAULT_FG_COLOR, ESC_SEQ_DEFAULT_FG_COLOR_SZ);
 
-		// Clear the line from the cursor to the end and move to the next line
-		abAppend(ab, ESC_SEQ_ERASE_INLINE, ESC_SEQ_ERASE_INLINE_SZ);
-		abAppend(ab, NEW_LINE, NEW_LINE_SZ);
+		// a closed fold is marked after its first row, when there is room
+		int hidden = editorFoldHidden(rowIndex);
+		if (hidden)
+		{
+			char label[32];
+			int labelLen = snprintf(label, sizeof(label), " [+%d lines]", hidden);
+			if (labelLen <= editorTextColumns() - len)
+			{
+				abAppend(ab, ESC_SEQ("2m"), 4);
+				abAppend(ab, label, labelLen);
+				abAppend(ab, ESC_SEQ("22m"), 5);
+			}
+		}
+	}
+}
+
+uint64_t editorHashLine(const char *s, int len)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (int i = 0; i < len; i++)
+	{
+		hash = (hash ^ (unsigned char)s[i]) * 0x100000001b3ull;
 	}
+	// 0 marks a screen line whose content is unknown
+	return hash | 1;
 }
 
-// variadic function
-void editorSetStatusMessage(const char *fmt, ...)
+/*
+ * The previous frame is remembered as one hash per screen line. When the
+ * view moved vertically and the terminal can shift its lines into place, the
+ * text area is scrolled with a scroll region (DECSTBM) and CSI S / CSI T, and
+ * only lines whose content differs from what is on screen are sent.
+ */
+void editorDrawRows(struct abuf *ab)
 {
-	va_list ap;
-	va_start(ap, fmt);
-	vsnprintf(EC.statusMsg, sizeof(EC.statusMsg), fmt, ap);
-	va_end(ap);
-	EC.statusMsgTime = time(NULL);
+	struct EditorScreen *sc = &ET.screen;
+	if (sc->rows != EC.screenRows)
+	{
+		free(sc->lines);
+		sc->lines = calloc(EC.screenRows, sizeof(uint64_t));
+		if (!sc->lines)
+		{
+			terminate("[error]@editorDrawRows | calloc");
+		}
+		sc->rows = EC.screenRows;
+	}
+
+	struct abuf line = ABUF_INIT;
+	uint64_t *hashes = malloc(sizeof(uint64_t) * EC.screenRows);
+	if (!hashes)
+	{
+		terminate("[error]@editorDrawRows | malloc");
+	}
+	int *ends = malloc(sizeof(int) * (EC.screenRows + 1));
+	if (!ends)
+	{
+		terminate("[error]@editorDrawRows | malloc");
+	}
+	ends[0] = 0;
+	size_t rowBytes = editorHexRowBytes();
+	for (int y = 0, rowIndex = EC.rowOffset; y < EC.screenRows; y++, rowIndex = editorFoldNext(rowIndex))
+	{
+		int from = line.len;
+		if (EC.hex.active)
+		{
+			editorDrawHexRow(&line, EC.hex.top + y * rowBytes);
+		}
+		else
+		{
+			editorDrawRow(&line, y, rowIndex);
+		}
+		hashes[y] = editorHashLine(&line.b[from], line.len - from);
+		ends[y + 1] = line.len;
+	}
+
+	// scroll when more lines are already on screen after the shift than without it
+	long long top = EC.hex.active ? (long long)(EC.hex.top / rowBytes) : editorFoldVisible(EC.rowOffset);
+	int shift = (llabs(top - sc->rowOffset) < EC.screenRows) ? top - sc->rowOffset : 0;
+	if (shift)
+	{
+		int kept = 0, shifted = 0;
+		for (int y = 0; y < EC.screenRows; y++)
+		{
+			kept += hashes[y] == sc->lines[y];
+			shifted += (y + shift >= 0 && y + shift < EC.screenRows && hashes[y] == sc->lines[y + shift]);
+		}
+		if (shifted > kept)
+		{
+			char buf[32];
+			int len = snprintf(buf, sizeof(buf), ESC_SEQ("m") ESC_SEQ("1;%dr") ESC_SEQ("%d%c") ESC_SEQ("r"),
+							   EC.screenRows, abs(shift), shift > 0 ? 'S' : 'T');
+			abAppend(ab, buf, len);
+			if (shift > 0)
+			{
+				memmove(sc->lines, &sc->lines[shift], sizeof(uint64_t) * (EC.screenRows - shift));
+				memset(&sc->lines[EC.screenRows - shift], 0, sizeof(uint64_t) * shift);
+			}
+			else
+			{
+				memmove(&sc->lines[-shift], sc->lines, sizeof(uint64_t) * (EC.screenRows + shift));
+				memset(sc->lines, 0, sizeof(uint64_t) * -shift);
+			}
+		}
+	}
+	sc->rowOffset = top;
+
+	for (int y = 0; y < EC.screenRows; y++)
+	{
+		if (hashes[y] == sc->lines[y])
+		{
+			continue;
+		}
+		char buf[16];
+		int len = snprintf(buf, sizeof(buf), ESC_SEQ("%d;1H"), y + 1);
+		abAppend(ab, buf, len);
+		abAppend(ab, &line.b[ends[y]], ends[y + 1] - ends[y]);
+		// Clear the line from the cursor to the end
+		abAppend(ab, ESC_SEQ_ERASE_INLINE, ESC_SEQ_ERASE_INLINE_SZ);
+		sc->lines[y] = hashes[y];
+	}
+
+	// the status bar follows the text area
+	char buf[16];
+	int len = snprintf(buf, sizeof(buf), ESC_SEQ("%d;1H"), EC.screenRows + 1);
+	abAppend(ab, buf, len);
+
+	free(ends);
+	free(hashes);
+	abFree(&line);
 }
 
 void throwErrorLog(const char *fmt, ...)
@@ -1604,13 +2660,27 @@ void throwErrorLog(const char *fmt, ...)
 
 void editorRefresh()
 {
-	editorScroll();
+	if (EC.hex.active)
+	{
+		editorHexScroll();
+	}
+	else
+	{
+		editorDiffUpdate();
+		editorScroll();
+		editorBracketUpdate();
+	}
 
 	struct abuf ab = ABUF_INIT;
 
+	// the terminal shows the frame only once it is complete
+	if (ET.screen.syncOutput)
+	{
+		abAppend(&ab, ESC_SEQ_BEGIN_SYNC, ESC_SEQ_BEGIN_SYNC_SZ);
+	}
+
 	// hide cursor while repainting
 	abAppend(&ab, ESC_SEQ_HIDE_CURSOR, ESC_SEQ_HIDE_CURSOR_SZ);
-	abAppend(&ab, ESC_SEQ_RESET_CURSOR, ESC_SEQ_RESET_CURSOR_SZ);
 
 	// draw file rows
 	editorDrawRows(&ab);
@@ -1623,32 +2693,101 @@ void editorRefresh()
 
 	// draw cursor
 	char buf[32];
-	snprintf(buf, sizeof(buf), ESC_SEQ("%d;%dH"), EC.cursorY - EC.rowOffset + 1,
-			 EC.renderX - EC.columnOffset + 1);
+	if (EC.hex.active)
+	{
+		snprintf(buf, sizeof(buf), ESC_SEQ("%d;%dH"), (int)((EC.hex.cursor - EC.hex.top) / editorHexRowBytes()) + 1,
+				 editorHexCursorColumn() + 1);
+	}
+	else
+	{
+		snprintf(buf, sizeof(buf), ESC_SEQ("%d;%dH"), editorFoldVisible(EC.cursorY) - editorFoldVisible(EC.rowOffset) + 1,
+				 EC.renderX - EC.columnOffset + EC.screenColumns - editorTextColumns() + 1);
+	}
 	abAppend(&ab, buf, strlen(buf));
 
 	// show cursor
 	abAppend(&ab, ESC_SEQ_SHOW_CURSOR, ESC_SEQ_SHOW_CURSOR_SZ);
+	if (ET.screen.syncOutput)
+	{
+		abAppend(&ab, ESC_SEQ_END_SYNC, ESC_SEQ_END_SYNC_SZ);
+	}
 
 	// render
 	(void)!write(STDOUT_FILENO, ab.b, ab.len);
 	abFree(&ab);
+	editorFrameDone();
+}
+
+long long frameNowUs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// records a painted frame and how long the input it shows waited for it
+void editorFrameDone()
+{
+	struct EditorFrames *fr = &ET.frames;
+	long long now = frameNowUs();
+	fr->lastPaint = now;
+	fr->keys = 0;
+	fr->painted++;
+	if (fr->inputAt)
+	{
+		fr->latency = now - fr->inputAt;
+		fr->latencyTotal += fr->latency;
+		fr->latencyMax = MAX(fr->latencyMax, fr->latency);
+		fr->measured++;
+		fr->inputAt = 0;
+	}
+}
+
+// called after each key: a lone key is drawn at once, a burst is drained first and drawn
+// at most once per frame interval
+void editorFrameSchedule()
+{
+	struct EditorFrames *fr = &ET.frames;
+	fr->keys++;
+	long long deadline = fr->lastPaint + fr->interval;
+	if (editorInputPending())
+	{
+		// a long burst still shows its progress once per frame
+		if (frameNowUs() < deadline)
+		{
+			fr->skipped++;
+			return;
+		}
+	}
+	else if (fr->keys > 1)
+	{
+		// the end of a burst waits for the frame deadline, in case more keys follow
+		long long wait = deadline - frameNowUs();
+		struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+		if (wait > 0 && poll(&pfd, 1, (wait + 999) / 1000) > 0)
+		{
+			fr->skipped++;
+			return;
+		}
+	}
+	editorRefresh();
+}
+
+void editorFrameReport()
+{
+	struct EditorFrames *fr = &ET.frames;
+	long long average = fr->measured ? fr->latencyTotal / fr->measured : 0;
+	editorSetStatusMessage("Frames: %lu drawn, %lu skipped | input to paint: last %.1fms, avg %.1fms, max %.1fms",
+						   fr->painted, fr->skipped, fr->latency / 1000.0, average / 1000.0, fr->latencyMax / 1000.0);
 }
 
 /*** init ***/
 void initEditor()
 {
-	EC.cursorX = EC.cursorXS = EC.cursorY = 0;
-	EC.numRows = 0;
-	EC.rowOffset = EC.columnOffset = 0;
-	EC.renderX = 0;
-	EC.row = NULL;
-	EC.filename = NULL;
-	EC.statusMsg[0] = '\0';
-	EC.statusMsgTime = 0;
-	EC.messageLifeTime = 5;
-	EC.dirty = 0;
-	EC.syntax = NULL;
+	// the editor is one client of the core, which talks to the terminal through these
+	EC.hooks.inputPending = editorInputPending;
+	EC.hooks.clipboard = editorSetClipboard;
+	EC.hooks.fatal = editorClearScreen;
 
 	if (getWindowSize(&EC.screenRows, &EC.screenColumns) == -1)
 	{
@@ -1657,24 +2796,111 @@ void initEditor()
 
 	// reserve line for status menu
 	EC.screenRows -= 2;
+	ET.screen.syncOutput = editorQuerySyncOutput();
+
+	const char *fps = getenv("MTE_MAX_FPS");
+	int maxFps = fps ? atoi(fps) : 0;
+	if (maxFps <= 0 || maxFps > FRAME_MAX_FPS)
+	{
+		maxFps = FRAME_DEFAULT_FPS;
+	}
+	ET.frames.interval = 1000000 / maxFps;
+}
+
+// highlights the whole file repeatedly for about a second and reports lexing throughput
+void editorBenchSyntax(const char *filename)
+{
+	if (editorOpen(filename) == -1)
+	{
+		terminate("[Error]@editorBenchSyntax | open");
+	}
+	editorLoadWait();
+	if (!EC.syntax)
+	{
+		fprintf(stderr, "%s: no syntax definition matches\n", filename);
+		exit(1);
+	}
+
+	long long bytes = 0;
+	for (int i = 0; i < EC.numRows; i++)
+	{
+		bytes += EC.row[i].rsize;
+	}
+
+	struct timespec start, now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	double elapsed = 0;
+	int passes = 0;
+	do
+	{
+		for (int i = 0; i < EC.numRows; i++)
+		{
+			editorUpdateSyntax(&EC.row[i]);
+		}
+		passes++;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		elapsed = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+	} while (elapsed < 1.0);
+
+	printf("%s (%s): %d lines, %.2f MB x %d passes, %.1f MB/s\n", filename, EC.syntax->fileType,
+		   EC.numRows, bytes / 1e6, passes, bytes * passes / 1e6 / elapsed);
+	mteDestroy(editorContext);
 }
 
 int main(int argc, char *argv[])
 {
+	int bench = argc >= 3 && !strcmp(argv[1], "--bench-syntax");
+	editorContext = mteCreate(bench ? 0 : MTE_JOURNAL | MTE_WATCH);
+	if (!editorContext)
+	{
+		terminate("[Error]@main | mteCreate");
+	}
+	if (bench)
+	{
+		editorBenchSyntax(argv[2]);
+		return 0;
+	}
+
+	signal(SIGHUP, editorJournalSignalHandler);
+	signal(SIGTERM, editorJournalSignalHandler);
+
 	enableRawMode();
 	initEditor();
-	if (argc >= 2)
+	int follow = argc >= 3 && !strcmp(argv[1], "--follow");
+	int hex = argc >= 3 && !strcmp(argv[1], "--hex");
+	const char *filename = (follow || hex) ? argv[2] : (argc >= 2 ? argv[1] : NULL);
+	// binary files open in hex mode rather than being split into lines
+	if (filename && (hex || editorHexDetect(filename)))
+	{
+		if (editorHexOpen(filename) == -1)
+		{
+			terminate("[Error]@editorHexOpen | open");
+		}
+	}
+	else if (filename && editorOpen(filename) == -1)
+	{
+		terminate("[Error]@editorOpen | open");
+	}
+	if (follow)
 	{
-		editorOpen(argv[1]);
+		editorToggleFollow();
 	}
 
-	editorSetStatusMessage("KEY: Ctrl-Q = quit | Ctrl-S = save | Ctrl-F = search");
+	if (EC.hex.active)
+	{
+		editorSetStatusMessage("HEX: Tab = hex/text | Ctrl-F = find bytes | Ctrl-G = go to offset | Ctrl-S = write in place");
+	}
+	else
+	{
+		editorSetStatusMessage("KEY: Ctrl-Q = quit | Ctrl-S = save | Ctrl-F = search");
+	}
 
+	editorRefresh();
 	while (1)
 	{
-		editorRefresh();
 		editorProcessKeyEvent();
+		editorFrameSchedule();
 	}
 
 	return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,95 @@
+/*
+ * libmte: the buffer, highlight, search and file I/O core of mte, without the
+ * terminal. Every call works on an explicit context; independent contexts can
+ * be used concurrently from different threads, while a single context (and a
+ * single compiled regex) must only be used by one thread at a time.
+ *
+ * Rows and columns count from 0; columns are byte offsets into a row. Calls
+ * that fail return -1 (or NULL) and set errno where the failure came from the
+ * system, including running out of memory while opening, saving or compiling
+ * a pattern. Running out in the middle of an edit still ends the process, as
+ * the buffer would be left half changed.
+ */
+#ifndef MTE_H
+#define MTE_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+	typedef struct EditorContext MteContext;
+	typedef struct Regex MteRegex;
+
+	// mteCreate flags
+	enum MteFlags
+	{
+		// keep a crash recovery journal next to the open file
+		MTE_JOURNAL = 1 << 0,
+		// follow changes made to the file on disk, see mteTick
+		MTE_WATCH = 1 << 1,
+	};
+
+	// highlight classes reported by mteHighlight
+	enum MteHighlight
+	{
+		MTE_HL_NORMAL = 0,
+		MTE_HL_NUMBER,
+		MTE_HL_MATCH,
+		MTE_HL_STRING,
+		MTE_HL_COMMENT,
+		MTE_HL_MLCOMMENT,
+		MTE_HL_KEYWORD_MAIN,
+		MTE_HL_KEYWORD_SUB,
+	};
+
+	// an empty buffer with the syntax definitions loaded; NULL when out of memory
+	MteContext *mteCreate(int flags);
+	// waits for a running save and frees the context
+	void mteDestroy(MteContext *ctx);
+
+	// reads a file into an empty context and picks its syntax by name
+	int mteOpen(MteContext *ctx, const char *filename);
+	// writes the buffer to filename, or to the file it came from when NULL
+	int mteSave(MteContext *ctx, const char *filename);
+	// picks up changes on disk (MTE_WATCH); returns 1 when the buffer changed
+	int mteTick(MteContext *ctx);
+	// the last status message, e.g. the result of a save
+	const char *mteMessage(MteContext *ctx);
+	// whether the buffer has changes that were not saved
+	int mteDirty(MteContext *ctx);
+
+	int mteNumRows(MteContext *ctx);
+	// the text of a row without its line break, valid until the next edit
+	const char *mteRow(MteContext *ctx, int row, int *len);
+	// text may contain '\n'; endRow and endCol (may be NULL) receive where it ends
+	int mteInsert(MteContext *ctx, int row, int col, const char *text, size_t len, int *endRow, int *endCol);
+	int mteDelete(MteContext *ctx, int startRow, int startCol, int endRow, int endCol);
+	// the text of a range joined with '\n'; to be freed by the caller
+	char *mteCopy(MteContext *ctx, int startRow, int startCol, int endRow, int endCol, size_t *len);
+
+	// fills one MteHighlight class per byte of the row
+	int mteHighlight(MteContext *ctx, int row, unsigned char *classes);
+
+	// fills candidates with up to max (at most 16) words completing the one before (row, col),
+	// best first, and returns their number; the caller frees them. Words of the numOthers
+	// other contexts are offered too, which no other thread may use meanwhile
+	int mteCompletions(MteContext *ctx, int row, int col, MteContext **others, int numOthers, char **candidates, int max);
+
+	// NULL with errno EINVAL when the pattern is invalid, or ENOMEM when out of memory
+	MteRegex *mteRegexCompile(const char *pattern);
+	void mteRegexFree(MteRegex *re);
+	// finds a match in text at or after from; returns 1 and its bounds, or 0. Searching
+	// allocates nothing it can't do without: short of memory it only gets slower
+	int mteRegexSearch(MteRegex *re, const char *text, int len, int from, int *start, int *end);
+	// finds the next match in the buffer from (*row, *col) on, without wrapping;
+	// returns 1 and moves *row and *col to it, or 0
+	int mteFind(MteContext *ctx, MteRegex *re, int *row, int *col, int *len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
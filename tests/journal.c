@@ -0,0 +1,162 @@
+// crash recovery: a child editor is killed mid-batch and the journal is replayed on the next open
+#include "../core.h"
+
+#include <sys/wait.h>
+
+int failures = 0;
+
+#define CHECK(cond)                                                   \
+	do                                                                \
+	{                                                                 \
+		if (!(cond))                                                  \
+		{                                                             \
+			fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			failures++;                                               \
+		}                                                             \
+	} while (0)
+
+char dir[] = "/tmp/mte-journal-XXXXXX";
+char path[PATH_MAX];
+
+void writeFile(const char *text)
+{
+	FILE *fp = fopen(path, "w");
+	fputs(text, fp);
+	fclose(fp);
+}
+
+void appendFile(const char *text)
+{
+	FILE *fp = fopen(path, "a");
+	fputs(text, fp);
+	fclose(fp);
+}
+
+// opens the file in a fresh context that keeps a journal, recovering any left behind
+MteContext *openFile()
+{
+	MteContext *ctx = mteCreate(MTE_JOURNAL | MTE_WATCH);
+	if (!ctx || mteOpen(ctx, path) == -1)
+	{
+		perror("mteOpen");
+		exit(1);
+	}
+	return ctx;
+}
+
+int sameRows(MteContext *ctx, const char **expected)
+{
+	int n = 0;
+	for (; expected[n]; n++)
+	{
+		int len;
+		const char *row = mteRow(ctx, n, &len);
+		if (!row || len != (int)strlen(expected[n]) || memcmp(row, expected[n], len) != 0)
+		{
+			return 0;
+		}
+	}
+	return mteNumRows(ctx) == n;
+}
+
+// runs edit in a child editor that dies by sig; returns its exit status
+int crash(void (*edit)(MteContext *ctx), int sig)
+{
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		MteContext *ctx = openFile();
+		// the handler flushes the journal of the context the signalled thread works on
+		editorContext = ctx;
+		signal(SIGTERM, editorJournalSignalHandler);
+		edit(ctx);
+		raise(sig);
+		_exit(0);
+	}
+	int status;
+	waitpid(pid, &status, 0);
+	return status;
+}
+
+// edits well within one group-commit window: nothing has been flushed yet
+void editUnflushed(MteContext *ctx)
+{
+	mteInsert(ctx, 0, 0, "hello ", 6, NULL, NULL);
+	mteInsert(ctx, 1, 3, "\nthree", 6, NULL, NULL);
+}
+
+// a first batch made durable by the group commit, then a second one still pending
+void editFlushedThenPending(MteContext *ctx)
+{
+	mteInsert(ctx, 0, 0, "a", 1, NULL, NULL);
+	usleep((JOURNAL_FLUSH_MS + 100) * 1000);
+	mteInsert(ctx, 0, 1, "b", 1, NULL, NULL);
+	mteInsert(ctx, 0, 2, "c", 1, NULL, NULL);
+}
+
+// the file grows on disk under a modified buffer, and the appended rows are edited too
+void editAppended(MteContext *ctx)
+{
+	mteInsert(ctx, 0, 0, "x", 1, NULL, NULL);
+	appendFile("\ntwo\nthr");
+	for (int i = 0; i < 200 && !mteTick(ctx); i++)
+	{
+		usleep(10 * 1000);
+	}
+	mteInsert(ctx, 2, 3, "ee", 2, NULL, NULL);
+}
+
+int main()
+{
+	if (!mkdtemp(dir))
+	{
+		perror("mkdtemp");
+		return 1;
+	}
+	snprintf(path, sizeof(path), "%s/file.txt", dir);
+
+	// SIGTERM before the first flush: the handler writes the pending records
+	writeFile("one\ntwo\n");
+	int status = crash(editUnflushed, SIGTERM);
+	CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 128 + SIGTERM);
+	MteContext *ctx = openFile();
+	CHECK(sameRows(ctx, (const char *[]){"hello one", "two", "three", NULL}));
+	CHECK(mteDirty(ctx));
+	mteDestroy(ctx);
+
+	// SIGKILL runs no handler: the flushed batch survives, the pending one is lost
+	writeFile("one\n");
+	status = crash(editFlushedThenPending, SIGKILL);
+	CHECK(WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL);
+	ctx = openFile();
+	CHECK(sameRows(ctx, (const char *[]){"abone", NULL}));
+	mteDestroy(ctx);
+
+	// the journal follows the appended file instead of being set aside as stale
+	writeFile("one");
+	status = crash(editAppended, SIGTERM);
+	CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 128 + SIGTERM);
+	ctx = openFile();
+	CHECK(sameRows(ctx, (const char *[]){"xone", "two", "three", NULL}));
+	mteDestroy(ctx);
+	writeFile("one\n");
+
+	// a clean exit removes the journal, so the next open starts from the file
+	ctx = openFile();
+	CHECK(sameRows(ctx, (const char *[]){"one", NULL}));
+	CHECK(!mteDirty(ctx));
+	mteDestroy(ctx);
+
+	char stale[PATH_MAX];
+	snprintf(stale, sizeof(stale), "%s/.file.txt.mte-journal.stale", dir);
+	CHECK(access(stale, F_OK) == -1);
+	unlink(stale);
+	unlink(path);
+	rmdir(dir);
+	if (failures)
+	{
+		return 1;
+	}
+	printf("journal: ok\n");
+	return 0;
+}
@@ -0,0 +1,112 @@
+// independent contexts driven from two threads at once: open, insert, save and find
+#define _DEFAULT_SOURCE
+#include "../mte.h"
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define ROUNDS 20
+#define LINES 2000
+
+struct Worker
+{
+	char path[PATH_MAX];
+	const char *word;
+	const char *error;
+};
+
+char dir[] = "/tmp/mte-threads-XXXXXX";
+
+// one context per round: its own file, edits, save and search
+void *work(void *arg)
+{
+	struct Worker *w = arg;
+	MteRegex *re = mteRegexCompile(w->word);
+	for (int round = 0; round < ROUNDS && !w->error; round++)
+	{
+		FILE *fp = fopen(w->path, "w");
+		fprintf(fp, "int main()\n{\n}\n");
+		fclose(fp);
+
+		MteContext *ctx = mteCreate(0);
+		if (!ctx || mteOpen(ctx, w->path) == -1)
+		{
+			w->error = "open";
+			break;
+		}
+		// every line names this worker, every tenth twice
+		char line[64];
+		for (int i = 0; i < LINES; i++)
+		{
+			int len = snprintf(line, sizeof(line), "\t// %s %d%s%s\n", w->word, i, i % 10 ? "" : " ", i % 10 ? "" : w->word);
+			if (mteInsert(ctx, 2, 0, line, len, NULL, NULL) == -1)
+			{
+				w->error = "insert";
+			}
+		}
+		if (mteNumRows(ctx) != LINES + 3 || !mteDirty(ctx) || mteSave(ctx, NULL) == -1 || mteDirty(ctx))
+		{
+			w->error = "save";
+		}
+		mteDestroy(ctx);
+
+		// the saved file reads back with every match where it was put
+		ctx = mteCreate(0);
+		if (!ctx || mteOpen(ctx, w->path) == -1)
+		{
+			w->error = "reopen";
+			break;
+		}
+		int matches = 0, row = 0, col = 0, len;
+		while (mteFind(ctx, re, &row, &col, &len))
+		{
+			matches++;
+			col += len;
+		}
+		if (matches != LINES + LINES / 10 || mteNumRows(ctx) != LINES + 3)
+		{
+			w->error = "find";
+		}
+		mteDestroy(ctx);
+	}
+	mteRegexFree(re);
+	unlink(w->path);
+	return NULL;
+}
+
+int main()
+{
+	if (!mkdtemp(dir))
+	{
+		perror("mkdtemp");
+		return 1;
+	}
+	struct Worker workers[2] = {{.word = "alpha"}, {.word = "omega"}};
+	pthread_t threads[2];
+	for (int i = 0; i < 2; i++)
+	{
+		snprintf(workers[i].path, sizeof(workers[i].path), "%s/%s.c", dir, workers[i].word);
+		pthread_create(&threads[i], NULL, work, &workers[i]);
+	}
+	int failed = 0;
+	for (int i = 0; i < 2; i++)
+	{
+		pthread_join(threads[i], NULL);
+		if (workers[i].error)
+		{
+			fprintf(stderr, "threads: %s: %s failed\n", workers[i].word, workers[i].error);
+			failed = 1;
+		}
+	}
+	rmdir(dir);
+	if (failed)
+	{
+		return 1;
+	}
+	printf("threads: ok\n");
+	return 0;
+}